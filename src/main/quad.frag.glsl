@@ -30,10 +30,17 @@
 
 precision highp float;
 
+// See RuLayerPushConsts.
+layout(push_constant) uniform Layer {
+    vec4 rect;
+    vec4 crop;
+    float opacity;
+} layer;
+
 layout(binding=0) uniform sampler2D tex;
 layout(location=0) in vec2 tex_coord;
 layout(location=0) out vec4 color;
 
 void main() {
-    color = texture(tex, tex_coord);
+    color = vec4(texture(tex, tex_coord).rgb, layer.opacity);
 }
@@ -28,15 +28,25 @@
 // OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+// See RuLayerPushConsts.
+layout(push_constant) uniform Layer {
+    vec4 rect; // x0, y0, x1, y1 in normalized device coordinates
+    vec4 crop; // u0, v0, u1, v1 in texture coordinates
+    float opacity;
+} layer;
+
 layout(location=0) out vec2 tex_coord;
 
 void main() {
+    vec2 corner;
+
     switch (gl_VertexIndex) {
-        case 0: gl_Position = vec4(-1, -1,  0,  1); break;
-        case 1: gl_Position = vec4(-1,  1,  0,  1); break;
-        case 2: gl_Position = vec4( 1, -1,  0,  1); break;
-        case 3: gl_Position = vec4( 1,  1,  0,  1); break;
+        case 0: corner = vec2(0, 0); break;
+        case 1: corner = vec2(0, 1); break;
+        case 2: corner = vec2(1, 0); break;
+        case 3: corner = vec2(1, 1); break;
     }
 
-    tex_coord = 0.5 * (vec2(gl_Position) + vec2(1, 1));
+    gl_Position = vec4(mix(layer.rect.xy, layer.rect.zw, corner), 0, 1);
+    tex_coord = mix(layer.crop.xy, layer.crop.zw, corner);
 }
@@ -27,14 +27,21 @@
 
 // stdlib
 #include <assert.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// Linux
+#include <pthread.h>
 
 // Android
 #include <android/log.h>
 #include <android_native_app_glue.h>
 #include <jni.h>
+#include <media/NdkImageReader.h>
 
 // local
 #include "util/alloc.h"
@@ -42,19 +49,43 @@
 #include "util/check.h"
 #include "util/log.h"
 #include "util/macros.h"
+#include "util/ru_latency.h"
+#include "util/ru_logring.h"
 #include "util/ru_ndk.h"
+#include "util/ru_pool.h"
+#include "util/ru_reactor.h"
+#include "util/ru_thread.h"
+#include "util/ru_time.h"
 
 #include "ru_app.h"
 #include "ru_media.h"
 #include "ru_rend.h"
 
+#define RU_APP_MAX_MEDIA_STREAMS 16
+
+// Each media stream needs a render layer.
+static_assert_q(RU_APP_MAX_MEDIA_STREAMS <= RU_REND_MAX_LAYERS);
+
 typedef struct RuApp {
     struct android_app *android;
     RuMedia *media;
+    RuLatency *latency; // shared by media and rend
+    RuReactor *reactor; // null unless eventLoop=reactor
+    RuPool *import_pool; // null unless renderImport=background
+
+    // The media thread reaches the renderer through
+    // on_media_aimage_reader_replaced() and on_media_frame_rate_changed(), so
+    // rend_mutex guards its teardown.
     RuRend *rend;
+    pthread_mutex_t rend_mutex;
 } RuApp;
 
 static void on_app_cmd(struct android_app *android, int32_t cmd);
+static void on_latency_frame(void *_app, const RuLatencyFrame *frame);
+static void on_media_aimage_reader_replaced(void *_app, uint32_t stream,
+                                            AImageReader *reader,
+                                            AImageReader *old_reader);
+static void on_media_frame_rate_changed(void *_app, uint32_t stream, float hz);
 
 static char *
 get_arg(struct android_app *android, const char *name) {
@@ -65,10 +96,80 @@ get_arg(struct android_app *android, const char *name) {
 
 RuApp *
 ru_app_new(struct android_app *android) {
-    _cleanup_free_ char *media_src = get_arg(android, "mediaSrc");
-    if (!media_src)
+    // Parse logLevel first, so that it filters the other args' logs.
+    _cleanup_free_ char *log_level_s =
+        ru_activity_get_string_extra(android->activity, "logLevel");
+
+    if (log_level_s) {
+        RuLogLevel log_level;
+        if (!ru_log_parse_level(log_level_s, &log_level))
+            die("bad value for logLevel: %s", log_level_s);
+
+        ru_log_set_level(log_level);
+    }
+
+    logd("arg: logLevel=\"%s\"", log_level_s);
+
+    // mediaSrc is stream 0. Extras mediaSrc1, mediaSrc2, ... add more streams.
+    uint32_t media_stream_count = 0;
+    char *media_srcs[RU_APP_MAX_MEDIA_STREAMS];
+
+    for (; media_stream_count < RU_APP_MAX_MEDIA_STREAMS; ++media_stream_count) {
+        char name[32];
+        if (media_stream_count == 0)
+            snprintf(name, sizeof(name), "mediaSrc");
+        else
+            snprintf(name, sizeof(name), "mediaSrc%u", media_stream_count);
+
+        media_srcs[media_stream_count] = get_arg(android, name);
+        if (!media_srcs[media_stream_count])
+            break;
+    }
+
+    if (media_stream_count == 0)
         die("cmdline missing `-e mediaSrc <path>`");
 
+    bool media_loop = false;
+    _cleanup_free_ char *media_loop_s = get_arg(android, "mediaLoop");
+
+    if (!media_loop_s) {
+        // default
+    } else if (!strcmp(media_loop_s, "false")) {
+        media_loop = false;
+    } else if (!strcmp(media_loop_s, "true")) {
+        media_loop = true;
+    } else {
+        die("bad value for mediaLoop: %s", media_loop_s);
+    }
+
+    RuMediaDecoderProfile decoder_profile = RU_MEDIA_DECODER_PROFILE_DEFAULT;
+    _cleanup_free_ char *decoder_profile_s = get_arg(android, "mediaDecoderProfile");
+
+    if (!decoder_profile_s) {
+        // default
+    } else if (!strcmp(decoder_profile_s, "default")) {
+        decoder_profile = RU_MEDIA_DECODER_PROFILE_DEFAULT;
+    } else if (!strcmp(decoder_profile_s, "lowLatency")) {
+        decoder_profile = RU_MEDIA_DECODER_PROFILE_LOW_LATENCY;
+    } else {
+        die("bad value for mediaDecoderProfile: %s", decoder_profile_s);
+    }
+
+    _cleanup_free_ char *media_codec = get_arg(android, "mediaCodec");
+
+    bool media_codec_benchmark = false;
+    _cleanup_free_ char *media_codec_benchmark_s = get_arg(android, "mediaCodecBenchmark");
+
+    if (!media_codec_benchmark_s) {
+        // default
+    } else if (!strcmp(media_codec_benchmark_s, "false")) {
+        media_codec_benchmark = false;
+    } else if (!strcmp(media_codec_benchmark_s, "true")) {
+        media_codec_benchmark = true;
+    } else {
+        die("bad value for mediaCodecBenchmark: %s", media_codec_benchmark_s);
+    }
+
     RuRendUseExternalFormat use_ext_format = RU_REND_USE_EXTERNAL_FORMAT_AUTO;
     _cleanup_free_ char *use_ext_format_s = get_arg(android, "useVkExternalFormat");
 
@@ -97,14 +198,127 @@ ru_app_new(struct android_app *android) {
         die("bad value for useVkValidation: %s", use_validation_s);
     }
 
+    bool vsync_schedule = true;
+    _cleanup_free_ char *vsync_schedule_s = get_arg(android, "vsyncSchedule");
+
+    if (!vsync_schedule_s) {
+        // default
+    } else if (!strcmp(vsync_schedule_s, "false")) {
+        vsync_schedule = false;
+    } else if (!strcmp(vsync_schedule_s, "true")) {
+        vsync_schedule = true;
+    } else {
+        die("bad value for vsyncSchedule: %s", vsync_schedule_s);
+    }
+
+    bool render_submit_thread = false;
+    _cleanup_free_ char *render_submit_thread_s = get_arg(android, "renderSubmitThread");
+
+    if (!render_submit_thread_s) {
+        // default
+    } else if (!strcmp(render_submit_thread_s, "false")) {
+        render_submit_thread = false;
+    } else if (!strcmp(render_submit_thread_s, "true")) {
+        render_submit_thread = true;
+    } else {
+        die("bad value for renderSubmitThread: %s", render_submit_thread_s);
+    }
+
+    bool use_reactor = false;
+    _cleanup_free_ char *event_loop_s = get_arg(android, "eventLoop");
+
+    if (!event_loop_s) {
+        // default
+    } else if (!strcmp(event_loop_s, "threads")) {
+        use_reactor = false;
+    } else if (!strcmp(event_loop_s, "reactor")) {
+        use_reactor = true;
+    } else {
+        die("bad value for eventLoop: %s", event_loop_s);
+    }
+
+    bool render_import_background = false;
+    _cleanup_free_ char *render_import_s = get_arg(android, "renderImport");
+
+    if (!render_import_s) {
+        // default
+    } else if (!strcmp(render_import_s, "inline")) {
+        render_import_background = false;
+    } else if (!strcmp(render_import_s, "background")) {
+        render_import_background = true;
+    } else {
+        die("bad value for renderImport: %s", render_import_s);
+    }
+
+    _cleanup_free_ char *thread_policy_s = get_arg(android, "threadPolicy");
+
+    if (thread_policy_s && !ru_thread_set_policies(thread_policy_s))
+        die("bad value for threadPolicy: %s", thread_policy_s);
+
     let app = new0(RuApp);
     app->android = android;
+
+    if (pthread_mutex_init(&app->rend_mutex, NULL))
+        abort();
+
     app->android->userData = app;
     app->android->onAppCmd = on_app_cmd;
-    app->media = ru_media_new(media_src);
+
+    app->latency = ru_latency_new(
+        .listener = {
+            .context = app,
+            .on_frame = on_latency_frame,
+        });
+
+    if (use_reactor)
+        app->reactor = ru_reactor_new("ru-reactor", RU_THREAD_CLASS_RENDER);
+
+    if (render_import_background) {
+        app->import_pool = ru_pool_new(
+            .worker_count = 2,
+            .thread_name = "ru-import",
+            .thread_class = RU_THREAD_CLASS_RENDER);
+    }
+
+    struct ru_media_stream_args media_streams[RU_APP_MAX_MEDIA_STREAMS];
+    for (uint32_t i = 0; i < media_stream_count; ++i) {
+        if (!ru_media_parse_playlist(media_srcs[i], media_loop,
+                                     &media_streams[i])) {
+            die("bad value for mediaSrc: playlist is empty");
+        }
+    }
+
+    app->media = ru_media_new(
+        .streams = media_streams,
+        .stream_count = media_stream_count,
+        .decoder_profile = decoder_profile,
+        .codec_selector = {
+            .java_vm = android->activity->vm,
+            .codec_name = media_codec,
+            .benchmark = media_codec_benchmark,
+            .cache_dir = android->activity->internalDataPath,
+        },
+        .listener = {
+            .context = app,
+            .on_aimage_reader_replaced = on_media_aimage_reader_replaced,
+            .on_frame_rate_changed = on_media_frame_rate_changed,
+        },
+        .latency = app->latency,
+        .reactor = app->reactor);
+
+    for (uint32_t i = 0; i < media_stream_count; ++i) {
+        free((void *) media_streams[i].src_paths);
+        free(media_srcs[i]);
+    }
+
     app->rend = ru_rend_new(
         .use_validation = use_validation,
-        .use_external_format = use_ext_format);
+        .use_external_format = use_ext_format,
+        .use_vsync_schedule = vsync_schedule,
+        .latency = app->latency,
+        .use_submit_thread = render_submit_thread,
+        .reactor = app->reactor,
+        .import_pool = app->import_pool);
 
     return app;
 }
@@ -113,8 +327,22 @@ void
 ru_app_free(RuApp *app) {
     if (!app)
         return;
-    ru_rend_free(app->rend);
+
+    {
+        ru_mutex_lock_scoped(&app->rend_mutex);
+        ru_rend_free(app->rend);
+        app->rend = NULL;
+    }
+
+    ru_pool_free(app->import_pool);
+
     ru_media_free(app->media);
+    ru_reactor_free(app->reactor);
+    ru_latency_free(app->latency);
+
+    if (pthread_mutex_destroy(&app->rend_mutex))
+        abort();
+
     free(app);
 }
 
@@ -176,6 +404,141 @@ app_cmd_to_str(int32_t cmd) {
     #undef CASE
 }
 
+// Runs on the media thread.
+static void
+on_media_aimage_reader_replaced(void *_app, uint32_t stream,
+                                AImageReader *reader,
+                                AImageReader *old_reader) {
+    RuApp *app = _app;
+
+    ru_mutex_lock_scoped(&app->rend_mutex);
+
+    if (!app->rend) {
+        // The renderer is gone and holds no AImages.
+        AImageReader_delete(old_reader);
+        return;
+    }
+
+    // Each stream is the layer of the same index. See ru_app_start_rend().
+    ru_rend_replace_aimage_reader(app->rend, stream, reader, old_reader);
+}
+
+static void
+on_media_frame_rate_changed(void *_app, uint32_t stream, float hz) {
+    RuApp *app = _app;
+
+    ru_mutex_lock_scoped(&app->rend_mutex);
+
+    if (app->rend)
+        ru_rend_set_frame_rate(app->rend, stream, hz);
+}
+
+// Tile the media streams in a near-square grid, filling rows top to bottom.
+static void
+ru_app_start_rend(RuApp *app) {
+    uint32_t n = ru_media_get_stream_count(app->media);
+    assert(n > 0);
+    assert(n <= RU_REND_MAX_LAYERS);
+
+    uint32_t cols = 1;
+    while (cols * cols < n)
+        ++cols;
+
+    uint32_t rows = (n + cols - 1) / cols;
+
+    RuRendLayer layers[RU_REND_MAX_LAYERS];
+
+    for (uint32_t i = 0; i < n; ++i) {
+        layers[i] = (RuRendLayer) {
+            .aimage_reader = ru_media_get_aimage_reader(app->media, i),
+            .rect = {
+                .x = (float) (i % cols) / cols,
+                .y = (float) (i / cols) / rows,
+                .width = 1.0f / cols,
+                .height = 1.0f / rows,
+            },
+            .z = i,
+            .opacity = 1.0f,
+        };
+    }
+
+    ru_rend_start(app->rend, layers, n);
+}
+
+static void
+ru_app_log_rend_stats(RuApp *app) {
+    RuRendStats stats;
+    ru_rend_get_stats(app->rend, &stats);
+
+    logi("render phases, in ms: count min mean p50 p90 p99 p99.9 max");
+
+    for (uint32_t i = 0; i < RU_REND_PHASE_COUNT; ++i) {
+        const RuRendPhaseStats *ps = &stats.phases[i];
+
+        logi("  %-10s %8"PRIu64" %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f",
+             ru_rend_phase_to_str(i), ps->count,
+             ru_time_ns_to_ms(ps->min_ns),
+             ru_time_ns_to_ms(ps->mean_ns),
+             ru_time_ns_to_ms(ps->p50_ns),
+             ru_time_ns_to_ms(ps->p90_ns),
+             ru_time_ns_to_ms(ps->p99_ns),
+             ru_time_ns_to_ms(ps->p999_ns),
+             ru_time_ns_to_ms(ps->max_ns));
+    }
+
+    logi("render idle_count=%"PRIu64" missed_vsync_count=%"PRIu64
+         " deferred_aimage_count=%"PRIu64,
+         stats.idle_count, stats.missed_vsync_count,
+         stats.deferred_aimage_count);
+    logi("render ahb_import_count=%"PRIu64" startup_hitch=%.3fms",
+         stats.ahb_import_count, ru_time_ns_to_ms(stats.startup_hitch_ns));
+}
+
+// Runs on the render thread, once per decoded frame.
+static void
+on_latency_frame(void *_app, const RuLatencyFrame *frame) {
+    const int64_t *t = frame->stamps_ns;
+
+    // Zero stamps make nonsense intervals, but only for frames that
+    // RuLatency evicted or that began before it.
+    logv_deferred("latency: stream %u pts=%"PRIi64"us: decode=%"PRIi64"us "
+                  "release=%"PRIi64"us available=%"PRIi64"us acquire=%"PRIi64"us "
+                  "submit=%"PRIi64"us present=%"PRIi64"us",
+                  frame->stream, frame->pts_us,
+                  (t[RU_LATENCY_STAGE_DECODE] - t[RU_LATENCY_STAGE_QUEUE]) / RU_NSEC_PER_USEC,
+                  (t[RU_LATENCY_STAGE_RELEASE] - t[RU_LATENCY_STAGE_DECODE]) / RU_NSEC_PER_USEC,
+                  (t[RU_LATENCY_STAGE_AVAILABLE] - t[RU_LATENCY_STAGE_RELEASE]) / RU_NSEC_PER_USEC,
+                  (t[RU_LATENCY_STAGE_ACQUIRE] - t[RU_LATENCY_STAGE_AVAILABLE]) / RU_NSEC_PER_USEC,
+                  (t[RU_LATENCY_STAGE_SUBMIT] - t[RU_LATENCY_STAGE_ACQUIRE]) / RU_NSEC_PER_USEC,
+                  (t[RU_LATENCY_STAGE_PRESENT] - t[RU_LATENCY_STAGE_SUBMIT]) / RU_NSEC_PER_USEC);
+}
+
+static void
+ru_app_log_latency_stats(RuApp *app) {
+    RuLatencyStats stats;
+    ru_latency_get_stats(app->latency, &stats);
+
+    logi("frame latency of the last %.0f-%.0fs, in ms: count p50 p90 p99 max",
+         (double) RU_LATENCY_DEFAULT_WINDOW_NS / RU_NSEC_PER_SEC,
+         (double) 2 * RU_LATENCY_DEFAULT_WINDOW_NS / RU_NSEC_PER_SEC);
+
+    for (uint32_t i = 1; i <= RU_LATENCY_STAGE_COUNT; ++i) {
+        const RuLatencyPercentiles *p = i < RU_LATENCY_STAGE_COUNT
+            ? &stats.stages[i]
+            : &stats.total;
+
+        logi("  %-10s %8"PRIu64" %7.3f %7.3f %7.3f %7.3f",
+             i < RU_LATENCY_STAGE_COUNT ? ru_latency_stage_to_str(i) : "total",
+             p->count,
+             ru_time_ns_to_ms(p->p50_ns),
+             ru_time_ns_to_ms(p->p90_ns),
+             ru_time_ns_to_ms(p->p99_ns),
+             ru_time_ns_to_ms(p->max_ns));
+    }
+
+    logi("  dropped    %8"PRIu64, stats.dropped_count);
+}
+
 static void
 on_app_cmd(struct android_app *android, int32_t cmd) {
     RuApp *app = android->userData;
@@ -185,7 +548,7 @@ on_app_cmd(struct android_app *android, int32_t cmd) {
     // See <https://developer.android.com/guide/components/activities/activity-lifecycle.html>
     switch (cmd) {
         case APP_CMD_START:
-            ru_rend_start(app->rend, ru_media_get_aimage_reader(app->media));
+            ru_app_start_rend(app);
             ru_media_start(app->media);
             break;
         case APP_CMD_INIT_WINDOW:
@@ -200,10 +563,15 @@ on_app_cmd(struct android_app *android, int32_t cmd) {
         case APP_CMD_LOST_FOCUS:
             ru_rend_pause(app->rend);
             break;
+        case APP_CMD_SAVE_STATE:
+            // The activity is going to the background. Dump the render
+            // phase timings and the frame latency to logcat.
+            ru_app_log_rend_stats(app);
+            ru_app_log_latency_stats(app);
+            break;
         case APP_CMD_STOP:
         case APP_CMD_RESUME:
         case APP_CMD_PAUSE:
-        case APP_CMD_SAVE_STATE:
         case APP_CMD_INPUT_CHANGED:
         case APP_CMD_WINDOW_RESIZED:
         case APP_CMD_WINDOW_REDRAW_NEEDED:
@@ -0,0 +1,766 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ru-bench decodes and renders for a fixed time, then prints a JSON report to
+// stdout. It drives the same RuMedia and RuRend as the app, but renders
+// headless and needs no window.
+//
+//     usage: ru-bench [-d SECONDS] [-w SECONDS] [-s WIDTHxHEIGHT]
+//                     [-c CODEC] [-l] [-V] [-L LEVEL] [-t TRACE]
+//                     [-v HZ] [-p] [-R] [-I] [-P POLICY] [-F FRAMES]
+//                     PLAYLIST [PLAYLIST...]
+//
+//     -d  Measure for this long. Default is 10.
+//     -w  Warm up for this long before measuring. Default is 1.
+//     -s  Size of the render target. Default is 1920x1080.
+//     -c  Decode with the named codec.
+//     -l  Use the low-latency decoder profile.
+//     -V  Enable the Vulkan validation layers.
+//     -L  Log at this level and above, such as "info". Default is "warn",
+//         because logging perturbs the timings.
+//     -t  On the host, write a Chrome trace-event JSON file of the
+//         measurement. On Android, record with Perfetto instead.
+//     -v  Pace frames to a timer of this rate, in Hz, standing in for the
+//         display's vsync, and latch each frame's images just in time.
+//     -p  Submit on a second thread while the render thread records the
+//         next frame. See ru_rend_new_args::use_submit_thread.
+//     -R  Run the media and render loops on one reactor thread instead of a
+//         thread each. See RuReactor.
+//     -I  Import new AHBs, and create their pipelines, on a pool of two
+//         workers instead of on the render thread. See
+//         ru_rend_new_args::import_pool.
+//     -P  Place and prioritize the threads by this spec, such as
+//         "render=big:-8,media=little:-4,io=little:0", or "none" to leave them
+//         as created. See ru_thread_set_policies().
+//     -F  Write the latency breakdown of each frame presented during the
+//         measurement to this CSV file.
+//
+// Each PLAYLIST is a colon-separated list of files, like the app's mediaSrc,
+// and becomes one layer. Playlists loop so that they outlast the run.
+//
+// The report contains the following. Its percentiles come from RuHist, so
+// each is within 1/32 of the true value.
+//
+//     fps                 Frames completed per second.
+//     frame_interval_ms   Time between the submits of consecutive frames.
+//     latency_ms          Time from the decoder's onImageAvailable to the
+//                         completion of the first frame that draws the image.
+//     dropped_aimages     Decoded images that no frame drew.
+//     idle_frames         Times the renderer had no new image and slept
+//                         instead of redrawing. See RuRendStats.
+//     missed_vsyncs       Frames that likely finished after the vsync they
+//                         aimed for. Only counted with -v.
+//     ahb_imports         AHBs imported since the renderer started,
+//                         including the warm-up.
+//     deferred_aimages    With -I, images that a frame could not draw yet
+//                         because their AHB was still importing.
+//     startup_hitch_ms    The longest import phase of any frame since the
+//                         renderer started, including the warm-up. Most
+//                         imports happen as each stream starts.
+//     phases_ms           Percentiles of each phase of the render loop. See
+//                         RuRendPhase.
+//     pipeline_ms         Percentiles of the time between each pair of a
+//                         frame's stages, from queueInputBuffer to present.
+//                         See RuLatencyStage.
+//     context_switches    Voluntary and involuntary context switches of the
+//                         process during the measurement.
+//     reactor             With -R, the reactor's dispatches, the wakes
+//                         requested of it, and the wakes that reached its
+//                         eventfds. The rest coalesced.
+//     threads             CPU time of each thread during the measurement,
+//                         and its nice value and last CPU at the end.
+
+// stdlib
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Linux
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Android
+#include <android/native_window.h>
+#include <media/NdkImageReader.h>
+
+// local
+#include "util/alloc.h"
+#include "util/check.h"
+#include "util/log.h"
+#include "util/macros.h"
+#include "util/ru_hist.h"
+#include "util/ru_latency.h"
+#include "util/ru_math.h"
+#include "util/ru_pool.h"
+#include "util/ru_reactor.h"
+#include "util/ru_thread.h"
+#include "util/ru_time.h"
+#include "util/ru_trace.h"
+
+#include "ru_media.h"
+#include "ru_rend.h"
+
+#define RU_BENCH_MAX_STREAMS 16
+#define RU_BENCH_MAX_THREADS 256
+
+// Each media stream needs a render layer.
+static_assert_q(RU_BENCH_MAX_STREAMS <= RU_REND_MAX_LAYERS);
+
+// CPU time of one thread, from /proc/self/task/<tid>/stat.
+typedef struct RuBenchThreadTime {
+    pid_t tid;
+    char name[16];
+    uint64_t ticks;
+    long nice;
+    int cpu; // where the thread last ran
+} RuBenchThreadTime;
+
+typedef struct RuBench {
+    RuMedia *media;
+    RuLatency *latency;
+    RuReactor *reactor; // null unless -R
+    RuPool *import_pool; // null unless -I
+
+    // The media thread reaches the renderer through
+    // on_media_aimage_reader_replaced() and on_media_frame_rate_changed(), so
+    // rend_mutex guards its teardown.
+    RuRend *rend;
+    pthread_mutex_t rend_mutex;
+
+    // Protects the members below. The render thread records each frame
+    // that completes within [start_ns, end_ns).
+    pthread_mutex_t mutex;
+    int64_t start_ns; // 0 while warming up
+    int64_t end_ns; // INT64_MAX while measuring
+    int64_t prev_submit_ns;
+    uint64_t frame_count;
+    uint64_t new_aimage_count;
+    uint64_t dropped_aimage_count;
+    RuHist frame_intervals;
+    RuHist latencies;
+    FILE *frames_file; // may be null
+} RuBench;
+
+static void
+ru_bench_print_percentiles(FILE *f, const char *name, const RuHist *h) {
+    fprintf(f, "  \"%s\": {\"count\": %" PRIu64 ", \"p50\": %.3f, "
+            "\"p99\": %.3f, \"p99.9\": %.3f, \"max\": %.3f},\n",
+            name, h->count,
+            ru_time_ns_to_ms(ru_hist_percentile(h, 50.0)),
+            ru_time_ns_to_ms(ru_hist_percentile(h, 99.0)),
+            ru_time_ns_to_ms(ru_hist_percentile(h, 99.9)),
+            ru_time_ns_to_ms(h->max));
+}
+
+// Returns the number of threads found.
+static uint32_t
+ru_bench_get_thread_times(RuBenchThreadTime *times, uint32_t max) {
+    DIR *dir = opendir("/proc/self/task");
+    if (!dir)
+        die("opendir(\"/proc/self/task\") failed");
+
+    uint32_t n = 0;
+    struct dirent *ent;
+
+    while (n < max && (ent = readdir(dir))) {
+        if (ent->d_name[0] == '.')
+            continue;
+
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/task/%s/stat", ent->d_name);
+
+        FILE *f = fopen(path, "r");
+        if (!f) {
+            // The thread exited.
+            continue;
+        }
+
+        char buf[512];
+        size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+        fclose(f);
+        buf[len] = '\0';
+
+        // The name may contain spaces and parentheses, so find the last ')'.
+        char *name_begin = strchr(buf, '(');
+        char *name_end = strrchr(buf, ')');
+        if (!name_begin || !name_end || name_end < name_begin)
+            continue;
+
+        unsigned long utime, stime;
+        long nice;
+        int cpu;
+        if (sscanf(name_end + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u"
+                   " %lu %lu %*d %*d %*d %ld"
+                   " %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s"
+                   " %*s %*s %*s %*s %*s %*s %*s %*s %*s %d",
+                   &utime, &stime, &nice, &cpu) != 4) {
+            continue;
+        }
+
+        RuBenchThreadTime *t = &times[n++];
+        t->tid = atoi(ent->d_name);
+        t->ticks = (uint64_t) utime + stime;
+        t->nice = nice;
+        t->cpu = cpu;
+
+        size_t name_len = ru_min((size_t) (name_end - name_begin - 1),
+                                 sizeof(t->name) - 1);
+        memcpy(t->name, name_begin + 1, name_len);
+        t->name[name_len] = '\0';
+
+        // Keep the JSON valid.
+        for (char *c = t->name; *c; ++c) {
+            if (*c == '"' || *c == '\\' || (unsigned char) *c < 0x20)
+                *c = '_';
+        }
+    }
+
+    closedir(dir);
+    return n;
+}
+
+static int64_t
+ru_bench_get_process_cpu_ns(void) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru))
+        die("getrusage failed");
+
+    return ((int64_t) ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * RU_NSEC_PER_SEC +
+           ((int64_t) ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * RU_NSEC_PER_USEC;
+}
+
+static void
+ru_bench_get_context_switches(uint64_t *voluntary, uint64_t *involuntary) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru))
+        die("getrusage failed");
+
+    *voluntary = ru.ru_nvcsw;
+    *involuntary = ru.ru_nivcsw;
+}
+
+static void
+ru_bench_sleep_s(double s) {
+    struct timespec ts = {
+        .tv_sec = (time_t) s,
+        .tv_nsec = (long) ((s - (time_t) s) * RU_NSEC_PER_SEC),
+    };
+
+    while (nanosleep(&ts, &ts)) {
+        // interrupted; sleep the remainder
+    }
+}
+
+// Runs on the render thread.
+static void
+on_rend_frame_complete(void *_bench, const RuRendFrameInfo *info) {
+    RuBench *bench = _bench;
+
+    ru_mutex_lock_scoped(&bench->mutex);
+
+    if (bench->start_ns == 0 ||
+        info->complete_ns < bench->start_ns ||
+        info->complete_ns >= bench->end_ns) {
+        return;
+    }
+
+    ++bench->frame_count;
+    bench->new_aimage_count += info->new_aimage_count;
+    bench->dropped_aimage_count += info->dropped_aimage_count;
+
+    // Frames complete in the order of submission.
+    if (bench->prev_submit_ns != 0) {
+        ru_hist_record(&bench->frame_intervals,
+                       info->submit_ns - bench->prev_submit_ns);
+    }
+
+    bench->prev_submit_ns = info->submit_ns;
+
+    if (info->new_aimage_count > 0) {
+        ru_hist_record(&bench->latencies,
+                       info->complete_ns - info->aimage_available_ns);
+    }
+}
+
+// Runs on the render thread.
+static void
+on_latency_frame(void *_bench, const RuLatencyFrame *frame) {
+    RuBench *bench = _bench;
+    const int64_t *t = frame->stamps_ns;
+
+    ru_mutex_lock_scoped(&bench->mutex);
+
+    if (!bench->frames_file ||
+        bench->start_ns == 0 ||
+        t[RU_LATENCY_STAGE_PRESENT] < bench->start_ns ||
+        t[RU_LATENCY_STAGE_PRESENT] >= bench->end_ns) {
+        return;
+    }
+
+    // Stamps relative to the frame's queueInputBuffer. Empty if unstamped.
+    fprintf(bench->frames_file, "%u,%" PRIi64, frame->stream, frame->pts_us);
+
+    for (uint32_t i = 1; i < RU_LATENCY_STAGE_COUNT; ++i) {
+        if (t[RU_LATENCY_STAGE_QUEUE] && t[i]) {
+            fprintf(bench->frames_file, ",%.3f",
+                    ru_time_ns_to_ms(t[i] - t[RU_LATENCY_STAGE_QUEUE]));
+        } else {
+            fprintf(bench->frames_file, ",");
+        }
+    }
+
+    fprintf(bench->frames_file, "\n");
+}
+
+// Runs on the media thread.
+static void
+on_media_aimage_reader_replaced(void *_bench, uint32_t stream,
+                                AImageReader *reader,
+                                AImageReader *old_reader) {
+    RuBench *bench = _bench;
+
+    ru_mutex_lock_scoped(&bench->rend_mutex);
+
+    if (!bench->rend) {
+        // The renderer is gone and holds no AImages.
+        AImageReader_delete(old_reader);
+        return;
+    }
+
+    // Each stream is the layer of the same index. See ru_bench_start_rend().
+    ru_rend_replace_aimage_reader(bench->rend, stream, reader, old_reader);
+}
+
+// Runs on the media thread.
+static void
+on_media_frame_rate_changed(void *_bench, uint32_t stream, float hz) {
+    RuBench *bench = _bench;
+
+    ru_mutex_lock_scoped(&bench->rend_mutex);
+
+    if (bench->rend)
+        ru_rend_set_frame_rate(bench->rend, stream, hz);
+}
+
+// Tile the media streams in a near-square grid, as the app does.
+static void
+ru_bench_start_rend(RuBench *bench) {
+    uint32_t n = ru_media_get_stream_count(bench->media);
+    assert(n > 0);
+    assert(n <= RU_REND_MAX_LAYERS);
+
+    uint32_t cols = 1;
+    while (cols * cols < n)
+        ++cols;
+
+    uint32_t rows = (n + cols - 1) / cols;
+
+    RuRendLayer layers[RU_REND_MAX_LAYERS];
+
+    for (uint32_t i = 0; i < n; ++i) {
+        layers[i] = (RuRendLayer) {
+            .aimage_reader = ru_media_get_aimage_reader(bench->media, i),
+            .rect = {
+                .x = (float) (i % cols) / cols,
+                .y = (float) (i / cols) / rows,
+                .width = 1.0f / cols,
+                .height = 1.0f / rows,
+            },
+            .z = i,
+            .opacity = 1.0f,
+        };
+    }
+
+    ru_rend_start(bench->rend, layers, n);
+}
+
+static noreturn void
+usage(void) {
+    fprintf(stderr,
+            "usage: ru-bench [-d SECONDS] [-w SECONDS] [-s WIDTHxHEIGHT]\n"
+            "                [-c CODEC] [-l] [-V] [-L LEVEL] [-t TRACE]\n"
+            "                [-v HZ] [-p] [-R] [-I] [-P POLICY] [-F FRAMES]\n"
+            "                PLAYLIST [PLAYLIST...]\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv) {
+    double duration_s = 10.0;
+    double warmup_s = 1.0;
+    uint32_t width = 1920;
+    uint32_t height = 1080;
+    const char *codec_name = NULL;
+    RuMediaDecoderProfile decoder_profile = RU_MEDIA_DECODER_PROFILE_DEFAULT;
+    bool use_validation = false;
+    RuLogLevel log_level = RU_LOG_LEVEL_WARN;
+    const char *trace_path = NULL;
+    const char *frames_path = NULL;
+    double vsync_hz = 0.0;
+    bool use_submit_thread = false;
+    bool use_reactor = false;
+    bool use_import_pool = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:w:s:c:lVL:t:v:pRIP:F:")) != -1) {
+        switch (opt) {
+            case 'd':
+                duration_s = atof(optarg);
+                if (duration_s <= 0.0)
+                    usage();
+                break;
+            case 'w':
+                warmup_s = atof(optarg);
+                if (warmup_s < 0.0)
+                    usage();
+                break;
+            case 's':
+                if (sscanf(optarg, "%ux%u", &width, &height) != 2 ||
+                    width == 0 || height == 0) {
+                    usage();
+                }
+                break;
+            case 'c':
+                codec_name = optarg;
+                break;
+            case 'l':
+                decoder_profile = RU_MEDIA_DECODER_PROFILE_LOW_LATENCY;
+                break;
+            case 'V':
+                use_validation = true;
+                break;
+            case 'L':
+                if (!ru_log_parse_level(optarg, &log_level))
+                    usage();
+                break;
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'v':
+                vsync_hz = atof(optarg);
+                if (vsync_hz <= 0.0)
+                    usage();
+                break;
+            case 'p':
+                use_submit_thread = true;
+                break;
+            case 'R':
+                use_reactor = true;
+                break;
+            case 'I':
+                use_import_pool = true;
+                break;
+            case 'P':
+                if (!ru_thread_set_policies(optarg))
+                    usage();
+                break;
+            case 'F':
+                frames_path = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+
+    ru_log_set_level(log_level);
+
+    uint32_t stream_count = argc - optind;
+    if (stream_count == 0 || stream_count > RU_BENCH_MAX_STREAMS)
+        usage();
+
+    struct ru_media_stream_args streams[RU_BENCH_MAX_STREAMS];
+    for (uint32_t i = 0; i < stream_count; ++i) {
+        if (!ru_media_parse_playlist(argv[optind + i], /*loop*/ true,
+                                     &streams[i])) {
+            die("bad playlist: playlist is empty");
+        }
+    }
+
+    let bench = new0(RuBench);
+    bench->end_ns = INT64_MAX;
+    ru_hist_reset(&bench->frame_intervals);
+    ru_hist_reset(&bench->latencies);
+
+    if (pthread_mutex_init(&bench->rend_mutex, NULL))
+        abort();
+
+    if (pthread_mutex_init(&bench->mutex, NULL))
+        abort();
+
+    if (frames_path) {
+        bench->frames_file = fopen(frames_path, "w");
+        if (!bench->frames_file)
+            die("failed to open %s", frames_path);
+
+        fprintf(bench->frames_file, "stream,pts_us");
+        for (uint32_t i = 1; i < RU_LATENCY_STAGE_COUNT; ++i)
+            fprintf(bench->frames_file, ",%s_ms", ru_latency_stage_to_str(i));
+        fprintf(bench->frames_file, "\n");
+    }
+
+    // One window spans the whole measurement, so the stats do not roll.
+    bench->latency = ru_latency_new(
+        .window_ns = (int64_t) ((duration_s + 1.0) * RU_NSEC_PER_SEC),
+        .listener = {
+            .context = bench,
+            .on_frame = on_latency_frame,
+        });
+
+    if (use_reactor)
+        bench->reactor = ru_reactor_new("ru-reactor", RU_THREAD_CLASS_RENDER);
+
+    if (use_import_pool) {
+        bench->import_pool = ru_pool_new(
+            .worker_count = 2,
+            .thread_name = "ru-import",
+            .thread_class = RU_THREAD_CLASS_RENDER);
+    }
+
+    bench->media = ru_media_new(
+        .streams = streams,
+        .stream_count = stream_count,
+        .decoder_profile = decoder_profile,
+        .codec_selector = {
+            .codec_name = codec_name,
+        },
+        .listener = {
+            .context = bench,
+            .on_aimage_reader_replaced = on_media_aimage_reader_replaced,
+            .on_frame_rate_changed = on_media_frame_rate_changed,
+        },
+        .latency = bench->latency,
+        .reactor = bench->reactor);
+
+    for (uint32_t i = 0; i < stream_count; ++i) {
+        free((void *) streams[i].src_paths);
+    }
+
+    bench->rend = ru_rend_new(
+        .use_validation = use_validation,
+        .headless = true,
+        .headless_width = width,
+        .headless_height = height,
+        .use_vsync_schedule = vsync_hz > 0.0,
+        .headless_vsync_period_ns = vsync_hz > 0.0
+            ? (int64_t) (RU_NSEC_PER_SEC / vsync_hz)
+            : 0,
+        .listener = {
+            .context = bench,
+            .on_frame_complete = on_rend_frame_complete,
+        },
+        .latency = bench->latency,
+        .use_submit_thread = use_submit_thread,
+        .reactor = bench->reactor,
+        .import_pool = bench->import_pool);
+
+    ru_bench_start_rend(bench);
+    ru_media_start(bench->media);
+    ru_rend_unpause(bench->rend);
+
+    ru_bench_sleep_s(warmup_s);
+
+    RuBenchThreadTime threads0[RU_BENCH_MAX_THREADS];
+    uint32_t thread_count0 = ru_bench_get_thread_times(threads0,
+                                                       RU_BENCH_MAX_THREADS);
+    int64_t process_cpu0_ns = ru_bench_get_process_cpu_ns();
+
+    uint64_t voluntary_switches0, involuntary_switches0;
+    ru_bench_get_context_switches(&voluntary_switches0, &involuntary_switches0);
+
+    RuReactorStats reactor_stats0 = { 0 };
+    if (bench->reactor)
+        ru_reactor_get_stats(bench->reactor, &reactor_stats0);
+
+    if (trace_path && !ru_trace_start_file(trace_path))
+        die("failed to start trace %s", trace_path);
+
+    ru_rend_reset_stats(bench->rend);
+    ru_latency_reset_stats(bench->latency);
+
+    int64_t start_ns = ru_time_now_ns();
+    {
+        ru_mutex_lock_scoped(&bench->mutex);
+        bench->start_ns = start_ns;
+    }
+
+    ru_bench_sleep_s(duration_s);
+
+    int64_t end_ns = ru_time_now_ns();
+    {
+        ru_mutex_lock_scoped(&bench->mutex);
+        bench->end_ns = end_ns;
+    }
+
+    ru_trace_stop_file();
+
+    RuBenchThreadTime threads1[RU_BENCH_MAX_THREADS];
+    uint32_t thread_count1 = ru_bench_get_thread_times(threads1,
+                                                       RU_BENCH_MAX_THREADS);
+    int64_t process_cpu1_ns = ru_bench_get_process_cpu_ns();
+
+    uint64_t voluntary_switches1, involuntary_switches1;
+    ru_bench_get_context_switches(&voluntary_switches1, &involuntary_switches1);
+
+    RuReactorStats reactor_stats1 = { 0 };
+    if (bench->reactor)
+        ru_reactor_get_stats(bench->reactor, &reactor_stats1);
+
+    RuRendStats rend_stats;
+    ru_rend_get_stats(bench->rend, &rend_stats);
+
+    RuLatencyStats latency_stats;
+    ru_latency_get_stats(bench->latency, &latency_stats);
+
+    {
+        ru_mutex_lock_scoped(&bench->rend_mutex);
+        ru_rend_free(bench->rend);
+        bench->rend = NULL;
+    }
+
+    ru_pool_free(bench->import_pool);
+    ru_media_free(bench->media);
+    ru_reactor_free(bench->reactor);
+    ru_latency_free(bench->latency);
+
+    if (bench->frames_file)
+        fclose(bench->frames_file);
+
+    // The render thread is gone, so bench->mutex is no longer needed.
+    const double measured_s = (double) (end_ns - start_ns) / RU_NSEC_PER_SEC;
+    const double ns_per_tick = (double) RU_NSEC_PER_SEC / sysconf(_SC_CLK_TCK);
+    FILE *f = stdout;
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"duration_s\": %.3f,\n", measured_s);
+    fprintf(f, "  \"width\": %u,\n", width);
+    fprintf(f, "  \"height\": %u,\n", height);
+    fprintf(f, "  \"layers\": %u,\n", stream_count);
+    fprintf(f, "  \"frames\": %" PRIu64 ",\n", bench->frame_count);
+    fprintf(f, "  \"fps\": %.3f,\n", bench->frame_count / measured_s);
+    ru_bench_print_percentiles(f, "frame_interval_ms", &bench->frame_intervals);
+    ru_bench_print_percentiles(f, "latency_ms", &bench->latencies);
+    fprintf(f, "  \"new_aimages\": %" PRIu64 ",\n", bench->new_aimage_count);
+    fprintf(f, "  \"dropped_aimages\": %" PRIu64 ",\n", bench->dropped_aimage_count);
+    fprintf(f, "  \"idle_frames\": %" PRIu64 ",\n", rend_stats.idle_count);
+    fprintf(f, "  \"missed_vsyncs\": %" PRIu64 ",\n", rend_stats.missed_vsync_count);
+    fprintf(f, "  \"ahb_imports\": %" PRIu64 ",\n", rend_stats.ahb_import_count);
+    fprintf(f, "  \"deferred_aimages\": %" PRIu64 ",\n", rend_stats.deferred_aimage_count);
+    fprintf(f, "  \"startup_hitch_ms\": %.3f,\n",
+            ru_time_ns_to_ms(rend_stats.startup_hitch_ns));
+    fprintf(f, "  \"phases_ms\": {");
+
+    for (uint32_t i = 0; i < RU_REND_PHASE_COUNT; ++i) {
+        const RuRendPhaseStats *ps = &rend_stats.phases[i];
+
+        fprintf(f, "%s\n    \"%s\": {\"count\": %" PRIu64 ", \"mean\": %.3f, "
+                "\"p50\": %.3f, \"p99\": %.3f, \"p99.9\": %.3f, \"max\": %.3f}",
+                i == 0 ? "" : ",", ru_rend_phase_to_str(i), ps->count,
+                ru_time_ns_to_ms(ps->mean_ns),
+                ru_time_ns_to_ms(ps->p50_ns),
+                ru_time_ns_to_ms(ps->p99_ns),
+                ru_time_ns_to_ms(ps->p999_ns),
+                ru_time_ns_to_ms(ps->max_ns));
+    }
+
+    fprintf(f, "\n  },\n");
+    fprintf(f, "  \"pipeline_ms\": {");
+
+    for (uint32_t i = 1; i <= RU_LATENCY_STAGE_COUNT; ++i) {
+        const RuLatencyPercentiles *p = i < RU_LATENCY_STAGE_COUNT
+            ? &latency_stats.stages[i]
+            : &latency_stats.total;
+
+        fprintf(f, "%s\n    \"%s\": {\"count\": %" PRIu64 ", \"p50\": %.3f, "
+                "\"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}",
+                i == 1 ? "" : ",",
+                i < RU_LATENCY_STAGE_COUNT ? ru_latency_stage_to_str(i) : "total",
+                p->count,
+                ru_time_ns_to_ms(p->p50_ns),
+                ru_time_ns_to_ms(p->p90_ns),
+                ru_time_ns_to_ms(p->p99_ns),
+                ru_time_ns_to_ms(p->max_ns));
+    }
+
+    fprintf(f, ",\n    \"dropped\": %" PRIu64 "\n  },\n", latency_stats.dropped_count);
+    fprintf(f, "  \"process_cpu_ms\": %.3f,\n",
+            ru_time_ns_to_ms(process_cpu1_ns - process_cpu0_ns));
+    fprintf(f, "  \"context_switches\": {\"voluntary\": %" PRIu64 ", "
+            "\"involuntary\": %" PRIu64 "},\n",
+            voluntary_switches1 - voluntary_switches0,
+            involuntary_switches1 - involuntary_switches0);
+
+    if (use_reactor) {
+        fprintf(f, "  \"reactor\": {\"dispatches\": %" PRIu64 ", "
+                "\"wakes\": %" PRIu64 ", \"wake_writes\": %" PRIu64 "},\n",
+                reactor_stats1.dispatch_count - reactor_stats0.dispatch_count,
+                reactor_stats1.wake_count - reactor_stats0.wake_count,
+                reactor_stats1.wake_write_count - reactor_stats0.wake_write_count);
+    }
+
+    fprintf(f, "  \"threads\": [");
+
+    // Report the threads that lived through the whole measurement.
+    bool first = true;
+    for (uint32_t i = 0; i < thread_count1; ++i) {
+        const RuBenchThreadTime *t1 = &threads1[i];
+
+        for (uint32_t j = 0; j < thread_count0; ++j) {
+            const RuBenchThreadTime *t0 = &threads0[j];
+            if (t0->tid != t1->tid)
+                continue;
+
+            fprintf(f, "%s\n    {\"tid\": %d, \"name\": \"%s\", \"cpu_ms\": %.3f, "
+                    "\"nice\": %ld, \"cpu\": %d}",
+                    first ? "" : ",", (int) t1->tid, t1->name,
+                    (t1->ticks - t0->ticks) * ns_per_tick / RU_NSEC_PER_MSEC,
+                    t1->nice, t1->cpu);
+            first = false;
+            break;
+        }
+    }
+
+    fprintf(f, "\n  ]\n");
+    fprintf(f, "}\n");
+
+    if (pthread_mutex_destroy(&bench->mutex))
+        abort();
+
+    if (pthread_mutex_destroy(&bench->rend_mutex))
+        abort();
+
+    free(bench);
+
+    return 0;
+}
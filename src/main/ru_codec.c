@@ -0,0 +1,564 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// stdlib
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Linux
+#include <errno.h>
+#include <pthread.h>
+
+// Workaround a bug in NdkMediaCodec.h, which contains invalid C.
+typedef struct AMediaCodecOnAsyncNotifyCallback AMediaCodecOnAsyncNotifyCallback;
+
+// Android
+#include <media/NdkImage.h>
+#include <media/NdkImageReader.h>
+#include <media/NdkMediaCodec.h>
+#include <media/NdkMediaError.h>
+#include <media/NdkMediaExtractor.h>
+#include <media/NdkMediaFormat.h>
+
+// local
+#include "util/alloc.h"
+#include "util/check.h"
+#include "util/log.h"
+#include "util/macros.h"
+#include "util/ru_ndk.h"
+#include "util/ru_thread.h"
+#include "util/ru_time.h"
+
+#include "ru_codec.h"
+
+// The benchmark decodes at most this many frames of each clip...
+#define RU_CODEC_BENCH_FRAME_COUNT 60
+
+// ... and gives up after this long.
+#define RU_CODEC_BENCH_TIMEOUT_NS (3 * RU_NSEC_PER_SEC)
+
+#define RU_CODEC_BENCH_IMAGE_COUNT 4
+
+// If the format has no frame rate, then a decoder must sustain this.
+#define RU_CODEC_DEFAULT_FRAME_RATE 30
+
+#define RU_CODEC_CACHE_FILENAME "ru-codec-bench.txt"
+
+// The decoder chosen for each (mime, size). A null name means that
+// AMediaCodec_createDecoderByType chooses.
+typedef struct RuCodecChoice {
+    char *mime;
+    int32_t width;
+    int32_t height;
+    char *name;
+} RuCodecChoice;
+
+typedef struct RuCodecBenchResult {
+    char *mime;
+    int32_t width;
+    int32_t height;
+    char *name;
+    double fps;
+} RuCodecBenchResult;
+
+struct RuCodecSelector {
+    JavaVM *java_vm;
+    char *codec_name;
+    bool benchmark;
+    char *cache_path;
+
+    // Protects all below. Decoders are created on the app thread and on the
+    // media prep thread. Benchmarks run without the lock, so that neither
+    // thread waits for the other's benchmark. If both benchmark the same
+    // decoder at once, the first result published wins.
+    pthread_mutex_t mutex;
+
+    RuCodecChoice *choices;
+    size_t choice_count;
+
+    // Loaded lazily from cache_path.
+    bool is_bench_loaded;
+    RuCodecBenchResult *bench_results;
+    size_t bench_result_count;
+};
+
+RuCodecSelector *
+ru_codec_selector_new_s(struct ru_codec_selector_new_args args) {
+    let sel = new0(RuCodecSelector);
+
+    sel->java_vm = args.java_vm;
+    sel->benchmark = args.benchmark;
+
+    if (args.codec_name)
+        sel->codec_name = xstrdup(args.codec_name);
+
+    if (args.cache_dir) {
+        if (asprintf(&sel->cache_path, "%s/%s", args.cache_dir,
+                     RU_CODEC_CACHE_FILENAME) < 0) {
+            oom();
+        }
+    }
+
+    if (sel->benchmark && !sel->java_vm)
+        die("codec: benchmark requires a JavaVM");
+
+    if (pthread_mutex_init(&sel->mutex, NULL))
+        abort();
+
+    return sel;
+}
+
+void
+ru_codec_selector_free(RuCodecSelector *sel) {
+    if (!sel)
+        return;
+
+    for (size_t i = 0; i < sel->choice_count; ++i) {
+        free(sel->choices[i].mime);
+        free(sel->choices[i].name);
+    }
+
+    for (size_t i = 0; i < sel->bench_result_count; ++i) {
+        free(sel->bench_results[i].mime);
+        free(sel->bench_results[i].name);
+    }
+
+    if (pthread_mutex_destroy(&sel->mutex))
+        abort();
+
+    free(sel->choices);
+    free(sel->bench_results);
+    free(sel->cache_path);
+    free(sel->codec_name);
+    free(sel);
+}
+
+static void
+ru_codec_selector_add_bench_result(RuCodecSelector *sel, const char *mime,
+                                   int32_t width, int32_t height,
+                                   const char *name, double fps) {
+    sel->bench_results = xreallocn(sel->bench_results,
+            sel->bench_result_count + 1, sizeof(sel->bench_results[0]));
+    sel->bench_results[sel->bench_result_count++] = (RuCodecBenchResult) {
+        .mime = xstrdup(mime),
+        .width = width,
+        .height = height,
+        .name = xstrdup(name),
+        .fps = fps,
+    };
+}
+
+// Each line of the cache is "<mime> <width> <height> <codec name> <fps>".
+static void
+ru_codec_selector_load_bench_cache(RuCodecSelector *sel) {
+    if (sel->is_bench_loaded)
+        return;
+
+    sel->is_bench_loaded = true;
+
+    if (!sel->cache_path)
+        return;
+
+    FILE *f = fopen(sel->cache_path, "r");
+    if (!f) {
+        if (errno != ENOENT)
+            loge("codec: failed to open %s: %s", sel->cache_path, strerror(errno));
+        return;
+    }
+
+    char mime[128];
+    char name[256];
+    int32_t width, height;
+    double fps;
+
+    while (fscanf(f, "%127s %d %d %255s %lf", mime, &width, &height, name, &fps) == 5) {
+        ru_codec_selector_add_bench_result(sel, mime, width, height, name, fps);
+    }
+
+    fclose(f);
+
+    logd("codec: loaded %zu benchmark results from %s",
+         sel->bench_result_count, sel->cache_path);
+}
+
+static void
+ru_codec_selector_save_bench_result(RuCodecSelector *sel,
+                                    const RuCodecBenchResult *r) {
+    if (!sel->cache_path)
+        return;
+
+    FILE *f = fopen(sel->cache_path, "a");
+    if (!f) {
+        loge("codec: failed to open %s: %s", sel->cache_path, strerror(errno));
+        return;
+    }
+
+    fprintf(f, "%s %d %d %s %.2f\n", r->mime, r->width, r->height, r->name, r->fps);
+    fclose(f);
+}
+
+// Decode the start of the track as fast as the decoder allows. Returns frames
+// per second, or 0 if the decoder fails.
+static double
+ru_codec_benchmark(const char *name, AMediaFormat *format, AMediaExtractor *ex,
+                   int32_t width, int32_t height) {
+    AImageReader *reader = NULL;
+    AMediaCodec *codec = NULL;
+    ANativeWindow *window;
+    double fps = 0.0;
+    int ret;
+
+    codec = AMediaCodec_createCodecByName(name);
+    if (!codec) {
+        loge("codec: AMediaCodec_createCodecByName(%s) failed", name);
+        goto out;
+    }
+
+    // Decode into a surface, as the app does, so that hardware decoders skip
+    // the copy to a ByteBuffer.
+    ret = AImageReader_newWithUsage(width, height,
+        AIMAGE_FORMAT_YUV_420_888,
+        AHARDWAREBUFFER_USAGE_CPU_READ_NEVER |
+        AHARDWAREBUFFER_USAGE_CPU_WRITE_NEVER |
+        AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE,
+        RU_CODEC_BENCH_IMAGE_COUNT,
+        &reader);
+    if (ret)
+        die("codec: AImageReader_newWithUsage failed: error=%d", ret);
+
+    ret = AImageReader_getWindow(reader, &window);
+    if (ret)
+        die("codec: AImageReader_getWindow failed: error=%d", ret);
+
+    ret = AMediaCodec_configure(codec, format, window, /*crypto*/ NULL, /*flags*/ 0);
+    if (ret) {
+        loge("codec: %s: AMediaCodec_configure failed: error=%d", name, ret);
+        goto out;
+    }
+
+    ret = AMediaCodec_start(codec);
+    if (ret) {
+        loge("codec: %s: AMediaCodec_start failed: error=%d", name, ret);
+        goto out;
+    }
+
+    uint32_t frame_count = 0;
+    bool input_eos = false;
+    bool output_eos = false;
+    int64_t start_ns = ru_time_now_ns();
+    int64_t now_ns = start_ns;
+
+    while (!output_eos && frame_count < RU_CODEC_BENCH_FRAME_COUNT &&
+           now_ns - start_ns < RU_CODEC_BENCH_TIMEOUT_NS) {
+        if (!input_eos) {
+            ssize_t index = AMediaCodec_dequeueInputBuffer(codec, /*timeoutUs*/ 0);
+            if (index >= 0) {
+                size_t buf_size;
+                uint8_t *buf = AMediaCodec_getInputBuffer(codec, index, &buf_size);
+                if (!buf)
+                    die("codec: AMediaCodec_getInputBuffer(index=%zd) failed", index);
+
+                ssize_t sample_size = AMediaExtractor_readSampleData(ex, buf, buf_size);
+                int64_t sample_time = AMediaExtractor_getSampleTime(ex);
+                input_eos = sample_size < 0 || !AMediaExtractor_advance(ex);
+
+                AMediaCodec_queueInputBuffer(codec, index, /*offset*/ 0,
+                        sample_size < 0 ? 0 : sample_size, sample_time,
+                        input_eos ? AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM : 0);
+            }
+        }
+
+        AMediaCodecBufferInfo info;
+        ssize_t index = AMediaCodec_dequeueOutputBuffer(codec, &info,
+                /*timeoutUs*/ 1000);
+        if (index >= 0) {
+            if (info.size > 0)
+                ++frame_count;
+            output_eos = info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM;
+            AMediaCodec_releaseOutputBuffer(codec, index, /*render*/ false);
+        }
+
+        now_ns = ru_time_now_ns();
+    }
+
+    AMediaCodec_stop(codec);
+
+    if (frame_count > 0)
+        fps = frame_count / ((double) (now_ns - start_ns) / RU_NSEC_PER_SEC);
+
+    logi("codec: benchmark %s: %dx%d: %u frames, %.1f fps",
+         name, width, height, frame_count, fps);
+
+ out:
+    if (codec)
+        AMediaCodec_delete(codec);
+    if (reader)
+        AImageReader_delete(reader);
+
+    ret = AMediaExtractor_seekTo(ex, 0, AMEDIAEXTRACTOR_SEEK_CLOSEST_SYNC);
+    if (ret)
+        die("codec: AMediaExtractor_seekTo failed: error=%d", ret);
+
+    return fps;
+}
+
+// Call with the mutex held.
+static const RuCodecBenchResult *
+ru_codec_selector_find_bench_result(RuCodecSelector *sel, const char *name,
+                                    const char *mime, int32_t width,
+                                    int32_t height) {
+    ru_codec_selector_load_bench_cache(sel);
+
+    for (size_t i = 0; i < sel->bench_result_count; ++i) {
+        const RuCodecBenchResult *r = &sel->bench_results[i];
+
+        if (!strcmp(r->mime, mime) && r->width == width &&
+            r->height == height && !strcmp(r->name, name)) {
+            return r;
+        }
+    }
+
+    return NULL;
+}
+
+// Call without the mutex held. The benchmark may take seconds.
+static double
+ru_codec_selector_get_fps(RuCodecSelector *sel, const char *name,
+                          const char *mime, AMediaFormat *format,
+                          AMediaExtractor *ex, int32_t width, int32_t height) {
+    {
+        ru_mutex_lock_scoped(&sel->mutex);
+
+        let r = ru_codec_selector_find_bench_result(sel, name, mime,
+                                                    width, height);
+        if (r) {
+            logd("codec: %s: cached benchmark: %.1f fps", name, r->fps);
+            return r->fps;
+        }
+    }
+
+    double fps = ru_codec_benchmark(name, format, ex, width, height);
+
+    ru_mutex_lock_scoped(&sel->mutex);
+
+    let r = ru_codec_selector_find_bench_result(sel, name, mime, width, height);
+    if (r)
+        return r->fps;
+
+    ru_codec_selector_add_bench_result(sel, mime, width, height, name, fps);
+    ru_codec_selector_save_bench_result(sel,
+            &sel->bench_results[sel->bench_result_count - 1]);
+
+    return fps;
+}
+
+// Returns the chosen decoder's name, or null to let the platform choose. Call
+// without the mutex held.
+static char *
+ru_codec_selector_choose(RuCodecSelector *sel, const char *mime,
+                         AMediaFormat *format, AMediaExtractor *ex,
+                         int32_t width, int32_t height) {
+    size_t count;
+    RuCodecInfo *infos = ru_media_codec_list_get_decoders(sel->java_vm, mime,
+                                                          &count);
+    if (count == 0) {
+        logi("codec: MediaCodecList has no decoder for %s", mime);
+        return NULL;
+    }
+
+    // Hardware decoders first. Otherwise, keep MediaCodecList's order, which
+    // ranks each group by the platform's preference.
+    const RuCodecInfo *order[count];
+    size_t n = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (infos[i].is_hardware)
+            order[n++] = &infos[i];
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (!infos[i].is_hardware)
+            order[n++] = &infos[i];
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        logd("codec: candidate %zu: %s%s", i, order[i]->name,
+             order[i]->is_hardware ? " (hardware)" : "");
+    }
+
+    const RuCodecInfo *choice = order[0];
+
+    if (sel->benchmark) {
+        int32_t frame_rate;
+        float frame_rate_f;
+        if (AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_FRAME_RATE, &frame_rate)) {
+            // ok
+        } else if (AMediaFormat_getFloat(format, AMEDIAFORMAT_KEY_FRAME_RATE, &frame_rate_f)) {
+            frame_rate = frame_rate_f;
+        } else {
+            frame_rate = RU_CODEC_DEFAULT_FRAME_RATE;
+        }
+
+        const RuCodecInfo *fastest = NULL;
+        double fastest_fps = 0.0;
+        choice = NULL;
+
+        for (size_t i = 0; i < count; ++i) {
+            double fps = ru_codec_selector_get_fps(sel, order[i]->name, mime,
+                    format, ex, width, height);
+
+            if (fps > fastest_fps) {
+                fastest = order[i];
+                fastest_fps = fps;
+            }
+
+            if (order[i]->is_hardware && fps >= frame_rate) {
+                choice = order[i];
+                break;
+            }
+        }
+
+        if (!choice)
+            choice = fastest;
+
+        if (!choice) {
+            loge("codec: every decoder for %s failed the benchmark", mime);
+            ru_codec_infos_free(infos, count);
+            return NULL;
+        }
+    }
+
+    char *name = xstrdup(choice->name);
+    ru_codec_infos_free(infos, count);
+
+    return name;
+}
+
+// Call with the mutex held.
+static RuCodecChoice *
+ru_codec_selector_find_choice(RuCodecSelector *sel, const char *mime,
+                              int32_t width, int32_t height) {
+    for (size_t i = 0; i < sel->choice_count; ++i) {
+        RuCodecChoice *c = &sel->choices[i];
+        if (!strcmp(c->mime, mime) && c->width == width && c->height == height)
+            return c;
+    }
+
+    return NULL;
+}
+
+// Returns the decoder chosen for the format's mime and size, choosing it on
+// first use, or null to let the platform choose. The name lives as long as
+// the selector.
+static const char *
+ru_codec_selector_get_choice(RuCodecSelector *sel, const char *mime,
+                             AMediaFormat *format, AMediaExtractor *ex) {
+    int32_t width, height;
+    if (!AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_WIDTH, &width) ||
+        !AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_HEIGHT, &height)) {
+        die("codec: failed to query AMediaFormat width, height");
+    }
+
+    {
+        ru_mutex_lock_scoped(&sel->mutex);
+
+        let choice = ru_codec_selector_find_choice(sel, mime, width, height);
+
+        // The name outlives the lock. Choices are never removed, and a
+        // realloc of the array does not move their names.
+        if (choice)
+            return choice->name;
+    }
+
+    // Choose without the lock, because choosing may benchmark.
+    char *chosen = ru_codec_selector_choose(sel, mime, format, ex,
+                                            width, height);
+
+    ru_mutex_lock_scoped(&sel->mutex);
+
+    let choice = ru_codec_selector_find_choice(sel, mime, width, height);
+    if (choice) {
+        // The other thread chose first.
+        free(chosen);
+        return choice->name;
+    }
+
+    sel->choices = xreallocn(sel->choices, sel->choice_count + 1,
+                             sizeof(sel->choices[0]));
+    sel->choices[sel->choice_count++] = (RuCodecChoice) {
+        .mime = xstrdup(mime),
+        .width = width,
+        .height = height,
+        .name = chosen,
+    };
+
+    return chosen;
+}
+
+AMediaCodec *
+ru_codec_selector_create_decoder(RuCodecSelector *sel, AMediaFormat *format,
+                                 AMediaExtractor *ex) {
+    AMediaCodec *codec;
+
+    const char *mime = NULL; // owned by format
+    if (!AMediaFormat_getString(format, AMEDIAFORMAT_KEY_MIME, &mime))
+        die("codec: AMediaFormat_getString(AMEDIAFORMAT_KEY_MIME) failed");
+
+    if (sel->codec_name) {
+        codec = AMediaCodec_createCodecByName(sel->codec_name);
+        if (!codec)
+            die("codec: AMediaCodec_createCodecByName(%s) failed", sel->codec_name);
+
+        logi("codec: %s: use %s (pinned)", mime, sel->codec_name);
+        return codec;
+    }
+
+    const char *name = NULL;
+
+    if (sel->java_vm)
+        name = ru_codec_selector_get_choice(sel, mime, format, ex);
+
+    if (name) {
+        codec = AMediaCodec_createCodecByName(name);
+        if (codec) {
+            logi("codec: %s: use %s", mime, name);
+            return codec;
+        }
+
+        loge("codec: AMediaCodec_createCodecByName(%s) failed; "
+             "fall back to the platform's choice", name);
+    }
+
+    codec = AMediaCodec_createDecoderByType(mime);
+    if (!codec)
+        die("codec: AMediaCodec_createDecoderByType(%s) failed", mime);
+
+    logi("codec: %s: use the platform's default decoder", mime);
+    return codec;
+}
@@ -0,0 +1,70 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <jni.h>
+
+#include "util/attribs.h"
+
+typedef struct AMediaCodec AMediaCodec;
+typedef struct AMediaExtractor AMediaExtractor;
+typedef struct AMediaFormat AMediaFormat;
+typedef struct RuCodecSelector RuCodecSelector;
+
+struct ru_codec_selector_new_args {
+    // If non-null, then list the decoders with MediaCodecList and prefer
+    // hardware decoders. Otherwise, AMediaCodec_createDecoderByType chooses.
+    JavaVM *java_vm;
+
+    // If non-null, then always create this decoder, by name.
+    const char *codec_name;
+
+    // If set, then decode the start of each clip with each candidate decoder,
+    // and choose the first hardware decoder that sustains the clip's frame
+    // rate, else the fastest decoder. Requires java_vm.
+    bool benchmark;
+
+    // If non-null, then benchmark results persist in this directory, such as
+    // ANativeActivity::internalDataPath.
+    const char *cache_dir;
+};
+
+#define ru_codec_selector_new(...) ru_codec_selector_new_s((struct ru_codec_selector_new_args) { 0, __VA_ARGS__ })
+RuCodecSelector *ru_codec_selector_new_s(struct ru_codec_selector_new_args args) _malloc_ _must_use_result_;
+void ru_codec_selector_free(RuCodecSelector *sel);
+
+// Create an unconfigured decoder for the extractor's selected track, whose
+// format is given. A benchmark reads samples from the extractor, then seeks
+// it back to the start. Thread-safe.
+AMediaCodec *ru_codec_selector_create_decoder(RuCodecSelector *sel,
+                                              AMediaFormat *format,
+                                              AMediaExtractor *ex) _must_use_result_;
@@ -26,6 +26,7 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 // stdlib
+#include <inttypes.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -54,160 +55,309 @@ typedef struct AMediaCodecOnAsyncNotifyCallback AMediaCodecOnAsyncNotifyCallback
 #include "util/check.h"
 #include "util/log.h"
 #include "util/macros.h"
+#include "util/ru_cadence.h"
 #include "util/ru_chan.h"
-
+#include "util/ru_logring.h"
+#include "util/ru_latency.h"
+#include "util/ru_math.h"
+#include "util/ru_queue.h"
+#include "util/ru_reactor.h"
+#include "util/ru_thread.h"
+#include "util/ru_time.h"
+#include "util/ru_trace.h"
+
+#include "ru_codec.h"
 #include "ru_media.h"
 
+// Each stream's AImageReader holds at most this many images.
 #define RU_MEDIA_MAX_IMAGE_COUNT 8
 
+// The image budget is shared by all streams. The renderer caches one import per
+// AHardwareBuffer, in a cache of 64 slots (see RuAhbCache), so the budget
+// leaves headroom for the buffers that each decoder dequeues.
+#define RU_MEDIA_IMAGE_BUDGET 32
+
+// Each stream needs one image on screen and one in flight.
+#define RU_MEDIA_MIN_IMAGE_COUNT 2
+
+// The standby decoder never releases a buffer into its private AImageReader,
+// so the reader needs no more images than the minimum.
+#define RU_MEDIA_STANDBY_IMAGE_COUNT 1
+
+// Bounds the input timestamps that await their output frame. Codecs rarely
+// buffer more than a handful of frames.
+#define RU_MEDIA_MAX_PENDING_INPUTS 32
+
+// Log the decoder's latency summary every this many frames.
+#define RU_MEDIA_LATENCY_LOG_PERIOD 120
+
+// AMEDIAFORMAT_KEY_LOW_LATENCY requires API 30. The key's value is stable,
+// and older codecs ignore it.
+#define RU_MEDIA_KEY_LOW_LATENCY "low-latency"
+
+typedef struct RuMediaStream RuMediaStream;
+
+typedef struct RuDecoderOutput {
+    uint32_t index;
+    AMediaCodecBufferInfo info;
+} RuDecoderOutput;
+
+typedef struct RuDecoderPendingInput {
+    int64_t pts_us;
+    int64_t queue_ns; // when the input was queued
+} RuDecoderPendingInput;
+
+// Time from AMediaCodec_queueInputBuffer to onAsyncOutputAvailable, matched
+// by presentation timestamp. This is the latency added by the codec's
+// internal buffering.
+typedef struct RuDecoderLatency {
+    RuDecoderPendingInput pending[RU_MEDIA_MAX_PENDING_INPUTS];
+    uint32_t pending_count;
+    uint32_t max_pending_count;
+
+    uint32_t frame_count;
+    int64_t sum_ns;
+    int64_t max_ns;
+} RuDecoderLatency;
+
+// Decodes one clip of a stream's playlist.
+typedef struct RuDecoder {
+    RuMediaStream *stream;
+    uint32_t id;
+    size_t clip; // index into RuMediaStream::src_paths
+
+    uint32_t track; // We play a single track, the first video track.
+    AMediaFormat *format;
+    AMediaExtractor *ex;
+    AMediaCodec *codec;
+
+    // The latest format reported by onAsyncFormatChanged, or null.
+    AMediaFormat *output_format;
+
+    // The display size, after crop. From output_format if non-null, else from
+    // format.
+    int32_t width;
+    int32_t height;
+
+    bool is_started;
+
+    // A standby decoder is configured onto standby_reader and pre-rolled, but
+    // it holds its decoded frames in held_outputs instead of releasing them.
+    // ru_media_promote_standby() redirects the codec to the stream's
+    // AImageReader and releases the held frames.
+    //
+    // Pre-roll is capped by RuMediaStream::preroll_count. Past the cap, input
+    // buffers wait in pending_inputs until promotion.
+    bool is_standby;
+    AImageReader *standby_reader;
+    RuQueue held_outputs; // of RuDecoderOutput
+    RuQueue pending_inputs; // of uint32_t
+
+    // Presentation time of the last sample queued, or 0 if none. After a
+    // recoverable codec error, input resumes at the sync sample before it.
+    int64_t last_input_pts_us;
+
+    RuDecoderLatency latency;
+} RuDecoder;
+
 typedef struct RuMediaEvent {
     enum {
         RU_MEDIA_EVENT_START,
         RU_MEDIA_EVENT_STOP,
         RU_MEDIA_EVENT_BUFFER_IN,
         RU_MEDIA_EVENT_BUFFER_OUT,
+        RU_MEDIA_EVENT_STANDBY_READY,
+        RU_MEDIA_EVENT_FORMAT_CHANGED,
+        RU_MEDIA_EVENT_CODEC_ERROR,
     } type;
 
+    // For all events except START and STOP, the index into RuMedia::streams.
+    uint32_t stream;
+
+    // For BUFFER_IN, BUFFER_OUT, FORMAT_CHANGED and CODEC_ERROR, the
+    // RuDecoder::id of the emitting codec.
+    // Events from a retired decoder may linger in the channel, so the media
+    // thread looks up the decoder by id rather than trusting a pointer.
+    uint32_t decoder_id;
+
     union {
         struct {
             uint32_t index;
         } buffer_in;
 
+        RuDecoderOutput buffer_out;
+
         struct {
-            uint32_t index;
-            AMediaCodecBufferInfo info;
-        } buffer_out;
+            RuDecoder *dec;
+        } standby_ready;
+
+        struct {
+            media_status_t error;
+            int32_t action; // AMediaCodecActionCode
+        } codec_error;
     };
 } RuMediaEvent;
 
-typedef struct RuMedia {
-    pthread_t thread; // See ru_media_thread().
+typedef struct RuMediaPrepRequest {
+    enum {
+        RU_MEDIA_PREP_REQUEST_DECODER,
+        RU_MEDIA_PREP_REQUEST_EXIT,
+    } type;
 
-    uint32_t track; // We play a single track, the first video track.
-    AMediaFormat *format;
-    AMediaExtractor *ex;
-    AMediaCodec *codec;
+    RuMediaStream *stream;
+    size_t clip;
+    RuDecoder *retire;
+} RuMediaPrepRequest;
+
+struct RuMediaStream {
+    RuMedia *media;
+    uint32_t id; // index into RuMedia::streams
+
+    char **src_paths;
+    size_t src_count;
+    bool loop;
+
+    // Sized to the active decoder's display size. When the size changes,
+    // ru_media_stream_fit_aimage_reader() replaces the reader.
     AImageReader *image_reader;
+    ANativeWindow *image_window; // owned by image_reader
+    int32_t image_width;
+    int32_t image_height;
+    int32_t image_count;
+    int32_t preroll_count;
+
+    // The active decoder renders into image_reader. The standby decoder, if
+    // any, is pre-rolled with the next clip.
+    RuDecoder *active;
+    RuDecoder *standby;
+
+    // A RuMediaPrepRequest is in flight.
+    bool is_prep_pending;
+
+    // The active decoder reached end of stream before the standby was ready.
+    bool is_switch_pending;
+
+    // The stream has ended, and its decoders are gone. A standby decoder
+    // that the prep thread finishes afterwards is discarded.
+    bool is_ended;
+
+    // Fatal codec errors since the stream last rendered a frame. Once every
+    // clip of the playlist has failed in a row, nothing is left to play.
+    size_t fatal_error_count;
+
+    // Measure the transition gap from the last rendered frame of the old clip
+    // to the first rendered frame of the new clip.
+    int64_t last_render_ns;
+    int64_t transition_start_ns;
+    bool is_transition_measured;
+    uint32_t transition_count;
+    int64_t transition_max_gap_ns;
+
+    // Estimated from the rendered frames' timestamps, across clips.
+    RuFrameRate frame_rate;
+};
 
-    // RuMedia::codec feeds the channel through AMediaCodecOnAsyncNotifyCallback.
-    // RuMedia::thread drains the channel and forwards each index to
-    // AMediaCodec_queueInputBuffer or AMediaCodec_releaseOutputBuffer.
+typedef struct RuMedia {
+    // A single thread serves all streams. See ru_media_thread(). With a
+    // reactor, the reactor's thread serves them instead, and thread is
+    // unused. See ru_media_dispatch().
+    pthread_t thread;
+    RuReactor *reactor _not_owned_; // may be null
+    // Codec callbacks and the prep thread wake the reactor through it.
+    // ru_media_free() clears it, which waits out any wake in flight, before
+    // it removes the source.
+    RuReactorLink reactor_link;
+
+    RuMediaStream *streams;
+    uint32_t stream_count;
+    // The prep thread takes ids for new decoders, and the media thread for
+    // recovered ones.
+    _Atomic uint32_t next_decoder_id;
+    RuMediaDecoderProfile decoder_profile;
+    RuCodecSelector *codec_selector;
+    RuMediaListener listener;
+    RuLatency *latency _not_owned_; // may be null
+
+    // Streams that have not yet ended. When none remain, the media thread's
+    // work is done, and is_done is set after ru_media_finish_events().
+    uint32_t live_stream_count;
+
+    // Written under done_mutex, which ru_media_free() waits on with
+    // done_cond. The media thread may read it without the mutex.
+    bool is_done;
+    pthread_mutex_t done_mutex;
+    pthread_cond_t done_cond;
+
+    // Every AMediaCodec feeds the channel through
+    // AMediaCodecOnAsyncNotifyCallback. RuMedia::thread drains the channel
+    // and forwards each index to AMediaCodec_queueInputBuffer or
+    // AMediaCodec_releaseOutputBuffer.
     RuChan event_chan;
+
+    // ru_media_prep_thread() creates standby decoders off the media thread,
+    // because creating and configuring an AMediaCodec may take longer than
+    // a frame. It also deletes retired decoders, for the same reason.
+    pthread_t prep_thread;
+    RuChan prep_chan; // of RuMediaPrepRequest
 } RuMedia;
 
 static void
 ru_media_push_event(RuMedia *m, RuMediaEvent ev) {
     ru_chan_push(&m->event_chan, &ev);
-}
-
-static void *
-ru_media_thread(void *_media) {
-    logd("media: start thread tid=%d", gettid());
-
-    RuMedia *m = _media;
-    int ret;
-
-    for (;;) {
-        RuMediaEvent ev;
-        ru_chan_pop_wait(&m->event_chan, &ev);
-
-        switch (ev.type) {
-            case RU_MEDIA_EVENT_START:
-                logd("media: pop_MEDIA_EVENT_START");
-                ret = AMediaCodec_start(m->codec);
-                if (ret)
-                    die("media: AMediaCodec_start failed: error=%d", ret);
-                break;
-            case RU_MEDIA_EVENT_STOP:
-                logd("media: pop_MEDIA_EVENT_STOP");
-                goto done;
-            case RU_MEDIA_EVENT_BUFFER_IN: {
-                int index = ev.buffer_in.index;
-                logd("media: pop_MEDIA_EVENT_BUFFER_IN(index=%d)", index);
-
-                size_t buf_size;
-                uint8_t *buf = AMediaCodec_getInputBuffer(m->codec, index, &buf_size);
-                logd("media: buf=%p buf_size=%zu", buf, buf_size);
-                if (!buf) {
-                    die("media: AMediaCodec_getInputBuffer(index=%d) failed", index);
-                }
-
-                ssize_t sample_size = AMediaExtractor_readSampleData(m->ex, buf, buf_size);
-                logd("media: sample size: %zd", sample_size);
-
-                int64_t sample_time = AMediaExtractor_getSampleTime(m->ex);
-                logd("media: sample time: %"PRIi64, sample_time);
-
-                bool eos = sample_size < 0 || !AMediaExtractor_advance(m->ex);
-                if (eos)
-                    logd("media: end of input stream");
-
-                uint32_t flags = 0;
-                if (eos)
-                    flags |= AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM;
-
-                if (sample_size < 0) {
-                    // AMediaCodec_queueInputBuffer will fail if given negative
-                    // sample size.
-                    sample_size = 0;
-                }
 
-                ret = AMediaCodec_queueInputBuffer(m->codec, index,
-                        /*offset*/ 0, sample_size, sample_time, flags);
-                if (ret) {
-                    die("media: AMediaCodec_queueInputBuffer(index=%d) "
-                            "failed: error=%d", index, ret);
-                }
-                break;
-            }
-            case RU_MEDIA_EVENT_BUFFER_OUT: {
-                int index = ev.buffer_out.index;
-                logd("media: pop_MEDIA_EVENT_BUFFER_OUT(index=%d)", index);
-
-                bool eos = (ev.buffer_out.info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM);
-                if (eos)
-                    logd("media: end of output stream");
-
-                bool render = (ev.buffer_out.info.size > 0);
-
-                ret = AMediaCodec_releaseOutputBuffer(m->codec, ev.buffer_out.index, render);
-                if (ret) {
-                    die("media: AMediaCodec_releaseOutputBuffer(index=%d) "
-                            "failed: error=%d", ev.buffer_out.index, ret);
-                }
-
-                if (eos)
-                    goto done;
-            }
-        }
-    }
-
- done:
-    AMediaCodec_stop(m->codec);
-    return NULL;
+    ru_reactor_link_wake(&m->reactor_link);
 }
 
 static void
-on_codec_error(AMediaCodec *codec, void *_media, media_status_t error,
+on_codec_error(AMediaCodec *codec, void *_dec, media_status_t error,
                int32_t action, const char *detail) {
-    logd("media: %s: error=%d action=%d: %s", __func__, error, action, detail);
-    logd("media: %s: FINISHME", __func__);
+    RuDecoder *dec = _dec;
+
+    // The detail string does not outlive the callback, so log it here.
+    loge("media: stream %u: decoder %u: codec error=%d action=%d: %s",
+         dec->stream->id, dec->id, error, action, detail);
+
+    ru_media_push_event(dec->stream->media,
+        (RuMediaEvent) {
+            .type = RU_MEDIA_EVENT_CODEC_ERROR,
+            .stream = dec->stream->id,
+            .decoder_id = dec->id,
+            .codec_error = {
+                .error = error,
+                .action = action,
+            },
+        });
 }
 
 static void
-on_codec_format_changed(AMediaCodec *codec, void *_media, AMediaFormat *format) {
+on_codec_format_changed(AMediaCodec *codec, void *_dec, AMediaFormat *format) {
+    RuDecoder *dec = _dec;
+
     logd("media: %s: %s", __func__, AMediaFormat_toString(format));
-    logd("media: %s: FINISHME", __func__);
+
+    // The media thread queries the format with AMediaCodec_getOutputFormat,
+    // so the event need not own a copy.
+    logd("media: push RU_MEDIA_EVENT_FORMAT_CHANGED(stream=%u, decoder=%u)",
+         dec->stream->id, dec->id);
+    ru_media_push_event(dec->stream->media,
+        (RuMediaEvent) {
+            .type = RU_MEDIA_EVENT_FORMAT_CHANGED,
+            .stream = dec->stream->id,
+            .decoder_id = dec->id,
+        });
 }
 
 static void
-on_codec_input_available(AMediaCodec *codec, void *_media, int32_t index) {
-    RuMedia *m = _media;
+on_codec_input_available(AMediaCodec *codec, void *_dec, int32_t index) {
+    RuDecoder *dec = _dec;
 
-    logd("media: push RU_MEDIA_EVENT_BUFFER_IN(index=%d)", index);
-    ru_media_push_event(m,
+    logv_deferred("media: push RU_MEDIA_EVENT_BUFFER_IN(stream=%u, decoder=%u, index=%d)",
+                  dec->stream->id, dec->id, index);
+    ru_media_push_event(dec->stream->media,
         (RuMediaEvent) {
             .type = RU_MEDIA_EVENT_BUFFER_IN,
+            .stream = dec->stream->id,
+            .decoder_id = dec->id,
             .buffer_in = {
                 .index = index,
             },
@@ -215,14 +365,17 @@ on_codec_input_available(AMediaCodec *codec, void *_media, int32_t index) {
 }
 
 static void
-on_codec_output_available(AMediaCodec *codec, void *_media, int32_t index,
+on_codec_output_available(AMediaCodec *codec, void *_dec, int32_t index,
         AMediaCodecBufferInfo *info) {
-    RuMedia *m = _media;
+    RuDecoder *dec = _dec;
 
-    logd("media: push RU_MEDIA_EVENT_BUFFER_OUT(index=%d)", index);
-    ru_media_push_event(m,
+    logv_deferred("media: push RU_MEDIA_EVENT_BUFFER_OUT(stream=%u, decoder=%u, index=%d)",
+                  dec->stream->id, dec->id, index);
+    ru_media_push_event(dec->stream->media,
         (RuMediaEvent) {
             .type = RU_MEDIA_EVENT_BUFFER_OUT,
+            .stream = dec->stream->id,
+            .decoder_id = dec->id,
             .buffer_out = {
                 .index = index,
                 .info = *info,
@@ -276,15 +429,60 @@ select_track(AMediaExtractor *ex, uint32_t *out_track,
     *out_format = format;
 }
 
-RuMedia *
-ru_media_new(const char *src_path) {
+static AImageReader *
+ru_media_new_aimage_reader(int32_t width, int32_t height, int32_t max_images) {
+    AImageReader *reader;
     int ret;
 
-    let m = new0(RuMedia);
+    ret = AImageReader_newWithUsage(
+        width, height,
+        AIMAGE_FORMAT_YUV_420_888,
+        AHARDWAREBUFFER_USAGE_CPU_READ_NEVER |
+        AHARDWAREBUFFER_USAGE_CPU_WRITE_NEVER |
+        AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE,
+        max_images,
+        &reader);
+    if (ret)
+        die("media: AImageReader_newWithUsage failed: error=%d", ret);
 
-    ru_chan_init(&m->event_chan, sizeof(RuMediaEvent), 64);
+    return reader;
+}
+
+// Query the size of the format's display rect. The crop, if any, excludes
+// the decoder's alignment padding.
+static void
+ru_media_format_get_display_size(AMediaFormat *format, int32_t *width,
+                                 int32_t *height) {
+    if (!AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_WIDTH, width) ||
+        !AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_HEIGHT, height)) {
+        die("media: failed to query AMediaFormat width, height");
+    }
+
+    int32_t left, top, right, bottom;
+    if (AMediaFormat_getRect(format, AMEDIAFORMAT_KEY_DISPLAY_CROP,
+                             &left, &top, &right, &bottom)) {
+        // The crop rect is inclusive.
+        *width = right - left + 1;
+        *height = bottom - top + 1;
+    }
+}
+
+// Open the clip and select its track. Call ru_decoder_configure() next.
+static RuDecoder *
+ru_decoder_new(RuMediaStream *s, size_t clip) {
+    const char *src_path = s->src_paths[clip];
+    int ret;
+
+    let dec = new0(RuDecoder);
+    dec->stream = s;
+    dec->id = s->media->next_decoder_id++;
+    dec->clip = clip;
+    ru_queue_init(&dec->held_outputs, sizeof(RuDecoderOutput),
+                  RU_MEDIA_MAX_IMAGE_COUNT);
+    ru_queue_init(&dec->pending_inputs, sizeof(uint32_t),
+                  RU_MEDIA_MAX_IMAGE_COUNT);
 
-    logd("media: open file: %s", src_path);
+    logd("media: stream %u: decoder %u: open file: %s", s->id, dec->id, src_path);
     int src_fd = open(src_path, O_RDONLY);
     if (src_fd == -1)
         die("media: failed to open file: %s", src_path);
@@ -293,52 +491,103 @@ ru_media_new(const char *src_path) {
     if (src_len == -1)
         die("media: failed to query size of file");
 
-    m->ex = AMediaExtractor_new();
-    if (!m->ex)
+    dec->ex = AMediaExtractor_new();
+    if (!dec->ex)
         abort();
 
-    ret = AMediaExtractor_setDataSourceFd(m->ex, src_fd, /*offset*/ 0, src_len);
+    ret = AMediaExtractor_setDataSourceFd(dec->ex, src_fd, /*offset*/ 0, src_len);
     if (ret)
         die("media: AMediaExtractor_setDataSourceFd failed: error=%d", ret);
 
     close(src_fd);
 
-    select_track(m->ex, &m->track, &m->format);
+    select_track(dec->ex, &dec->track, &dec->format);
+    ru_media_format_get_display_size(dec->format, &dec->width, &dec->height);
 
-    int32_t width, height;
-    if (!AMediaFormat_getInt32(m->format, AMEDIAFORMAT_KEY_WIDTH, &width) ||
-        !AMediaFormat_getInt32(m->format, AMEDIAFORMAT_KEY_HEIGHT, &height)) {
-        die("media: failed to query AMediaFormat width, height");
+    return dec;
+}
+
+// Set the low-latency keys on the format passed to AMediaCodec_configure.
+static void
+ru_decoder_apply_low_latency(RuDecoder *dec) {
+    AMediaFormat *f = dec->format;
+
+    AMediaFormat_setInt32(f, RU_MEDIA_KEY_LOW_LATENCY, 1);
+
+    // Run the codec at its highest clock rather than at the content's frame
+    // rate. Short.MAX_VALUE is the documented way to ask for that.
+    AMediaFormat_setInt32(f, AMEDIAFORMAT_KEY_OPERATING_RATE, INT16_MAX);
+
+    // 0 is realtime. 1 is best effort.
+    AMediaFormat_setInt32(f, AMEDIAFORMAT_KEY_PRIORITY, 0);
+
+    // Size the input buffers from the container if it knows the largest
+    // sample. Otherwise, a raw YUV 4:2:0 frame bounds any compressed sample.
+    // Either way, the codec does not reallocate input buffers on a large
+    // keyframe.
+    int32_t max_input_size;
+    if (!AMediaFormat_getInt32(f, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE, &max_input_size)) {
+        max_input_size = dec->width * dec->height * 3 / 2;
+        AMediaFormat_setInt32(f, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE, max_input_size);
     }
 
-    ret = AImageReader_newWithUsage(
-        width, height,
-        AIMAGE_FORMAT_YUV_420_888,
-        AHARDWAREBUFFER_USAGE_CPU_READ_NEVER |
-        AHARDWAREBUFFER_USAGE_CPU_WRITE_NEVER |
-        AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE,
-        RU_MEDIA_MAX_IMAGE_COUNT,
-        &m->image_reader);
-    if (ret)
-        die("media: AImageReader_newWithUsage failed: error=%d", ret);
+    logd("media: stream %u: decoder %u: low-latency profile: max_input_size=%d",
+         dec->stream->id, dec->id, max_input_size);
+}
 
-    ANativeWindow *surface;
-    ret = AImageReader_getWindow(m->image_reader, &surface);
-    if (ret)
-        die("media: AImageReader_getWindow failed: error=%d", ret);
+// Codecs silently drop the keys that they do not support. A key that the
+// codec honours appears in its input or output format.
+//
+// Nearly every codec reports max-input-size, requested or not, so its
+// presence says nothing. It counts as honoured only if the input buffers are
+// at least as large as requested.
+static void
+ru_decoder_check_low_latency(RuDecoder *dec) {
+    const char *const keys[] = {
+        RU_MEDIA_KEY_LOW_LATENCY,
+        AMEDIAFORMAT_KEY_OPERATING_RATE,
+        AMEDIAFORMAT_KEY_PRIORITY,
+    };
 
-    const char *mime = NULL; // owned by format
-    if (!AMediaFormat_getString(m->format, AMEDIAFORMAT_KEY_MIME, &mime))
-        die("media: track: %u, AMediaFormat_getString(AMEDIAFORMAT_KEY_MIME) failed", m->track);
+    AMediaFormat *in = AMediaCodec_getInputFormat(dec->codec);
+    AMediaFormat *out = AMediaCodec_getOutputFormat(dec->codec);
 
-    m->codec = AMediaCodec_createDecoderByType(mime);
-    if (!m->codec)
-        die("media: AMediaCodec_createDeocderByType(%s) failed", mime);
+    for (uint32_t i = 0; i < ARRAY_LEN(keys); ++i) {
+        int32_t v;
+        float fv;
+        bool found =
+            (in && AMediaFormat_getInt32(in, keys[i], &v)) ||
+            (out && AMediaFormat_getInt32(out, keys[i], &v)) ||
+            (in && AMediaFormat_getFloat(in, keys[i], &fv)) ||
+            (out && AMediaFormat_getFloat(out, keys[i], &fv));
 
-    ret = AMediaCodec_configure(m->codec, m->format, surface, /*crypto*/ NULL,
-            /*flags*/ 0);
-    if (ret)
-        die("media: AMediaCodec_configure failed: error=%d", ret);
+        logi("media: stream %u: decoder %u: %s: %s", dec->stream->id, dec->id,
+             keys[i], found ? "honoured" : "ignored");
+    }
+
+    int32_t want_max_input_size;
+    int32_t max_input_size;
+    if (AMediaFormat_getInt32(dec->format, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE,
+                              &want_max_input_size)) {
+        bool found = in && AMediaFormat_getInt32(in,
+                AMEDIAFORMAT_KEY_MAX_INPUT_SIZE, &max_input_size);
+
+        logi("media: stream %u: decoder %u: %s: %s (want %d, got %d)",
+             dec->stream->id, dec->id, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE,
+             found && max_input_size >= want_max_input_size ?
+                 "honoured" : "ignored",
+             want_max_input_size, found ? max_input_size : -1);
+    }
+
+    if (in)
+        AMediaFormat_delete(in);
+    if (out)
+        AMediaFormat_delete(out);
+}
+
+static void
+ru_decoder_set_callbacks(RuDecoder *dec) {
+    int ret;
 
     AMediaCodecOnAsyncNotifyCallback codec_notify_cb = {
         .onAsyncError = on_codec_error,
@@ -347,13 +596,913 @@ ru_media_new(const char *src_path) {
         .onAsyncOutputAvailable = on_codec_output_available,
     };
 
-    ret = AMediaCodec_setAsyncNotifyCallback(m->codec, codec_notify_cb, m);
+    ret = AMediaCodec_setAsyncNotifyCallback(dec->codec, codec_notify_cb, dec);
     if (ret)
         die("media: AMediaCodec_setAsyncNotifyCallback failed: error=%d", ret);
+}
+
+// If window is null, then configure the decoder as a standby decoder.
+static void
+ru_decoder_configure(RuDecoder *dec, ANativeWindow *window) {
+    int ret;
+
+    if (!window) {
+        dec->is_standby = true;
+        dec->standby_reader = ru_media_new_aimage_reader(
+                dec->width, dec->height, RU_MEDIA_STANDBY_IMAGE_COUNT);
+
+        ret = AImageReader_getWindow(dec->standby_reader, &window);
+        if (ret)
+            die("media: AImageReader_getWindow failed: error=%d", ret);
+    }
+
+    dec->codec = ru_codec_selector_create_decoder(
+            dec->stream->media->codec_selector, dec->format, dec->ex);
+
+    RuMediaDecoderProfile profile = dec->stream->media->decoder_profile;
+    if (profile == RU_MEDIA_DECODER_PROFILE_LOW_LATENCY)
+        ru_decoder_apply_low_latency(dec);
+
+    ret = AMediaCodec_configure(dec->codec, dec->format, window, /*crypto*/ NULL,
+            /*flags*/ 0);
+    if (ret)
+        die("media: AMediaCodec_configure failed: error=%d", ret);
+
+    if (profile == RU_MEDIA_DECODER_PROFILE_LOW_LATENCY)
+        ru_decoder_check_low_latency(dec);
+
+    ru_decoder_set_callbacks(dec);
+}
+
+static void
+ru_decoder_log_latency(RuDecoder *dec) {
+    const RuDecoderLatency *l = &dec->latency;
+
+    if (l->frame_count == 0)
+        return;
+
+    logi("media: stream %u: decoder %u: decode latency: frames=%u "
+         "avg=%.3fms max=%.3fms max_in_flight=%u",
+         dec->stream->id, dec->id, l->frame_count,
+         ru_time_ns_to_ms(l->sum_ns / l->frame_count),
+         ru_time_ns_to_ms(l->max_ns),
+         l->max_pending_count);
+}
+
+// Identifies a frame's async "decode" trace section. Decoder ids are unique
+// within the RuMedia.
+static int32_t
+ru_decoder_trace_cookie(RuDecoder *dec, int64_t pts_us) {
+    return (int32_t) ((uint32_t) pts_us * 64 + dec->id % 64);
+}
+
+static void
+ru_decoder_latency_on_input(RuDecoder *dec, int64_t pts_us) {
+    RuDecoderLatency *l = &dec->latency;
+
+    if (l->pending_count == ARRAY_LEN(l->pending)) {
+        // The codec dropped frames, or it emits fewer outputs than inputs.
+        // Forget the oldest input.
+        logd_ratelimit(1000, "media: stream %u: decoder %u: too many pending inputs",
+                       dec->stream->id, dec->id);
+        memmove(&l->pending[0], &l->pending[1],
+                (l->pending_count - 1) * sizeof(l->pending[0]));
+        --l->pending_count;
+    }
+
+    const int64_t now_ns = ru_time_now_ns();
+
+    l->pending[l->pending_count++] = (RuDecoderPendingInput) {
+        .pts_us = pts_us,
+        .queue_ns = now_ns,
+    };
+
+    RuLatency *lat = dec->stream->media->latency;
+    if (lat)
+        ru_latency_stamp(lat, dec->stream->id, pts_us, RU_LATENCY_STAGE_QUEUE, now_ns);
+
+    ru_trace_async_begin("decode", ru_decoder_trace_cookie(dec, pts_us));
+
+    l->max_pending_count = ru_max(l->max_pending_count, l->pending_count);
+}
+
+static void
+ru_decoder_latency_on_output(RuDecoder *dec, const AMediaCodecBufferInfo *info) {
+    RuDecoderLatency *l = &dec->latency;
+
+    if (info->size <= 0)
+        return;
+
+    const int64_t now_ns = ru_time_now_ns();
+
+    RuLatency *lat = dec->stream->media->latency;
+    if (lat) {
+        ru_latency_stamp(lat, dec->stream->id, info->presentationTimeUs,
+                         RU_LATENCY_STAGE_DECODE, now_ns);
+    }
+
+    for (uint32_t i = 0; i < l->pending_count; ++i) {
+        if (l->pending[i].pts_us != info->presentationTimeUs)
+            continue;
+
+        int64_t latency_ns = now_ns - l->pending[i].queue_ns;
+        ru_trace_async_end("decode", ru_decoder_trace_cookie(dec, info->presentationTimeUs));
+
+        // Inputs that precede this output in decode order but follow it in
+        // presentation order stay pending.
+        memmove(&l->pending[i], &l->pending[i + 1],
+                (l->pending_count - i - 1) * sizeof(l->pending[0]));
+        --l->pending_count;
+
+        l->frame_count += 1;
+        l->sum_ns += latency_ns;
+        l->max_ns = ru_max(l->max_ns, latency_ns);
+
+        logv_deferred("media: stream %u: decoder %u: pts=%"PRIi64"us latency=%.3fms",
+                      dec->stream->id, dec->id, info->presentationTimeUs,
+                      ru_time_ns_to_ms(latency_ns));
+
+        if (l->frame_count % RU_MEDIA_LATENCY_LOG_PERIOD == 0)
+            ru_decoder_log_latency(dec);
+
+        return;
+    }
+
+    logd_ratelimit(1000, "media: stream %u: decoder %u: no input for pts=%"PRIi64"us",
+                   dec->stream->id, dec->id, info->presentationTimeUs);
+}
+
+static void
+ru_decoder_start(RuDecoder *dec) {
+    int ret;
+
+    logd("media: stream %u: decoder %u: start%s", dec->stream->id, dec->id,
+         dec->is_standby ? " (standby)" : "");
+
+    ret = AMediaCodec_start(dec->codec);
+    if (ret)
+        die("media: AMediaCodec_start failed: error=%d", ret);
+
+    dec->is_started = true;
+}
+
+static void
+ru_decoder_stop(RuDecoder *dec) {
+    if (!dec->is_started)
+        return;
+
+    logd("media: stream %u: decoder %u: stop", dec->stream->id, dec->id);
+    AMediaCodec_stop(dec->codec);
+    dec->is_started = false;
+
+    ru_decoder_log_latency(dec);
+}
+
+static void
+ru_decoder_free(RuDecoder *dec) {
+    if (!dec)
+        return;
+
+    ru_decoder_stop(dec);
+
+    if (dec->codec)
+        AMediaCodec_delete(dec->codec);
+    if (dec->standby_reader)
+        AImageReader_delete(dec->standby_reader);
+
+    AMediaExtractor_delete(dec->ex);
+    AMediaFormat_delete(dec->format);
+    if (dec->output_format)
+        AMediaFormat_delete(dec->output_format);
+    ru_queue_finish(&dec->held_outputs);
+    ru_queue_finish(&dec->pending_inputs);
+    free(dec);
+}
+
+static void
+ru_decoder_queue_input(RuDecoder *dec, uint32_t index) {
+    ru_trace_scoped("queue input");
+    int ret;
+
+    size_t buf_size;
+    uint8_t *buf = AMediaCodec_getInputBuffer(dec->codec, index, &buf_size);
+    logv_deferred("media: buf=%p buf_size=%zu", (void *) buf, buf_size);
+    if (!buf) {
+        die("media: AMediaCodec_getInputBuffer(index=%u) failed", index);
+    }
+
+    ssize_t sample_size = AMediaExtractor_readSampleData(dec->ex, buf, buf_size);
+    logv_deferred("media: sample size: %zd", sample_size);
+
+    int64_t sample_time = AMediaExtractor_getSampleTime(dec->ex);
+    logv_deferred("media: sample time: %"PRIi64, sample_time);
+
+    bool eos = sample_size < 0 || !AMediaExtractor_advance(dec->ex);
+    if (eos)
+        logd("media: stream %u: decoder %u: end of input stream",
+             dec->stream->id, dec->id);
+
+    uint32_t flags = 0;
+    if (eos)
+        flags |= AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM;
+
+    if (sample_size < 0) {
+        // AMediaCodec_queueInputBuffer will fail if given negative
+        // sample size.
+        sample_size = 0;
+    } else {
+        dec->last_input_pts_us = sample_time;
+        ru_decoder_latency_on_input(dec, sample_time);
+    }
+
+    ret = AMediaCodec_queueInputBuffer(dec->codec, index,
+            /*offset*/ 0, sample_size, sample_time, flags);
+    if (ret) {
+        die("media: AMediaCodec_queueInputBuffer(index=%u) "
+                "failed: error=%d", index, ret);
+    }
+}
+
+// Recover from a codec error that AMediaCodecActionCode_isRecoverable allows.
+// Stop the codec, configure it again onto the same window, and resume the
+// input at the sync sample at or before the last one queued. The decoder
+// takes a new id, so that the media thread drops the stale events of the
+// failed session, whose buffer indices are void.
+static void
+ru_decoder_recover(RuDecoder *dec) {
+    RuMediaStream *s = dec->stream;
+    ANativeWindow *window = s->image_window;
+    int ret;
+
+    logw("media: stream %u: decoder %u: reset codec and resume at the sync "
+         "sample before pts=%"PRIi64"us", s->id, dec->id,
+         dec->last_input_pts_us);
+
+    ru_decoder_stop(dec);
+
+    while (ru_queue_pop(&dec->held_outputs, NULL)) {}
+    while (ru_queue_pop(&dec->pending_inputs, NULL)) {}
+    dec->latency.pending_count = 0;
+
+    if (dec->is_standby) {
+        ret = AImageReader_getWindow(dec->standby_reader, &window);
+        if (ret)
+            die("media: AImageReader_getWindow failed: error=%d", ret);
+    }
+
+    // The low-latency keys, if any, are already in the format.
+    ret = AMediaCodec_configure(dec->codec, dec->format, window, /*crypto*/ NULL,
+            /*flags*/ 0);
+    if (ret)
+        die("media: AMediaCodec_configure failed: error=%d", ret);
+
+    ru_decoder_set_callbacks(dec);
+
+    ret = AMediaExtractor_seekTo(dec->ex, dec->last_input_pts_us,
+                                 AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC);
+    if (ret)
+        die("media: AMediaExtractor_seekTo failed: error=%d", ret);
+
+    dec->id = s->media->next_decoder_id++;
+    ru_decoder_start(dec);
+}
+
+static void *
+ru_media_prep_thread(void *_media) {
+    ru_thread_apply(RU_THREAD_CLASS_IO, "ru-media-prep");
+    logd("media: start prep thread tid=%d", gettid());
+
+    RuMedia *m = _media;
+
+    for (;;) {
+        RuMediaPrepRequest req;
+        ru_chan_pop_wait(&m->prep_chan, &req);
+
+        ru_decoder_free(req.retire);
+
+        if (req.type == RU_MEDIA_PREP_REQUEST_EXIT)
+            break;
+
+        let dec = ru_decoder_new(req.stream, req.clip);
+        ru_decoder_configure(dec, /*window*/ NULL);
+
+        logd("media: push RU_MEDIA_EVENT_STANDBY_READY(stream=%u, decoder=%u)",
+             req.stream->id, dec->id);
+        ru_media_push_event(m,
+            (RuMediaEvent) {
+                .type = RU_MEDIA_EVENT_STANDBY_READY,
+                .stream = req.stream->id,
+                .decoder_id = dec->id,
+                .standby_ready = {
+                    .dec = dec,
+                },
+            });
+    }
+
+    return NULL;
+}
+
+static bool _must_use_result_
+ru_media_stream_get_next_clip(RuMediaStream *s, size_t clip, size_t *next) {
+    if (clip + 1 < s->src_count) {
+        *next = clip + 1;
+        return true;
+    }
+
+    if (s->loop) {
+        *next = 0;
+        return true;
+    }
+
+    return false;
+}
+
+// Request the standby decoder for the clip that follows the given one.
+// Takes ownership of retire.
+static void
+ru_media_stream_request_standby(RuMediaStream *s, size_t clip,
+                                RuDecoder *retire) {
+    assert(!s->is_prep_pending);
+    assert(!s->standby);
+
+    RuMediaPrepRequest req = {
+        .type = RU_MEDIA_PREP_REQUEST_DECODER,
+        .stream = s,
+        .retire = retire,
+    };
+
+    if (!ru_media_stream_get_next_clip(s, clip, &req.clip)) {
+        logd("media: stream %u: playlist has no clip after %zu", s->id, clip);
+        ru_decoder_free(retire);
+        return;
+    }
+
+    logd("media: stream %u: request standby decoder for clip %zu",
+         s->id, req.clip);
+
+    s->is_prep_pending = true;
+    ru_chan_push(&s->media->prep_chan, &req);
+}
+
+static void
+ru_decoder_update_output_format(RuDecoder *dec) {
+    AMediaFormat *format = AMediaCodec_getOutputFormat(dec->codec);
+    if (!format)
+        die("media: AMediaCodec_getOutputFormat failed");
+
+    if (dec->output_format)
+        AMediaFormat_delete(dec->output_format);
+
+    dec->output_format = format;
+    ru_media_format_get_display_size(format, &dec->width, &dec->height);
+
+    logi("media: stream %u: decoder %u: output format changed: %dx%d",
+         dec->stream->id, dec->id, dec->width, dec->height);
+    logd("media: %s", AMediaFormat_toString(format));
+}
+
+static void
+ru_media_stream_set_aimage_reader(RuMediaStream *s, int32_t width,
+                                  int32_t height) {
+    int ret;
+
+    s->image_reader = ru_media_new_aimage_reader(width, height, s->image_count);
+    s->image_width = width;
+    s->image_height = height;
+
+    ret = AImageReader_getWindow(s->image_reader, &s->image_window);
+    if (ret)
+        die("media: AImageReader_getWindow failed: error=%d", ret);
+}
+
+// If the decoder's display size differs from the stream's AImageReader, then
+// replace the reader and redirect the decoder to it. The codec keeps running.
+//
+// A crop change alone keeps the reader, because each AImage carries its own
+// crop rect.
+//
+// Returns true if it replaced the reader. Else the decoder's output surface
+// is unchanged.
+static bool
+ru_media_stream_fit_aimage_reader(RuMediaStream *s, RuDecoder *dec) {
+    int ret;
+
+    if (dec->width == s->image_width && dec->height == s->image_height)
+        return false;
+
+    logi("media: stream %u: resize AImageReader from %dx%d to %dx%d",
+         s->id, s->image_width, s->image_height, dec->width, dec->height);
+
+    AImageReader *old_reader = s->image_reader;
+    ru_media_stream_set_aimage_reader(s, dec->width, dec->height);
+
+    // Disconnect the codec from the old reader's window before the consumer
+    // deletes the old reader.
+    ret = AMediaCodec_setOutputSurface(dec->codec, s->image_window);
+    if (ret)
+        die("media: AMediaCodec_setOutputSurface failed: error=%d", ret);
+
+    const RuMediaListener *l = &s->media->listener;
+    if (l->on_aimage_reader_replaced) {
+        l->on_aimage_reader_replaced(l->context, s->id, s->image_reader,
+                                     old_reader);
+    } else {
+        AImageReader_delete(old_reader);
+    }
+
+    return true;
+}
+
+static bool ru_media_stream_release_output(RuMediaStream *s, RuDecoder *dec,
+                                           const RuDecoderOutput *out)
+                                           _must_use_result_;
+
+// Redirect the pre-rolled standby decoder to the stream's AImageReader, then
+// release its held frames. The switch happens between two frames, and the
+// AImageReader and its consumers never notice.
+//
+// Returns false if the stream has ended.
+static bool _must_use_result_
+ru_media_promote_standby(RuMediaStream *s) {
+    RuDecoder *old = s->active;
+    RuDecoder *dec = s->standby;
+    int ret;
+
+    assert(dec->is_standby);
+    assert(!old->is_started);
+
+    logd("media: stream %u: promote decoder %u (clip %zu) with %zu held frames",
+         s->id, dec->id, dec->clip, ru_queue_len(&dec->held_outputs));
+
+    // Fit the reader to the new clip, which redirects the decoder to the new
+    // reader. The old codec is stopped, so the reader may be replaced under
+    // it. If the size is unchanged, redirect the decoder to the current
+    // reader; the old codec must be stopped first, because it remains
+    // connected to the window until then.
+    if (!ru_media_stream_fit_aimage_reader(s, dec)) {
+        ret = AMediaCodec_setOutputSurface(dec->codec, s->image_window);
+        if (ret)
+            die("media: AMediaCodec_setOutputSurface failed: error=%d", ret);
+    }
+
+    dec->is_standby = false;
+    AImageReader_delete(dec->standby_reader);
+    dec->standby_reader = NULL;
+
+    s->active = dec;
+    s->standby = NULL;
+    s->transition_start_ns = s->last_render_ns;
+    s->is_transition_measured = true;
+
+    ru_media_stream_request_standby(s, dec->clip, old);
+
+    RuDecoderOutput out;
+    while (ru_queue_pop(&dec->held_outputs, &out)) {
+        if (!ru_media_stream_release_output(s, dec, &out))
+            return false;
+    }
+
+    uint32_t index;
+    while (ru_queue_pop(&dec->pending_inputs, &index)) {
+        ru_decoder_queue_input(dec, index);
+    }
+
+    return true;
+}
+
+// Returns false if the stream has ended.
+static bool _must_use_result_
+ru_media_stream_on_active_eos(RuMediaStream *s) {
+    ru_decoder_stop(s->active);
+
+    if (s->standby)
+        return ru_media_promote_standby(s);
+
+    if (s->is_prep_pending) {
+        // Hold the last frame on screen until the standby is ready.
+        logi("media: stream %u: standby decoder is late; hold the last frame",
+             s->id);
+        s->is_switch_pending = true;
+        return true;
+    }
+
+    logd("media: stream %u: end of playlist", s->id);
+    return false;
+}
+
+static void
+ru_media_stream_report_transition(RuMediaStream *s, int64_t now_ns) {
+    int64_t gap_ns = now_ns - s->transition_start_ns;
+
+    s->is_transition_measured = false;
+    s->transition_count += 1;
+    s->transition_max_gap_ns = ru_max(s->transition_max_gap_ns, gap_ns);
+
+    logi("media: stream %u: transition %u to clip %zu: gap=%.3fms max_gap=%.3fms",
+         s->id, s->transition_count, s->active->clip,
+         ru_time_ns_to_ms(gap_ns),
+         ru_time_ns_to_ms(s->transition_max_gap_ns));
+}
+
+static bool
+ru_media_stream_release_output(RuMediaStream *s, RuDecoder *dec,
+                               const RuDecoderOutput *out) {
+    ru_trace_scoped("release output");
+    int ret;
+
+    bool eos = (out->info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM);
+    if (eos)
+        logd("media: stream %u: decoder %u: end of output stream", s->id, dec->id);
+
+    bool render = (out->info.size > 0);
+
+    ret = AMediaCodec_releaseOutputBuffer(dec->codec, out->index, render);
+    if (ret) {
+        die("media: AMediaCodec_releaseOutputBuffer(index=%d) "
+                "failed: error=%d", out->index, ret);
+    }
+
+    if (render) {
+        s->last_render_ns = ru_time_now_ns();
+        s->fatal_error_count = 0;
+
+        if (s->media->latency) {
+            ru_latency_stamp(s->media->latency, s->id,
+                             out->info.presentationTimeUs,
+                             RU_LATENCY_STAGE_RELEASE, s->last_render_ns);
+        }
+
+        if (s->is_transition_measured)
+            ru_media_stream_report_transition(s, s->last_render_ns);
+
+        if (ru_frame_rate_observe(&s->frame_rate,
+                                  out->info.presentationTimeUs * RU_NSEC_PER_USEC)) {
+            logi("media: stream %u: frame rate is %.3f Hz", s->id,
+                 s->frame_rate.hz);
+
+            const RuMediaListener *l = &s->media->listener;
+            if (l->on_frame_rate_changed)
+                l->on_frame_rate_changed(l->context, s->id, s->frame_rate.hz);
+        }
+    }
+
+    if (eos)
+        return ru_media_stream_on_active_eos(s);
+
+    return true;
+}
+
+static RuDecoder *
+ru_media_stream_find_decoder(RuMediaStream *s, uint32_t id) {
+    if (s->active && s->active->id == id)
+        return s->active;
+    if (s->standby && s->standby->id == id)
+        return s->standby;
+    return NULL;
+}
+
+static void
+ru_media_stream_start(RuMediaStream *s) {
+    ru_decoder_start(s->active);
+    ru_media_stream_request_standby(s, s->active->clip, /*retire*/ NULL);
+}
+
+static void
+ru_media_stream_stop(RuMediaStream *s) {
+    ru_decoder_free(s->standby);
+    s->standby = NULL;
+    ru_decoder_stop(s->active);
+}
+
+// Returns false once the media thread's work is done: on STOP, or when every
+// stream has ended.
+static bool _must_use_result_
+ru_media_handle_event(RuMedia *m, RuMediaEvent *ev) {
+    RuMediaStream *s = NULL;
+    if (ev->type != RU_MEDIA_EVENT_START && ev->type != RU_MEDIA_EVENT_STOP) {
+        assert(ev->stream < m->stream_count);
+        s = &m->streams[ev->stream];
+    }
+
+    switch (ev->type) {
+        case RU_MEDIA_EVENT_START:
+            logd("media: pop_MEDIA_EVENT_START");
+            for (uint32_t i = 0; i < m->stream_count; ++i) {
+                ru_media_stream_start(&m->streams[i]);
+            }
+            break;
+        case RU_MEDIA_EVENT_STOP:
+            logd("media: pop_MEDIA_EVENT_STOP");
+            return false;
+        case RU_MEDIA_EVENT_STANDBY_READY: {
+            logd("media: pop_MEDIA_EVENT_STANDBY_READY(stream=%u, decoder=%u)",
+                 ev->stream, ev->decoder_id);
+            assert(s->is_prep_pending);
+            s->is_prep_pending = false;
+
+            if (s->is_ended) {
+                ru_decoder_free(ev->standby_ready.dec);
+                break;
+            }
+
+            s->standby = ev->standby_ready.dec;
+            ru_decoder_start(s->standby);
+
+            if (s->is_switch_pending) {
+                s->is_switch_pending = false;
+                if (!ru_media_promote_standby(s))
+                    goto stream_ended;
+            }
+            break;
+        }
+        case RU_MEDIA_EVENT_BUFFER_IN: {
+            uint32_t index = ev->buffer_in.index;
+            logv_deferred("media: pop_MEDIA_EVENT_BUFFER_IN(stream=%u, decoder=%u, index=%u)",
+                          ev->stream, ev->decoder_id, index);
+
+            RuDecoder *dec = ru_media_stream_find_decoder(s, ev->decoder_id);
+            if (!dec || !dec->is_started) {
+                logd("media: drop event from retired decoder");
+                break;
+            }
+
+            if (dec->is_standby &&
+                ru_queue_len(&dec->held_outputs) +
+                ru_queue_len(&dec->pending_inputs) >= (size_t) s->preroll_count) {
+                // Pre-roll is full. Feed the buffer after promotion.
+                ru_queue_push(&dec->pending_inputs, &index);
+                break;
+            }
+
+            ru_decoder_queue_input(dec, index);
+            break;
+        }
+        case RU_MEDIA_EVENT_BUFFER_OUT: {
+            logv_deferred("media: pop_MEDIA_EVENT_BUFFER_OUT(stream=%u, decoder=%u, index=%u)",
+                          ev->stream, ev->decoder_id, ev->buffer_out.index);
+
+            RuDecoder *dec = ru_media_stream_find_decoder(s, ev->decoder_id);
+            if (!dec || !dec->is_started) {
+                logd("media: drop event from retired decoder");
+                break;
+            }
+
+            // Measure when the codec emits the frame, not when we release
+            // it, so pre-roll does not count.
+            ru_decoder_latency_on_output(dec, &ev->buffer_out.info);
+
+            if (dec->is_standby) {
+                // Pre-roll. Hold the frame until the standby is promoted.
+                ru_queue_push(&dec->held_outputs, &ev->buffer_out);
+                break;
+            }
 
-    if (pthread_create(&m->thread, NULL, ru_media_thread, m))
+            if (!ru_media_stream_release_output(s, dec, &ev->buffer_out))
+                goto stream_ended;
+            break;
+        }
+        case RU_MEDIA_EVENT_FORMAT_CHANGED: {
+            logd("media: pop_MEDIA_EVENT_FORMAT_CHANGED(stream=%u, decoder=%u)",
+                 ev->stream, ev->decoder_id);
+
+            RuDecoder *dec = ru_media_stream_find_decoder(s, ev->decoder_id);
+            if (!dec || !dec->is_started) {
+                logd("media: drop event from retired decoder");
+                break;
+            }
+
+            ru_decoder_update_output_format(dec);
+
+            // A standby decoder renders into its private reader.
+            // ru_media_promote_standby() fits the stream's reader.
+            if (!dec->is_standby)
+                ru_media_stream_fit_aimage_reader(s, dec);
+            break;
+        }
+        case RU_MEDIA_EVENT_CODEC_ERROR: {
+            logd("media: pop_MEDIA_EVENT_CODEC_ERROR(stream=%u, decoder=%u)",
+                 ev->stream, ev->decoder_id);
+
+            RuDecoder *dec = ru_media_stream_find_decoder(s, ev->decoder_id);
+            if (!dec || !dec->is_started) {
+                logd("media: drop event from retired decoder");
+                break;
+            }
+
+            if (AMediaCodecActionCode_isTransient(ev->codec_error.action)) {
+                // The codec retries on its own.
+                logi("media: stream %u: decoder %u: transient codec error=%d",
+                     s->id, dec->id, ev->codec_error.error);
+                break;
+            }
+
+            if (AMediaCodecActionCode_isRecoverable(ev->codec_error.action)) {
+                ru_decoder_recover(dec);
+                break;
+            }
+
+            // The codec is unusable. Retire it, and skip to the next clip.
+            loge("media: stream %u: decoder %u: fatal codec error=%d action=%d",
+                 s->id, dec->id, ev->codec_error.error, ev->codec_error.action);
+
+            const bool is_any_left = ++s->fatal_error_count <= s->src_count;
+
+            if (dec->is_standby) {
+                // The active decoder plays on. Pre-roll the clip after the
+                // failed one instead.
+                s->standby = NULL;
+
+                if (is_any_left) {
+                    ru_media_stream_request_standby(s, dec->clip, dec);
+                } else {
+                    logw("media: stream %u: every clip failed; end after "
+                         "clip %zu", s->id, s->active->clip);
+                    ru_decoder_free(dec);
+                }
+                break;
+            }
+
+            if (!is_any_left) {
+                logw("media: stream %u: every clip failed", s->id);
+                goto stream_ended;
+            }
+
+            // As at the end of the clip, promote the standby, or wait for
+            // it, or end the stream if the playlist has no more clips.
+            if (!ru_media_stream_on_active_eos(s))
+                goto stream_ended;
+            break;
+        }
+    }
+
+    return true;
+
+ stream_ended:
+    ru_media_stream_stop(s);
+    s->is_ended = true;
+
+    if (m->listener.on_stream_ended)
+        m->listener.on_stream_ended(m->listener.context, s->id);
+
+    if (--m->live_stream_count == 0) {
+        logd("media: all streams ended");
+        return false;
+    }
+
+    return true;
+}
+
+// Stop the streams and the prep thread.
+static void
+ru_media_finish_events(RuMedia *m) {
+    for (uint32_t i = 0; i < m->stream_count; ++i) {
+        ru_media_stream_stop(&m->streams[i]);
+    }
+
+    // Join the prep thread, then collect the standby decoders that it
+    // created after the streams stopped.
+    ru_chan_push(&m->prep_chan,
+        &(RuMediaPrepRequest) {
+            .type = RU_MEDIA_PREP_REQUEST_EXIT,
+        });
+
+    if (pthread_join(m->prep_thread, NULL))
+        abort();
+
+    RuMediaEvent ev;
+    while (ru_chan_pop_nowait(&m->event_chan, &ev)) {
+        if (ev.type == RU_MEDIA_EVENT_STANDBY_READY)
+            ru_decoder_free(ev.standby_ready.dec);
+    }
+
+    ru_mutex_lock_scoped(&m->done_mutex);
+    m->is_done = true;
+
+    if (pthread_cond_broadcast(&m->done_cond))
+        abort();
+}
+
+static void *
+ru_media_thread(void *_media) {
+    ru_thread_apply(RU_THREAD_CLASS_MEDIA, "ru-media");
+    logd("media: start thread tid=%d", gettid());
+
+    RuMedia *m = _media;
+
+    for (;;) {
+        RuMediaEvent ev;
+        ru_chan_pop_wait(&m->event_chan, &ev);
+
+        if (!ru_media_handle_event(m, &ev))
+            break;
+    }
+
+    ru_media_finish_events(m);
+    return NULL;
+}
+
+// The reactor's handler, in place of ru_media_thread(). Handles the queued
+// events without waiting for more.
+static void
+ru_media_dispatch(void *_media) {
+    RuMedia *m = _media;
+    RuMediaEvent ev;
+
+    while (!m->is_done && ru_chan_pop_nowait(&m->event_chan, &ev)) {
+        if (!ru_media_handle_event(m, &ev))
+            ru_media_finish_events(m);
+    }
+}
+
+static void
+ru_media_stream_init(RuMediaStream *s, RuMedia *m, uint32_t id,
+                     const struct ru_media_stream_args *args) {
+    if (args->src_count == 0)
+        die("media: stream %u: playlist is empty", id);
+
+    s->media = m;
+    s->id = id;
+    s->src_count = args->src_count;
+    s->src_paths = new_array(char *, args->src_count);
+    s->loop = args->loop;
+    ru_frame_rate_reset(&s->frame_rate);
+
+    for (size_t i = 0; i < args->src_count; ++i) {
+        s->src_paths[i] = xstrdup(args->src_paths[i]);
+    }
+
+    // Split the image budget evenly. Half of each stream's share is the
+    // standby decoder's pre-roll.
+    s->image_count = ru_min(RU_MEDIA_IMAGE_BUDGET / m->stream_count,
+                            RU_MEDIA_MAX_IMAGE_COUNT);
+    s->preroll_count = ru_max(s->image_count / 2, 1);
+
+    s->active = ru_decoder_new(s, 0);
+
+    ru_media_stream_set_aimage_reader(s, s->active->width, s->active->height);
+    ru_decoder_configure(s->active, s->image_window);
+
+    logd("media: stream %u: image_count=%d preroll_count=%d", s->id,
+         s->image_count, s->preroll_count);
+}
+
+static void
+ru_media_stream_finish(RuMediaStream *s) {
+    ru_decoder_free(s->active);
+    AImageReader_delete(s->image_reader);
+
+    for (size_t i = 0; i < s->src_count; ++i) {
+        free(s->src_paths[i]);
+    }
+
+    free(s->src_paths);
+}
+
+RuMedia *
+ru_media_new_s(struct ru_media_new_args args) {
+    if (args.stream_count == 0)
+        die("media: no streams");
+
+    if (args.stream_count > RU_MEDIA_IMAGE_BUDGET / RU_MEDIA_MIN_IMAGE_COUNT) {
+        die("media: %u streams exceed the image budget of %d",
+            args.stream_count, RU_MEDIA_IMAGE_BUDGET);
+    }
+
+    let m = new0(RuMedia);
+    m->stream_count = args.stream_count;
+    m->decoder_profile = args.decoder_profile;
+    m->codec_selector = ru_codec_selector_new_s(args.codec_selector);
+    m->listener = args.listener;
+    m->latency = args.latency;
+    m->streams = new0_array(RuMediaStream, args.stream_count);
+    m->live_stream_count = args.stream_count;
+    m->is_done = false;
+    m->done_mutex = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    m->done_cond = (pthread_cond_t) PTHREAD_COND_INITIALIZER;
+    m->reactor = args.reactor;
+    ru_reactor_link_init(&m->reactor_link);
+
+    ru_chan_init(&m->event_chan, sizeof(RuMediaEvent), 64);
+    ru_chan_init(&m->prep_chan, sizeof(RuMediaPrepRequest), 4);
+
+    for (uint32_t i = 0; i < m->stream_count; ++i) {
+        ru_media_stream_init(&m->streams[i], m, i, &args.streams[i]);
+    }
+
+    if (pthread_create(&m->prep_thread, NULL, ru_media_prep_thread, m))
         abort();
 
+    if (m->reactor) {
+        ru_reactor_link_set(&m->reactor_link, ru_reactor_add(m->reactor,
+            (RuReactorHandler) {
+                .context = m,
+                .dispatch = ru_media_dispatch,
+            }));
+    } else {
+        if (pthread_create(&m->thread, NULL, ru_media_thread, m))
+            abort();
+    }
+
     return m;
 }
 
@@ -364,14 +1513,41 @@ ru_media_free(RuMedia *m) {
 
     ru_media_stop(m);
 
-    if (pthread_join(m->thread, NULL))
-        abort();
+    if (m->reactor) {
+        // Wait for the reactor to handle the stop. Then the codecs are
+        // stopped and the prep thread is joined, so nothing else wakes the
+        // source.
+        {
+            ru_mutex_lock_scoped(&m->done_mutex);
+
+            while (!m->is_done) {
+                if (pthread_cond_wait(&m->done_cond, &m->done_mutex))
+                    abort();
+            }
+        }
+
+        RuReactorSource *src = ru_reactor_link_clear(&m->reactor_link);
+        ru_reactor_remove(m->reactor, src);
+    } else {
+        if (pthread_join(m->thread, NULL))
+            abort();
+    }
+
+    for (uint32_t i = 0; i < m->stream_count; ++i) {
+        ru_media_stream_finish(&m->streams[i]);
+    }
 
-    AImageReader_delete(m->image_reader);
-    AMediaCodec_delete(m->codec);
-    AMediaExtractor_delete(m->ex);
-    AMediaFormat_delete(m->format);
+    free(m->streams);
+    ru_codec_selector_free(m->codec_selector);
+    ru_chan_finish(&m->prep_chan);
     ru_chan_finish(&m->event_chan);
+
+    if (pthread_cond_destroy(&m->done_cond))
+        abort();
+
+    if (pthread_mutex_destroy(&m->done_mutex))
+        abort();
+
     free(m);
 }
 
@@ -393,8 +1569,45 @@ ru_media_stop(RuMedia *m) {
         });
 }
 
+bool
+ru_media_parse_playlist(char *s, bool loop, struct ru_media_stream_args *args) {
+    size_t count = 0;
+    for (const char *c = s; *c; ++c) {
+        if (*c != ':' && (c == s || c[-1] == ':'))
+            ++count;
+    }
+
+    if (count == 0)
+        return false;
+
+    const char **paths = new_array(const char *, count);
+
+    char *save = NULL;
+    size_t i = 0;
+    for (char *path = strtok_r(s, ":", &save); path;
+         path = strtok_r(NULL, ":", &save)) {
+        paths[i++] = path;
+    }
+
+    assert(i == count);
+
+    *args = (struct ru_media_stream_args) {
+        .src_paths = paths,
+        .src_count = count,
+        .loop = loop,
+    };
+
+    return true;
+}
+
+uint32_t
+ru_media_get_stream_count(RuMedia *m) {
+    return m->stream_count;
+}
+
 AImageReader *
-ru_media_get_aimage_reader(RuMedia *m) {
-    assert(m->image_reader);
-    return m->image_reader;
+ru_media_get_aimage_reader(RuMedia *m, uint32_t stream) {
+    assert(stream < m->stream_count);
+    assert(m->streams[stream].image_reader);
+    return m->streams[stream].image_reader;
 }
@@ -27,13 +27,95 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include "util/attribs.h"
 
+#include "ru_codec.h"
+
 typedef struct AImage AImage;
 typedef struct AImageReader AImageReader;
+typedef struct RuLatency RuLatency;
 typedef struct RuMedia RuMedia;
+typedef struct RuReactor RuReactor;
+
+typedef enum RuMediaDecoderProfile {
+    // Configure the codec with the container's format, unchanged.
+    RU_MEDIA_DECODER_PROFILE_DEFAULT = 0,
+
+    // Ask the codec to output each frame as soon as it is decoded, to run at
+    // its highest clock, and to schedule as a realtime client. Codecs may
+    // ignore any of these.
+    RU_MEDIA_DECODER_PROFILE_LOW_LATENCY,
+} RuMediaDecoderProfile;
+
+struct ru_media_stream_args {
+    // The playlist. Clips play in order, each starting at the frame after the
+    // previous clip's last frame. Must contain at least one path.
+    const char *const *src_paths;
+    size_t src_count;
+
+    // After the last clip, restart at the first.
+    bool loop;
+};
+
+// Split a colon-separated playlist, such as "a.mp4:b.mp4", in place into
+// args. Empty segments, as in "a::b" or ":a:", are skipped. Returns false,
+// and allocates nothing, if no path remains. Otherwise the caller must free
+// args->src_paths.
+bool ru_media_parse_playlist(char *s, bool loop,
+                             struct ru_media_stream_args *args) _must_use_result_;
+
+typedef struct RuMediaListener {
+    void *context;
 
-RuMedia *ru_media_new(const char *src_path) _malloc_ _must_use_result_;
+    // Called on the media thread when the decoder's output size changes and
+    // the stream replaces its AImageReader. The codec already renders into
+    // the new reader. The callee takes ownership of old_reader, and must
+    // delete it after returning all of its AImages.
+    //
+    // If null, then RuMedia deletes the old reader immediately.
+    void (*on_aimage_reader_replaced)(void *context, uint32_t stream,
+                                      AImageReader *reader,
+                                      AImageReader *old_reader);
+
+    // Called on the media thread when the stream's frame rate, estimated
+    // from the presentation timestamps of its rendered frames, settles on a
+    // new value. Variable-rate streams may never settle. May be null.
+    void (*on_frame_rate_changed)(void *context, uint32_t stream, float hz);
+
+    // Called on the media thread when the stream ends, after the last clip
+    // of a playlist that does not loop, or once every clip has failed in a
+    // row. The stream's reader keeps its last images. May be null.
+    void (*on_stream_ended)(void *context, uint32_t stream);
+} RuMediaListener;
+
+struct ru_media_new_args {
+    // Each stream decodes into its own AImageReader. One thread serves all
+    // streams, and the streams share a fixed budget of images.
+    const struct ru_media_stream_args *streams;
+    uint32_t stream_count;
+
+    RuMediaDecoderProfile decoder_profile;
+    struct ru_codec_selector_new_args codec_selector;
+    RuMediaListener listener;
+
+    // If set, stamp each frame's queue, decode and release stages, with the
+    // stream index as RuLatencyFrame::stream. Not owned, and must outlive
+    // the RuMedia.
+    RuLatency *latency;
+
+    // If set, serve the streams from the reactor's thread instead of from a
+    // media thread of their own. Each codec callback then wakes the reactor
+    // instead of a media thread, and RuMediaListener is called on the
+    // reactor's thread. Not owned, and must outlive the RuMedia.
+    RuReactor *reactor;
+};
+
+#define ru_media_new(...) ru_media_new_s((struct ru_media_new_args) { 0, __VA_ARGS__ })
+RuMedia *ru_media_new_s(struct ru_media_new_args args) _malloc_ _must_use_result_;
 
 // Implicitly calls ru_media_stop().
 void ru_media_free(RuMedia *m);
@@ -41,4 +123,8 @@ void ru_media_free(RuMedia *m);
 void ru_media_start(RuMedia *m);
 void ru_media_stop(RuMedia *m);
 
-AImageReader *ru_media_get_aimage_reader(RuMedia *m) _must_use_result_;
+uint32_t ru_media_get_stream_count(RuMedia *m) _must_use_result_;
+
+// Returns the stream's initial AImageReader. Call it before ru_media_start();
+// afterwards, RuMediaListener reports each replacement.
+AImageReader *ru_media_get_aimage_reader(RuMedia *m, uint32_t stream) _must_use_result_;
@@ -0,0 +1,443 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ru-media-play plays clips through RuMedia alone, without a renderer, and
+// prints a JSON report to stdout. It stands in for RuRend as the consumer of
+// each stream's AImageReader, so on the host it runs the decode pipeline
+// through src/ndk_host without Vulkan. It dies if a stream stalls.
+//
+//     usage: ru-media-play [-n IMAGES] [-t SECONDS] [-1] [-R] [-L LEVEL]
+//                          (-g WIDTHxHEIGHT [-o CLIP] | PLAYLIST [PLAYLIST...])
+//
+//     -n  Stop once each stream delivers this many images. Default is 90.
+//     -1  Play each playlist once instead of looping. A stream that ends
+//         then counts as done, however many images it delivered.
+//     -t  Die if the streams take longer than this. Default is 10.
+//     -R  Serve the streams from a reactor thread instead of the media
+//         thread. See RuReactor.
+//     -L  Log at this level and above, such as "debug". Default is "warn".
+//     -g  Instead of PLAYLISTs, play one stream of a synthetic Y4M clip of
+//         this size and RU_PLAY_SYNTH_FRAMES frames, written to a temporary
+//         file. Each frame's luma encodes its index, so the images must
+//         arrive in order, looping.
+//     -o  With -g, write the synthetic clip to this path instead, and keep
+//         it, so that ru-bench can play it too.
+//
+// Each PLAYLIST is a colon-separated list of files, like the app's mediaSrc,
+// and becomes one stream. Unless -1, playlists loop so that they outlast the
+// run.
+
+// stdlib
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Linux
+#include <pthread.h>
+#include <unistd.h>
+
+// Android
+#include <android/hardware_buffer.h>
+#include <media/NdkImage.h>
+#include <media/NdkImageReader.h>
+
+// local
+#include "util/alloc.h"
+#include "util/check.h"
+#include "util/log.h"
+#include "util/macros.h"
+#include "util/ru_reactor.h"
+#include "util/ru_thread.h"
+#include "util/ru_time.h"
+
+#include "ru_media.h"
+
+#define RU_PLAY_MAX_STREAMS 16
+
+// The synthetic clip. Frame i has luma 16 + i * RU_PLAY_SYNTH_LUMA_STEP,
+// within the limited range.
+#define RU_PLAY_SYNTH_FRAMES 30
+#define RU_PLAY_SYNTH_LUMA_STEP 7
+
+typedef struct RuPlay RuPlay;
+
+typedef struct RuPlayStream {
+    RuPlay *play;
+    uint32_t index;
+    size_t clip_count; // of the playlist
+
+    // Guarded by RuPlay::mutex.
+    bool is_ended;
+    uint64_t image_count;
+    int64_t first_image_ns;
+    int64_t last_image_ns;
+
+    // With -g, the index of the previous frame, and the images that did not
+    // follow it.
+    int32_t prev_frame;
+    uint64_t out_of_order_count;
+} RuPlayStream;
+
+struct RuPlay {
+    RuMedia *media;
+    RuReactor *reactor; // null unless -R
+    bool is_synth;
+
+    pthread_mutex_t mutex;
+    RuPlayStream streams[RU_PLAY_MAX_STREAMS];
+};
+
+// Write the synthetic clip, as I420 frames of uniform luma and grey chroma.
+static void
+ru_play_write_synth_clip(const char *path, uint32_t width, uint32_t height) {
+    FILE *f = fopen(path, "w");
+    if (!f)
+        die("failed to open %s", path);
+
+    const size_t luma_size = (size_t) width * height;
+    const size_t chroma_size = (size_t) ((width + 1) / 2) * ((height + 1) / 2);
+
+    _cleanup_free_ uint8_t *frame = xmalloc(luma_size + 2 * chroma_size);
+    memset(frame + luma_size, 128, 2 * chroma_size);
+
+    fprintf(f, "YUV4MPEG2 W%u H%u F30:1 Ip A1:1 C420jpeg\n", width, height);
+
+    for (uint32_t i = 0; i < RU_PLAY_SYNTH_FRAMES; ++i) {
+        memset(frame, 16 + i * RU_PLAY_SYNTH_LUMA_STEP, luma_size);
+        fprintf(f, "FRAME\n");
+
+        if (fwrite(frame, luma_size + 2 * chroma_size, 1, f) != 1)
+            die("failed to write %s", path);
+    }
+
+    if (fclose(f))
+        die("failed to write %s", path);
+}
+
+// Recover the synthetic frame's index from the luma of its first pixel.
+static int32_t
+ru_play_get_synth_frame(AImage *image) {
+    AHardwareBuffer *ahb;
+    if (AImage_getHardwareBuffer(image, &ahb) != AMEDIA_OK)
+        die("AImage_getHardwareBuffer failed");
+
+    void *map;
+    if (AHardwareBuffer_lock(ahb, AHARDWAREBUFFER_USAGE_CPU_READ_RARELY,
+                             /*fence*/ -1, /*rect*/ NULL, &map)) {
+        die("AHardwareBuffer_lock failed");
+    }
+
+    const int32_t luma = *(const uint8_t *) map;
+
+    if (AHardwareBuffer_unlock(ahb, /*fence*/ NULL))
+        die("AHardwareBuffer_unlock failed");
+
+    return (luma - 16 + RU_PLAY_SYNTH_LUMA_STEP / 2) / RU_PLAY_SYNTH_LUMA_STEP;
+}
+
+// Runs on a codec's callback thread. Consume the images as soon as they
+// arrive, as a renderer that never falls behind would.
+static void
+on_aimage_available(void *_stream, AImageReader *reader) {
+    RuPlayStream *s = _stream;
+    RuPlay *play = s->play;
+    AImage *image;
+
+    while (AImageReader_acquireNextImage(reader, &image) == AMEDIA_OK) {
+        int32_t frame = play->is_synth ? ru_play_get_synth_frame(image) : -1;
+        AImage_delete(image);
+
+        const int64_t now_ns = ru_time_now_ns();
+
+        ru_mutex_lock_scoped(&play->mutex);
+
+        if (s->image_count == 0)
+            s->first_image_ns = now_ns;
+
+        s->last_image_ns = now_ns;
+        ++s->image_count;
+
+        if (play->is_synth) {
+            if (s->prev_frame >= 0 &&
+                frame != (s->prev_frame + 1) % RU_PLAY_SYNTH_FRAMES) {
+                logw("stream %u: frame %d followed frame %d", s->index,
+                     frame, s->prev_frame);
+                ++s->out_of_order_count;
+            }
+
+            s->prev_frame = frame;
+        }
+    }
+}
+
+// Runs on the media thread.
+static void
+on_media_stream_ended(void *_play, uint32_t stream) {
+    RuPlay *play = _play;
+
+    logi("stream %u: ended", stream);
+
+    ru_mutex_lock_scoped(&play->mutex);
+    play->streams[stream].is_ended = true;
+}
+
+static void
+ru_play_listen(RuPlayStream *s, AImageReader *reader) {
+    AImageReader_setImageListener(reader,
+        &(AImageReader_ImageListener) {
+            .context = s,
+            .onImageAvailable = on_aimage_available,
+        });
+}
+
+// Runs on the media thread. Every image of the old reader was deleted as it
+// arrived, so the old reader can go at once.
+static void
+on_media_aimage_reader_replaced(void *_play, uint32_t stream,
+                                AImageReader *reader,
+                                AImageReader *old_reader) {
+    RuPlay *play = _play;
+
+    AImageReader_setImageListener(old_reader, NULL);
+    AImageReader_delete(old_reader);
+    ru_play_listen(&play->streams[stream], reader);
+}
+
+static noreturn void
+usage(void) {
+    fprintf(stderr,
+            "usage: ru-media-play [-n IMAGES] [-t SECONDS] [-1] [-R] [-L LEVEL]\n"
+            "                     (-g WIDTHxHEIGHT [-o CLIP] | PLAYLIST [PLAYLIST...])\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv) {
+    uint64_t target_count = 90;
+    double timeout_s = 10.0;
+    bool loop = true;
+    bool use_reactor = false;
+    RuLogLevel log_level = RU_LOG_LEVEL_WARN;
+    uint32_t synth_width = 0;
+    uint32_t synth_height = 0;
+    const char *synth_out_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:1RL:g:o:")) != -1) {
+        switch (opt) {
+            case 'n':
+                target_count = strtoull(optarg, NULL, 0);
+                if (target_count == 0)
+                    usage();
+                break;
+            case 't':
+                timeout_s = atof(optarg);
+                if (timeout_s <= 0.0)
+                    usage();
+                break;
+            case '1':
+                loop = false;
+                break;
+            case 'R':
+                use_reactor = true;
+                break;
+            case 'L':
+                if (!ru_log_parse_level(optarg, &log_level))
+                    usage();
+                break;
+            case 'g':
+                if (sscanf(optarg, "%ux%u", &synth_width, &synth_height) != 2 ||
+                    synth_width == 0 || synth_height == 0) {
+                    usage();
+                }
+                break;
+            case 'o':
+                synth_out_path = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+
+    ru_log_set_level(log_level);
+
+    const bool is_synth = synth_width > 0;
+    char synth_tmp_path[] = "/tmp/ru-media-play-XXXXXX.y4m";
+    char *synth_path = synth_tmp_path;
+    char **playlists = argv + optind;
+    uint32_t stream_count = argc - optind;
+
+    if (synth_out_path && !is_synth)
+        usage();
+
+    if (is_synth) {
+        if (stream_count != 0)
+            usage();
+
+        if (synth_out_path) {
+            // Split by ru_media_parse_playlist(), so copy it.
+            synth_path = xstrdup(synth_out_path);
+        } else {
+            int fd = mkstemps(synth_tmp_path, strlen(".y4m"));
+            if (fd < 0)
+                die("failed to create %s", synth_tmp_path);
+
+            close(fd);
+        }
+
+        ru_play_write_synth_clip(synth_path, synth_width, synth_height);
+
+        playlists = &synth_path;
+        stream_count = 1;
+    }
+
+    if (stream_count == 0 || stream_count > RU_PLAY_MAX_STREAMS)
+        usage();
+
+    struct ru_media_stream_args streams[RU_PLAY_MAX_STREAMS];
+    for (uint32_t i = 0; i < stream_count; ++i) {
+        if (!ru_media_parse_playlist(playlists[i], loop, &streams[i]))
+            die("bad playlist: playlist is empty");
+    }
+
+    let play = new0(RuPlay);
+    play->is_synth = is_synth;
+
+    if (pthread_mutex_init(&play->mutex, NULL))
+        abort();
+
+    for (uint32_t i = 0; i < stream_count; ++i) {
+        play->streams[i] = (RuPlayStream) {
+            .play = play,
+            .index = i,
+            .clip_count = streams[i].src_count,
+            .prev_frame = -1,
+        };
+    }
+
+    if (use_reactor)
+        play->reactor = ru_reactor_new("ru-reactor", RU_THREAD_CLASS_MEDIA);
+
+    play->media = ru_media_new(
+        .streams = streams,
+        .stream_count = stream_count,
+        .listener = {
+            .context = play,
+            .on_aimage_reader_replaced = on_media_aimage_reader_replaced,
+            .on_stream_ended = on_media_stream_ended,
+        },
+        .reactor = play->reactor);
+
+    for (uint32_t i = 0; i < stream_count; ++i) {
+        free((void *) streams[i].src_paths);
+        ru_play_listen(&play->streams[i],
+                       ru_media_get_aimage_reader(play->media, i));
+    }
+
+    const int64_t start_ns = ru_time_now_ns();
+    const int64_t deadline_ns = start_ns + (int64_t) (timeout_s * RU_NSEC_PER_SEC);
+
+    ru_media_start(play->media);
+
+    for (;;) {
+        bool is_done = true;
+
+        {
+            ru_mutex_lock_scoped(&play->mutex);
+
+            for (uint32_t i = 0; i < stream_count; ++i) {
+                if (!play->streams[i].is_ended &&
+                    play->streams[i].image_count < target_count) {
+                    is_done = false;
+                }
+            }
+        }
+
+        if (is_done)
+            break;
+
+        if (ru_time_now_ns() > deadline_ns)
+            die("streams delivered fewer than %" PRIu64 " images in %.3fs",
+                target_count, timeout_s);
+
+        ru_time_sleep_until_ns(ru_time_now_ns() + 10 * RU_NSEC_PER_MSEC);
+    }
+
+    ru_media_free(play->media);
+    ru_reactor_free(play->reactor);
+
+    if (synth_out_path)
+        free(synth_path);
+    else if (is_synth)
+        unlink(synth_path);
+
+    // The codecs are gone, so play->mutex is no longer needed.
+    const double elapsed_s = (double) (ru_time_now_ns() - start_ns) / RU_NSEC_PER_SEC;
+    uint64_t out_of_order_count = 0;
+    FILE *f = stdout;
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"duration_s\": %.3f,\n", elapsed_s);
+    fprintf(f, "  \"reactor\": %s,\n", use_reactor ? "true" : "false");
+    fprintf(f, "  \"streams\": [");
+
+    for (uint32_t i = 0; i < stream_count; ++i) {
+        const RuPlayStream *s = &play->streams[i];
+        const double span_s = (double) (s->last_image_ns - s->first_image_ns)
+                              / RU_NSEC_PER_SEC;
+
+        fprintf(f, "%s\n    {\"clips\": %zu, \"ended\": %s, "
+                "\"images\": %" PRIu64 ", \"fps\": %.3f",
+                i == 0 ? "" : ",", s->clip_count,
+                s->is_ended ? "true" : "false", s->image_count,
+                span_s > 0.0 ? (s->image_count - 1) / span_s : 0.0);
+
+        if (is_synth)
+            fprintf(f, ", \"out_of_order\": %" PRIu64, s->out_of_order_count);
+
+        fprintf(f, "}");
+        out_of_order_count += s->out_of_order_count;
+    }
+
+    fprintf(f, "\n  ]\n");
+    fprintf(f, "}\n");
+
+    if (pthread_mutex_destroy(&play->mutex))
+        abort();
+
+    free(play);
+
+    if (out_of_order_count > 0)
+        die("%" PRIu64 " images arrived out of order", out_of_order_count);
+
+    return 0;
+}
@@ -37,10 +37,15 @@
 // Linux
 #include <sys/types.h>
 #include <unistd.h>
+#ifdef ANDROID
+#include <dlfcn.h>
+#endif
 
 // Vulkan
 #include <vulkan/vulkan_core.h>
+#ifdef ANDROID
 #include <vulkan/vulkan_android.h>
+#endif
 
 // Android
 #include <android/hardware_buffer.h>
@@ -53,16 +58,51 @@
 #include "util/check.h"
 #include "util/log.h"
 #include "util/macros.h"
+#include "util/ru_cadence.h"
 #include "util/ru_chan.h"
+#include "util/ru_hist.h"
+#include "util/ru_latency.h"
+#include "util/ru_logring.h"
+#include "util/ru_math.h"
+#include "util/ru_pool.h"
 #include "util/ru_queue.h"
+#include "util/ru_reactor.h"
+#include "util/ru_spsc.h"
 #include "util/ru_thread.h"
+#include "util/ru_time.h"
+#include "util/ru_trace.h"
 
 #include "ru_rend.h"
+#include "ru_vsync.h"
 
 #define RU_FMT_MASK32 "#08x"
 #define RU_FMT_MASK64 "#016" PRIx64
 #define RU_FMT_VK_FLAGS RU_FMT_MASK32
 
+// With a vsync schedule, finish each frame this long before the predicted
+// vsync, to absorb the jitter of the frame times.
+#define RU_REND_LATCH_MARGIN_NS (2 * RU_NSEC_PER_MSEC)
+
+// ANATIVEWINDOW_FRAME_RATE_COMPATIBILITY_FIXED_SOURCE requires API 30. The
+// value is stable.
+#define RU_REND_FRAME_RATE_COMPATIBILITY_FIXED_SOURCE 1
+
+// Capacity of RuRend::done_spsc. Each frame is handed to the submit thread at
+// most once at a time, so this bounds the swapchain's length.
+#define RU_REND_MAX_HANDED_OFF_FRAMES 16
+
+// With a reactor, ru_rend_dispatch() draws at once if the latch time is this
+// close, and else asks to be dispatched again at the latch time.
+#define RU_REND_REACTOR_LATCH_SLACK_NS (500 * RU_NSEC_PER_USEC)
+
+// Between frames, ru_rend_destroy_retired() stops destroying retired
+// resources once it has spent this long.
+#define RU_REND_DESTROY_BUDGET_NS (500 * RU_NSEC_PER_USEC)
+
+typedef int32_t (*PFN_ANativeWindow_setFrameRate)(ANativeWindow *window,
+                                                  float frame_rate,
+                                                  int8_t compatibility);
+
 typedef struct RuInstance {
     VkInstance vk;
     VkDebugReportCallbackEXT debug_report_cb;
@@ -73,7 +113,9 @@ typedef struct RuInstance {
     PFN_vkGetPhysicalDeviceImageFormatProperties2KHR vkGetPhysicalDeviceImageFormatProperties2KHR;
 
     // TODO: Move these to RuDevice
+#ifdef ANDROID
     PFN_vkGetAndroidHardwareBufferPropertiesANDROID vkGetAndroidHardwareBufferPropertiesANDROID;
+#endif
     PFN_vkCreateSamplerYcbcrConversionKHR vkCreateSamplerYcbcrConversionKHR;
     PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSetKHR;
 } RuInstance;
@@ -105,14 +147,40 @@ typedef struct RuDevice {
     // Not much here...
     RuPhysicalDevice *phys_dev _not_owned_;
     VkDevice vk;
+
+    // VK_GOOGLE_display_timing is optional. Never enabled if headless.
+    bool has_display_timing;
+    PFN_vkGetPastPresentationTimingGOOGLE vkGetPastPresentationTimingGOOGLE;
+    PFN_vkGetRefreshCycleDurationGOOGLE vkGetRefreshCycleDurationGOOGLE;
 } RuDevice;
 
-// Resources for the scene that are specific to each AHB.
-typedef struct RuAhb {
-    AHardwareBuffer *ahb;
-    VkDeviceMemory mem;
-    VkImage image;
-    VkImageView image_view;
+typedef enum RuBlendMode {
+    RU_BLEND_MODE_OPAQUE,
+    RU_BLEND_MODE_ALPHA,
+    RU_BLEND_MODE_COUNT,
+} RuBlendMode;
+
+// Parameters of a VkSamplerYcbcrConversion. The AHBs from one decoder usually
+// share the same parameters.
+typedef struct RuYcbcrKey {
+    VkFormat format;
+    uint64_t external_format;
+    VkSamplerYcbcrModelConversion model;
+    VkSamplerYcbcrRange range;
+    VkComponentMapping components;
+    VkChromaLocation x_chroma_offset;
+    VkChromaLocation y_chroma_offset;
+} RuYcbcrKey;
+
+// Resources for the scene that depend on the AHB's YCbCr conversion, but not
+// on the AHB itself. Shared by all RuAhb with equal RuYcbcrKey.
+typedef struct RuYcbcrPipeline {
+    RuYcbcrKey key;
+
+    // The RuAhbs that use the pipeline. Guarded by the cache's mutex. See
+    // ru_rend_unref_ycbcr_pipeline().
+    uint32_t ref_count;
+
     VkSamplerYcbcrConversionKHR sampler_ycbcr_conv;
     VkSampler sampler;
 
@@ -121,24 +189,124 @@ typedef struct RuAhb {
     // combined-image-sampler.
     VkDescriptorSetLayout desc_set_layout;
     VkPipelineLayout pipeline_layout;
-    VkPipeline pipeline;
+
+    // Indexed by RuBlendMode. Created on first use.
+    VkPipeline pipelines[RU_BLEND_MODE_COUNT];
+} RuYcbcrPipeline;
+
+typedef struct RuYcbcrPipelineCache {
+    // With an import pool, the pool's workers create slots and pipelines
+    // while the render thread looks up pipelines, so the mutex guards both.
+    // It is not held while a pipeline compiles.
+    pthread_mutex_t mutex;
+
+    // Each is allocated separately, so that RuAhbs may point to it while the
+    // array grows. Once unreferenced, it moves to the retired queue.
+    RuYcbcrPipeline **pipelines;
+    uint32_t pipeline_count;
+} RuYcbcrPipelineCache;
+
+typedef struct RuAhbImport RuAhbImport;
+
+// Resources for the scene that are specific to each AHB.
+typedef struct RuAhb {
+    AHardwareBuffer *ahb;
+    VkDeviceMemory mem;
+    VkImage image;
+    VkImageView image_view;
+    RuYcbcrPipeline *ycbcr_pipeline _not_owned_;
+
+    // The AImageReader that produced the AHB.
+    AImageReader *aimage_reader _not_owned_;
 
     // If non-null, the AImage holds a reference to the AHB.
     AImage *aimage;
 
-    // RuRend::aimage_reader holds a reference to the AHB. Therefore the AHB
-    // may continue to receive updates from the media decoder.
+    // The AImage's crop rect, normalized to the AHB: u0, v0, u1, v1. The
+    // decoder may crop without changing the AHB's size.
+    float crop[4];
+
+    // Counts the references to `aimage`: one from RuLayer::latest, plus one
+    // from each RuFrame that draws it. When the count drops to zero, we
+    // return the AImage to its AImageReader.
+    uint32_t use_count;
+
+    // The layer's AImageReader holds a reference to the AHB. Therefore the
+    // AHB may continue to receive updates from the media decoder.
     bool in_aimage_reader;
+
+    // Non-null while the import pool imports the AHB. Meanwhile, only `ahb`,
+    // `aimage_reader` and `in_aimage_reader` are valid. See
+    // ru_rend_poll_import().
+    RuAhbImport *import;
+
+#ifndef ANDROID
+    // The host's Vulkan cannot import AHBs. Instead, ru_ahb_stage() copies
+    // each new AImage into the mapped staging buffer, and the next frame
+    // copies the staging buffer into `image`.
+    VkExtent2D extent; // of `image`
+    uint32_t stride; // of the AHB's rows, in bytes
+    VkBuffer staging_buffer;
+    VkDeviceMemory staging_mem;
+    void *staging_map;
+    bool needs_upload;
+#endif
 } RuAhb;
 
+// Vertex and fragment shader push constants. See quad.vert.glsl.
+typedef struct RuLayerPushConsts {
+    float rect[4]; // x0, y0, x1, y1 in normalized device coordinates
+    float crop[4]; // u0, v0, u1, v1 in texture coordinates
+    float opacity;
+} RuLayerPushConsts;
+
+// One video stream in the scene.
+typedef struct RuLayer {
+    RuRend *rend _not_owned_;
+    uint32_t index; // into RuRend::layers
+    AImageReader *aimage_reader _not_owned_;
+    RuRendRect rect;
+    int32_t z;
+    float opacity;
+    float frame_rate_hz; // from ru_rend_set_frame_rate(); 0 if unknown
+
+    // Incremented by AImageReader_ImageListener::onImageAvailable. Protected
+    // by RuAImageHeap::aimage_available::mutex.
+    uint32_t aimage_available_count;
+
+    // Time of the latest onImageAvailable. Protected like
+    // aimage_available_count.
+    int64_t aimage_available_ns;
+
+    // The RuAhb of the layer's most recently acquired AImage. Holds one
+    // RuAhb::use_count. The layer draws it until a newer AImage arrives.
+    RuAhb *latest;
+
+    // The newest acquired AImage whose AHB is still importing on the import
+    // pool, or null. The layer draws it once the import finishes, unless a
+    // newer AImage replaces it first.
+    AImage *pending_aimage;
+    RuAhb *pending_rahb;
+    int64_t pending_available_ns;
+} RuLayer;
+
+// Collects the image notifications of all layers' AImageReaders.
 typedef struct RuAImageHeap {
-    AImageReader *aimage_reader;
-
-    // Incremented by AImageReader_ImageListener::onImageAvailable.
+    // Incremented by AImageReader_ImageListener::onImageAvailable. The count
+    // sums RuLayer::aimage_available_count.
     struct {
         pthread_mutex_t mutex;
         pthread_cond_t cond;
         uint32_t count;
+
+        // The render thread is idle in ru_chan_pop_wait(). The next
+        // onImageAvailable wakes it with RU_REND_EVENT_AIMAGE_AVAILABLE.
+        bool wake_rend;
+
+        // Imports that finished on the import pool since the last pop. Each
+        // may let a layer draw its pending AImage, so it counts like a new
+        // AImage.
+        uint32_t import_count;
     } aimage_available;
 } RuAImageHeap;
 
@@ -149,12 +317,25 @@ typedef struct RuAhbCache {
 
 typedef struct RuSwapchain {
     RuDevice *dev _not_owned_;
-    VkSwapchainKHR vk;
+    VkSwapchainKHR vk; // null if is_headless
     VkExtent2D extent;
     uint32_t len;
-    VkImage *images _not_owned_;
+    VkImage *images; // the VkImages are owned iff is_headless
     uint32_t queue_fam_index;
-    VkResult status; // set by vkQueuePresentKHR
+    VkResult status; // set by vkQueuePresentKHR; guarded by mutex
+
+    // Vulkan requires that the swapchain be externally synchronized. With a
+    // submit thread, the render thread acquires while the submit thread
+    // presents, so both hold the mutex. Held for vkAcquireNextImageKHR,
+    // vkQueuePresentKHR, and the VK_GOOGLE_display_timing queries.
+    pthread_mutex_t mutex;
+
+    // A headless swapchain is a ring of offscreen images that we allocate
+    // ourselves. Nothing acquires or presents them; the frames simply take
+    // turns. See ru_swapchain_new_headless().
+    bool is_headless;
+    VkDeviceMemory *image_mems; // length is len; null unless is_headless
+    uint32_t next_image_index; // valid iff is_headless
 } RuSwapchain;
 
 // Container for all resources needed to record a frame's command buffer.
@@ -183,12 +364,36 @@ typedef struct RuFrame {
     VkFence release_fence;
     VkSemaphore release_sem;
 
+    // The command buffer writes timestamps into queries `first_query` and
+    // `first_query + 1` of the pool, at the start and end of the render
+    // pass. Null if the queue lacks timestamps.
+    VkQueryPool query_pool _not_owned_;
+    uint32_t first_query;
+
     // Acquired Data
     // -------------
     // These members are freshly set each time the frame is acquired.
 
-    // Received from RuMedia when a new media frame is available.
-    RuAhb *rahb;
+    // Indexed by RuLayer::index. Null if the layer has not yet received an
+    // image. Each holds one RuAhb::use_count.
+    RuAhb *rahbs[RU_REND_MAX_LAYERS];
+
+    // Reported to RuRendListener when the frame is reset.
+    RuRendFrameInfo info;
+
+    // VkPresentTimeGOOGLE::desiredPresentTime. Zero for as soon as possible.
+    int64_t desired_present_ns;
+
+    // Durations of the frame's phases, indexed by RuRendPhase. The render
+    // thread fills them up to RU_REND_PHASE_RECORD, and whichever thread
+    // submits the frame adds the rest and moves them into the histograms.
+    int64_t phase_ns[RU_REND_PHASE_COUNT];
+
+    int64_t latch_ns; // when the frame latched its AImages
+
+    // The submit thread owns the frame until it hands the frame back. Only
+    // the render thread reads or writes this. See ru_rend_wait_for_submit().
+    bool is_handed_off;
 } RuFrame;
 
 // All child resources use the same queue family as the
@@ -196,10 +401,43 @@ typedef struct RuFrame {
 typedef struct RuFramechain {
     RuSwapchain *swapchain _not_owned_;
     VkFence swapchain_fence;
+    VkQueryPool query_pool; // 2 timestamps per frame. May be null.
     RuFrame *frames; // length is swapchain->len
+
+    // Frames whose submission has finished, in order. The render thread
+    // resets each once its fence signals. See ru_framechain_collect().
     RuQueue submitted_frames;
 } RuFramechain;
 
+typedef enum RuRetiredType {
+    RU_RETIRED_AHB,
+    RU_RETIRED_FRAMECHAIN,
+    RU_RETIRED_YCBCR_PIPELINE,
+} RuRetiredType;
+
+// A resource that no frame will draw with again, awaiting destruction. See
+// ru_rend_destroy_retired().
+typedef struct RuRetired {
+    RuRetiredType type;
+
+    union {
+        // Invalidated in the AHB cache. No frame holds the AHB, so the GPU is
+        // done with it.
+        RuAhb ahb;
+
+        // Replaced by a new swapchain. Frames may still execute, so wait for
+        // the release_fence of each frame that is not reset.
+        struct {
+            RuFramechain *framechain;
+            RuSwapchain *swapchain;
+        } framechain;
+
+        // Unreferenced by the last RuAhb, which was destroyed first, so the
+        // GPU is done with it. Owned.
+        RuYcbcrPipeline *ycbcr_pipeline;
+    };
+} RuRetired;
+
 typedef enum RuRendEventType {
     RU_REND_EVENT_START,
     RU_REND_EVENT_STOP,
@@ -208,6 +446,11 @@ typedef enum RuRendEventType {
     RU_REND_EVENT_BIND_WINDOW,
     RU_REND_EVENT_UNBIND_WINDOW,
     RU_REND_EVENT_AIMAGE_BUFFER_REMOVED,
+    RU_REND_EVENT_REPLACE_AIMAGE_READER,
+    RU_REND_EVENT_SET_FRAME_RATE,
+
+    // Wakes the idle render thread. See ru_aimage_heap_poll().
+    RU_REND_EVENT_AIMAGE_AVAILABLE,
 } RuRendEventType;
 
 typedef struct RuRendEvent {
@@ -215,7 +458,8 @@ typedef struct RuRendEvent {
 
     union {
         struct {
-            AImageReader *aimage_reader;
+            RuRendLayer *layers; // owned by the event
+            uint32_t layer_count;
         } start;
 
         struct {
@@ -225,9 +469,26 @@ typedef struct RuRendEvent {
         struct {
             AHardwareBuffer *ahb;
         } aimage_buffer_removed;
+
+        struct {
+            uint32_t layer;
+            AImageReader *aimage_reader;
+            AImageReader *old_aimage_reader; // owned by the event
+        } replace_aimage_reader;
+
+        struct {
+            uint32_t layer;
+            float hz;
+        } set_frame_rate;
     };
 } RuRendEvent;
 
+// Hands a recorded frame to the submit thread. See ru_rend_submit_thread().
+typedef struct RuRendSubmit {
+    RuFramechain *framechain;
+    RuFrame *frame; // Null tells the submit thread to exit.
+} RuRendSubmit;
+
 typedef struct RuRend {
     RuInstance inst;
     RuPhysicalDevice phys_dev;
@@ -243,7 +504,12 @@ typedef struct RuRend {
     VkShaderModule vert_module;
     VkShaderModule frag_module;
 
-    // Lifetime is that of app's ANativeWindow.
+    // If set, render into a headless RuSwapchain of this extent, and never
+    // bind a window.
+    bool headless;
+    VkExtent2D headless_extent;
+
+    // Lifetime is that of app's ANativeWindow. Always null if headless.
     RuSurface *surf;
 
     // We create/destroy these in response to window events and to errors from
@@ -252,10 +518,114 @@ typedef struct RuRend {
     RuFramechain *framechain;
 
     RuAhbCache ahb_cache;
-    RuAImageHeap aimage_heap; // valid iff RuAImageHeap::aimage_reader != NULL
+    RuYcbcrPipelineCache ycbcr_pipeline_cache;
+
+    RuLayer layers[RU_REND_MAX_LAYERS];
+    uint32_t layer_count;
+    RuAImageHeap aimage_heap; // valid iff layer_count > 0
+
+    // AImageReaders replaced by ru_rend_replace_aimage_reader(). Each is
+    // deleted once no frame draws any of its AImages.
+    AImageReader *retired_aimage_readers[RU_REND_MAX_LAYERS];
+    uint32_t retired_aimage_reader_count;
+
+    // Of RuRetired, oldest first. The render thread destroys them between
+    // frames, a few at a time, so that no frame pays for a large teardown.
+    RuQueue retired;
+
+    RuRendListener listener;
+    uint64_t frame_seq; // RuRendFrameInfo::seq of the next frame
+    RuLatency *latency _not_owned_; // may be null
+
+    // If set, AHBs import on the pool. See ru_rend_import_ahb().
+    RuPool *import_pool _not_owned_;
+
+    // Counts the import jobs that may still touch the RuRend, so that
+    // ru_rend_free() can wait for them.
+    struct {
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        uint32_t count;
+    } imports_in_flight;
+
+    // Null unless ru_rend_new_args::use_vsync_schedule. See
+    // ru_rend_wait_for_latch().
+    RuVsync *vsync;
+
+    // The time from latching a frame's AImages to the GPU finishing the
+    // frame, estimated from recent frames. It rises at once and decays
+    // slowly, so that one fast frame does not cause the next to miss its
+    // vsync. Written by whichever thread submits.
+    _Atomic int64_t latch_budget_ns;
+    _Atomic int64_t last_gpu_ns; // RuRendFrameInfo::gpu_ns of the last completed frame
+
+    // The greatest frame rate among the layers, or 0 if none is known.
+    float frame_rate_hz;
+
+    // ANativeWindow_setFrameRate requires API 30, above our minSdkVersion,
+    // so look it up at runtime. Null if headless or unavailable.
+    void *libnativewindow;
+    PFN_ANativeWindow_setFrameRate ANativeWindow_setFrameRate;
+    float window_frame_rate_hz; // last requested of the window, or 0
+
+    // If the display is faster than frame_rate_hz, each frame stays on the
+    // display for the number of vsyncs that the cadence gives, and
+    // cadence_vsync_ns is the vsync at which the next frame is due. Zero if
+    // there is no cadence. See ru_rend_advance_cadence().
+    RuCadence cadence;
+    int64_t cadence_vsync_ns;
+
+    // When the previous frame began. Zero after a pause, so that the pause
+    // is not counted as a frame interval. Written by whichever thread
+    // submits, and by the render thread while no frame is handed off.
+    int64_t prev_frame_begin_ns;
+
+    struct {
+        pthread_mutex_t mutex;
+        RuHist phase_hists[RU_REND_PHASE_COUNT];
+        uint64_t idle_count; // RuRendStats::idle_count
+        uint64_t missed_vsync_count; // RuRendStats::missed_vsync_count
+        uint64_t deferred_aimage_count; // RuRendStats::deferred_aimage_count
+        uint64_t ahb_import_count; // RuRendStats::ahb_import_count
+        int64_t startup_hitch_ns; // RuRendStats::startup_hitch_ns
+    } stats;
 
     RuChan event_chan;
-    pthread_t thread; // See ru_rend_thread().
+    pthread_t thread; // See ru_rend_thread(). Unused if reactor is set.
+
+    // If set, the reactor's thread runs the render loop instead of thread.
+    // See ru_rend_dispatch().
+    RuReactor *reactor _not_owned_;
+    // The AImageReader listeners and the import jobs wake the reactor
+    // through it. ru_rend_free() clears it, which waits out any wake in
+    // flight, before it removes the source.
+    RuReactorLink reactor_link;
+
+    // Set on RU_REND_EVENT_STOP. Only with a reactor. Written under
+    // stop_mutex, which ru_rend_free() waits on with stop_cond. The reactor
+    // thread may read it without the mutex.
+    bool is_stopped;
+    pthread_mutex_t stop_mutex;
+    pthread_cond_t stop_cond;
+
+    // State of the render loop, owned by whichever thread runs it.
+    bool is_started;
+    bool is_paused;
+    bool is_window_bound;
+
+    // No layer has a new AImage, so sleep until an event arrives. See
+    // ru_aimage_heap_poll().
+    bool is_idle;
+    int64_t idle_begin_ns;
+
+    // If set, the render thread records each frame and hands it to the
+    // submit thread, which submits and presents it while the render thread
+    // prepares the next. See ru_rend_submit_thread().
+    bool use_submit_thread;
+    RuSpsc submit_spsc; // RuRendSubmit, to the submit thread
+    RuSpsc done_spsc; // RuFrame *, back to the render thread
+    uint32_t handed_off_count; // frames not yet back from the submit thread
+    pthread_t submit_thread;
 } RuRend;
 
 // Use the driver's default allocator.
@@ -270,7 +640,14 @@ static const VkSurfaceFormatKHR ru_present_format = {
     .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
 };
 
+// Enough images that the CPU may record a frame while the queue executes the
+// previous two, as with a FIFO swapchain.
+static const uint32_t ru_headless_image_count = 3;
+
 static void *ru_rend_thread(void *_rend);
+static void *ru_rend_submit_thread(void *_rend);
+static void ru_rend_dispatch(void *_rend);
+static void ru_rend_push_event(RuRend *rend, RuRendEvent ev);
 
 static void __attribute__((sentinel))
 ru_chain_vk_structs(void *s, ...) {
@@ -354,6 +731,7 @@ ru_choose_queue_family(RuPhysicalDevice *phys_dev) {
     die("failed to find a graphics queue");
 }
 
+#ifdef ANDROID
 static int
 ru_vk_debug_report_flags_to_android_log_level(VkDebugReportFlagsEXT flags) {
     if (flags & VK_DEBUG_REPORT_ERROR_BIT_EXT) {
@@ -370,6 +748,7 @@ ru_vk_debug_report_flags_to_android_log_level(VkDebugReportFlagsEXT flags) {
         return ANDROID_LOG_VERBOSE;
     }
 }
+#endif
 
 // Vulkan on android-armeabi-v7a uses a non-default calling convention, which
 // we must use here to avoid compilation failure.
@@ -383,6 +762,7 @@ ru_vk_debug_report(
         const char *pLayerPrefix,
         const char *pMessage,
         void *pUserData) {
+#ifdef ANDROID
     int level = ru_vk_debug_report_flags_to_android_log_level(flags);
 
     __android_log_print(
@@ -396,6 +776,17 @@ ru_vk_debug_report(
         messageCode,
         pLayerPrefix,
         pMessage);
+#else
+    // The host log has no levels. The flags tell the severity.
+    logd("vkDebug:0x%x:%i:0x%"PRIx64":%zu:%i:%s:%s",
+        flags,
+        objectType,
+        object,
+        location,
+        messageCode,
+        pLayerPrefix,
+        pMessage);
+#endif
 
     return VK_FALSE;
 }
@@ -414,6 +805,7 @@ ru_vk_debug_report(
 static void
 ru_instance_init(
         bool use_validation,
+        bool headless,
         RuInstance *inst)
 {
     *inst = (RuInstance) {0};
@@ -470,30 +862,43 @@ ru_instance_init(
         logd("    %s", ext_props[i].extensionName);
     }
 
-    static const char *enable_exts[] = {
+    static const char *base_exts[] = {
         "VK_EXT_debug_report",
             // Requires:
             //    nothing
 
-        "VK_KHR_surface",
+        "VK_KHR_external_memory_capabilities",
             // Requires:
             //     nothing
 
-        "VK_KHR_android_surface",
+        "VK_KHR_get_physical_device_properties2",
             // Requires:
-            //     VK_KHR_surface
+            //     nothing
+    };
 
-        "VK_KHR_external_memory_capabilities",
+    // A headless renderer has no VkSurfaceKHR.
+    static const char *surface_exts[] = {
+        "VK_KHR_surface",
             // Requires:
             //     nothing
 
-        "VK_KHR_get_physical_device_properties2",
+        "VK_KHR_android_surface",
             // Requires:
-            //     nothing
+            //     VK_KHR_surface
     };
 
-    static const uint32_t enable_ext_count =
-        ARRAY_LEN(enable_exts);
+    const char *enable_exts[ARRAY_LEN(base_exts) + ARRAY_LEN(surface_exts)];
+    uint32_t enable_ext_count = 0;
+
+    for (uint32_t i = 0; i < ARRAY_LEN(base_exts); ++i) {
+        enable_exts[enable_ext_count++] = base_exts[i];
+    }
+
+    if (!headless) {
+        for (uint32_t i = 0; i < ARRAY_LEN(surface_exts); ++i) {
+            enable_exts[enable_ext_count++] = surface_exts[i];
+        }
+    }
 
     logd("Enable Vulkan instance extensions:");
     for (uint32_t i = 0; i < enable_ext_count; ++i) {
@@ -518,7 +923,7 @@ ru_instance_init(
             },
             .enabledLayerCount = enable_layer_count,
             .ppEnabledLayerNames = enable_layers,
-            .enabledExtensionCount = ARRAY_LEN(enable_exts),
+            .enabledExtensionCount = enable_ext_count,
             .ppEnabledExtensionNames = enable_exts,
         },
         ru_alloc_cb,
@@ -526,7 +931,9 @@ ru_instance_init(
 
     ru_instance_init_proc_addr(inst, vkCreateDebugReportCallbackEXT);
     ru_instance_init_proc_addr(inst, vkDestroyDebugReportCallbackEXT);
+#ifdef ANDROID
     ru_instance_init_proc_addr(inst, vkGetAndroidHardwareBufferPropertiesANDROID);
+#endif
     ru_instance_init_proc_addr(inst, vkGetPhysicalDeviceFeatures2KHR);
     ru_instance_init_proc_addr(inst, vkGetPhysicalDeviceProperties2KHR);
     ru_instance_init_proc_addr(inst, vkGetPhysicalDeviceImageFormatProperties2KHR);
@@ -709,6 +1116,23 @@ ru_phys_dev_finish(RuPhysicalDevice *phys_dev) {
     free(phys_dev->queue_fam_props);
 }
 
+// Return the first memory type in type_bits that has all the property flags.
+static uint32_t _must_use_result_
+ru_phys_dev_find_memory_type(RuPhysicalDevice *phys_dev, uint32_t type_bits,
+                             VkMemoryPropertyFlags flags) {
+    const VkPhysicalDeviceMemoryProperties *props = &phys_dev->mem_props;
+
+    for (uint32_t i = 0; i < props->memoryTypeCount; ++i) {
+        if ((type_bits & (1u << i)) &&
+            (props->memoryTypes[i].propertyFlags & flags) == flags) {
+            return i;
+        }
+    }
+
+    die("no VkMemoryType in %" RU_FMT_VK_FLAGS " has VkMemoryPropertyFlags(%"
+        RU_FMT_VK_FLAGS ")", type_bits, flags);
+}
+
 static RuSurface * _malloc_ _must_use_result_
 ru_surface_new(
         RuPhysicalDevice *phys_dev,
@@ -717,6 +1141,7 @@ ru_surface_new(
     RuInstance *inst = phys_dev->inst;
 
     VkSurfaceKHR vk_surf;
+#ifdef ANDROID
     check(vkCreateAndroidSurfaceKHR(inst->vk,
         &(VkAndroidSurfaceCreateInfoKHR) {
             .sType = VK_STRUCTURE_TYPE_ANDROID_SURFACE_CREATE_INFO_KHR,
@@ -725,6 +1150,10 @@ ru_surface_new(
         },
         ru_alloc_cb,
         &vk_surf));
+#else
+    (void) inst;
+    die("the host has no window system; use a headless renderer");
+#endif
 
     VkSurfaceCapabilitiesKHR caps;
     check(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(phys_dev->vk, vk_surf,
@@ -795,13 +1224,19 @@ ru_surface_free(RuSurface *surf) {
 static void
 ru_device_init(
         RuPhysicalDevice *phys_dev,
+        bool headless,
         RuDevice *dev)
 {
-    static const char *enable_exts[] = {
+    // A headless renderer has no VkSwapchainKHR.
+    static const char *swapchain_exts[] = {
         "VK_KHR_swapchain",
             // Requires:
             //     i/VK_KHR_surface
+    };
 
+    static const char *base_exts[] = {
+        // The host has no AHBs to import. See ru_ahb_stage().
+#ifdef ANDROID
         "VK_ANDROID_external_memory_android_hardware_buffer",
             // Requires:
             //     d/VK_KHR_sampler_ycbcr_conversion
@@ -823,6 +1258,7 @@ ru_device_init(
             // Requires:
             //     d/VK_KHR_external_memory
 #endif
+#endif // ANDROID
 
         "VK_KHR_sampler_ycbcr_conversion",
             // Requires:
@@ -848,8 +1284,24 @@ ru_device_init(
             //     i/VK_KHR_get_physical_device_properties2
     };
 
+    // Reports when each frame reached the display. See RuLatency.
+    static const char *display_timing_ext = "VK_GOOGLE_display_timing";
+
+    const char *enable_exts[ARRAY_LEN(swapchain_exts) + ARRAY_LEN(base_exts) + 1];
+    uint32_t enable_ext_count = 0;
+
+    if (!headless) {
+        for (uint32_t i = 0; i < ARRAY_LEN(swapchain_exts); ++i) {
+            enable_exts[enable_ext_count++] = swapchain_exts[i];
+        }
+    }
+
+    for (uint32_t i = 0; i < ARRAY_LEN(base_exts); ++i) {
+        enable_exts[enable_ext_count++] = base_exts[i];
+    }
+
     logd("Enable Vulkan device extensions:");
-    for (uint32_t i = 0; i < ARRAY_LEN(enable_exts); ++i) {
+    for (uint32_t i = 0; i < enable_ext_count; ++i) {
         if (!ru_has_extension(
                     phys_dev->avail_ext_props,
                     phys_dev->avail_ext_count,
@@ -861,6 +1313,15 @@ ru_device_init(
         logd("    %s", enable_exts[i]);
     }
 
+    const bool has_display_timing = !headless &&
+        ru_has_extension(phys_dev->avail_ext_props, phys_dev->avail_ext_count,
+                         display_timing_ext);
+
+    if (has_display_timing) {
+        enable_exts[enable_ext_count++] = display_timing_ext;
+        logd("    %s", display_timing_ext);
+    }
+
     // Acquire exactly one VkQueue handle for each queue family.
     VkDeviceQueueCreateInfo queue_create_infos[phys_dev->queue_fam_count];
     for (uint32_t i = 0; i < phys_dev->queue_fam_count; ++i) {
@@ -879,7 +1340,7 @@ ru_device_init(
             .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
             .queueCreateInfoCount = phys_dev->queue_fam_count,
             .pQueueCreateInfos = queue_create_infos,
-            .enabledExtensionCount = ARRAY_LEN(enable_exts),
+            .enabledExtensionCount = enable_ext_count,
             .ppEnabledExtensionNames = enable_exts,
         },
         ru_alloc_cb,
@@ -888,7 +1349,20 @@ ru_device_init(
     *dev = (RuDevice) {
         .phys_dev = phys_dev,
         .vk = vk_dev,
+        .has_display_timing = has_display_timing,
     };
+
+    if (has_display_timing) {
+        dev->vkGetPastPresentationTimingGOOGLE = (PFN_vkGetPastPresentationTimingGOOGLE)
+            vkGetDeviceProcAddr(vk_dev, "vkGetPastPresentationTimingGOOGLE");
+        if (!dev->vkGetPastPresentationTimingGOOGLE)
+            die("vkGetDeviceProcAddr(\"vkGetPastPresentationTimingGOOGLE\") failed");
+
+        dev->vkGetRefreshCycleDurationGOOGLE = (PFN_vkGetRefreshCycleDurationGOOGLE)
+            vkGetDeviceProcAddr(vk_dev, "vkGetRefreshCycleDurationGOOGLE");
+        if (!dev->vkGetRefreshCycleDurationGOOGLE)
+            die("vkGetDeviceProcAddr(\"vkGetRefreshCycleDurationGOOGLE\") failed");
+    }
 }
 
 static void
@@ -897,12 +1371,20 @@ ru_device_finish(RuDevice *dev)
     vkDestroyDevice(dev->vk, ru_alloc_cb);
 }
 
+// If old_swapchain is non-null, the new swapchain retires it. Its frames may
+// still execute, and it must be freed after them.
 static RuSwapchain * _must_use_result_ _malloc_
 ru_swapchain_new(
         RuDevice *dev,
         RuSurface *surf,
-        uint32_t queue_fam_index)
+        uint32_t extra_image_count,
+        uint32_t queue_fam_index,
+        RuSwapchain *old_swapchain)
 {
+    uint32_t image_count = surf->caps.minImageCount + extra_image_count;
+    if (surf->caps.maxImageCount > 0)
+        image_count = ru_min(image_count, surf->caps.maxImageCount);
+
     const VkExtent2D extent = {
         .width = ANativeWindow_getWidth(surf->window),
         .height = ANativeWindow_getHeight(surf->window),
@@ -916,7 +1398,7 @@ ru_swapchain_new(
     const VkSwapchainCreateInfoKHR info = {
         .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
         .surface = surf->vk,
-        .minImageCount = surf->caps.minImageCount,
+        .minImageCount = image_count,
         .imageFormat = ru_present_format.format,
         .imageColorSpace = ru_present_format.colorSpace,
         .imageExtent = extent,
@@ -935,7 +1417,7 @@ ru_swapchain_new(
         .presentMode = VK_PRESENT_MODE_FIFO_KHR,
 
         .clipped = false,
-        .oldSwapchain = VK_NULL_HANDLE,
+        .oldSwapchain = old_swapchain ? old_swapchain->vk : VK_NULL_HANDLE,
     };
 
     if ((info.imageUsage & ~surf->caps.supportedUsageFlags)) {
@@ -961,6 +1443,80 @@ ru_swapchain_new(
         .images = images,
         .queue_fam_index = queue_fam_index,
         .status = VK_SUCCESS,
+        .mutex = PTHREAD_MUTEX_INITIALIZER,
+    );
+}
+
+static RuSwapchain * _must_use_result_ _malloc_
+ru_swapchain_new_headless(
+        RuDevice *dev,
+        VkExtent2D extent,
+        uint32_t len,
+        uint32_t queue_fam_index)
+{
+    let images = new_array(VkImage, len);
+    let image_mems = new_array(VkDeviceMemory, len);
+
+    for (uint32_t i = 0; i < len; ++i) {
+        // TRANSFER_SRC lets a client read back the rendered frame.
+        check(vkCreateImage(dev->vk,
+            &(VkImageCreateInfo) {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+                .flags = 0,
+                .imageType = VK_IMAGE_TYPE_2D,
+                .format = ru_present_format.format,
+                .extent = (VkExtent3D) {
+                    .width = extent.width,
+                    .height = extent.height,
+                    .depth = 1,
+                },
+                .mipLevels = 1,
+                .arrayLayers = 1,
+                .samples = 1,
+                .tiling = VK_IMAGE_TILING_OPTIMAL,
+                .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                         VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+                .queueFamilyIndexCount = 1,
+                .pQueueFamilyIndices = (uint32_t[]) { queue_fam_index },
+                .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            },
+            ru_alloc_cb,
+            &images[i]));
+
+        VkMemoryRequirements reqs;
+        vkGetImageMemoryRequirements(dev->vk, images[i], &reqs);
+
+        check(vkAllocateMemory(dev->vk,
+            &(VkMemoryAllocateInfo) {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+                .allocationSize = reqs.size,
+                .memoryTypeIndex = ru_phys_dev_find_memory_type(
+                    dev->phys_dev, reqs.memoryTypeBits,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+            },
+            ru_alloc_cb,
+            &image_mems[i]));
+
+        check(vkBindImageMemory(dev->vk, images[i], image_mems[i],
+                    /*offset*/ 0));
+    }
+
+    logd("create headless swapchain: %ux%u, %u images",
+         extent.width, extent.height, len);
+
+    return new_init(RuSwapchain,
+        .dev = dev,
+        .vk = VK_NULL_HANDLE,
+        .extent = extent,
+        .len = len,
+        .images = images,
+        .queue_fam_index = queue_fam_index,
+        .status = VK_SUCCESS,
+        .mutex = PTHREAD_MUTEX_INITIALIZER,
+        .is_headless = true,
+        .image_mems = image_mems,
+        .next_image_index = 0,
     );
 }
 
@@ -972,11 +1528,25 @@ ru_swapchain_free(RuSwapchain *swapchain)
 
     RuDevice *dev = swapchain->dev;
 
-    vkDestroySwapchainKHR(dev->vk, swapchain->vk, ru_alloc_cb);
+    if (swapchain->is_headless) {
+        for (uint32_t i = 0; i < swapchain->len; ++i) {
+            vkDestroyImage(dev->vk, swapchain->images[i], ru_alloc_cb);
+            vkFreeMemory(dev->vk, swapchain->image_mems[i], ru_alloc_cb);
+        }
+
+        free(swapchain->image_mems);
+    } else {
+        vkDestroySwapchainKHR(dev->vk, swapchain->vk, ru_alloc_cb);
+    }
+
+    if (pthread_mutex_destroy(&swapchain->mutex))
+        abort();
+
     free(swapchain->images);
     free(swapchain);
 }
 
+#ifdef ANDROID
 static void
 ru_ahb_choose_image_creation_params(
         RuPhysicalDevice *phys_dev,
@@ -1217,232 +1787,91 @@ ru_ahb_choose_image_creation_params(
 
     #undef LOG_PREFIX
 }
+#endif // ANDROID
+
 
+static bool _must_use_result_
+ru_ycbcr_key_eq(const RuYcbcrKey *a, const RuYcbcrKey *b) {
+    return a->format == b->format &&
+           a->external_format == b->external_format &&
+           a->model == b->model &&
+           a->range == b->range &&
+           a->components.r == b->components.r &&
+           a->components.g == b->components.g &&
+           a->components.b == b->components.b &&
+           a->components.a == b->components.a &&
+           a->x_chroma_offset == b->x_chroma_offset &&
+           a->y_chroma_offset == b->y_chroma_offset;
+}
 
 static void
-ru_ahb_init(
-        RuRend *rend,
-        AHardwareBuffer *ahb,
-        RuAhb *rahb)
-{
+ru_ycbcr_pipeline_init(RuRend *rend, const RuYcbcrKey *key,
+                       RuYcbcrPipeline *yp) {
     RuInstance *inst = &rend->inst;
-    RuPhysicalDevice *phys_dev = &rend->phys_dev;
     RuDevice *dev = &rend->dev;
 
-    AHardwareBuffer_acquire(ahb);
-
-    AHardwareBuffer_Desc ahb_desc;
-    AHardwareBuffer_describe(ahb, &ahb_desc);
-
-    VkAndroidHardwareBufferPropertiesANDROID ahb_props = {
-        .sType = VK_STRUCTURE_TYPE_ANDROID_HARDWARE_BUFFER_PROPERTIES_ANDROID,
-    };
+    logd("create VkSamplerYcbcrConversion: format=%d externalFormat=%"PRIu64
+         " model=%d range=%d", key->format, key->external_format, key->model,
+         key->range);
 
-    VkAndroidHardwareBufferFormatPropertiesANDROID ahb_format_props = {
-        .sType = VK_STRUCTURE_TYPE_ANDROID_HARDWARE_BUFFER_FORMAT_PROPERTIES_ANDROID,
+    VkSamplerYcbcrConversionCreateInfoKHR sampler_ycbcr_conv_create_info = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_CREATE_INFO_KHR,
+        .format = key->format,
+        .ycbcrModel = key->model,
+        .ycbcrRange = key->range,
+        .components = key->components,
+        .xChromaOffset = key->x_chroma_offset,
+        .yChromaOffset = key->y_chroma_offset,
+        .chromaFilter = VK_FILTER_NEAREST,
+        .forceExplicitReconstruction = false,
     };
 
+#ifdef ANDROID
     ru_chain_vk_structs(
-            &ahb_props,
-            &ahb_format_props,
-            NULL);
+        &sampler_ycbcr_conv_create_info,
+        &(VkExternalFormatANDROID) {
+            .sType = VK_STRUCTURE_TYPE_EXTERNAL_FORMAT_ANDROID,
+            .externalFormat = key->external_format,
+        },
+        NULL);
+#else
+    assert(key->external_format == 0);
+#endif
 
-    check(inst->vkGetAndroidHardwareBufferPropertiesANDROID(dev->vk, ahb,
-                &ahb_props));
+    VkSamplerYcbcrConversion sampler_ycbcr_conv;
+    check(inst->vkCreateSamplerYcbcrConversionKHR(dev->vk,
+            &sampler_ycbcr_conv_create_info, ru_alloc_cb, &sampler_ycbcr_conv));
 
-    logd("importing ahb %p:", ahb);
-    logd("    AHardwareBuffer_Desc:");
-    logd("        width: %u", ahb_desc.width);
-    logd("        height: %u", ahb_desc.height);
-    logd("        layers: %u", ahb_desc.layers);
-    logd("        format: %u", ahb_desc.format);
-    logd("        usage: %" RU_FMT_MASK64, ahb_desc.usage);
-    logd("        stride: %u", ahb_desc.stride);
-    logd("    VkAndroidHardwareBufferPropertiesANDROID:");
-    logd("        allocationSize: %"PRIu64, ahb_props.allocationSize);
-    logd("        memoryTypeBits: %" RU_FMT_VK_FLAGS, ahb_props.memoryTypeBits);
-    logd("    VkAndroidHardwareBufferFormatPropertiesANDROID:");
-    logd("        format: %u", ahb_format_props.format);
-    logd("        externalFormat: %"PRIu64, ahb_format_props.externalFormat);
-    logd("        formatFeatures: %" RU_FMT_VK_FLAGS, ahb_format_props.formatFeatures);
-    logd("        samplerYcbcrConversionComponents:");
-    logd("            r: %u", ahb_format_props.samplerYcbcrConversionComponents.r);
-    logd("            g: %u", ahb_format_props.samplerYcbcrConversionComponents.g);
-    logd("            b: %u", ahb_format_props.samplerYcbcrConversionComponents.b);
-    logd("            a: %u", ahb_format_props.samplerYcbcrConversionComponents.a);
-    logd("        suggestedYcbcrModel: %u", ahb_format_props.suggestedYcbcrModel);
-    logd("        suggestedYcbcrRange: %u", ahb_format_props.suggestedYcbcrRange);
-    logd("        suggestedXChromaOffset: %u", ahb_format_props.suggestedXChromaOffset);
-    logd("        suggestedYChromaOffset: %u", ahb_format_props.suggestedYChromaOffset);
+    VkSamplerCreateInfo sampler_create_info = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .flags = 0,
+        .magFilter = VK_FILTER_NEAREST,
+        .minFilter = VK_FILTER_NEAREST,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .mipLodBias = 0.0f,
+        .anisotropyEnable = false,
+        .compareEnable = false,
+        .minLod = 0.0f,
+        .maxLod = 0.0f,
+        .unnormalizedCoordinates = false,
+    };
 
-    VkImageCreateInfo image_create_info;
-    VkExternalMemoryImageCreateInfoKHR ext_mem_image_create_info;
-    VkExternalFormatANDROID ext_format;
-    ru_ahb_choose_image_creation_params(
-        phys_dev,
-        rend->queue_fam_index,
-        rend->use_ext_format,
-        ahb,
-        &ahb_desc,
-        &ahb_props,
-        &ahb_format_props,
-        &image_create_info,
-        &ext_mem_image_create_info,
-        &ext_format);
+    VkSamplerYcbcrConversionInfo sampler_ycbcr_conv_info = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO,
+        .conversion = sampler_ycbcr_conv,
+    };
 
     ru_chain_vk_structs(
-            &image_create_info,
-            &ext_mem_image_create_info,
-            &ext_format,
-            NULL);
-
-    VkImage image;
-    check(vkCreateImage(dev->vk, &image_create_info, ru_alloc_cb, &image));
+        &sampler_create_info,
+        &sampler_ycbcr_conv_info,
+        NULL);
 
-    // Memory allocation and binding are unusual for AHB images.  The app
-    // doesn't call vkGetImageMemoryRequirements2 because the spec prohibits
-    // calling it on AHB images before they are bound to memory. Instead, the
-    // spec requires the app to import the AHB as VkDeviceMemory dedicated to
-    // a VkImage. The spec permits the app to call
-    // vkGetImageMemoryRequirements2 *after* binding if needed, which is rare.
-
-    VkMemoryAllocateInfo mem_alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-
-        .memoryTypeIndex = ({
-            // Be sloppy. Choose any supported bit.
-            assert(ahb_props.memoryTypeBits != 0);
-            1 << (__builtin_ffs(ahb_props.memoryTypeBits) - 1);
-        }),
-
-        .allocationSize = ahb_props.allocationSize,
-    };
-
-    VkImportAndroidHardwareBufferInfoANDROID import_ahb_info = {
-        .sType = VK_STRUCTURE_TYPE_IMPORT_ANDROID_HARDWARE_BUFFER_INFO_ANDROID,
-        .buffer = ahb,
-    };
-
-    // Required for AHB images.
-    VkMemoryDedicatedAllocateInfo mem_ded_alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
-        .image = image,
-    };
-
-    ru_chain_vk_structs(
-        &mem_alloc_info,
-        &import_ahb_info,
-        &mem_ded_alloc_info,
-        NULL);
-
-    VkDeviceMemory mem;
-    check(vkAllocateMemory(dev->vk, &mem_alloc_info, ru_alloc_cb, &mem));
-
-    // Dedicated memory bindings require offset 0.
-    check(vkBindImageMemory(dev->vk, image, mem, /*offset*/ 0));
-
-    VkSamplerYcbcrConversionCreateInfoKHR sampler_ycbcr_conv_create_info = {
-        .sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_CREATE_INFO_KHR,
-        .format = image_create_info.format,
-        .ycbcrModel = ahb_format_props.suggestedYcbcrModel,
-        .ycbcrRange = ahb_format_props.suggestedYcbcrRange,
-        .components = ahb_format_props.samplerYcbcrConversionComponents,
-        .xChromaOffset = ahb_format_props.suggestedXChromaOffset,
-        .yChromaOffset = ahb_format_props.suggestedYChromaOffset,
-        .chromaFilter = VK_FILTER_NEAREST,
-        .forceExplicitReconstruction = false,
-    };
-
-    ru_chain_vk_structs(
-        &sampler_ycbcr_conv_create_info,
-        &ext_format,
-        NULL);
-
-    VkSamplerYcbcrConversion sampler_ycbcr_conv;
-    check(inst->vkCreateSamplerYcbcrConversionKHR(dev->vk,
-            &sampler_ycbcr_conv_create_info, ru_alloc_cb, &sampler_ycbcr_conv));
-
-    VkSamplerCreateInfo sampler_create_info = {
-        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-        .flags = 0,
-        .magFilter = VK_FILTER_NEAREST,
-        .minFilter = VK_FILTER_NEAREST,
-        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
-        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-        .mipLodBias = 0.0f,
-        .anisotropyEnable = false,
-        .compareEnable = false,
-        .minLod = 0.0f,
-        .maxLod = 0.0f,
-        .unnormalizedCoordinates = false,
-    };
-
-    VkSamplerYcbcrConversionInfo sampler_ycbcr_conv_info = {
-        .sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO,
-        .conversion = sampler_ycbcr_conv,
-    };
-
-    ru_chain_vk_structs(
-        &sampler_create_info,
-        &sampler_ycbcr_conv_info,
-        NULL);
-
-    VkSampler sampler;
-    check(vkCreateSampler(dev->vk, &sampler_create_info, ru_alloc_cb,
-            &sampler));
-
-    VkImageViewCreateInfo image_view_create_info = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-        .image = image,
-        .viewType = VK_IMAGE_VIEW_TYPE_2D,
-
-        // From the Vulkan 1.1.111 spec:
-        //
-        //     If the image has a multi-planar format and
-        //     subresourceRange.aspectMask is VK_IMAGE_ASPECT_COLOR_BIT, format
-        //     must be identical to the image format, and the sampler to be
-        //     used with the image view must enable sampler Y’CBCR conversion.
-        //
-        //     If image was not created with the
-        //     VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT flag, or if the format of the
-        //     image is a multi-planar format and if
-        //     subresourceRange.aspectMask is VK_IMAGE_ASPECT_COLOR_BIT, format
-        //     must be identical to the format used to create image.
-        //
-        //     If image has an external format, the pNext chain must contain an
-        //     instance of VkSamplerYcbcrConversionInfo with a conversion
-        //     object created with the same external format as image.
-        .format = image_create_info.format,
-
-        // Don't swizzle again. We already provided
-        // VkAndroidHardwareBufferFormatPropertiesANDROID::samplerYcbcrConversionComponents
-        // to VkSamplerYcbcrConversion.
-        //
-        // From the Vulkan 1.1.111 spec:
-        //
-        //     If image has an external format, all members of components must
-        //     be VK_COMPONENT_SWIZZLE_IDENTITY.
-        .components = (VkComponentMapping) {0}, // identity mapping
-
-        .subresourceRange = (VkImageSubresourceRange) {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .baseMipLevel = 0,
-            .levelCount = 1,
-            .baseArrayLayer = 0,
-            .layerCount = 1,
-        },
-    };
-
-    ru_chain_vk_structs(
-        &image_view_create_info,
-        &sampler_ycbcr_conv_info,
-        NULL);
-
-    VkImageView image_view;
-    check(vkCreateImageView(dev->vk, &image_view_create_info, ru_alloc_cb,
-            &image_view));
+    VkSampler sampler;
+    check(vkCreateSampler(dev->vk, &sampler_create_info, ru_alloc_cb,
+            &sampler));
 
     // When using VkSamplerYcbcrConversionKHR, the Vulkan spec requires that
     // the VkDescriptorSetLayoutBinding use use an immutable
@@ -1474,11 +1903,118 @@ ru_ahb_init(
             .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
             .setLayoutCount = 1,
             .pSetLayouts = (VkDescriptorSetLayout[]) { desc_set_layout },
-            .pushConstantRangeCount = 0,
+            .pushConstantRangeCount = 1,
+            .pPushConstantRanges = (VkPushConstantRange[]) {
+                {
+                    .stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+                                  VK_SHADER_STAGE_FRAGMENT_BIT,
+                    .offset = 0,
+                    .size = sizeof(RuLayerPushConsts),
+                },
+            },
         },
         ru_alloc_cb,
         &pipeline_layout));
 
+    *yp = (RuYcbcrPipeline) {
+        .key = *key,
+        .ref_count = 0,
+        .sampler_ycbcr_conv = sampler_ycbcr_conv,
+        .sampler = sampler,
+        .desc_set_layout = desc_set_layout,
+        .pipeline_layout = pipeline_layout,
+    };
+}
+
+static void
+ru_ycbcr_pipeline_finish(RuDevice *dev, RuYcbcrPipeline *yp) {
+    for (uint32_t i = 0; i < RU_BLEND_MODE_COUNT; ++i) {
+        if (yp->pipelines[i])
+            vkDestroyPipeline(dev->vk, yp->pipelines[i], ru_alloc_cb);
+    }
+
+    vkDestroyPipelineLayout(dev->vk, yp->pipeline_layout, ru_alloc_cb);
+    vkDestroyDescriptorSetLayout(dev->vk, yp->desc_set_layout, ru_alloc_cb);
+    vkDestroySampler(dev->vk, yp->sampler, ru_alloc_cb);
+
+    // FIXME: vkDestroySamplerYcbcrConversion(dev->vk, yp->sampler_ycbcr_conv, ru_alloc_cb);
+    logd("WORKAROUND: Avoid vkDestroySamplerYcbcrConversion; it crashes "
+            "libVkLayer_unique_objects.so");
+}
+
+// Return a referenced pipeline. The caller's RuAhb holds the reference until
+// ru_rend_unref_ycbcr_pipeline().
+static RuYcbcrPipeline * _must_use_result_
+ru_rend_get_ycbcr_pipeline(RuRend *rend, const RuYcbcrKey *key) {
+    RuYcbcrPipelineCache *cache = &rend->ycbcr_pipeline_cache;
+
+    ru_mutex_lock_scoped(&cache->mutex);
+
+    for (uint32_t i = 0; i < cache->pipeline_count; ++i) {
+        RuYcbcrPipeline *yp = cache->pipelines[i];
+
+        if (ru_ycbcr_key_eq(&yp->key, key)) {
+            ++yp->ref_count;
+            return yp;
+        }
+    }
+
+    // Cache miss.
+    let yp = new0(RuYcbcrPipeline);
+    ru_ycbcr_pipeline_init(rend, key, yp);
+    yp->ref_count = 1;
+
+    cache->pipelines = xreallocn(cache->pipelines, cache->pipeline_count + 1,
+                                 sizeof(cache->pipelines[0]));
+    cache->pipelines[cache->pipeline_count++] = yp;
+
+    return yp;
+}
+
+// Drop the reference of a destroyed RuAhb. Retire the pipeline once no RuAhb
+// uses it. Call only from the render thread, which owns the retired queue.
+static void
+ru_rend_unref_ycbcr_pipeline(RuRend *rend, RuYcbcrPipeline *yp) {
+    RuYcbcrPipelineCache *cache = &rend->ycbcr_pipeline_cache;
+
+    ru_mutex_lock_scoped(&cache->mutex);
+
+    assert(yp->ref_count > 0);
+    if (--yp->ref_count > 0)
+        return;
+
+    for (uint32_t i = 0; i < cache->pipeline_count; ++i) {
+        if (cache->pipelines[i] == yp) {
+            cache->pipelines[i] = cache->pipelines[--cache->pipeline_count];
+            break;
+        }
+    }
+
+    ru_queue_push(&rend->retired,
+        &(RuRetired) {
+            .type = RU_RETIRED_YCBCR_PIPELINE,
+            .ycbcr_pipeline = yp,
+        });
+}
+
+// Pipelines with the same RuYcbcrPipeline differ only in blend state.
+static VkPipeline _must_use_result_
+ru_ycbcr_pipeline_get_vk_pipeline(RuRend *rend, RuYcbcrPipeline *yp,
+                                  RuBlendMode blend) {
+    RuDevice *dev = &rend->dev;
+    RuYcbcrPipelineCache *cache = &rend->ycbcr_pipeline_cache;
+
+    {
+        ru_mutex_lock_scoped(&cache->mutex);
+
+        if (yp->pipelines[blend])
+            return yp->pipelines[blend];
+    }
+
+    logd("create VkPipeline: blend=%d", blend);
+
+    VkPipelineLayout pipeline_layout = yp->pipeline_layout;
+
     VkPipeline pipeline;
     check(vkCreateGraphicsPipelines(dev->vk,
         (VkPipelineCache) VK_NULL_HANDLE,
@@ -1537,7 +2073,13 @@ ru_ahb_init(
                     .attachmentCount = 1,
                     .pAttachments = (VkPipelineColorBlendAttachmentState []) {
                         {
-                            .blendEnable = false,
+                            .blendEnable = (blend == RU_BLEND_MODE_ALPHA),
+                            .srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+                            .dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+                            .colorBlendOp = VK_BLEND_OP_ADD,
+                            .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+                            .dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+                            .alphaBlendOp = VK_BLEND_OP_ADD,
                             .colorWriteMask =
                                 VK_COLOR_COMPONENT_R_BIT |
                                 VK_COLOR_COMPONENT_G_BIT |
@@ -1565,93 +2107,711 @@ ru_ahb_init(
         ru_alloc_cb,
         &pipeline));
 
-     *rahb = (RuAhb) {
-        .ahb = ahb,
-        .mem = mem,
-        .image = image,
-        .image_view = image_view,
-        .sampler_ycbcr_conv = sampler_ycbcr_conv,
-        .sampler = sampler,
-        .desc_set_layout = desc_set_layout,
-        .pipeline_layout = pipeline_layout,
-        .pipeline = pipeline,
-        .aimage = NULL,
-        .in_aimage_reader = false,
-    };
-}
+    ru_mutex_lock_scoped(&cache->mutex);
 
-static void
-ru_ahb_finish(RuDevice *dev, RuAhb *rahb) {
-    if (rahb->aimage) {
-        // Assume that if we own an AImage then the AImageReader holds
-        // a reference to the AImage's AHB.
-        assert(rahb->in_aimage_reader);
-        AImage_delete(rahb->aimage);
+    // A worker of the import pool may have won the race.
+    if (yp->pipelines[blend]) {
+        vkDestroyPipeline(dev->vk, pipeline, ru_alloc_cb);
+        return yp->pipelines[blend];
     }
 
-    vkDestroyPipeline(dev->vk, rahb->pipeline, ru_alloc_cb);
-    vkDestroyPipelineLayout(dev->vk, rahb->pipeline_layout, ru_alloc_cb);
-    vkDestroyDescriptorSetLayout(dev->vk, rahb->desc_set_layout, ru_alloc_cb);
-    vkDestroySampler(dev->vk, rahb->sampler, ru_alloc_cb);
-
-    // FIXME: vkDestroySamplerYcbcrConversion(dev->vk, rahb->sampler_ycbcr_conv, ru_alloc_cb);
-    logd("WORKAROUND: Avoid vkDestroySamplerYcbcrConversion; it crashes "
-            "libVkLayer_unique_objects.so");
+    yp->pipelines[blend] = pipeline;
 
-    vkDestroyImageView(dev->vk, rahb->image_view, ru_alloc_cb);
-    vkDestroyImage(dev->vk, rahb->image, ru_alloc_cb);
-    vkFreeMemory(dev->vk, rahb->mem, ru_alloc_cb);
-    AHardwareBuffer_release(rahb->ahb);
+    return pipeline;
 }
 
+// Import the AHB into `rahb`, which takes over the caller's reference to the
+// AHB. Runs on the render thread, or on a worker of the import pool.
+#ifdef ANDROID
 static void
-ru_frame_reset(RuDevice *dev, RuFrame *frame) {
-    assert(!frame->is_reset);
+ru_ahb_init(
+        RuRend *rend,
+        AHardwareBuffer *ahb,
+        RuAhb *rahb)
+{
+    RuInstance *inst = &rend->inst;
+    RuPhysicalDevice *phys_dev = &rend->phys_dev;
+    RuDevice *dev = &rend->dev;
 
-    check(vkResetFences(dev->vk,
-        /*fenceCount*/ 1,
-        (VkFence[]) { frame->release_fence }));
+    AHardwareBuffer_Desc ahb_desc;
+    AHardwareBuffer_describe(ahb, &ahb_desc);
 
-    if (frame->rahb) {
-        if (frame->rahb->aimage) {
-            AImage_delete(frame->rahb->aimage);
-            frame->rahb->aimage = NULL;
-        }
+    VkAndroidHardwareBufferPropertiesANDROID ahb_props = {
+        .sType = VK_STRUCTURE_TYPE_ANDROID_HARDWARE_BUFFER_PROPERTIES_ANDROID,
+    };
 
-        frame->rahb = NULL;
-    }
+    VkAndroidHardwareBufferFormatPropertiesANDROID ahb_format_props = {
+        .sType = VK_STRUCTURE_TYPE_ANDROID_HARDWARE_BUFFER_FORMAT_PROPERTIES_ANDROID,
+    };
 
-    frame->is_reset = true;
-}
+    ru_chain_vk_structs(
+            &ahb_props,
+            &ahb_format_props,
+            NULL);
 
-static RuFramechain * _malloc_ _must_use_result_
-ru_framechain_new(
-        RuSwapchain *swapchain,
-        VkCommandPool cmd_pool,
-        VkRenderPass render_pass)
-{
-    RuDevice *dev = swapchain->dev;
-    const uint32_t len = swapchain->len;
+    check(inst->vkGetAndroidHardwareBufferPropertiesANDROID(dev->vk, ahb,
+                &ahb_props));
 
-    VkFence swapchain_fence;
-    check(vkCreateFence(dev->vk,
-        &(VkFenceCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-            .flags = 0,
-        },
-        ru_alloc_cb,
-        &swapchain_fence));
+    // Each AImage may bring a new AHardwareBuffer, so skip the dump unless
+    // it will print.
+    if (ru_log_is_enabled(RU_LOG_LEVEL_DEBUG)) {
+        logd("importing ahb %p:", ahb);
+        logd("    AHardwareBuffer_Desc:");
+        logd("        width: %u", ahb_desc.width);
+        logd("        height: %u", ahb_desc.height);
+        logd("        layers: %u", ahb_desc.layers);
+        logd("        format: %u", ahb_desc.format);
+        logd("        usage: %" RU_FMT_MASK64, ahb_desc.usage);
+        logd("        stride: %u", ahb_desc.stride);
+        logd("    VkAndroidHardwareBufferPropertiesANDROID:");
+        logd("        allocationSize: %"PRIu64, ahb_props.allocationSize);
+        logd("        memoryTypeBits: %" RU_FMT_VK_FLAGS, ahb_props.memoryTypeBits);
+        logd("    VkAndroidHardwareBufferFormatPropertiesANDROID:");
+        logd("        format: %u", ahb_format_props.format);
+        logd("        externalFormat: %"PRIu64, ahb_format_props.externalFormat);
+        logd("        formatFeatures: %" RU_FMT_VK_FLAGS, ahb_format_props.formatFeatures);
+        logd("        samplerYcbcrConversionComponents:");
+        logd("            r: %u", ahb_format_props.samplerYcbcrConversionComponents.r);
+        logd("            g: %u", ahb_format_props.samplerYcbcrConversionComponents.g);
+        logd("            b: %u", ahb_format_props.samplerYcbcrConversionComponents.b);
+        logd("            a: %u", ahb_format_props.samplerYcbcrConversionComponents.a);
+        logd("        suggestedYcbcrModel: %u", ahb_format_props.suggestedYcbcrModel);
+        logd("        suggestedYcbcrRange: %u", ahb_format_props.suggestedYcbcrRange);
+        logd("        suggestedXChromaOffset: %u", ahb_format_props.suggestedXChromaOffset);
+        logd("        suggestedYChromaOffset: %u", ahb_format_props.suggestedYChromaOffset);
+    }
 
-    VkCommandBuffer cmd_buffers[len];
-    check(vkAllocateCommandBuffers(dev->vk,
-        &(VkCommandBufferAllocateInfo) {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    VkImageCreateInfo image_create_info;
+    VkExternalMemoryImageCreateInfoKHR ext_mem_image_create_info;
+    VkExternalFormatANDROID ext_format;
+    ru_ahb_choose_image_creation_params(
+        phys_dev,
+        rend->queue_fam_index,
+        rend->use_ext_format,
+        ahb,
+        &ahb_desc,
+        &ahb_props,
+        &ahb_format_props,
+        &image_create_info,
+        &ext_mem_image_create_info,
+        &ext_format);
+
+    ru_chain_vk_structs(
+            &image_create_info,
+            &ext_mem_image_create_info,
+            &ext_format,
+            NULL);
+
+    VkImage image;
+    check(vkCreateImage(dev->vk, &image_create_info, ru_alloc_cb, &image));
+
+    // Memory allocation and binding are unusual for AHB images.  The app
+    // doesn't call vkGetImageMemoryRequirements2 because the spec prohibits
+    // calling it on AHB images before they are bound to memory. Instead, the
+    // spec requires the app to import the AHB as VkDeviceMemory dedicated to
+    // a VkImage. The spec permits the app to call
+    // vkGetImageMemoryRequirements2 *after* binding if needed, which is rare.
+
+    VkMemoryAllocateInfo mem_alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+
+        .memoryTypeIndex = ({
+            // Be sloppy. Choose any supported bit.
+            assert(ahb_props.memoryTypeBits != 0);
+            1 << (__builtin_ffs(ahb_props.memoryTypeBits) - 1);
+        }),
+
+        .allocationSize = ahb_props.allocationSize,
+    };
+
+    VkImportAndroidHardwareBufferInfoANDROID import_ahb_info = {
+        .sType = VK_STRUCTURE_TYPE_IMPORT_ANDROID_HARDWARE_BUFFER_INFO_ANDROID,
+        .buffer = ahb,
+    };
+
+    // Required for AHB images.
+    VkMemoryDedicatedAllocateInfo mem_ded_alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+        .image = image,
+    };
+
+    ru_chain_vk_structs(
+        &mem_alloc_info,
+        &import_ahb_info,
+        &mem_ded_alloc_info,
+        NULL);
+
+    VkDeviceMemory mem;
+    check(vkAllocateMemory(dev->vk, &mem_alloc_info, ru_alloc_cb, &mem));
+
+    // Dedicated memory bindings require offset 0.
+    check(vkBindImageMemory(dev->vk, image, mem, /*offset*/ 0));
+
+    RuYcbcrPipeline *yp = ru_rend_get_ycbcr_pipeline(rend,
+        &(RuYcbcrKey) {
+            .format = image_create_info.format,
+            .external_format = ext_format.externalFormat,
+            .model = ahb_format_props.suggestedYcbcrModel,
+            .range = ahb_format_props.suggestedYcbcrRange,
+            .components = ahb_format_props.samplerYcbcrConversionComponents,
+            .x_chroma_offset = ahb_format_props.suggestedXChromaOffset,
+            .y_chroma_offset = ahb_format_props.suggestedYChromaOffset,
+        });
+
+    VkSamplerYcbcrConversionInfo sampler_ycbcr_conv_info = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO,
+        .conversion = yp->sampler_ycbcr_conv,
+    };
+
+    VkImageViewCreateInfo image_view_create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+
+        // From the Vulkan 1.1.111 spec:
+        //
+        //     If the image has a multi-planar format and
+        //     subresourceRange.aspectMask is VK_IMAGE_ASPECT_COLOR_BIT, format
+        //     must be identical to the image format, and the sampler to be
+        //     used with the image view must enable sampler Y’CBCR conversion.
+        //
+        //     If image was not created with the
+        //     VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT flag, or if the format of the
+        //     image is a multi-planar format and if
+        //     subresourceRange.aspectMask is VK_IMAGE_ASPECT_COLOR_BIT, format
+        //     must be identical to the format used to create image.
+        //
+        //     If image has an external format, the pNext chain must contain an
+        //     instance of VkSamplerYcbcrConversionInfo with a conversion
+        //     object created with the same external format as image.
+        .format = image_create_info.format,
+
+        // Don't swizzle again. We already provided
+        // VkAndroidHardwareBufferFormatPropertiesANDROID::samplerYcbcrConversionComponents
+        // to VkSamplerYcbcrConversion.
+        //
+        // From the Vulkan 1.1.111 spec:
+        //
+        //     If image has an external format, all members of components must
+        //     be VK_COMPONENT_SWIZZLE_IDENTITY.
+        .components = (VkComponentMapping) {0}, // identity mapping
+
+        .subresourceRange = (VkImageSubresourceRange) {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+
+    ru_chain_vk_structs(
+        &image_view_create_info,
+        &sampler_ycbcr_conv_info,
+        NULL);
+
+    VkImageView image_view;
+    check(vkCreateImageView(dev->vk, &image_view_create_info, ru_alloc_cb,
+            &image_view));
+
+    *rahb = (RuAhb) {
+        .ahb = ahb,
+        .mem = mem,
+        .image = image,
+        .image_view = image_view,
+        .ycbcr_pipeline = yp,
+        .aimage = NULL,
+        .use_count = 0,
+        .in_aimage_reader = false,
+    };
+}
+#else // ANDROID
+
+// The host's AHBs are plain shared memory, which Vulkan cannot import.
+// Instead, create an NV12 image of the AHB's size, and a staging buffer from
+// which to fill it. See ru_ahb_stage() and ru_ahb_record_upload().
+static void
+ru_ahb_init(
+        RuRend *rend,
+        AHardwareBuffer *ahb,
+        RuAhb *rahb)
+{
+    RuPhysicalDevice *phys_dev = &rend->phys_dev;
+    RuDevice *dev = &rend->dev;
+
+    AHardwareBuffer_Desc ahb_desc;
+    AHardwareBuffer_describe(ahb, &ahb_desc);
+
+    if (ru_log_is_enabled(RU_LOG_LEVEL_DEBUG)) {
+        logd("importing ahb %p:", ahb);
+        logd("    AHardwareBuffer_Desc:");
+        logd("        width: %u", ahb_desc.width);
+        logd("        height: %u", ahb_desc.height);
+        logd("        format: %u", ahb_desc.format);
+        logd("        stride: %u", ahb_desc.stride);
+    }
+
+    if (ahb_desc.format != AHARDWAREBUFFER_FORMAT_Y8Cb8Cr8_420) {
+        die("importing ahb %p: unsupported AHardwareBuffer_Format(%u)",
+            ahb, ahb_desc.format);
+    }
+
+    const VkFormat format = VK_FORMAT_G8_B8R8_2PLANE_420_UNORM;
+
+    // The spec requires 4:2:0 images to have even dimensions.
+    const VkExtent2D extent = {
+        .width = (ahb_desc.width + 1) & ~1u,
+        .height = (ahb_desc.height + 1) & ~1u,
+    };
+
+    VkFormatProperties format_props;
+    vkGetPhysicalDeviceFormatProperties(phys_dev->vk, format, &format_props);
+
+    const VkFormatFeatureFlags need_features =
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+        VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+
+    if ((format_props.optimalTilingFeatures & need_features) != need_features) {
+        die("VkFormat(%d) lacks VkFormatFeatureFlags(%" RU_FMT_VK_FLAGS ")",
+            format, need_features);
+    }
+
+    VkImage image;
+    check(vkCreateImage(dev->vk,
+        &(VkImageCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .flags = 0,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = format,
+            .extent = (VkExtent3D) {
+                .width = extent.width,
+                .height = extent.height,
+                .depth = 1,
+            },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = 1,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = VK_IMAGE_USAGE_SAMPLED_BIT |
+                     VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .queueFamilyIndexCount = 1,
+            .pQueueFamilyIndices = (uint32_t[]) { rend->queue_fam_index },
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        },
+        ru_alloc_cb,
+        &image));
+
+    VkMemoryRequirements image_reqs;
+    vkGetImageMemoryRequirements(dev->vk, image, &image_reqs);
+
+    VkDeviceMemory mem;
+    check(vkAllocateMemory(dev->vk,
+        &(VkMemoryAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = image_reqs.size,
+            .memoryTypeIndex = ru_phys_dev_find_memory_type(phys_dev,
+                image_reqs.memoryTypeBits,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+        },
+        ru_alloc_cb,
+        &mem));
+
+    check(vkBindImageMemory(dev->vk, image, mem, /*offset*/ 0));
+
+    // The staging buffer holds the Y plane, then the CbCr plane, both with
+    // the AHB's stride. See ru_ahb_record_upload().
+    const VkDeviceSize staging_size =
+        (VkDeviceSize) ahb_desc.stride * (extent.height + extent.height / 2);
+
+    VkBuffer staging_buffer;
+    check(vkCreateBuffer(dev->vk,
+        &(VkBufferCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = staging_size,
+            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        },
+        ru_alloc_cb,
+        &staging_buffer));
+
+    VkMemoryRequirements staging_reqs;
+    vkGetBufferMemoryRequirements(dev->vk, staging_buffer, &staging_reqs);
+
+    VkDeviceMemory staging_mem;
+    check(vkAllocateMemory(dev->vk,
+        &(VkMemoryAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = staging_reqs.size,
+            .memoryTypeIndex = ru_phys_dev_find_memory_type(phys_dev,
+                staging_reqs.memoryTypeBits,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+        },
+        ru_alloc_cb,
+        &staging_mem));
+
+    check(vkBindBufferMemory(dev->vk, staging_buffer, staging_mem,
+                /*offset*/ 0));
+
+    void *staging_map;
+    check(vkMapMemory(dev->vk, staging_mem, /*offset*/ 0, VK_WHOLE_SIZE,
+                /*flags*/ 0, &staging_map));
+
+    // The host decoder writes BT.601 limited range, like most software
+    // decoders. Prefer the chroma siting of MPEG-2 and H.264.
+    const VkChromaLocation chroma_offset =
+        (format_props.optimalTilingFeatures &
+         VK_FORMAT_FEATURE_MIDPOINT_CHROMA_SAMPLES_BIT)
+        ? VK_CHROMA_LOCATION_MIDPOINT
+        : VK_CHROMA_LOCATION_COSITED_EVEN;
+
+    RuYcbcrPipeline *yp = ru_rend_get_ycbcr_pipeline(rend,
+        &(RuYcbcrKey) {
+            .format = format,
+            .external_format = 0,
+            .model = VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_601,
+            .range = VK_SAMPLER_YCBCR_RANGE_ITU_NARROW,
+            .components = (VkComponentMapping) {0}, // identity mapping
+            .x_chroma_offset = chroma_offset,
+            .y_chroma_offset = chroma_offset,
+        });
+
+    VkImageView image_view;
+    check(vkCreateImageView(dev->vk,
+        &(VkImageViewCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .pNext = &(VkSamplerYcbcrConversionInfo) {
+                .sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO,
+                .conversion = yp->sampler_ycbcr_conv,
+            },
+            .image = image,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = format,
+            .components = (VkComponentMapping) {0}, // identity mapping
+            .subresourceRange = (VkImageSubresourceRange) {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+        },
+        ru_alloc_cb,
+        &image_view));
+
+    *rahb = (RuAhb) {
+        .ahb = ahb,
+        .mem = mem,
+        .image = image,
+        .image_view = image_view,
+        .ycbcr_pipeline = yp,
+        .aimage = NULL,
+        .use_count = 0,
+        .in_aimage_reader = false,
+        .extent = extent,
+        .stride = ahb_desc.stride,
+        .staging_buffer = staging_buffer,
+        .staging_mem = staging_mem,
+        .staging_map = staging_map,
+        .needs_upload = false,
+    };
+}
+
+// Copy the AHB's pixels into the staging buffer, and scale the crop from the
+// AHB to the image. Call after a new AImage arrives for the AHB, while no
+// frame draws it.
+static void
+ru_ahb_stage(RuAhb *rahb) {
+    assert(rahb->use_count == 0);
+
+    AHardwareBuffer_Desc desc;
+    AHardwareBuffer_describe(rahb->ahb, &desc);
+
+    const uint8_t *src;
+    int ret = AHardwareBuffer_lock(rahb->ahb,
+            AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN, /*fence*/ -1,
+            /*rect*/ NULL, (void **) &src);
+    if (ret)
+        die("AHardwareBuffer_lock failed: error=%d", ret);
+
+    const size_t stride = rahb->stride;
+    const size_t y_size = stride * desc.height;
+    const size_t cbcr_size = stride * ((desc.height + 1) / 2);
+    uint8_t *dst = rahb->staging_map;
+
+    memcpy(dst, src, y_size);
+
+    // Repeat the last row into the image's padding row, if any.
+    if (rahb->extent.height > desc.height)
+        memcpy(dst + y_size, dst + y_size - stride, stride);
+
+    memcpy(dst + stride * rahb->extent.height, src + y_size, cbcr_size);
+
+    ret = AHardwareBuffer_unlock(rahb->ahb, /*fence*/ NULL);
+    if (ret)
+        die("AHardwareBuffer_unlock failed: error=%d", ret);
+
+    const float sx = (float) desc.width / rahb->extent.width;
+    const float sy = (float) desc.height / rahb->extent.height;
+
+    rahb->crop[0] *= sx;
+    rahb->crop[1] *= sy;
+    rahb->crop[2] *= sx;
+    rahb->crop[3] *= sy;
+
+    rahb->needs_upload = true;
+}
+
+// Copy the staging buffer into the image, and leave the image ready for the
+// fragment shader. Whatever the image held before is discarded.
+static void
+ru_ahb_record_upload(RuAhb *rahb, VkCommandBuffer cmd) {
+    static const VkImageSubresourceRange color_range = {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .baseMipLevel = 0,
+        .levelCount = 1,
+        .baseArrayLayer = 0,
+        .layerCount = 1,
+    };
+
+    vkCmdPipelineBarrier(cmd,
+        /*srcStageMask*/ VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        /*dstStageMask*/ VK_PIPELINE_STAGE_TRANSFER_BIT,
+        /*dependencyFlags*/ 0,
+        /*memoryBarriers*/ 0, NULL,
+        /*bufferMemmoryBarriers*/ 0, NULL,
+        /*imageMemmoryBarriers*/ 1,
+        (VkImageMemoryBarrier[]) {
+            {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                .srcAccessMask = 0,
+                .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image = rahb->image,
+                .subresourceRange = color_range,
+            },
+        });
+
+    // The CbCr plane has half the Y plane's width and height, and two bytes
+    // per texel. bufferRowLength counts texels.
+    const uint32_t w = rahb->extent.width;
+    const uint32_t h = rahb->extent.height;
+
+    vkCmdCopyBufferToImage(cmd, rahb->staging_buffer, rahb->image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        /*regionCount*/ 2,
+        (VkBufferImageCopy[]) {
+            {
+                .bufferOffset = 0,
+                .bufferRowLength = rahb->stride,
+                .bufferImageHeight = h,
+                .imageSubresource = {
+                    .aspectMask = VK_IMAGE_ASPECT_PLANE_0_BIT,
+                    .mipLevel = 0,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1,
+                },
+                .imageOffset = { 0, 0, 0 },
+                .imageExtent = { w, h, 1 },
+            },
+            {
+                .bufferOffset = (VkDeviceSize) rahb->stride * h,
+                .bufferRowLength = rahb->stride / 2,
+                .bufferImageHeight = h / 2,
+                .imageSubresource = {
+                    .aspectMask = VK_IMAGE_ASPECT_PLANE_1_BIT,
+                    .mipLevel = 0,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1,
+                },
+                .imageOffset = { 0, 0, 0 },
+                .imageExtent = { w / 2, h / 2, 1 },
+            },
+        });
+
+    vkCmdPipelineBarrier(cmd,
+        /*srcStageMask*/ VK_PIPELINE_STAGE_TRANSFER_BIT,
+        /*dstStageMask*/ VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        /*dependencyFlags*/ 0,
+        /*memoryBarriers*/ 0, NULL,
+        /*bufferMemmoryBarriers*/ 0, NULL,
+        /*imageMemmoryBarriers*/ 1,
+        (VkImageMemoryBarrier[]) {
+            {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+                .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image = rahb->image,
+                .subresourceRange = color_range,
+            },
+        });
+}
+#endif // ANDROID
+
+static void
+ru_ahb_finish(RuDevice *dev, RuAhb *rahb) {
+    if (rahb->aimage) {
+        // Assume that if we own an AImage then the AImageReader holds
+        // a reference to the AImage's AHB.
+        assert(rahb->in_aimage_reader);
+        AImage_delete(rahb->aimage);
+    }
+
+#ifndef ANDROID
+    vkDestroyBuffer(dev->vk, rahb->staging_buffer, ru_alloc_cb);
+    vkFreeMemory(dev->vk, rahb->staging_mem, ru_alloc_cb);
+#endif
+
+    vkDestroyImageView(dev->vk, rahb->image_view, ru_alloc_cb);
+    vkDestroyImage(dev->vk, rahb->image, ru_alloc_cb);
+    vkFreeMemory(dev->vk, rahb->mem, ru_alloc_cb);
+    AHardwareBuffer_release(rahb->ahb);
+}
+
+static void
+ru_ahb_ref(RuAhb *rahb) {
+    assert(rahb->aimage);
+    ++rahb->use_count;
+}
+
+static void
+ru_ahb_unref(RuAhb *rahb) {
+    assert(rahb->aimage);
+    assert(rahb->use_count > 0);
+
+    if (--rahb->use_count > 0)
+        return;
+
+    // Return the AHB to the AImageReader.
+    AImage_delete(rahb->aimage);
+    rahb->aimage = NULL;
+}
+
+static void
+ru_frame_unref_ahbs(RuFrame *frame) {
+    for (uint32_t i = 0; i < ARRAY_LEN(frame->rahbs); ++i) {
+        if (frame->rahbs[i]) {
+            ru_ahb_unref(frame->rahbs[i]);
+            frame->rahbs[i] = NULL;
+        }
+    }
+}
+
+// Call only after the frame's fence signals.
+static void
+ru_frame_reset(RuRend *rend, RuFrame *frame) {
+    RuDevice *dev = &rend->dev;
+
+    assert(!frame->is_reset);
+
+    frame->info.complete_ns = ru_time_now_ns();
+    ru_trace_async_end("frame", (int32_t) frame->info.seq);
+
+    if (frame->query_pool) {
+        // The fence has signaled, so the results are available and this does
+        // not stall.
+        uint64_t ts[2];
+        VkResult r = vkGetQueryPoolResults(dev->vk, frame->query_pool,
+            frame->first_query, /*queryCount*/ 2,
+            sizeof(ts), ts, /*stride*/ sizeof(ts[0]),
+            VK_QUERY_RESULT_64_BIT);
+
+        switch (r) {
+            case VK_SUCCESS: {
+                const RuPhysicalDevice *phys_dev = dev->phys_dev;
+                uint32_t valid_bits =
+                    phys_dev->queue_fam_props[rend->queue_fam_index].timestampValidBits;
+                uint64_t mask = valid_bits >= 64
+                    ? UINT64_MAX
+                    : (UINT64_C(1) << valid_bits) - 1;
+                uint64_t ticks = (ts[1] - ts[0]) & mask;
+
+                frame->info.gpu_ns = (int64_t)
+                    (ticks * (double) phys_dev->props.limits.timestampPeriod);
+                rend->last_gpu_ns = frame->info.gpu_ns;
+
+                ru_mutex_lock_scoped(&rend->stats.mutex);
+                ru_hist_record(&rend->stats.phase_hists[RU_REND_PHASE_GPU],
+                               frame->info.gpu_ns);
+                break;
+            }
+            case VK_NOT_READY:
+                break;
+            default:
+                die("vkGetQueryPoolResults failed with VkResult(%d)", r);
+        }
+    }
+
+    check(vkResetFences(dev->vk,
+        /*fenceCount*/ 1,
+        (VkFence[]) { frame->release_fence }));
+
+    ru_frame_unref_ahbs(frame);
+
+    frame->is_reset = true;
+
+    // Else ru_rend_collect_present_times() reports the display's time.
+    if (rend->latency && !rend->dev.has_display_timing)
+        ru_latency_on_present(rend->latency, frame->info.seq, frame->info.complete_ns);
+
+    if (rend->listener.on_frame_complete)
+        rend->listener.on_frame_complete(rend->listener.context, &frame->info);
+}
+
+static RuFramechain * _malloc_ _must_use_result_
+ru_framechain_new(
+        RuSwapchain *swapchain,
+        VkCommandPool cmd_pool,
+        VkRenderPass render_pass)
+{
+    RuDevice *dev = swapchain->dev;
+    const uint32_t len = swapchain->len;
+    const uint32_t queue_fam_index = swapchain->queue_fam_index;
+
+    VkQueryPool query_pool = VK_NULL_HANDLE;
+
+    if (dev->phys_dev->queue_fam_props[queue_fam_index].timestampValidBits > 0) {
+        check(vkCreateQueryPool(dev->vk,
+            &(VkQueryPoolCreateInfo) {
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .queryType = VK_QUERY_TYPE_TIMESTAMP,
+                .queryCount = 2 * len,
+            },
+            ru_alloc_cb,
+            &query_pool));
+    }
+
+    VkFence swapchain_fence;
+    check(vkCreateFence(dev->vk,
+        &(VkFenceCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+            .flags = 0,
+        },
+        ru_alloc_cb,
+        &swapchain_fence));
+
+    VkCommandBuffer cmd_buffers[len];
+    check(vkAllocateCommandBuffers(dev->vk,
+        &(VkCommandBufferAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
             .commandPool = cmd_pool,
             .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
             .commandBufferCount = len,
         },
         cmd_buffers));
 
+    if (len > RU_REND_MAX_HANDED_OFF_FRAMES)
+        die("swapchain has %u images; the renderer supports %u", len,
+            RU_REND_MAX_HANDED_OFF_FRAMES);
+
     let frames = new_array(RuFrame, len);
 
     for (uint32_t i = 0; i < len; ++i) {
@@ -1721,15 +2881,20 @@ ru_framechain_new(
             .release_fence = release_fence,
             .release_sem = release_sem,
 
-            .rahb = NULL,
+            .query_pool = query_pool,
+            .first_query = 2 * i,
+
+            .rahbs = {0},
 
             .is_reset = true,
+            .is_handed_off = false,
         };
     }
 
     let framechain = new(RuFramechain);
     framechain->swapchain = swapchain;
     framechain->swapchain_fence = swapchain_fence;
+    framechain->query_pool = query_pool;
     framechain->frames = frames;
     ru_queue_init(&framechain->submitted_frames, sizeof(RuFrame*),
             swapchain->len);
@@ -1759,12 +2924,7 @@ ru_framechain_free(RuFramechain *framechain)
     for (uint32_t i = 0; i < len; ++i) {
         RuFrame *frame = &framechain->frames[i];
 
-        if (frame->rahb) {
-            if (frame->rahb->aimage) {
-                AImage_delete(frame->rahb->aimage);
-                frame->rahb->aimage = NULL;
-            }
-        }
+        ru_frame_unref_ahbs(frame);
 
         vkDestroySemaphore(dev->vk, frame->release_sem, ru_alloc_cb);
         vkDestroyFence(dev->vk, frame->release_fence, ru_alloc_cb);
@@ -1773,72 +2933,122 @@ ru_framechain_free(RuFramechain *framechain)
 
     }
 
+    vkDestroyQueryPool(dev->vk, framechain->query_pool, ru_alloc_cb);
     vkDestroyFence(dev->vk, framechain->swapchain_fence, ru_alloc_cb);
     ru_queue_finish(&framechain->submitted_frames);
     free(framechain->frames);
     free(framechain);
 }
 
+// Add the time spent in vkQueueSubmit and vkQueuePresentKHR to
+// phase_ns[RU_REND_PHASE_SUBMIT] and phase_ns[RU_REND_PHASE_PRESENT].
 static void
 ru_framechain_submit(
         RuFramechain *framechain,
         RuFrame *frame,
-        VkQueue queue)
+        VkQueue queue,
+        int64_t *phase_ns)
 {
-    ru_queue_push(&framechain->submitted_frames, &frame);
+    const bool is_headless = framechain->swapchain->is_headless;
 
-    check(vkQueueSubmit(queue,
-        /*submitCount*/ 1,
-        (VkSubmitInfo[]) {
-            {
-                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                .waitSemaphoreCount = 0,
-                .commandBufferCount = 1,
-                .pCommandBuffers = (VkCommandBuffer[]) {
-                    frame->cmd_buffer,
-                },
-                .signalSemaphoreCount = 1,
-                .pSignalSemaphores = (VkSemaphore[]) {
-                    frame->release_sem,
+    int64_t t0 = ru_time_now_ns();
+
+    {
+        ru_trace_scoped("submit");
+
+        check(vkQueueSubmit(queue,
+            /*submitCount*/ 1,
+            (VkSubmitInfo[]) {
+                {
+                    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                    .waitSemaphoreCount = 0,
+                    .commandBufferCount = 1,
+                    .pCommandBuffers = (VkCommandBuffer[]) {
+                        frame->cmd_buffer,
+                    },
+                    // Nothing would wait on the semaphore.
+                    .signalSemaphoreCount = is_headless ? 0 : 1,
+                    .pSignalSemaphores = (VkSemaphore[]) {
+                        frame->release_sem,
+                    },
                 },
             },
-        },
-        frame->release_fence));
+            frame->release_fence));
+    }
 
-    VkResult swapchain_result = VK_SUCCESS;
-    VkResult present_result = vkQueuePresentKHR(queue,
-        &(VkPresentInfoKHR) {
-            .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-            .waitSemaphoreCount = 1,
-            .pWaitSemaphores = (VkSemaphore[]) {
-                frame->release_sem,
-            },
-            .swapchainCount = 1,
-            .pSwapchains = (VkSwapchainKHR[]) {
-                framechain->swapchain->vk,
-            },
-            .pImageIndices = (uint32_t[]) {
-                frame->swapchain_image_index,
+    int64_t t1 = ru_time_now_ns();
+    phase_ns[RU_REND_PHASE_SUBMIT] += t1 - t0;
+
+    if (is_headless)
+        return;
+
+    // The present id is the low bits of the frame's seq. See
+    // ru_rend_collect_present_times().
+    const VkPresentTimesInfoGOOGLE present_times = {
+        .sType = VK_STRUCTURE_TYPE_PRESENT_TIMES_INFO_GOOGLE,
+        .swapchainCount = 1,
+        .pTimes = (VkPresentTimeGOOGLE[]) {
+            {
+                .presentID = (uint32_t) frame->info.seq,
+                .desiredPresentTime = (uint64_t) frame->desired_present_ns,
             },
-            &swapchain_result,
-        });
+        },
+    };
 
-    switch (swapchain_result) {
-        case VK_SUCCESS:
-        case VK_ERROR_OUT_OF_DATE_KHR:
-        case VK_SUBOPTIMAL_KHR:
-            framechain->swapchain->status = swapchain_result;
-            break;
-        default:
-            die("vkQueuePresentKHR returned VkResult(%d)", swapchain_result);
+    VkResult swapchain_result = VK_SUCCESS;
+    VkResult present_result;
+    {
+        ru_trace_scoped("present");
+        ru_mutex_lock_scoped(&framechain->swapchain->mutex);
+
+        present_result = vkQueuePresentKHR(queue,
+            &(VkPresentInfoKHR) {
+                .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+                .pNext = framechain->swapchain->dev->has_display_timing
+                    ? &present_times
+                    : NULL,
+                .waitSemaphoreCount = 1,
+                .pWaitSemaphores = (VkSemaphore[]) {
+                    frame->release_sem,
+                },
+                .swapchainCount = 1,
+                .pSwapchains = (VkSwapchainKHR[]) {
+                    framechain->swapchain->vk,
+                },
+                .pImageIndices = (uint32_t[]) {
+                    frame->swapchain_image_index,
+                },
+                &swapchain_result,
+            });
+
+        switch (swapchain_result) {
+            case VK_SUCCESS:
+            case VK_ERROR_OUT_OF_DATE_KHR:
+            case VK_SUBOPTIMAL_KHR:
+                framechain->swapchain->status = swapchain_result;
+                break;
+            default:
+                die("vkQueuePresentKHR returned VkResult(%d)", swapchain_result);
+        }
     }
 
+    phase_ns[RU_REND_PHASE_PRESENT] += ru_time_now_ns() - t1;
+
     if (present_result != VK_SUCCESS)
         die("vkQueuePresentKHR returned VkResult(%d)", present_result);
 }
 
+// The frame's submission has finished. Queue it for ru_framechain_collect().
+static void
+ru_framechain_track(RuFramechain *framechain, RuFrame *frame) {
+    ru_queue_push(&framechain->submitted_frames, &frame);
+    ru_trace_counter("frames in flight", ru_queue_len(&framechain->submitted_frames));
+}
+
 static void
-ru_framechain_collect(RuDevice *dev, RuFramechain *framechain) {
+ru_framechain_collect(RuRend *rend, RuFramechain *framechain) {
+    RuDevice *dev = &rend->dev;
+
     for (;;) {
         RuFrame *frame;
         if (!ru_queue_peek(&framechain->submitted_frames, &frame))
@@ -1856,7 +3066,7 @@ ru_framechain_collect(RuDevice *dev, RuFramechain *framechain) {
                             __func__, r);
             }
 
-            ru_frame_reset(dev, frame);
+            ru_frame_reset(rend, frame);
         }
 
         (void) ru_queue_pop(&framechain->submitted_frames, NULL);
@@ -1885,8 +3095,82 @@ ru_ahb_cache_search(RuAhbCache *cache, AHardwareBuffer *ahb) {
     return NULL;
 }
 
+// An AHB that a worker of the import pool imports. See ru_rend_import_ahb().
+struct RuAhbImport {
+    RuRend *rend _not_owned_;
+    AHardwareBuffer *ahb;
+    RuAhb rahb; // Filled by the worker.
+    _Atomic bool is_done;
+};
+
+static void
+ru_rend_record_ahb_init(RuRend *rend, int64_t ns) {
+    ru_mutex_lock_scoped(&rend->stats.mutex);
+    ru_hist_record(&rend->stats.phase_hists[RU_REND_PHASE_AHB_INIT], ns);
+    ++rend->stats.ahb_import_count;
+}
+
+static void
+ru_ahb_import_run(void *_import) {
+    RuAhbImport *import = _import;
+    RuRend *rend = import->rend;
+    int64_t begin_ns = ru_time_now_ns();
+
+    ru_ahb_init(rend, import->ahb, &import->rahb);
+
+    // Create the AHB's pipelines now, rather than in the first frame that
+    // draws the AHB.
+    RuYcbcrPipeline *yp = import->rahb.ycbcr_pipeline;
+
+    for (uint32_t i = 0; i < RU_BLEND_MODE_COUNT; ++i) {
+        if (!ru_ycbcr_pipeline_get_vk_pipeline(rend, yp, i))
+            abort();
+    }
+
+    ru_rend_record_ahb_init(rend, ru_time_now_ns() - begin_ns);
+}
+
+// The render thread may be idle, or waiting in ru_aimage_heap_pop_wait(), with
+// a layer's pending AImage on this import. Wake it as a new AImage would.
+static void
+ru_ahb_import_on_done(void *_import) {
+    RuAhbImport *import = _import;
+    RuRend *rend = import->rend;
+    RuAImageHeap *heap = &rend->aimage_heap;
+    bool wake_rend;
+
+    {
+        ru_mutex_lock_scoped(&heap->aimage_available.mutex);
+
+        // Once set, the render thread may free the import.
+        atomic_store_explicit(&import->is_done, true, memory_order_release);
+        ++heap->aimage_available.import_count;
+
+        wake_rend = heap->aimage_available.wake_rend;
+        heap->aimage_available.wake_rend = false;
+
+        if (pthread_cond_broadcast(&heap->aimage_available.cond))
+            abort();
+    }
+
+    if (wake_rend) {
+        ru_rend_push_event(rend,
+            (RuRendEvent) { .type = RU_REND_EVENT_AIMAGE_AVAILABLE, });
+    }
+
+    ru_mutex_lock_scoped(&rend->imports_in_flight.mutex);
+    --rend->imports_in_flight.count;
+
+    if (pthread_cond_broadcast(&rend->imports_in_flight.cond))
+        abort();
+}
+
+// Return the AHB's slot in the cache. On a miss, import the AHB into an empty
+// slot. With an import pool, the import runs on the pool and the slot is
+// unusable until ru_rend_poll_import() returns true. The AHB came from the
+// layer's AImageReader.
 static RuAhb * _must_use_result_
-ru_rend_import_ahb(RuRend *rend, AHardwareBuffer *ahb) {
+ru_rend_import_ahb(RuRend *rend, RuLayer *layer, AHardwareBuffer *ahb) {
     RuAhbCache *cache = &rend->ahb_cache;
     RuAhb *rahb;
 
@@ -1899,21 +3183,105 @@ ru_rend_import_ahb(RuRend *rend, AHardwareBuffer *ahb) {
     if (!rahb)
         die("RuAhbCache is full");
 
-    ru_ahb_init(rend, ahb, rahb);
+    AHardwareBuffer_acquire(ahb);
+
+    if (!rend->import_pool) {
+        int64_t begin_ns = ru_time_now_ns();
+        ru_ahb_init(rend, ahb, rahb);
+        ru_rend_record_ahb_init(rend, ru_time_now_ns() - begin_ns);
+        return rahb;
+    }
+
+    RuAhbImport *import = new0(RuAhbImport);
+    import->rend = rend;
+    import->ahb = ahb;
+    atomic_init(&import->is_done, false);
+
+    // Occupy the slot, so that later searches find the import.
+    *rahb = (RuAhb) {
+        .ahb = ahb,
+        .aimage_reader = layer->aimage_reader,
+        .in_aimage_reader = true,
+        .import = import,
+    };
+
+    {
+        ru_mutex_lock_scoped(&rend->imports_in_flight.mutex);
+        ++rend->imports_in_flight.count;
+    }
+
+    ru_pool_submit(rend->import_pool,
+        (RuPoolJob) {
+            .context = import,
+            .run = ru_ahb_import_run,
+            .on_done = ru_ahb_import_on_done,
+        });
 
     return rahb;
 }
 
+// Return true if the slot is usable: its AHB was imported inline, or its
+// import on the pool is done. Then adopt the import's result.
+static bool _must_use_result_
+ru_rend_poll_import(RuAhb *slot) {
+    RuAhbImport *import = slot->import;
+
+    if (!import)
+        return true;
+
+    if (!atomic_load_explicit(&import->is_done, memory_order_acquire))
+        return false;
+
+    // The AImageReader may have dropped the AHB, or been retired, while the
+    // import ran.
+    AImageReader *aimage_reader = slot->aimage_reader;
+    bool in_aimage_reader = slot->in_aimage_reader;
+
+    *slot = import->rahb;
+    slot->aimage_reader = aimage_reader;
+    slot->in_aimage_reader = in_aimage_reader;
+    assert(!slot->import);
+
+    free(import);
+
+    return true;
+}
+
+// Block until no import job touches the RuRend. Then adopt each import.
 static void
-ru_rend_purge_dead_ahbs(RuRend *rend) {
-    RuDevice *dev = &rend->dev;
+ru_rend_finish_imports(RuRend *rend) {
+    {
+        ru_mutex_lock_scoped(&rend->imports_in_flight.mutex);
+
+        while (rend->imports_in_flight.count > 0) {
+            if (pthread_cond_wait(&rend->imports_in_flight.cond,
+                                  &rend->imports_in_flight.mutex)) {
+                abort();
+            }
+        }
+    }
+
+    ru_ahb_cache_each_slot(&rend->ahb_cache, slot) {
+        if (slot->ahb && !ru_rend_poll_import(slot))
+            abort();
+    }
+}
 
+// Retire each cached AHB that its AImageReader no longer holds. See
+// ru_rend_destroy_retired().
+static void
+ru_rend_purge_dead_ahbs(RuRend *rend) {
     ru_ahb_cache_each_slot(&rend->ahb_cache, slot) {
         if (!slot->ahb) {
             // invalid slot
             continue;
         }
 
+        if (!ru_rend_poll_import(slot)) {
+            // The import pool still owns the slot's resources.
+            continue;
+        }
+
         if (slot->in_aimage_reader) {
             // The AImageReader still holds a reference to the AHB. Therefore
             // the media decoder may continue to update it.
@@ -1921,99 +3289,535 @@ ru_rend_purge_dead_ahbs(RuRend *rend) {
         }
 
         assert(!slot->aimage);
-        ru_ahb_finish(dev, slot);
+        assert(slot->use_count == 0);
+        ru_queue_push(&rend->retired,
+            &(RuRetired) {
+                .type = RU_RETIRED_AHB,
+                .ahb = *slot,
+            });
 
         // Invalidate the slot
         slot->ahb = NULL;
     }
 }
 
+// Hand the framechain and its swapchain to ru_rend_destroy_retired(), instead
+// of waiting here for their frames. Call after ru_rend_wait_for_submit().
+static void
+ru_rend_retire_framechain(RuRend *rend, RuFramechain *framechain,
+                          RuSwapchain *swapchain) {
+    assert(framechain->swapchain == swapchain);
+
+    ru_queue_push(&rend->retired,
+        &(RuRetired) {
+            .type = RU_RETIRED_FRAMECHAIN,
+            .framechain = {
+                .framechain = framechain,
+                .swapchain = swapchain,
+            },
+        });
+}
+
+static bool _must_use_result_
+ru_framechain_is_idle(RuDevice *dev, RuFramechain *framechain) {
+    for (uint32_t i = 0; i < framechain->swapchain->len; ++i) {
+        RuFrame *frame = &framechain->frames[i];
+
+        if (frame->is_reset)
+            continue;
+
+        VkResult r = vkGetFenceStatus(dev->vk, frame->release_fence);
+        switch (r) {
+            case VK_SUCCESS:
+                break;
+            case VK_NOT_READY:
+                return false;
+            default:
+                die("%s: vkGetFenceStatus failed with VkResult(%d)",
+                        __func__, r);
+        }
+    }
+
+    return true;
+}
+
+// Destroy retired resources, oldest first, until one is still in use on the
+// GPU or budget_ns has passed. With a negative budget, destroy them all, and
+// block for any still in use.
+static void
+ru_rend_destroy_retired(RuRend *rend, int64_t budget_ns) {
+    RuDevice *dev = &rend->dev;
+    const int64_t begin_ns = ru_time_now_ns();
+    uint32_t count = 0;
+    bool is_traced = false;
+    RuRetired r;
+
+    while (ru_queue_peek(&rend->retired, &r)) {
+        if (budget_ns >= 0) {
+            if (count > 0 && ru_time_now_ns() - begin_ns >= budget_ns)
+                break;
+
+            if (r.type == RU_RETIRED_FRAMECHAIN &&
+                !ru_framechain_is_idle(dev, r.framechain.framechain)) {
+                break;
+            }
+        }
+
+        if (count == 0)
+            is_traced = ru_trace_begin("destroy");
+
+        switch (r.type) {
+            case RU_RETIRED_AHB:
+                ru_ahb_finish(dev, &r.ahb);
+                ru_rend_unref_ycbcr_pipeline(rend, r.ahb.ycbcr_pipeline);
+                break;
+            case RU_RETIRED_FRAMECHAIN:
+                // Both wait for any frame still in use.
+                ru_framechain_free(r.framechain.framechain);
+                ru_swapchain_free(r.framechain.swapchain);
+                break;
+            case RU_RETIRED_YCBCR_PIPELINE:
+                ru_ycbcr_pipeline_finish(dev, r.ycbcr_pipeline);
+                free(r.ycbcr_pipeline);
+                break;
+        }
+
+        (void) ru_queue_pop(&rend->retired, NULL);
+        ++count;
+    }
+
+    if (is_traced)
+        ru_trace_end();
+
+    if (count > 0) {
+        ru_mutex_lock_scoped(&rend->stats.mutex);
+        ru_hist_record(&rend->stats.phase_hists[RU_REND_PHASE_DESTROY],
+                       ru_time_now_ns() - begin_ns);
+    }
+}
+
+static void
+ru_rend_retire_aimage_reader(RuRend *rend, AImageReader *reader) {
+    if (rend->retired_aimage_reader_count ==
+            ARRAY_LEN(rend->retired_aimage_readers)) {
+        die("too many retired AImageReaders");
+    }
+
+    rend->retired_aimage_readers[rend->retired_aimage_reader_count++] = reader;
+}
+
+// Delete each retired AImageReader whose AImages are all returned. Then its
+// AHBs are dead, and ru_rend_purge_dead_ahbs() may retire their imports.
+static void
+ru_rend_purge_retired_aimage_readers(RuRend *rend) {
+    for (uint32_t i = 0; i < rend->retired_aimage_reader_count;) {
+        AImageReader *reader = rend->retired_aimage_readers[i];
+        bool in_use = false;
+
+        ru_ahb_cache_each_slot(&rend->ahb_cache, slot) {
+            if (slot->ahb && slot->aimage_reader == reader && slot->aimage) {
+                in_use = true;
+                break;
+            }
+        }
+
+        if (in_use) {
+            ++i;
+            continue;
+        }
+
+        ru_ahb_cache_each_slot(&rend->ahb_cache, slot) {
+            if (slot->ahb && slot->aimage_reader == reader) {
+                slot->aimage_reader = NULL;
+                slot->in_aimage_reader = false;
+            }
+        }
+
+        logd("delete retired AImageReader %p", (void *) reader);
+        AImageReader_delete(reader);
+
+        rend->retired_aimage_readers[i] =
+            rend->retired_aimage_readers[--rend->retired_aimage_reader_count];
+    }
+}
+
 static void
-on_aimage_available(void *_heap, AImageReader *reader) {
+on_aimage_available(void *_layer, AImageReader *reader) {
     static _Atomic uint64_t seq = 0;
-    logd("%s: seq=%"PRIu64, __func__, ++seq);
+    logv_deferred("%s: seq=%"PRIu64, __func__, ++seq);
 
-    RuAImageHeap *heap = _heap;
+    RuLayer *layer = _layer;
+    RuAImageHeap *heap = &layer->rend->aimage_heap;
+    bool wake_rend;
 
-    assert(reader == heap->aimage_reader);
+    assert(reader == layer->aimage_reader);
 
-    ru_mutex_lock_scoped(&heap->aimage_available.mutex);
+    {
+        ru_mutex_lock_scoped(&heap->aimage_available.mutex);
 
-    ++heap->aimage_available.count;
+        ++layer->aimage_available_count;
+        layer->aimage_available_ns = ru_time_now_ns();
+        ++heap->aimage_available.count;
 
-    if (pthread_cond_broadcast(&heap->aimage_available.cond))
-        abort();
+        wake_rend = heap->aimage_available.wake_rend;
+        heap->aimage_available.wake_rend = false;
+
+        if (pthread_cond_broadcast(&heap->aimage_available.cond))
+            abort();
+    }
+
+    if (wake_rend) {
+        ru_rend_push_event(layer->rend,
+            (RuRendEvent) { .type = RU_REND_EVENT_AIMAGE_AVAILABLE, });
+    }
 }
 
 static void
-ru_aimage_heap_init(RuAImageHeap *heap, AImageReader *reader) {
+ru_aimage_heap_init(RuAImageHeap *heap, RuLayer *layers, uint32_t layer_count) {
     *heap = (RuAImageHeap) {
-        .aimage_reader = reader,
         .aimage_available = {
             .mutex = PTHREAD_MUTEX_INITIALIZER,
             .cond = PTHREAD_COND_INITIALIZER,
-
-            // Assume the media decoder has already begun and therefore images
-            // are already available.
-            .count = 1,
+            .count = 0,
+            .wake_rend = false,
+            .import_count = 0,
         },
     };
 
-    AImageReader_setImageListener(reader,
-        &(AImageReader_ImageListener) {
-            .context = heap,
-            .onImageAvailable = on_aimage_available,
-        });
+    for (uint32_t i = 0; i < layer_count; ++i) {
+        RuLayer *layer = &layers[i];
+
+        // Assume the media decoder has already begun and therefore images
+        // are already available.
+        layer->aimage_available_count = 1;
+        layer->aimage_available_ns = ru_time_now_ns();
+        ++heap->aimage_available.count;
+
+        AImageReader_setImageListener(layer->aimage_reader,
+            &(AImageReader_ImageListener) {
+                .context = layer,
+                .onImageAvailable = on_aimage_available,
+            });
+    }
+}
+
+static void
+ru_aimage_heap_finish(RuAImageHeap *heap, RuLayer *layers, uint32_t layer_count) {
+    for (uint32_t i = 0; i < layer_count; ++i) {
+        AImageReader_setImageListener(layers[i].aimage_reader, NULL);
+    }
+
+    if (pthread_mutex_init(&heap->aimage_available.mutex, NULL))
+        abort();
+
+    if (pthread_cond_init(&heap->aimage_available.cond, NULL))
+        abort();
+}
+
+// Return true if any layer has a new AImage, or an import finished. Else,
+// arrange for the next onImageAvailable to wake the render thread's
+// ru_chan_pop_wait(), and return false.
+//
+// The render thread polls before it acquires a swapchain image, so that it
+// neither holds the image while it waits for the decoder nor redraws
+// unchanged content.
+static bool _must_use_result_
+ru_aimage_heap_poll(RuAImageHeap *heap) {
+    ru_mutex_lock_scoped(&heap->aimage_available.mutex);
+
+    if (heap->aimage_available.count > 0 ||
+        heap->aimage_available.import_count > 0) {
+        return true;
+    }
+
+    heap->aimage_available.wake_rend = true;
+    return false;
+}
+
+// Block until at least one layer has a new AImage, or an import on the import
+// pool finished, which may let a layer draw its pending AImage. For each
+// layer, set
+// aimages[layer] to its latest AImage, or to null if the layer has none new,
+// and set available_ns[layer] to when the AImage arrived. Return how many
+// older AImages the new ones replaced.
+static uint32_t _must_use_result_
+ru_aimage_heap_pop_wait(RuAImageHeap *heap, RuLayer *layers,
+                        uint32_t layer_count, AImage **aimages,
+                        int64_t *available_ns) {
+    static _Atomic uint64_t seq = 0;
+    logv_deferred("%s: seq=%"PRIu64, __func__, ++seq);
+    ru_trace_scoped("image wait");
+
+    int ret;
+
+    ru_mutex_lock_scoped(&heap->aimage_available.mutex);
+
+ try_again:
+    while (heap->aimage_available.count == 0 &&
+           heap->aimage_available.import_count == 0) {
+        // FIXME: Avoid deadlock when the media decoder is done.
+        if (pthread_cond_wait(&heap->aimage_available.cond,
+                    &heap->aimage_available.mutex)) {
+            abort();
+        }
+    }
+
+    uint32_t found = 0;
+    uint32_t dropped = 0;
+
+    for (uint32_t i = 0; i < layer_count; ++i) {
+        RuLayer *layer = &layers[i];
+        uint32_t available_count = layer->aimage_available_count;
+
+        aimages[i] = NULL;
+        available_ns[i] = 0;
+
+        if (available_count == 0)
+            continue;
+
+        layer->aimage_available_count = 0;
+
+        // TODO: Use AImageReader_acquireLatestImageAsync.
+        AImage *aimage;
+        ret = AImageReader_acquireLatestImage(layer->aimage_reader, &aimage);
+
+        switch (ret) {
+            case AMEDIA_OK:
+                assert(aimage);
+                aimages[i] = aimage;
+                available_ns[i] = layer->aimage_available_ns;
+                dropped += available_count - 1;
+                ++found;
+                break;
+            case AMEDIA_IMGREADER_NO_BUFFER_AVAILABLE:
+                break;
+            case AMEDIA_IMGREADER_MAX_IMAGES_ACQUIRED:
+                // In-flight frames hold all of the reader's images. Keep
+                // drawing the layer's current image.
+                logd_ratelimit(1000, "layer %u: AImageReader_acquireLatestImage: "
+                               "max images acquired", i);
+                break;
+            default:
+                die("AImageReader_acquireLatestImage: unexpected error=%d", ret);
+        }
+    }
+
+    uint32_t import_count = heap->aimage_available.import_count;
+    heap->aimage_available.count = 0;
+    heap->aimage_available.import_count = 0;
+
+    if (found == 0 && import_count == 0)
+        goto try_again;
+
+    return dropped;
+}
+
+static void
+ru_aimage_get_crop(AImage *aimage, float crop[4]) {
+    int32_t width, height;
+    AImageCropRect rect;
+    int ret;
+
+    ret = AImage_getWidth(aimage, &width);
+    if (ret)
+        die("AImage_getWidth failed: error=%d", ret);
+
+    ret = AImage_getHeight(aimage, &height);
+    if (ret)
+        die("AImage_getHeight failed: error=%d", ret);
+
+    ret = AImage_getCropRect(aimage, &rect);
+    if (ret)
+        die("AImage_getCropRect failed: error=%d", ret);
+
+    crop[0] = (float) rect.left / width;
+    crop[1] = (float) rect.top / height;
+    crop[2] = (float) rect.right / width;
+    crop[3] = (float) rect.bottom / height;
+}
+
+// Choose the vsync at which the frame after the one due at vsync_ns is due.
+static void
+ru_rend_advance_cadence(RuRend *rend, int64_t vsync_ns) {
+    const int64_t period_ns = ru_vsync_get_period(rend->vsync);
+
+    if (rend->frame_rate_hz == 0 || period_ns == 0) {
+        rend->cadence_vsync_ns = 0;
+        return;
+    }
+
+    // Restart the cadence when the display's period changes, such as after
+    // ANativeWindow_setFrameRate switches its mode. Ignore the jitter of a
+    // period estimated from Choreographer.
+    if (50 * llabs(period_ns - rend->cadence.vsync_period_ns) > period_ns) {
+        ru_cadence_reset(&rend->cadence,
+                         (int64_t) (RU_NSEC_PER_SEC / rend->frame_rate_hz),
+                         period_ns);
+
+        logi("cadence: %.3f Hz frames on a %.3f Hz display, %.3f vsyncs per frame",
+             rend->frame_rate_hz, (double) RU_NSEC_PER_SEC / period_ns,
+             (double) rend->cadence.frame_period_ns / period_ns);
+    }
+
+    rend->cadence_vsync_ns = vsync_ns + ru_cadence_next(&rend->cadence) * period_ns;
+}
+
+// Return the latest moment that lets a frame, prepared from now_ns, latch its
+// AImages and still finish before a vsync, and set vsync_ns to that vsync. If
+// the frame rate has a cadence, the vsync is no earlier than the one the
+// cadence gives, and is_held is set. Without a prediction, return now_ns.
+static int64_t _must_use_result_
+ru_rend_predict_latch(RuRend *rend, int64_t now_ns, int64_t *vsync_ns,
+                      bool *is_held) {
+    const int64_t lead_ns = rend->latch_budget_ns + RU_REND_LATCH_MARGIN_NS;
+
+    *vsync_ns = ru_vsync_next(rend->vsync, now_ns + lead_ns);
+    *is_held = rend->cadence_vsync_ns > *vsync_ns;
+
+    if (*is_held) {
+        // Snap to the latest prediction, which may have drifted since the
+        // previous frame.
+        const int64_t period_ns = ru_vsync_get_period(rend->vsync);
+        *vsync_ns = ru_vsync_next(rend->vsync, rend->cadence_vsync_ns - period_ns / 2);
+    }
+
+    return ru_max(*vsync_ns - lead_ns, now_ns);
+}
+
+// Sleep until the frame's latch time. See ru_rend_predict_latch().
+static void
+ru_rend_wait_for_latch(RuRend *rend, RuFrame *frame) {
+    const int64_t now_ns = ru_time_now_ns();
+    const int64_t period_ns = ru_vsync_get_period(rend->vsync);
+    int64_t vsync_ns;
+    bool is_held;
+    const int64_t latch_ns =
+        ru_rend_predict_latch(rend, now_ns, &vsync_ns, &is_held);
+
+    if (period_ns > 0)
+        frame->info.vsync_ns = vsync_ns;
+
+    // The compositor must not show the frame early, or it would cut the
+    // previous frame's share short.
+    if (is_held)
+        frame->desired_present_ns = vsync_ns - period_ns / 2;
+
+    ru_rend_advance_cadence(rend, vsync_ns);
+
+    if (latch_ns <= now_ns)
+        return;
+
+    ru_trace_scoped("latch wait");
+    ru_time_sleep_until_ns(latch_ns);
+}
+
+// Fold the frame's time from latch to GPU completion into latch_budget_ns.
+// The frame's own GPU time is not yet known, so use the latest completed
+// frame's.
+static void
+ru_rend_update_latch_budget(RuRend *rend, const RuFrame *frame) {
+    const int64_t sample_ns =
+        frame->info.submit_ns - frame->latch_ns + rend->last_gpu_ns;
+    const int64_t budget_ns = rend->latch_budget_ns;
+
+    if (sample_ns > budget_ns) {
+        rend->latch_budget_ns = sample_ns;
+    } else {
+        rend->latch_budget_ns = budget_ns - (budget_ns - sample_ns) / 32;
+    }
+}
+
+// The submit thread has handed the frame back. Queue it for
+// ru_framechain_collect().
+static void
+ru_rend_reclaim_frame(RuRend *rend, RuFrame *frame) {
+    assert(frame->is_handed_off);
+    assert(rend->handed_off_count > 0);
+
+    frame->is_handed_off = false;
+    --rend->handed_off_count;
+    ru_framechain_track(rend->framechain, frame);
+}
+
+// Reclaim the frames that the submit thread has finished, without blocking.
+static void
+ru_rend_reclaim_frames(RuRend *rend) {
+    RuFrame *frame;
+
+    while (rend->handed_off_count > 0 &&
+           ru_spsc_try_pop(&rend->done_spsc, &frame)) {
+        ru_rend_reclaim_frame(rend, frame);
+    }
 }
 
+// Block until the submit thread hands back the frame, or every frame if
+// frame is null. Call before touching a frame that may be handed off, and
+// before destroying the framechain or the swapchain. Without a submit
+// thread, no frame is ever handed off and this returns at once.
 static void
-ru_aimage_heap_finish(RuAImageHeap *heap) {
-    assert(heap->aimage_reader);
+ru_rend_wait_for_submit(RuRend *rend, RuFrame *frame) {
+    while (frame ? frame->is_handed_off : rend->handed_off_count > 0) {
+        ru_trace_scoped("submit wait");
 
-    AImageReader_setImageListener(heap->aimage_reader, NULL);
+        RuFrame *done;
+        ru_spsc_pop_wait(&rend->done_spsc, &done);
+        ru_rend_reclaim_frame(rend, done);
+    }
+}
 
-    if (pthread_mutex_init(&heap->aimage_available.mutex, NULL))
-        abort();
+// Make the layer's pending AImage, whose AHB is imported, the one it draws,
+// starting with the frame. The render thread acquired the AImage at latch_ns.
+static void
+ru_layer_latch_pending(RuLayer *layer, RuFrame *frame, int64_t latch_ns) {
+    RuRend *rend = layer->rend;
+    AImage *aimage = layer->pending_aimage;
+    RuAhb *rahb = layer->pending_rahb;
+    int64_t available_ns = layer->pending_available_ns;
+    int ret;
 
-    if (pthread_cond_init(&heap->aimage_available.cond, NULL))
-        abort();
-}
+    layer->pending_aimage = NULL;
+    layer->pending_rahb = NULL;
+    layer->pending_available_ns = 0;
+
+    if (rend->latency) {
+        int64_t timestamp_ns;
+        ret = AImage_getTimestamp(aimage, &timestamp_ns);
+        if (ret)
+            die("AImage_getTimestamp failed: error=%d", ret);
+
+        // The codec sets the timestamp from the output buffer's
+        // presentationTimeUs.
+        ru_latency_on_acquire(rend->latency, layer->index,
+                              timestamp_ns / RU_NSEC_PER_USEC,
+                              available_ns, latch_ns, frame->info.seq);
+    }
 
-static AImage * _must_use_result_
-ru_aimage_heap_pop_wait(RuAImageHeap *heap) {
-    static _Atomic uint64_t seq = 0;
-    logd("%s: seq=%"PRIu64, __func__, ++seq);
+    // The AImageReader cannot reissue an AHB while we hold its previous
+    // AImage.
+    assert(!rahb->aimage);
+    assert(rahb->use_count == 0);
 
-    int ret;
+    rahb->aimage_reader = layer->aimage_reader;
+    rahb->aimage = aimage;
+    rahb->in_aimage_reader = true;
+    ru_ahb_ref(rahb);
 
-    ru_mutex_lock_scoped(&heap->aimage_available.mutex);
+    ru_aimage_get_crop(aimage, rahb->crop);
+#ifndef ANDROID
+    ru_ahb_stage(rahb);
+#endif
 
- try_again:
-    while (heap->aimage_available.count == 0) {
-        // FIXME: Avoid deadlock when the media decoder is done.
-        if (pthread_cond_wait(&heap->aimage_available.cond,
-                    &heap->aimage_available.mutex)) {
-            abort();
-        }
-    }
+    if (layer->latest)
+        ru_ahb_unref(layer->latest);
 
-    // TODO: Use AImageReader_acquireLatestImageAsync.
-    AImage *aimage;
-    ret = AImageReader_acquireLatestImage(heap->aimage_reader, &aimage);
+    layer->latest = rahb;
 
-    heap->aimage_available.count = 0;
+    RuRendFrameInfo *info = &frame->info;
 
-    switch (ret) {
-        case AMEDIA_OK:
-            assert(aimage);
-            break;
-        case AMEDIA_IMGREADER_NO_BUFFER_AVAILABLE:
-            goto try_again;
-        default:
-            die("AImageReader_acquireLatestImage: unexpected error=%d", ret);
+    if (info->new_aimage_count++ == 0 ||
+        available_ns < info->aimage_available_ns) {
+        info->aimage_available_ns = available_ns;
     }
-
-    return aimage;
 }
 
 static RuFrame * _must_use_result_
@@ -2023,20 +3827,53 @@ ru_rend_next_frame(RuRend *rend) {
     RuSwapchain *swapchain = framechain->swapchain;
     int ret;
 
-    check(vkResetFences(dev->vk,
-        /*fenceCount*/ 1,
-        (VkFence[]) { framechain->swapchain_fence }));
-
+    const int64_t begin_ns = ru_time_now_ns();
+    int64_t t = begin_ns;
+    int64_t acquire_ns = 0;
     uint32_t frame_index;
-    check(vkAcquireNextImageKHR(dev->vk, swapchain->vk,
-        /*timeout*/ UINT64_MAX,
-        /*semaphore*/ VK_NULL_HANDLE,
-        framechain->swapchain_fence,
-        &frame_index));
+
+    if (swapchain->is_headless) {
+        // There is nothing to acquire. The frames take turns.
+        frame_index = swapchain->next_image_index;
+        swapchain->next_image_index = (frame_index + 1) % swapchain->len;
+    } else {
+        check(vkResetFences(dev->vk,
+            /*fenceCount*/ 1,
+            (VkFence[]) { framechain->swapchain_fence }));
+
+        ru_trace_scoped("acquire");
+
+        {
+            // The swapchain has one image more than the surface's minimum
+            // if a submit thread may still hold the previous image, so the
+            // acquire does not wait on its present.
+            ru_mutex_lock_scoped(&swapchain->mutex);
+            check(vkAcquireNextImageKHR(dev->vk, swapchain->vk,
+                /*timeout*/ UINT64_MAX,
+                /*semaphore*/ VK_NULL_HANDLE,
+                framechain->swapchain_fence,
+                &frame_index));
+        }
+
+        acquire_ns = ru_time_now_ns() - t;
+    }
 
     RuFrame *frame = &framechain->frames[frame_index];
+    int64_t *phase_ns = frame->phase_ns;
+
+    // The submit thread may still be finishing the frame's previous use.
+    t = ru_time_now_ns();
+    ru_rend_wait_for_submit(rend, frame);
+
+    memset(frame->phase_ns, 0, sizeof(frame->phase_ns));
+    phase_ns[RU_REND_PHASE_ACQUIRE] = acquire_ns;
+    phase_ns[RU_REND_PHASE_FENCE_WAIT] = ru_time_now_ns() - t;
 
     if (!frame->is_reset) {
+        t = ru_time_now_ns();
+
+        ru_trace_scoped("fence wait");
+
         // Block until the queue is no longer accessing the old frame's resources.
         check(vkWaitForFences(dev->vk,
             /*fenceCount*/ 1,
@@ -2044,30 +3881,89 @@ ru_rend_next_frame(RuRend *rend) {
             /*waitAll*/ true,
             /*timeout*/ UINT64_MAX));
 
-        ru_frame_reset(dev, frame);
+        ru_frame_reset(rend, frame);
+        phase_ns[RU_REND_PHASE_FENCE_WAIT] += ru_time_now_ns() - t;
     }
 
+    frame->info = (RuRendFrameInfo) {
+        .seq = rend->frame_seq++,
+        .begin_ns = begin_ns,
+    };
+
+    ru_trace_async_begin("frame", (int32_t) frame->info.seq);
+
     // We want to present the most recently decoded video frame. So we postpone
     // pulling the AImage until the swapchain's VkImage is ready for rendering.
-    check(vkWaitForFences(dev->vk,
-        /*fenceCount*/ 1,
-        (VkFence[]) { framechain->swapchain_fence },
-        /*waitAll*/ true,
-        /*timeout*/ UINT64_MAX));
+    if (!swapchain->is_headless) {
+        ru_trace_scoped("acquire wait");
+        t = ru_time_now_ns();
+
+        check(vkWaitForFences(dev->vk,
+            /*fenceCount*/ 1,
+            (VkFence[]) { framechain->swapchain_fence },
+            /*waitAll*/ true,
+            /*timeout*/ UINT64_MAX));
+
+        phase_ns[RU_REND_PHASE_ACQUIRE] += ru_time_now_ns() - t;
+    }
+
+    frame->desired_present_ns = 0;
+
+    if (rend->vsync) {
+        t = ru_time_now_ns();
+        ru_rend_wait_for_latch(rend, frame);
+        phase_ns[RU_REND_PHASE_LATCH_WAIT] += ru_time_now_ns() - t;
+    }
 
     // FIXME: Avoid deadlock when the media decoder is done.
-    AImage *aimage = ru_aimage_heap_pop_wait(&rend->aimage_heap);
-    assert(aimage);
+    AImage *aimages[RU_REND_MAX_LAYERS];
+    int64_t available_ns[RU_REND_MAX_LAYERS];
+    t = ru_time_now_ns();
+    frame->latch_ns = t;
+    frame->info.dropped_aimage_count =
+        ru_aimage_heap_pop_wait(&rend->aimage_heap, rend->layers,
+                                rend->layer_count, aimages, available_ns);
+    phase_ns[RU_REND_PHASE_IMAGE_WAIT] += ru_time_now_ns() - t;
+    t = ru_time_now_ns();
+
+    for (uint32_t i = 0; i < rend->layer_count; ++i) {
+        RuLayer *layer = &rend->layers[i];
+
+        if (aimages[i]) {
+            AHardwareBuffer *ahb;
+            ret = AImage_getHardwareBuffer(aimages[i], &ahb);
+            if (ret)
+                die("AImage_getHardwareBuffer failed: error=%d", ret);
+
+            // The new AImage replaces any whose import is still running.
+            if (layer->pending_aimage) {
+                AImage_delete(layer->pending_aimage);
+                ++frame->info.dropped_aimage_count;
+            }
 
-    AHardwareBuffer *ahb;
-    ret = AImage_getHardwareBuffer(aimage, &ahb);
-    if (ret)
-        die("AImage_getHardwareBuffer failed: error=%d", ret);
+            layer->pending_aimage = aimages[i];
+            layer->pending_rahb = ru_rend_import_ahb(rend, layer, ahb);
+            layer->pending_available_ns = available_ns[i];
+        }
 
+        if (layer->pending_aimage) {
+            if (ru_rend_poll_import(layer->pending_rahb)) {
+                ru_layer_latch_pending(layer, frame, t);
+            } else if (aimages[i]) {
+                ru_mutex_lock_scoped(&rend->stats.mutex);
+                ++rend->stats.deferred_aimage_count;
+            }
+        }
+
+        // The layer may draw the same image in several frames.
+        if (layer->latest) {
+            ru_ahb_ref(layer->latest);
+            frame->rahbs[i] = layer->latest;
+        }
+    }
+
+    phase_ns[RU_REND_PHASE_IMPORT] += ru_time_now_ns() - t;
     frame->is_reset = false;
-    frame->rahb = ru_rend_import_ahb(rend, ahb);
-    frame->rahb->aimage = aimage;
-    frame->rahb->in_aimage_reader = true;
 
     return frame;
 }
@@ -2084,6 +3980,9 @@ ru_rend_event_type_to_str(RuRendEventType t) {
         CASE(RU_REND_EVENT_BIND_WINDOW);
         CASE(RU_REND_EVENT_UNBIND_WINDOW);
         CASE(RU_REND_EVENT_AIMAGE_BUFFER_REMOVED);
+        CASE(RU_REND_EVENT_REPLACE_AIMAGE_READER);
+        CASE(RU_REND_EVENT_SET_FRAME_RATE);
+        CASE(RU_REND_EVENT_AIMAGE_AVAILABLE);
         default:
             die("unknown RuRendEventType(%d)", t);
     }
@@ -2093,19 +3992,58 @@ ru_rend_event_type_to_str(RuRendEventType t) {
 
 static void
 ru_rend_push_event(RuRend *rend, RuRendEvent ev) {
-    logd("push %s", ru_rend_event_type_to_str(ev.type));
+    logv_deferred("push %s", ru_rend_event_type_to_str(ev.type));
     ru_chan_push(&rend->event_chan, &ev);
+
+    ru_reactor_link_wake(&rend->reactor_link);
 }
 
 void
-ru_rend_start(RuRend *rend, AImageReader *reader) {
-    assert(reader);
+ru_rend_start(RuRend *rend, const RuRendLayer *layers, uint32_t layer_count) {
+    assert(layer_count > 0);
+    assert(layer_count <= RU_REND_MAX_LAYERS);
+
+    for (uint32_t i = 0; i < layer_count; ++i) {
+        assert(layers[i].aimage_reader);
+    }
 
     ru_rend_push_event(rend,
         (RuRendEvent) {
             .type = RU_REND_EVENT_START,
             .start = {
+                .layers = xmemdupn(layers, layer_count, sizeof(layers[0])),
+                .layer_count = layer_count,
+            },
+        });
+}
+
+void
+ru_rend_replace_aimage_reader(RuRend *rend, uint32_t layer,
+                              AImageReader *reader,
+                              AImageReader *old_reader) {
+    assert(reader);
+    assert(old_reader);
+    assert(reader != old_reader);
+
+    ru_rend_push_event(rend,
+        (RuRendEvent) {
+            .type = RU_REND_EVENT_REPLACE_AIMAGE_READER,
+            .replace_aimage_reader = {
+                .layer = layer,
                 .aimage_reader = reader,
+                .old_aimage_reader = old_reader,
+            },
+        });
+}
+
+void
+ru_rend_set_frame_rate(RuRend *rend, uint32_t layer, float hz) {
+    ru_rend_push_event(rend,
+        (RuRendEvent) {
+            .type = RU_REND_EVENT_SET_FRAME_RATE,
+            .set_frame_rate = {
+                .layer = layer,
+                .hz = hz,
             },
         });
 }
@@ -2131,11 +4069,22 @@ ru_rend_unpause(RuRend *rend) {
 
 RuRend *
 ru_rend_new_s(struct ru_rend_new_args args) {
+#ifndef ANDROID
+    if (!args.headless)
+        die("the host has no window system; use a headless renderer");
+#endif
+
     let rend = new(RuRend);
 
-    ru_instance_init(args.use_validation, &rend->inst);
+    rend->headless = args.headless;
+    rend->headless_extent = (VkExtent2D) {
+        .width = args.headless_width ? args.headless_width : 1920,
+        .height = args.headless_height ? args.headless_height : 1080,
+    };
+
+    ru_instance_init(args.use_validation, rend->headless, &rend->inst);
     ru_phys_dev_init(&rend->inst, &rend->phys_dev);
-    ru_device_init(&rend->phys_dev, &rend->dev);
+    ru_device_init(&rend->phys_dev, rend->headless, &rend->dev);
     rend->use_ext_format = args.use_external_format;
 
     rend->queue_fam_index = ru_choose_queue_family(&rend->phys_dev);
@@ -2160,11 +4109,14 @@ ru_rend_new_s(struct ru_rend_new_args args) {
                 {
                     .format = ru_present_format.format,
                     .samples = 1,
-                    // loadOp is irrelevant because we draw the full quad
-                    .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                    // Layers need not cover the full window.
+                    .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
                     .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
                     .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-                    .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                    // Leave a headless frame ready to be read back.
+                    .finalLayout = rend->headless
+                        ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                        : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
                 },
             },
             .subpassCount = 1,
@@ -2215,13 +4167,93 @@ ru_rend_new_s(struct ru_rend_new_args args) {
     rend->framechain = NULL;
 
     zero(rend->ahb_cache);
+    zero(rend->ycbcr_pipeline_cache);
+    rend->ycbcr_pipeline_cache.mutex = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+
+    rend->layer_count = 0; // invalidates aimage_heap
+    rend->retired_aimage_reader_count = 0;
+    ru_queue_init(&rend->retired, sizeof(RuRetired), 16);
+
+    rend->listener = args.listener;
+    rend->frame_seq = 0;
+    rend->latency = args.latency;
+    rend->import_pool = args.import_pool;
+    rend->imports_in_flight.mutex = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    rend->imports_in_flight.cond = (pthread_cond_t) PTHREAD_COND_INITIALIZER;
+    rend->imports_in_flight.count = 0;
+
+    rend->vsync = NULL;
+    atomic_init(&rend->latch_budget_ns, 0);
+    atomic_init(&rend->last_gpu_ns, 0);
+
+    if (args.use_vsync_schedule) {
+        rend->vsync = ru_vsync_new(
+            .use_timer = rend->headless,
+            .timer_period_ns = args.headless_vsync_period_ns);
+    }
 
-    rend->aimage_heap.aimage_reader = NULL; // invalidate
+    rend->frame_rate_hz = 0;
+    rend->libnativewindow = NULL;
+    rend->ANativeWindow_setFrameRate = NULL;
+    rend->window_frame_rate_hz = 0;
+    ru_cadence_reset(&rend->cadence, 0, 0);
+    rend->cadence_vsync_ns = 0;
+
+#ifdef ANDROID
+    if (!rend->headless) {
+        rend->libnativewindow = dlopen("libnativewindow.so", RTLD_NOW | RTLD_LOCAL);
+        if (rend->libnativewindow) {
+            rend->ANativeWindow_setFrameRate =
+                dlsym(rend->libnativewindow, "ANativeWindow_setFrameRate");
+        }
+
+        if (!rend->ANativeWindow_setFrameRate)
+            logi("ANativeWindow_setFrameRate is unavailable; the display keeps its rate");
+    }
+#endif
+
+    rend->prev_frame_begin_ns = 0;
+    rend->stats.mutex = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    rend->stats.ahb_import_count = 0;
+    rend->stats.startup_hitch_ns = 0;
+    ru_rend_reset_stats(rend);
 
     ru_chan_init(&rend->event_chan, sizeof(RuRendEvent), 8);
 
-    if (pthread_create(&rend->thread, NULL, ru_rend_thread, rend))
-        abort();
+    rend->is_started = false;
+    rend->is_paused = true;
+    rend->is_window_bound = false;
+    rend->is_stopped = false;
+    rend->stop_mutex = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    rend->stop_cond = (pthread_cond_t) PTHREAD_COND_INITIALIZER;
+    rend->is_idle = false;
+    rend->idle_begin_ns = 0;
+
+    rend->use_submit_thread = args.use_submit_thread;
+    rend->handed_off_count = 0;
+
+    if (rend->use_submit_thread) {
+        ru_spsc_init(&rend->submit_spsc, sizeof(RuRendSubmit), 1);
+        ru_spsc_init(&rend->done_spsc, sizeof(RuFrame *),
+                     RU_REND_MAX_HANDED_OFF_FRAMES);
+
+        if (pthread_create(&rend->submit_thread, NULL, ru_rend_submit_thread, rend))
+            abort();
+    }
+
+    rend->reactor = args.reactor;
+    ru_reactor_link_init(&rend->reactor_link);
+
+    if (rend->reactor) {
+        ru_reactor_link_set(&rend->reactor_link, ru_reactor_add(rend->reactor,
+            (RuReactorHandler) {
+                .context = rend,
+                .dispatch = ru_rend_dispatch,
+            }));
+    } else {
+        if (pthread_create(&rend->thread, NULL, ru_rend_thread, rend))
+            abort();
+    }
 
     return rend;
 }
@@ -2233,95 +4265,451 @@ ru_rend_free(RuRend *rend) {
 
     ru_rend_stop(rend);
 
-    if (pthread_join(rend->thread, NULL))
-        abort();
+    if (rend->reactor) {
+        // Wait for the reactor to handle the stop, which takes back the
+        // frames and stops everything else that wakes the source.
+        {
+            ru_mutex_lock_scoped(&rend->stop_mutex);
+
+            while (!rend->is_stopped) {
+                if (pthread_cond_wait(&rend->stop_cond, &rend->stop_mutex))
+                    abort();
+            }
+        }
+
+        RuReactorSource *src = ru_reactor_link_clear(&rend->reactor_link);
+        ru_reactor_remove(rend->reactor, src);
+    } else {
+        if (pthread_join(rend->thread, NULL))
+            abort();
+    }
+
+    // The render thread took back every frame before it exited.
+    if (rend->use_submit_thread) {
+        assert(rend->handed_off_count == 0);
+
+        ru_spsc_push_wait(&rend->submit_spsc, &(RuRendSubmit) { 0 });
+
+        if (pthread_join(rend->submit_thread, NULL))
+            abort();
+
+        ru_spsc_finish(&rend->submit_spsc);
+        ru_spsc_finish(&rend->done_spsc);
+    }
+
+    // Collect the AImageReaders of events that the thread never popped.
+    RuRendEvent ev;
+    while (ru_chan_pop_nowait(&rend->event_chan, &ev)) {
+        switch (ev.type) {
+            case RU_REND_EVENT_START:
+                free(ev.start.layers);
+                break;
+            case RU_REND_EVENT_REPLACE_AIMAGE_READER:
+                AImageReader_delete(ev.replace_aimage_reader.old_aimage_reader);
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (rend->layer_count > 0) {
+        for (uint32_t i = 0; i < rend->layer_count; ++i) {
+            RuLayer *layer = &rend->layers[i];
+
+            if (layer->pending_aimage)
+                AImage_delete(layer->pending_aimage);
 
-    if (rend->aimage_heap.aimage_reader) {
-        AImageReader_setBufferRemovedListener(rend->aimage_heap.aimage_reader, NULL);
-        ru_aimage_heap_finish(&rend->aimage_heap);
+            if (layer->latest)
+                ru_ahb_unref(layer->latest);
+        }
+
+        ru_aimage_heap_finish(&rend->aimage_heap, rend->layers, rend->layer_count);
     }
 
+    // Free the framechain before the AHB cache because its frames hold
+    // references to the cached AHBs.
+    ru_framechain_free(rend->framechain);
+    ru_swapchain_free(rend->swapchain);
+    ru_rend_destroy_retired(rend, -1);
+    ru_queue_finish(&rend->retired);
+    ru_surface_free(rend->surf);
+
+    // The frames no longer hold AImages, so each retired AImageReader is
+    // idle.
+    ru_rend_purge_retired_aimage_readers(rend);
+    assert(rend->retired_aimage_reader_count == 0);
+
     ru_ahb_cache_each_slot(&rend->ahb_cache, rahb) {
         if (rahb->ahb) {
             ru_ahb_finish(&rend->dev, rahb);
         }
     }
 
+    // The cached AHBs still held references, so their pipelines remain.
+    for (uint32_t i = 0; i < rend->ycbcr_pipeline_cache.pipeline_count; ++i) {
+        RuYcbcrPipeline *yp = rend->ycbcr_pipeline_cache.pipelines[i];
+
+        ru_ycbcr_pipeline_finish(&rend->dev, yp);
+        free(yp);
+    }
+
+    free(rend->ycbcr_pipeline_cache.pipelines);
+
     vkDestroyShaderModule(rend->dev.vk, rend->vert_module, ru_alloc_cb);
     vkDestroyShaderModule(rend->dev.vk, rend->frag_module, ru_alloc_cb);
     vkDestroyRenderPass(rend->dev.vk, rend->render_pass, ru_alloc_cb);
     vkDestroyCommandPool(rend->dev.vk, rend->cmd_pool, ru_alloc_cb);
-    ru_framechain_free(rend->framechain);
-    ru_swapchain_free(rend->swapchain);
-    ru_surface_free(rend->surf);
     ru_device_finish(&rend->dev);
     ru_phys_dev_finish(&rend->phys_dev);
     ru_instance_finish(&rend->inst);
     ru_chan_finish(&rend->event_chan);
+    ru_vsync_free(rend->vsync);
+
+#ifdef ANDROID
+    if (rend->libnativewindow)
+        dlclose(rend->libnativewindow);
+#endif
+
+    if (pthread_mutex_destroy(&rend->stats.mutex))
+        abort();
+
+    if (pthread_mutex_destroy(&rend->ycbcr_pipeline_cache.mutex))
+        abort();
+
+    if (pthread_mutex_destroy(&rend->imports_in_flight.mutex))
+        abort();
+
+    if (pthread_cond_destroy(&rend->imports_in_flight.cond))
+        abort();
+
+    if (pthread_cond_destroy(&rend->stop_cond))
+        abort();
+
+    if (pthread_mutex_destroy(&rend->stop_mutex))
+        abort();
+
+    free(rend);
+}
+
+const char *
+ru_rend_phase_to_str(RuRendPhase phase) {
+    switch (phase) {
+        case RU_REND_PHASE_ACQUIRE: return "acquire";
+        case RU_REND_PHASE_FENCE_WAIT: return "fence_wait";
+        case RU_REND_PHASE_LATCH_WAIT: return "latch_wait";
+        case RU_REND_PHASE_IMAGE_WAIT: return "image_wait";
+        case RU_REND_PHASE_IMPORT: return "import";
+        case RU_REND_PHASE_RECORD: return "record";
+        case RU_REND_PHASE_SUBMIT: return "submit";
+        case RU_REND_PHASE_PRESENT: return "present";
+        case RU_REND_PHASE_FRAME: return "frame";
+        case RU_REND_PHASE_INTERVAL: return "interval";
+        case RU_REND_PHASE_GPU: return "gpu";
+        case RU_REND_PHASE_IDLE: return "idle";
+        case RU_REND_PHASE_AHB_INIT: return "ahb_init";
+        case RU_REND_PHASE_DESTROY: return "destroy";
+        case RU_REND_PHASE_COUNT: break;
+    }
+
+    return "unknown";
+}
+
+void
+ru_rend_get_stats(RuRend *rend, RuRendStats *stats) {
+    // Copy the histograms so that the render thread does not wait while we
+    // compute percentiles.
+    _cleanup_free_ RuHist *hists = new_array(RuHist, RU_REND_PHASE_COUNT);
+
+    {
+        ru_mutex_lock_scoped(&rend->stats.mutex);
+        memcpy(hists, rend->stats.phase_hists,
+               RU_REND_PHASE_COUNT * sizeof(*hists));
+        stats->idle_count = rend->stats.idle_count;
+        stats->missed_vsync_count = rend->stats.missed_vsync_count;
+        stats->deferred_aimage_count = rend->stats.deferred_aimage_count;
+        stats->ahb_import_count = rend->stats.ahb_import_count;
+        stats->startup_hitch_ns = rend->stats.startup_hitch_ns;
+    }
+
+    for (uint32_t i = 0; i < RU_REND_PHASE_COUNT; ++i) {
+        const RuHist *h = &hists[i];
+        RuRendPhaseStats *ps = &stats->phases[i];
+
+        if (h->count == 0) {
+            *ps = (RuRendPhaseStats) { 0 };
+            continue;
+        }
+
+        *ps = (RuRendPhaseStats) {
+            .count = h->count,
+            .min_ns = h->min,
+            .mean_ns = ru_hist_mean(h),
+            .p50_ns = ru_hist_percentile(h, 50),
+            .p90_ns = ru_hist_percentile(h, 90),
+            .p99_ns = ru_hist_percentile(h, 99),
+            .p999_ns = ru_hist_percentile(h, 99.9),
+            .max_ns = h->max,
+        };
+    }
+}
+
+void
+ru_rend_reset_stats(RuRend *rend) {
+    ru_mutex_lock_scoped(&rend->stats.mutex);
+
+    for (uint32_t i = 0; i < RU_REND_PHASE_COUNT; ++i)
+        ru_hist_reset(&rend->stats.phase_hists[i]);
+
+    rend->stats.idle_count = 0;
+    rend->stats.missed_vsync_count = 0;
+    rend->stats.deferred_aimage_count = 0;
+
+    // Keep ahb_import_count and startup_hitch_ns. See RuRendStats.
+}
+
+void
+ru_rend_bind_window(RuRend *rend, ANativeWindow *window) {
+    assert(!rend->headless);
+
+    ru_rend_push_event(rend,
+        (RuRendEvent) {
+            .type = RU_REND_EVENT_BIND_WINDOW,
+            .bind_window = {
+                .window = window,
+            },
+        });
+}
+
+void
+ru_rend_unbind_window(RuRend *rend) {
+    ru_rend_push_event(rend,
+        (RuRendEvent) { .type = RU_REND_EVENT_UNBIND_WINDOW, });
+}
+
+static void
+on_aimage_buffer_removed(
+        void *_rend,
+        AImageReader *reader,
+        AHardwareBuffer *ahb)
+{
+    RuRend *rend = _rend;
+
+#ifndef NDEBUG
+    bool found = false;
+    for (uint32_t i = 0; i < rend->layer_count; ++i) {
+        if (reader == rend->layers[i].aimage_reader) {
+            found = true;
+            break;
+        }
+    }
+    assert(found);
+#endif
+
+    ru_rend_push_event(rend,
+        (RuRendEvent) {
+            .type = RU_REND_EVENT_AIMAGE_BUFFER_REMOVED,
+            .aimage_buffer_removed  = {
+                .ahb = ahb,
+            },
+        });
+}
+
+// Follow the display's refresh period, which changes when the display
+// switches modes.
+static void
+ru_rend_update_vsync_period(RuRend *rend, RuSwapchain *swapchain) {
+    RuDevice *dev = &rend->dev;
+    VkRefreshCycleDurationGOOGLE refresh;
+
+    {
+        ru_mutex_lock_scoped(&swapchain->mutex);
+        check(dev->vkGetRefreshCycleDurationGOOGLE(dev->vk, swapchain->vk,
+                                                   &refresh));
+    }
+
+    ru_vsync_set_period(rend->vsync, (int64_t) refresh.refreshDuration);
+}
+
+// Report the frames that VK_GOOGLE_display_timing says have reached the
+// display since the last call. Each present time is also a vsync. next_seq
+// is the RuRendFrameInfo::seq of the frame after the latest presented.
+static void
+ru_rend_collect_present_times(RuRend *rend, RuSwapchain *swapchain,
+                              uint64_t next_seq) {
+    RuDevice *dev = &rend->dev;
+    VkPastPresentationTimingGOOGLE timings[8];
+    VkResult r;
+
+    if (rend->vsync)
+        ru_rend_update_vsync_period(rend, swapchain);
+
+    do {
+        uint32_t count = ARRAY_LEN(timings);
+
+        {
+            ru_mutex_lock_scoped(&swapchain->mutex);
+            r = dev->vkGetPastPresentationTimingGOOGLE(dev->vk, swapchain->vk,
+                                                       &count, timings);
+        }
+
+        switch (r) {
+            case VK_SUCCESS:
+            case VK_INCOMPLETE:
+                break;
+            case VK_ERROR_OUT_OF_DATE_KHR:
+                // The frames of the old swapchain are lost. RuLatency evicts
+                // them.
+                return;
+            default:
+                die("vkGetPastPresentationTimingGOOGLE failed with VkResult(%d)", r);
+        }
+
+        for (uint32_t i = 0; i < count; ++i) {
+            // Recover the seq from its low bits. The frame is recent.
+            uint32_t age = (uint32_t) next_seq - timings[i].presentID;
+            uint64_t seq = next_seq - age;
+
+            // On Android, actualPresentTime is on CLOCK_MONOTONIC.
+            const int64_t present_ns = (int64_t) timings[i].actualPresentTime;
+
+            if (rend->latency)
+                ru_latency_on_present(rend->latency, seq, present_ns);
+
+            if (rend->vsync)
+                ru_vsync_observe(rend->vsync, present_ns);
+        }
+    } while (r == VK_INCOMPLETE);
+}
+
+static void
+ru_rend_record_phases(RuRend *rend, RuFrame *frame) {
+    int64_t *phase_ns = frame->phase_ns;
+    const int64_t begin_ns = frame->info.begin_ns;
 
-    free(rend);
-}
+    phase_ns[RU_REND_PHASE_FRAME] = frame->info.submit_ns - begin_ns;
 
-void
-ru_rend_bind_window(RuRend *rend, ANativeWindow *window) {
-    ru_rend_push_event(rend,
-        (RuRendEvent) {
-            .type = RU_REND_EVENT_BIND_WINDOW,
-            .bind_window = {
-                .window = window,
-            },
-        });
+    ru_mutex_lock_scoped(&rend->stats.mutex);
+
+    for (uint32_t i = 0; i < RU_REND_PHASE_INTERVAL; ++i)
+        ru_hist_record(&rend->stats.phase_hists[i], phase_ns[i]);
+
+    if (rend->prev_frame_begin_ns) {
+        ru_hist_record(&rend->stats.phase_hists[RU_REND_PHASE_INTERVAL],
+                       begin_ns - rend->prev_frame_begin_ns);
+    }
+
+    rend->prev_frame_begin_ns = begin_ns;
+    rend->stats.startup_hitch_ns = ru_max(rend->stats.startup_hitch_ns,
+                                          phase_ns[RU_REND_PHASE_IMPORT]);
 }
 
-void
-ru_rend_unbind_window(RuRend *rend) {
-    ru_rend_push_event(rend,
-        (RuRendEvent) { .type = RU_REND_EVENT_UNBIND_WINDOW, });
+static void
+ru_rend_record_idle(RuRend *rend, int64_t idle_ns) {
+    ru_mutex_lock_scoped(&rend->stats.mutex);
+    ru_hist_record(&rend->stats.phase_hists[RU_REND_PHASE_IDLE], idle_ns);
+    ++rend->stats.idle_count;
 }
 
+// Submit and present the recorded frame, then account for it. Runs on the
+// submit thread if there is one, and else on the render thread.
 static void
-on_aimage_buffer_removed(
-        void *_rend,
-        AImageReader *reader,
-        AHardwareBuffer *ahb)
-{
+ru_rend_submit_frame(RuRend *rend, RuFramechain *framechain, RuFrame *frame) {
+    ru_framechain_submit(framechain, frame, rend->queue, frame->phase_ns);
+    frame->info.submit_ns = ru_time_now_ns();
+
+    if (rend->latency)
+        ru_latency_on_submit(rend->latency, frame->info.seq, frame->info.submit_ns);
+
+    if (rend->vsync) {
+        ru_rend_update_latch_budget(rend, frame);
+
+        // The frame's own GPU time is not yet known.
+        if (frame->info.vsync_ns &&
+            frame->info.submit_ns + rend->last_gpu_ns > frame->info.vsync_ns) {
+            ru_mutex_lock_scoped(&rend->stats.mutex);
+            ++rend->stats.missed_vsync_count;
+        }
+    }
+
+    if (rend->dev.has_display_timing && (rend->latency || rend->vsync))
+        ru_rend_collect_present_times(rend, framechain->swapchain, frame->info.seq + 1);
+
+    ru_rend_record_phases(rend, frame);
+}
+
+// Submits the frames that the render thread records, so that the render
+// thread may latch and record frame N+1 while this thread blocks in
+// vkQueueSubmit or vkQueuePresentKHR for frame N. The hand-off holds one
+// frame, so the render thread runs at most one frame ahead.
+static void *
+ru_rend_submit_thread(void *_rend) {
+    ru_thread_apply(RU_THREAD_CLASS_RENDER, "ru-rend-submit");
+    logd("start rend submit thread tid=%d", gettid());
+
     RuRend *rend = _rend;
 
-    assert(reader == rend->aimage_heap.aimage_reader);
+    for (;;) {
+        RuRendSubmit s;
+        ru_spsc_pop_wait(&rend->submit_spsc, &s);
 
-    ru_rend_push_event(rend,
-        (RuRendEvent) {
-            .type = RU_REND_EVENT_AIMAGE_BUFFER_REMOVED,
-            .aimage_buffer_removed  = {
-                .ahb = ahb,
-            },
-        });
+        if (!s.frame)
+            return NULL;
+
+        ru_rend_submit_frame(rend, s.framechain, s.frame);
+
+        // Never blocks. done_spsc holds every frame of the framechain.
+        ru_spsc_push_wait(&rend->done_spsc, &s.frame);
+    }
 }
 
 static void
 ru_rend_present(RuRend *rend) {
     static _Atomic uint64_t seq = 0;
-    logd("%s: seq=%"PRIu64, __func__, ++seq);
+    logv_deferred("%s: seq=%"PRIu64, __func__, ++seq);
+    ru_trace_scoped("ru_rend_present");
 
     RuInstance *inst = &rend->inst;
 
-    assert(rend->surf);
+    assert(!!rend->surf != rend->headless);
     assert(!!rend->framechain == !!rend->swapchain);
 
-    bool want_new_swapchain =
-        !rend->swapchain ||
-        rend->swapchain->status != VK_SUCCESS;
+    // A headless swapchain never goes out of date.
+    bool want_new_swapchain = !rend->swapchain;
+
+    if (rend->swapchain) {
+        ru_mutex_lock_scoped(&rend->swapchain->mutex);
+        want_new_swapchain = rend->swapchain->status != VK_SUCCESS;
+    }
 
     if (want_new_swapchain) {
-        if (rend->swapchain) {
-            ru_framechain_free(rend->framechain);
-            ru_swapchain_free(rend->swapchain);
+        RuSwapchain *old_swapchain = rend->swapchain;
+
+        if (old_swapchain) {
+            // The old frames may still execute. Destroy them later rather
+            // than wait for them.
+            ru_rend_wait_for_submit(rend, NULL);
+            ru_rend_retire_framechain(rend, rend->framechain, old_swapchain);
+        }
+
+        // While the submit thread presents one frame, the render thread
+        // holds the next.
+        const uint32_t extra_image_count = rend->use_submit_thread ? 1 : 0;
+
+        if (rend->headless) {
+            rend->swapchain = ru_swapchain_new_headless(&rend->dev,
+                    rend->headless_extent,
+                    ru_headless_image_count + extra_image_count,
+                    rend->queue_fam_index);
+        } else {
+            rend->swapchain = ru_swapchain_new(&rend->dev, rend->surf,
+                    extra_image_count, rend->queue_fam_index, old_swapchain);
         }
 
-        rend->swapchain = ru_swapchain_new(&rend->dev, rend->surf,
-                rend->queue_fam_index);
         rend->framechain = ru_framechain_new(rend->swapchain, rend->cmd_pool,
                 rend->render_pass);
+
+        if (rend->vsync && !rend->headless && rend->dev.has_display_timing)
+            ru_rend_update_vsync_period(rend, rend->swapchain);
     }
 
     assert(rend->swapchain);
@@ -2334,36 +4722,119 @@ ru_rend_present(RuRend *rend) {
         return;
     }
 
+    const int64_t record_begin_ns = ru_time_now_ns();
+    bool is_record_traced = ru_trace_begin("record");
+
+    // Draw back to front. Among layers at the same depth, group those that
+    // share a pipeline so that we bind each pipeline once.
+    uint32_t draw_order[RU_REND_MAX_LAYERS];
+    VkPipeline draw_pipelines[RU_REND_MAX_LAYERS];
+    uint32_t draw_count = 0;
+
+    for (uint32_t i = 0; i < rend->layer_count; ++i) {
+        RuAhb *rahb = frame->rahbs[i];
+        if (!rahb)
+            continue;
+
+        RuBlendMode blend = rend->layers[i].opacity < 1.0f
+            ? RU_BLEND_MODE_ALPHA
+            : RU_BLEND_MODE_OPAQUE;
+        draw_pipelines[i] = ru_ycbcr_pipeline_get_vk_pipeline(rend,
+                rahb->ycbcr_pipeline, blend);
+
+        // Insertion sort. There are few layers.
+        uint32_t j = draw_count++;
+        for (; j > 0; --j) {
+            const RuLayer *prev = &rend->layers[draw_order[j - 1]];
+            const RuLayer *cur = &rend->layers[i];
+
+            bool cur_first =
+                cur->z < prev->z ||
+                (cur->z == prev->z &&
+                 (uintptr_t) draw_pipelines[i] <
+                    (uintptr_t) draw_pipelines[draw_order[j - 1]]);
+
+            if (!cur_first)
+                break;
+
+            draw_order[j] = draw_order[j - 1];
+        }
+        draw_order[j] = i;
+    }
+
+#ifdef ANDROID
+    VkImageMemoryBarrier acquire_barriers[RU_REND_MAX_LAYERS];
+    VkImageMemoryBarrier release_barriers[RU_REND_MAX_LAYERS];
+
+    for (uint32_t i = 0; i < draw_count; ++i) {
+        RuAhb *rahb = frame->rahbs[draw_order[i]];
+
+        static const VkImageSubresourceRange color_range = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        };
+
+        acquire_barriers[i] = (VkImageMemoryBarrier) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_PREINITIALIZED,
+            .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_FOREIGN_EXT,
+            .dstQueueFamilyIndex = rend->queue_fam_index,
+            .image = rahb->image,
+            .subresourceRange = color_range,
+        };
+
+        release_barriers[i] = (VkImageMemoryBarrier) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .dstAccessMask = 0,
+            .oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            .srcQueueFamilyIndex = rend->queue_fam_index,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_FOREIGN_EXT,
+            .image = rahb->image,
+            .subresourceRange = color_range,
+        };
+    }
+#endif
+
     check(vkBeginCommandBuffer(frame->cmd_buffer,
         &(VkCommandBufferBeginInfo) {
             .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
         }));
 
-    vkCmdPipelineBarrier(frame->cmd_buffer,
-        /*srcStageMask*/ VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-        /*dstStageMask*/ VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-        /*dependencyFlags*/ 0,
-        /*memoryBarriers*/ 0, NULL,
-        /*bufferMemmoryBarriers*/ 0, NULL,
-        /*imageMemmoryBarriers*/ 1, (VkImageMemoryBarrier[]) {
-            {
-                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-                .srcAccessMask = 0,
-                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-                .oldLayout = VK_IMAGE_LAYOUT_PREINITIALIZED,
-                .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_FOREIGN_EXT,
-                .dstQueueFamilyIndex = rend->queue_fam_index,
-                .image = frame->rahb->image,
-                .subresourceRange = {
-                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                    .baseMipLevel = 0,
-                    .levelCount = 1,
-                    .baseArrayLayer = 0,
-                    .layerCount = 1,
-                },
-            },
-        });
+    // The reset must precede the render pass.
+    if (frame->query_pool) {
+        vkCmdResetQueryPool(frame->cmd_buffer, frame->query_pool,
+            frame->first_query, /*queryCount*/ 2);
+    }
+
+#ifdef ANDROID
+    if (draw_count > 0) {
+        vkCmdPipelineBarrier(frame->cmd_buffer,
+            /*srcStageMask*/ VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            /*dstStageMask*/ VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            /*dependencyFlags*/ 0,
+            /*memoryBarriers*/ 0, NULL,
+            /*bufferMemmoryBarriers*/ 0, NULL,
+            /*imageMemmoryBarriers*/ draw_count, acquire_barriers);
+    }
+#else
+    // Upload the AImages that arrived since the previous frame.
+    for (uint32_t i = 0; i < draw_count; ++i) {
+        RuAhb *rahb = frame->rahbs[draw_order[i]];
+
+        if (rahb->needs_upload) {
+            ru_ahb_record_upload(rahb, frame->cmd_buffer);
+            rahb->needs_upload = false;
+        }
+    }
+#endif
 
     vkCmdBeginRenderPass(frame->cmd_buffer,
         &(VkRenderPassBeginInfo) {
@@ -2374,38 +4845,19 @@ ru_rend_present(RuRend *rend) {
                 .offset = { 0, 0 },
                 .extent = frame->extent,
             },
-            // We draw the full quad
-            .clearValueCount = 0,
-
+            .clearValueCount = 1,
+            .pClearValues = (VkClearValue[]) {
+                { .color = { .float32 = { 0.0, 0.0, 0.0, 1.0 } } },
+            },
         },
         VK_SUBPASS_CONTENTS_INLINE);
 
-    vkCmdBindPipeline(frame->cmd_buffer,
-        VK_PIPELINE_BIND_POINT_GRAPHICS,
-        frame->rahb->pipeline);
-
-    inst->vkCmdPushDescriptorSetKHR(frame->cmd_buffer,
-        VK_PIPELINE_BIND_POINT_GRAPHICS,
-        frame->rahb->pipeline_layout,
-        /*set*/ 0,
-        /*descriptorWriteCount*/ 1,
-        (VkWriteDescriptorSet[]) {
-            {
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                // .dstSet = ignored,
-                // .dstBinding = ignored,
-                // .dstArrayElement = ignored,
-                .descriptorCount = 1,
-                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                .pImageInfo = (VkDescriptorImageInfo[]) {
-                    {
-                        .sampler = frame->rahb->sampler,
-                        .imageView = frame->rahb->image_view,
-                        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                    },
-                },
-            },
-        });
+    // Time the render pass alone, not the barriers and uploads around it.
+    if (frame->query_pool) {
+        vkCmdWriteTimestamp(frame->cmd_buffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            frame->query_pool, frame->first_query);
+    }
 
     vkCmdSetViewport(frame->cmd_buffer,
         /*first*/ 0,
@@ -2431,141 +4883,451 @@ ru_rend_present(RuRend *rend) {
             },
         });
 
-    vkCmdDraw(frame->cmd_buffer,
-        /*vertexCount*/ 4,
-        /*instanceCount*/ 1,
-        /*firstVertex*/ 0,
-        /*firstInstance*/ 0);
-
-    vkCmdEndRenderPass(frame->cmd_buffer);
+    VkPipeline bound_pipeline = VK_NULL_HANDLE;
+    uint32_t bind_count = 0;
+
+    for (uint32_t i = 0; i < draw_count; ++i) {
+        uint32_t l = draw_order[i];
+        const RuLayer *layer = &rend->layers[l];
+        RuAhb *rahb = frame->rahbs[l];
+        RuYcbcrPipeline *yp = rahb->ycbcr_pipeline;
+
+        if (draw_pipelines[l] != bound_pipeline) {
+            vkCmdBindPipeline(frame->cmd_buffer,
+                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                draw_pipelines[l]);
+            bound_pipeline = draw_pipelines[l];
+            ++bind_count;
+        }
 
-    vkCmdPipelineBarrier(frame->cmd_buffer,
-        /*srcStageMask*/ VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-        /*dstStageMask*/ VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-        /*dependencyFlags*/ 0,
-        /*memoryBarriers*/ 0, NULL,
-        /*bufferMemmoryBarriers*/ 0, NULL,
-        /*imageMemmoryBarriers*/ 1, (VkImageMemoryBarrier[]) {
-            {
-                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-                .srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
-                .dstAccessMask = 0,
-                .oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                .srcQueueFamilyIndex = rend->queue_fam_index,
-                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_FOREIGN_EXT,
-                .image = frame->rahb->image,
-                .subresourceRange = {
-                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                    .baseMipLevel = 0,
-                    .levelCount = 1,
-                    .baseArrayLayer = 0,
-                    .layerCount = 1,
+        inst->vkCmdPushDescriptorSetKHR(frame->cmd_buffer,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            yp->pipeline_layout,
+            /*set*/ 0,
+            /*descriptorWriteCount*/ 1,
+            (VkWriteDescriptorSet[]) {
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    // .dstSet = ignored,
+                    // .dstBinding = ignored,
+                    // .dstArrayElement = ignored,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                    .pImageInfo = (VkDescriptorImageInfo[]) {
+                        {
+                            .sampler = yp->sampler,
+                            .imageView = rahb->image_view,
+                            .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                        },
+                    },
                 },
+            });
+
+        // Map the normalized window rect to NDC.
+        RuLayerPushConsts consts = {
+            .rect = {
+                2.0f * layer->rect.x - 1.0f,
+                2.0f * layer->rect.y - 1.0f,
+                2.0f * (layer->rect.x + layer->rect.width) - 1.0f,
+                2.0f * (layer->rect.y + layer->rect.height) - 1.0f,
             },
-        });
+            .crop = {
+                rahb->crop[0],
+                rahb->crop[1],
+                rahb->crop[2],
+                rahb->crop[3],
+            },
+            .opacity = layer->opacity,
+        };
+
+        vkCmdPushConstants(frame->cmd_buffer,
+            yp->pipeline_layout,
+            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+            /*offset*/ 0,
+            sizeof(consts),
+            &consts);
+
+        vkCmdDraw(frame->cmd_buffer,
+            /*vertexCount*/ 4,
+            /*instanceCount*/ 1,
+            /*firstVertex*/ 0,
+            /*firstInstance*/ 0);
+    }
+
+    logv_deferred("%s: layers=%u binds=%u", __func__, draw_count, bind_count);
+
+    if (frame->query_pool) {
+        vkCmdWriteTimestamp(frame->cmd_buffer,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            frame->query_pool, frame->first_query + 1);
+    }
+
+    vkCmdEndRenderPass(frame->cmd_buffer);
+
+#ifdef ANDROID
+    if (draw_count > 0) {
+        vkCmdPipelineBarrier(frame->cmd_buffer,
+            /*srcStageMask*/ VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            /*dstStageMask*/ VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            /*dependencyFlags*/ 0,
+            /*memoryBarriers*/ 0, NULL,
+            /*bufferMemmoryBarriers*/ 0, NULL,
+            /*imageMemmoryBarriers*/ draw_count, release_barriers);
+    }
+#endif
 
     check(vkEndCommandBuffer(frame->cmd_buffer));
 
-    ru_framechain_submit(rend->framechain, frame, rend->queue);
+    if (is_record_traced)
+        ru_trace_end();
+
+    frame->phase_ns[RU_REND_PHASE_RECORD] = ru_time_now_ns() - record_begin_ns;
+
+    if (!rend->use_submit_thread) {
+        ru_rend_submit_frame(rend, rend->framechain, frame);
+        ru_framechain_track(rend->framechain, frame);
+        return;
+    }
+
+    frame->is_handed_off = true;
+    ++rend->handed_off_count;
+
+    ru_trace_scoped("hand off");
+    ru_spsc_push_wait(&rend->submit_spsc,
+        &(RuRendSubmit) {
+            .framechain = rend->framechain,
+            .frame = frame,
+        });
+}
+
+// Ask the display for a refresh rate that suits the frame rate, such as 24 Hz
+// or 120 Hz for 24 Hz video. The display may ignore the request.
+static void
+ru_rend_request_window_frame_rate(RuRend *rend) {
+    if (!rend->surf || !rend->ANativeWindow_setFrameRate)
+        return;
+
+    if (rend->frame_rate_hz == 0 ||
+        rend->frame_rate_hz == rend->window_frame_rate_hz) {
+        return;
+    }
+
+    int32_t ret = rend->ANativeWindow_setFrameRate(rend->surf->window,
+        rend->frame_rate_hz, RU_REND_FRAME_RATE_COMPATIBILITY_FIXED_SOURCE);
+    if (ret) {
+        logw("ANativeWindow_setFrameRate(%.3f) failed: error=%d",
+             rend->frame_rate_hz, ret);
+        return;
+    }
+
+    logi("ANativeWindow_setFrameRate(%.3f)", rend->frame_rate_hz);
+    rend->window_frame_rate_hz = rend->frame_rate_hz;
+}
+
+// The display follows the fastest layer.
+static void
+ru_rend_update_frame_rate(RuRend *rend) {
+    float hz = 0;
+
+    for (uint32_t i = 0; i < rend->layer_count; ++i)
+        hz = ru_max(hz, rend->layers[i].frame_rate_hz);
+
+    if (hz == rend->frame_rate_hz)
+        return;
+
+    rend->frame_rate_hz = hz;
+
+    // Restart the cadence at the next frame.
+    ru_cadence_reset(&rend->cadence, 0, 0);
+    rend->cadence_vsync_ns = 0;
+
+    ru_rend_request_window_frame_rate(rend);
+}
+
+// Stop the AImageReader listeners and the import jobs, which push events
+// from other threads. Afterwards only the app pushes events.
+static void
+ru_rend_silence_layers(RuRend *rend) {
+    for (uint32_t i = 0; i < rend->layer_count; ++i) {
+        AImageReader *reader = rend->layers[i].aimage_reader;
+
+        AImageReader_setImageListener(reader, NULL);
+        AImageReader_setBufferRemovedListener(reader, NULL);
+    }
+
+    // Import jobs also touch the AImage heap and the AHB cache.
+    ru_rend_finish_imports(rend);
+}
+
+// Returns false on RU_REND_EVENT_STOP.
+static bool _must_use_result_
+ru_rend_handle_event(RuRend *rend, RuRendEvent *ev) {
+    logv_deferred("pop %s", ru_rend_event_type_to_str(ev->type));
+
+    switch (ev->type) {
+        case RU_REND_EVENT_START: {
+            assert(!rend->is_started);
+            assert(rend->layer_count == 0); // aimage_heap should be invalid
+
+            for (uint32_t i = 0; i < ev->start.layer_count; ++i) {
+                const RuRendLayer *l = &ev->start.layers[i];
+
+                rend->layers[i] = (RuLayer) {
+                    .rend = rend,
+                    .index = i,
+                    .aimage_reader = l->aimage_reader,
+                    .rect = l->rect,
+                    .z = l->z,
+                    .opacity = l->opacity,
+                    .aimage_available_count = 0,
+                    .aimage_available_ns = 0,
+                    .latest = NULL,
+                    .pending_aimage = NULL,
+                    .pending_rahb = NULL,
+                    .pending_available_ns = 0,
+                };
+            }
+
+            // Set layer_count before installing the listeners because
+            // on_aimage_buffer_removed reads it.
+            rend->layer_count = ev->start.layer_count;
+            free(ev->start.layers);
+
+            ru_aimage_heap_init(&rend->aimage_heap, rend->layers,
+                                rend->layer_count);
+
+            for (uint32_t i = 0; i < rend->layer_count; ++i) {
+                AImageReader_setBufferRemovedListener(
+                    rend->layers[i].aimage_reader,
+                    &(AImageReader_BufferRemovedListener) {
+                        .context = rend,
+                        .onBufferRemoved = on_aimage_buffer_removed,
+                    });
+            }
+
+            rend->is_started = true;
+            break;
+        }
+        case RU_REND_EVENT_STOP:
+            ru_rend_wait_for_submit(rend, NULL);
+            ru_rend_silence_layers(rend);
+            return false;
+        case RU_REND_EVENT_BIND_WINDOW: {
+            assert(!rend->is_window_bound);
+            assert(!rend->surf);
+            assert(!rend->swapchain);
+            assert(!rend->framechain);
+            rend->surf = ru_surface_new(&rend->phys_dev, ev->bind_window.window);
+            rend->window_frame_rate_hz = 0;
+            ru_rend_request_window_frame_rate(rend);
+            rend->is_window_bound = true;
+            break;
+        }
+        case RU_REND_EVENT_UNBIND_WINDOW: {
+            assert(rend->is_window_bound);
+
+            ru_rend_wait_for_submit(rend, NULL);
+            ru_framechain_free(rend->framechain);
+            ru_swapchain_free(rend->swapchain);
+
+            // Retired swapchains must go before their surface.
+            ru_rend_destroy_retired(rend, -1);
+            ru_surface_free(rend->surf);
+
+            rend->framechain = NULL;
+            rend->swapchain = NULL;
+            rend->surf = NULL;
+
+            rend->is_window_bound = false;
+            break;
+        }
+        case RU_REND_EVENT_PAUSE:
+            assert(rend->is_started);
+            ru_rend_wait_for_submit(rend, NULL);
+            rend->is_paused = true;
+            rend->prev_frame_begin_ns = 0;
+            break;
+        case RU_REND_EVENT_UNPAUSE:
+            assert(rend->is_started);
+            rend->is_paused = false;
+            break;
+        case RU_REND_EVENT_AIMAGE_BUFFER_REMOVED: {
+            AHardwareBuffer *ahb = ev->aimage_buffer_removed.ahb;
+            let slot = ru_ahb_cache_search(&rend->ahb_cache, ahb);
+            if (slot) {
+                // Assume that the AImageReader will not remove an AImage's AHB
+                // if we hold ownership of the AImage.
+                assert(!slot->aimage);
+
+                slot->in_aimage_reader = false;
+            }
+            break;
+        }
+        case RU_REND_EVENT_REPLACE_AIMAGE_READER: {
+            let e = &ev->replace_aimage_reader;
+
+            assert(rend->is_started);
+            assert(e->layer < rend->layer_count);
+
+            RuLayer *layer = &rend->layers[e->layer];
+            RuAImageHeap *heap = &rend->aimage_heap;
+
+            assert(layer->aimage_reader == e->old_aimage_reader);
+
+            AImageReader_setImageListener(e->old_aimage_reader, NULL);
+            AImageReader_setBufferRemovedListener(e->old_aimage_reader, NULL);
+
+            // Skip the old reader's AImage that is still importing. Its AHB
+            // remains in the cache, like the reader's other AHBs.
+            if (layer->pending_aimage) {
+                AImage_delete(layer->pending_aimage);
+                layer->pending_aimage = NULL;
+                layer->pending_rahb = NULL;
+            }
+
+            {
+                ru_mutex_lock_scoped(&heap->aimage_available.mutex);
+                heap->aimage_available.count -= layer->aimage_available_count;
+                layer->aimage_available_count = 0;
+                layer->aimage_reader = e->aimage_reader;
+            }
+
+            AImageReader_setImageListener(e->aimage_reader,
+                &(AImageReader_ImageListener) {
+                    .context = layer,
+                    .onImageAvailable = on_aimage_available,
+                });
+
+            AImageReader_setBufferRemovedListener(e->aimage_reader,
+                &(AImageReader_BufferRemovedListener) {
+                    .context = rend,
+                    .onBufferRemoved = on_aimage_buffer_removed,
+                });
+
+            // The layer keeps drawing its latest AImage, from the
+            // old reader, until the new reader delivers one. The
+            // swapchain and the pipelines are untouched. Pipelines
+            // are created anew only if the new AHBs need a different
+            // Y'CbCr conversion.
+            ru_rend_retire_aimage_reader(rend, e->old_aimage_reader);
+            break;
+        }
+        case RU_REND_EVENT_SET_FRAME_RATE: {
+            let e = &ev->set_frame_rate;
+
+            assert(rend->is_started);
+            assert(e->layer < rend->layer_count);
+
+            rend->layers[e->layer].frame_rate_hz = e->hz;
+            ru_rend_update_frame_rate(rend);
+            break;
+        }
+        case RU_REND_EVENT_AIMAGE_AVAILABLE:
+            // The poll below finds the AImage.
+            break;
+    }
+
+    return true;
+}
+
+// Draw a frame if a layer has a new AImage, then collect finished frames.
+static void
+ru_rend_step(RuRend *rend) {
+    if (!rend->is_paused && (rend->is_window_bound || rend->headless)) {
+        if (ru_aimage_heap_poll(&rend->aimage_heap)) {
+            if (rend->is_idle) {
+                ru_rend_record_idle(rend, ru_time_now_ns() - rend->idle_begin_ns);
+                rend->is_idle = false;
+            }
+
+            ru_rend_present(rend);
+        } else if (!rend->is_idle) {
+            rend->is_idle = true;
+            rend->idle_begin_ns = ru_time_now_ns();
+        }
+    } else {
+        rend->is_idle = false;
+    }
+
+    if (rend->framechain) {
+        ru_rend_reclaim_frames(rend);
+        ru_framechain_collect(rend, rend->framechain);
+    }
+
+    ru_rend_purge_retired_aimage_readers(rend);
+    ru_rend_purge_dead_ahbs(rend);
+    ru_rend_destroy_retired(rend, RU_REND_DESTROY_BUDGET_NS);
 }
 
 static void *
 ru_rend_thread(void *_rend) {
+    ru_thread_apply(RU_THREAD_CLASS_RENDER, "ru-rend");
     logd("start rend thread tid=%d", gettid());
 
     RuRend *rend = _rend;
-    bool started = false;
-    bool paused = true;
-    bool window_bound = false;
 
     for (;;) {
         RuRendEvent ev;
         bool found_event;
 
-        if (paused) {
+        // While idle, no layer has a new AImage, so sleep until an event
+        // arrives. See ru_aimage_heap_poll().
+        if (rend->is_paused || rend->is_idle) {
             ru_chan_pop_wait(&rend->event_chan, &ev);
             found_event = true;
         } else {
             found_event = ru_chan_pop_nowait(&rend->event_chan, &ev);
         }
 
-        if (found_event) {
-            logd("pop %s", ru_rend_event_type_to_str(ev.type));
+        if (found_event && !ru_rend_handle_event(rend, &ev))
+            return NULL;
 
-            switch (ev.type) {
-                case RU_REND_EVENT_START: {
-                    assert(!started);
-                    assert(ev.start.aimage_reader);
+        ru_rend_step(rend);
+    }
+}
 
-                    assert(!rend->aimage_heap.aimage_reader); // should be invalid
-                    ru_aimage_heap_init(&rend->aimage_heap, ev.start.aimage_reader);
+// The reactor's handler, in place of ru_rend_thread(). Handles the queued
+// events, then draws at most one frame. Rather than sleep until the latch
+// time, as ru_rend_wait_for_latch() would, it asks the reactor to dispatch
+// it again then, so that the other sources run meanwhile.
+static void
+ru_rend_dispatch(void *_rend) {
+    RuRend *rend = _rend;
+    RuRendEvent ev;
 
-                    AImageReader_setBufferRemovedListener(ev.start.aimage_reader,
-                        &(AImageReader_BufferRemovedListener) {
-                            .context = rend,
-                            .onBufferRemoved = on_aimage_buffer_removed,
-                        });
+    while (!rend->is_stopped && ru_chan_pop_nowait(&rend->event_chan, &ev)) {
+        if (!ru_rend_handle_event(rend, &ev)) {
+            ru_mutex_lock_scoped(&rend->stop_mutex);
+            rend->is_stopped = true;
 
-                    started = true;
-                    break;
-                }
-                case RU_REND_EVENT_STOP:
-                    return NULL;
-                case RU_REND_EVENT_BIND_WINDOW: {
-                    assert(!window_bound);
-                    assert(!rend->surf);
-                    assert(!rend->swapchain);
-                    assert(!rend->framechain);
-                    rend->surf = ru_surface_new(&rend->phys_dev, ev.bind_window.window);
-                    window_bound = true;
-                    break;
-                }
-                case RU_REND_EVENT_UNBIND_WINDOW: {
-                    assert(window_bound);
+            if (pthread_cond_broadcast(&rend->stop_cond))
+                abort();
+        }
+    }
 
-                    ru_framechain_free(rend->framechain);
-                    ru_swapchain_free(rend->swapchain);
-                    ru_surface_free(rend->surf);
+    if (rend->is_stopped)
+        return;
 
-                    rend->framechain = NULL;
-                    rend->swapchain = NULL;
-                    rend->surf = NULL;
+    const bool can_draw = !rend->is_paused &&
+                          (rend->is_window_bound || rend->headless);
 
-                    window_bound = false;
-                    break;
-                }
-                case RU_REND_EVENT_PAUSE:
-                    assert(started);
-                    paused = true;
-                    break;
-                case RU_REND_EVENT_UNPAUSE:
-                    assert(started);
-                    paused = false;
-                    break;
-                case RU_REND_EVENT_AIMAGE_BUFFER_REMOVED: {
-                    let *ahb = ev.aimage_buffer_removed.ahb;
-                    let slot = ru_ahb_cache_search(&rend->ahb_cache, ahb);
-                    if (slot) {
-                        // Assume that the AImageReader will not remove an AImage's AHB
-                        // if we hold ownership of the AImage.
-                        assert(!slot->aimage);
-
-                        slot->in_aimage_reader = false;
-                    }
-                    break;
-                }
-            }
-        }
+    if (rend->vsync && can_draw && ru_aimage_heap_poll(&rend->aimage_heap)) {
+        const int64_t now_ns = ru_time_now_ns();
+        int64_t vsync_ns;
+        bool is_held;
+        const int64_t latch_ns =
+            ru_rend_predict_latch(rend, now_ns, &vsync_ns, &is_held);
 
-        if (!paused && window_bound) {
-            ru_rend_present(rend);
+        if (latch_ns > now_ns + RU_REND_REACTOR_LATCH_SLACK_NS) {
+            ru_reactor_source_schedule(
+                atomic_load(&rend->reactor_link.source), latch_ns);
+            return;
         }
+    }
 
-        if (rend->framechain) {
-            ru_framechain_collect(&rend->dev, rend->framechain);
-        }
+    ru_rend_step(rend);
 
-        ru_rend_purge_dead_ahbs(rend);
-    }
+    // Draw the next frame after the other sources have had a turn.
+    if (can_draw && !rend->is_idle)
+        ru_reactor_link_wake(&rend->reactor_link);
 }
@@ -27,10 +27,18 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "util/attribs.h"
 
+#define RU_REND_MAX_LAYERS 16
+
 typedef struct AImage AImage;
 typedef struct AImageReader AImageReader;
+typedef struct RuLatency RuLatency;
+typedef struct RuPool RuPool;
+typedef struct RuReactor RuReactor;
 typedef struct RuRend RuRend;
 
 typedef enum RuRendUseExternalFormat {
@@ -39,11 +47,178 @@ typedef enum RuRendUseExternalFormat {
     RU_REND_USE_EXTERNAL_FORMAT_NEVER,
 } RuRendUseExternalFormat;
 
+// Describes one frame, once the queue has finished it. Times are on
+// CLOCK_MONOTONIC, in nanoseconds.
+typedef struct RuRendFrameInfo {
+    uint64_t seq; // Counts the frames, from 0.
+
+    int64_t begin_ns; // The renderer began to prepare the frame.
+    int64_t submit_ns; // The renderer submitted the frame.
+
+    // The renderer saw the frame's fence signal. This may trail the GPU by up
+    // to one frame.
+    int64_t complete_ns;
+
+    // The AImages that this frame is the first to draw.
+    uint32_t new_aimage_count;
+
+    // The earliest onImageAvailable among the new AImages. Zero if none.
+    int64_t aimage_available_ns;
+
+    // AImages that arrived since the previous frame but that no frame will
+    // draw, because a newer AImage of the same layer replaced them.
+    uint32_t dropped_aimage_count;
+
+    // Time the GPU spent executing the frame's render pass, from timestamp
+    // queries inside it. Zero if the queue lacks timestamps.
+    int64_t gpu_ns;
+
+    // The predicted vsync that the frame aimed for. Zero without a vsync
+    // schedule, or before the first prediction.
+    int64_t vsync_ns;
+} RuRendFrameInfo;
+
+typedef struct RuRendListener {
+    void *context;
+
+    // Called on the render thread, or the reactor's thread. May be null.
+    void (*on_frame_complete)(void *context, const RuRendFrameInfo *info);
+} RuRendListener;
+
+// The phases of one frame. The first phases are sequential parts of
+// RU_REND_PHASE_FRAME, on the render thread up to RU_REND_PHASE_RECORD and
+// then on the submit thread, if any; RU_REND_PHASE_INTERVAL is the time
+// from one frame's start to the next; RU_REND_PHASE_GPU is
+// RuRendFrameInfo::gpu_ns; RU_REND_PHASE_IDLE is each sleep between frames
+// while no layer had a new AImage; RU_REND_PHASE_AHB_INIT is each import of
+// a new AHB, whichever thread ran it; RU_REND_PHASE_DESTROY is each batch of
+// retired AHBs and swapchains destroyed between frames.
+typedef enum RuRendPhase {
+    RU_REND_PHASE_ACQUIRE, // vkAcquireNextImageKHR and its fence.
+    RU_REND_PHASE_FENCE_WAIT, // Waiting for the frame's fence and hand-back.
+    RU_REND_PHASE_LATCH_WAIT, // Waiting to latch AImages close to vsync.
+    RU_REND_PHASE_IMAGE_WAIT, // Waiting for a decoded AImage.
+    RU_REND_PHASE_IMPORT, // Importing the AImages' AHardwareBuffers.
+    RU_REND_PHASE_RECORD, // Recording the command buffer.
+    RU_REND_PHASE_SUBMIT, // vkQueueSubmit.
+    RU_REND_PHASE_PRESENT, // vkQueuePresentKHR.
+    RU_REND_PHASE_FRAME,
+    RU_REND_PHASE_INTERVAL,
+    RU_REND_PHASE_GPU,
+    RU_REND_PHASE_IDLE,
+    RU_REND_PHASE_AHB_INIT,
+    RU_REND_PHASE_DESTROY,
+    RU_REND_PHASE_COUNT,
+} RuRendPhase;
+
+// Percentiles are accurate to about 3%. Zero if count is zero.
+typedef struct RuRendPhaseStats {
+    uint64_t count;
+    int64_t min_ns;
+    int64_t mean_ns;
+    int64_t p50_ns;
+    int64_t p90_ns;
+    int64_t p99_ns;
+    int64_t p999_ns;
+    int64_t max_ns;
+} RuRendPhaseStats;
+
+typedef struct RuRendStats {
+    RuRendPhaseStats phases[RU_REND_PHASE_COUNT]; // Indexed by RuRendPhase.
+
+    // Times the renderer found no new AImage and slept until one arrived,
+    // instead of acquiring a swapchain image to redraw unchanged content.
+    // Each is a frame, and a GPU wakeup, that did not happen.
+    uint64_t idle_count;
+
+    // Frames whose submit, plus the previous frame's GPU time, passed
+    // RuRendFrameInfo::vsync_ns. Zero without a vsync schedule.
+    uint64_t missed_vsync_count;
+
+    // AImages whose AHB was still importing on the import pool when the
+    // render thread latched them. Their layers kept drawing the previous
+    // AImage meanwhile.
+    uint64_t deferred_aimage_count;
+
+    // The members below count from ru_rend_new(), and
+    // ru_rend_reset_stats() keeps them, because most imports happen while
+    // each stream starts.
+
+    uint64_t ahb_import_count;
+
+    // The longest RU_REND_PHASE_IMPORT of any frame: the worst hitch that
+    // imports caused the render thread.
+    int64_t startup_hitch_ns;
+} RuRendStats;
+
 struct ru_rend_new_args {
     bool use_validation;
     RuRendUseExternalFormat use_external_format;
+
+    // Render into a ring of offscreen VkImages instead of a window's
+    // swapchain, and never present. The renderer then draws as soon as it
+    // has unpaused, without ru_rend_bind_window(). The host supports only
+    // headless renderers.
+    bool headless;
+    uint32_t headless_width; // default=1920
+    uint32_t headless_height; // default=1080
+
+    RuRendListener listener;
+
+    // Pace the frames to the display's predicted vsync, and latch each
+    // frame's AImages as late as the recent frame times allow, instead of as
+    // soon as a swapchain image is free. Headless renderers pace to a timer
+    // instead, of period headless_vsync_period_ns.
+    bool use_vsync_schedule;
+    int64_t headless_vsync_period_ns; // default=16666667, for 60 Hz
+
+    // If set, stamp the available, acquire, submit and present stages of
+    // each AImage, with the layer index as RuLatencyFrame::stream. Present is
+    // the display's time if VK_GOOGLE_display_timing is available, and else
+    // the time the renderer saw the frame's fence signal. Not owned, and must
+    // outlive the RuRend.
+    RuLatency *latency;
+
+    // Split the render loop into two threads. The render thread latches,
+    // imports and records frame N+1 while a submit thread blocks in
+    // vkQueueSubmit and vkQueuePresentKHR for frame N. The threads pass one
+    // frame at a time through a bounded hand-off. The swapchain gets one
+    // image more than it otherwise would, and a frame's latency grows by at
+    // most one frame of queueing.
+    bool use_submit_thread;
+
+    // If set, run the render loop as a handler on the reactor's thread
+    // instead of on a render thread of its own. Between frames, the handler
+    // returns to the reactor rather than sleeping until the latch time.
+    // RuRendListener is then called on the reactor's thread. Not owned, and
+    // must outlive the RuRend.
+    RuReactor *reactor;
+
+    // If set, import each new AHB, and create its pipelines, as a job on
+    // this pool instead of on the render thread. Until the import finishes,
+    // the AHB's layer keeps drawing its previous AImage, so the render
+    // thread never waits for an import. Not owned, and must outlive the
+    // RuRend.
+    RuPool *import_pool;
 };
 
+// Normalized to the window. {0, 0, 1, 1} covers the full window.
+typedef struct RuRendRect {
+    float x;
+    float y;
+    float width;
+    float height;
+} RuRendRect;
+
+// Each layer draws the latest image of one AImageReader. All layers are
+// composited in a single render pass.
+typedef struct RuRendLayer {
+    AImageReader *aimage_reader;
+    RuRendRect rect;
+    int32_t z; // Layers with greater z draw on top.
+    float opacity; // 1.0 is opaque.
+} RuRendLayer;
+
 #define ru_rend_new(...) ru_rend_new_s((struct ru_rend_new_args) { 0, __VA_ARGS__ })
 RuRend *ru_rend_new_s(struct ru_rend_new_args args) _must_use_result_;
 void ru_rend_free(RuRend *r);
@@ -51,7 +226,28 @@ void ru_rend_free(RuRend *r);
 void ru_rend_bind_window(RuRend *r, ANativeWindow *window);
 void ru_rend_unbind_window(RuRend *r);
 
-void ru_rend_start(RuRend *r, AImageReader *);
+void ru_rend_start(RuRend *r, const RuRendLayer *layers, uint32_t layer_count);
+
+// Redirect the layer to a new AImageReader, such as after the decoder changes
+// resolution. Takes ownership of old_reader, and deletes it once no frame
+// draws any of its AImages.
+void ru_rend_replace_aimage_reader(RuRend *r, uint32_t layer,
+                                   AImageReader *reader,
+                                   AImageReader *old_reader);
+
+// The layer's frames arrive at this rate, such as from
+// RuMediaListener::on_frame_rate_changed. The renderer asks the window for a
+// refresh rate that suits the fastest layer. With use_vsync_schedule, if the
+// display is still faster, each frame stays on the display for a steady
+// number of vsyncs, such as alternately 3 and 2 for 24 Hz on 60 Hz.
+void ru_rend_set_frame_rate(RuRend *r, uint32_t layer, float hz);
+
 void ru_rend_stop(RuRend *r);
 void ru_rend_pause(RuRend *r);
 void ru_rend_unpause(RuRend *r);
+
+// The renderer keeps a histogram of each RuRendPhase, from its creation or
+// from the last ru_rend_reset_stats(). Thread-safe.
+void ru_rend_get_stats(RuRend *r, RuRendStats *stats);
+void ru_rend_reset_stats(RuRend *r);
+const char *ru_rend_phase_to_str(RuRendPhase phase) _must_use_result_;
@@ -0,0 +1,247 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// stdlib
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Linux
+#include <pthread.h>
+#include <sched.h>
+
+// Android
+#ifdef ANDROID
+#include <android/choreographer.h>
+#include <android/looper.h>
+#endif
+
+// local
+#include "util/alloc.h"
+#include "util/log.h"
+#include "util/ru_thread.h"
+#include "util/ru_time.h"
+
+#include "ru_vsync.h"
+
+struct RuVsync {
+    pthread_mutex_t mutex;
+    int64_t phase_ns; // a recent vsync, or 0
+    int64_t period_ns; // 0 if unknown
+
+    // If the display has reported its period, then trust it over the
+    // intervals between observed vsyncs.
+    bool is_period_fixed;
+
+    // Consecutive intervals far from period_ns. See ru_vsync_observe().
+    uint32_t outlier_count;
+
+#ifdef ANDROID
+    // Follows AChoreographer unless use_timer.
+    bool has_thread;
+    pthread_t thread;
+    ALooper *looper; // the thread's
+    _Atomic bool quit;
+#endif
+};
+
+#ifdef ANDROID
+
+// AChoreographer_postFrameCallback64 needs API 29, above our minSdkVersion.
+// On 32-bit ABIs, the older callback's long truncates the time, so restore
+// the high bits from the current time.
+static void
+on_choreographer_frame(long frame_time_ns, void *_v) {
+    RuVsync *v = _v;
+    int64_t vsync_ns = frame_time_ns;
+
+    if (sizeof(long) < sizeof(int64_t)) {
+        int64_t now_ns = ru_time_now_ns();
+        vsync_ns = now_ns - (int64_t) (uint32_t) ((uint32_t) now_ns - (uint32_t) frame_time_ns);
+    }
+
+    ru_vsync_observe(v, vsync_ns);
+
+    if (!atomic_load(&v->quit))
+        AChoreographer_postFrameCallback(AChoreographer_getInstance(),
+                                         on_choreographer_frame, v);
+}
+
+static void *
+ru_vsync_thread(void *_v) {
+    RuVsync *v = _v;
+
+    ru_thread_apply(RU_THREAD_CLASS_RENDER, "ru-vsync");
+
+    ALooper *looper = ALooper_prepare(0);
+    ALooper_acquire(looper);
+
+    {
+        ru_mutex_lock_scoped(&v->mutex);
+        v->looper = looper;
+    }
+
+    AChoreographer *choreographer = AChoreographer_getInstance();
+    if (!choreographer) {
+        logw("vsync: AChoreographer_getInstance failed; not following vsync");
+    } else {
+        AChoreographer_postFrameCallback(choreographer, on_choreographer_frame, v);
+    }
+
+    while (!atomic_load(&v->quit))
+        ALooper_pollOnce(-1, NULL, NULL, NULL);
+
+    return NULL;
+}
+
+#endif // ANDROID
+
+RuVsync *
+ru_vsync_new_s(struct ru_vsync_new_args args) {
+    let v = new0(RuVsync);
+
+    if (pthread_mutex_init(&v->mutex, NULL))
+        abort();
+
+#ifdef ANDROID
+    if (!args.use_timer) {
+        atomic_init(&v->quit, false);
+
+        if (pthread_create(&v->thread, NULL, ru_vsync_thread, v))
+            abort();
+
+        v->has_thread = true;
+        return v;
+    }
+#endif
+
+    // The timer ticks from now.
+    v->phase_ns = ru_time_now_ns();
+    v->period_ns = args.timer_period_ns > 0
+        ? args.timer_period_ns
+        : RU_VSYNC_DEFAULT_PERIOD_NS;
+    v->is_period_fixed = true;
+
+    return v;
+}
+
+void
+ru_vsync_free(RuVsync *v) {
+    if (!v)
+        return;
+
+#ifdef ANDROID
+    if (v->has_thread) {
+        atomic_store(&v->quit, true);
+
+        // The thread may not yet have published its looper.
+        for (;;) {
+            ALooper *looper;
+            {
+                ru_mutex_lock_scoped(&v->mutex);
+                looper = v->looper;
+            }
+
+            if (looper) {
+                ALooper_wake(looper);
+                break;
+            }
+
+            sched_yield();
+        }
+
+        if (pthread_join(v->thread, NULL))
+            abort();
+
+        ALooper_release(v->looper);
+    }
+#endif
+
+    if (pthread_mutex_destroy(&v->mutex))
+        abort();
+
+    free(v);
+}
+
+void
+ru_vsync_observe(RuVsync *v, int64_t vsync_ns) {
+    ru_mutex_lock_scoped(&v->mutex);
+
+    int64_t delta_ns = vsync_ns - v->phase_ns;
+    if (v->phase_ns == 0 || delta_ns <= 0) {
+        if (v->phase_ns == 0)
+            v->phase_ns = vsync_ns;
+        return;
+    }
+
+    v->phase_ns = vsync_ns;
+
+    if (v->is_period_fixed)
+        return;
+
+    // Smooth the jitter of the callbacks. Ignore the intervals far from the
+    // period, such as those that span skipped vsyncs, unless they persist,
+    // which means the display switched modes.
+    if (v->period_ns == 0) {
+        v->period_ns = delta_ns;
+    } else if (2 * delta_ns < 3 * v->period_ns &&
+               3 * delta_ns > 2 * v->period_ns) {
+        v->period_ns += (delta_ns - v->period_ns) / 8;
+        v->outlier_count = 0;
+    } else if (++v->outlier_count >= 4) {
+        v->period_ns = delta_ns;
+        v->outlier_count = 0;
+    }
+}
+
+void
+ru_vsync_set_period(RuVsync *v, int64_t period_ns) {
+    ru_mutex_lock_scoped(&v->mutex);
+    v->period_ns = period_ns;
+    v->is_period_fixed = true;
+}
+
+int64_t
+ru_vsync_next(RuVsync *v, int64_t ns) {
+    ru_mutex_lock_scoped(&v->mutex);
+
+    if (v->phase_ns == 0 || v->period_ns == 0)
+        return ns;
+
+    if (ns <= v->phase_ns)
+        return v->phase_ns;
+
+    int64_t periods = (ns - v->phase_ns + v->period_ns - 1) / v->period_ns;
+    return v->phase_ns + periods * v->period_ns;
+}
+
+int64_t
+ru_vsync_get_period(RuVsync *v) {
+    ru_mutex_lock_scoped(&v->mutex);
+    return v->period_ns;
+}
@@ -0,0 +1,68 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+// Predicts when the display will next scan out.
+//
+// On Android, a thread follows AChoreographer's frame callbacks, and the
+// renderer may add the actual present times that VK_GOOGLE_display_timing
+// reports. On the host, and for headless renderers, a timer of fixed period
+// stands in for the display.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "util/attribs.h"
+
+#define RU_VSYNC_DEFAULT_PERIOD_NS INT64_C(16666667)
+
+typedef struct RuVsync RuVsync;
+
+struct ru_vsync_new_args {
+    // Tick on a timer instead of following the display. Always set on the
+    // host.
+    bool use_timer;
+    int64_t timer_period_ns; // default=RU_VSYNC_DEFAULT_PERIOD_NS
+};
+
+#define ru_vsync_new(...) ru_vsync_new_s((struct ru_vsync_new_args) { 0, __VA_ARGS__ })
+RuVsync *ru_vsync_new_s(struct ru_vsync_new_args args) _malloc_ _must_use_result_;
+void ru_vsync_free(RuVsync *v);
+
+// A vsync happened at vsync_ns, on CLOCK_MONOTONIC. Thread-safe.
+void ru_vsync_observe(RuVsync *v, int64_t vsync_ns);
+
+// The display reported its refresh period. Thread-safe.
+void ru_vsync_set_period(RuVsync *v, int64_t period_ns);
+
+// Return the first predicted vsync at or after ns, or ns itself if there is
+// no prediction yet. Thread-safe.
+int64_t ru_vsync_next(RuVsync *v, int64_t ns) _must_use_result_;
+
+// Zero if unknown.
+int64_t ru_vsync_get_period(RuVsync *v) _must_use_result_;
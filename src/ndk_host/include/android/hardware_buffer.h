@@ -0,0 +1,93 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Host stand-in for the NDK's <android/hardware_buffer.h>. Each buffer is a
+// memfd, mapped for the buffer's lifetime.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <android/rect.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AHardwareBuffer AHardwareBuffer;
+
+typedef struct AHardwareBuffer_Desc {
+    uint32_t width;
+    uint32_t height;
+    uint32_t layers;
+    uint32_t format; // AHardwareBuffer_Format
+    uint64_t usage; // AHardwareBuffer_UsageFlags
+    uint32_t stride; // in pixels
+    uint32_t rfu0;
+    uint64_t rfu1;
+} AHardwareBuffer_Desc;
+
+enum AHardwareBuffer_Format {
+    AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM = 1,
+    AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM = 2,
+    AHARDWAREBUFFER_FORMAT_R8G8B8_UNORM = 3,
+    AHARDWAREBUFFER_FORMAT_BLOB = 0x21,
+
+    // On the host, always NV12: a Y plane, then an interleaved CbCr plane,
+    // both with a row stride of AHardwareBuffer_Desc::stride.
+    AHARDWAREBUFFER_FORMAT_Y8Cb8Cr8_420 = 0x23,
+};
+
+enum AHardwareBuffer_UsageFlags {
+    AHARDWAREBUFFER_USAGE_CPU_READ_NEVER = 0UL,
+    AHARDWAREBUFFER_USAGE_CPU_READ_RARELY = 2UL,
+    AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN = 3UL,
+    AHARDWAREBUFFER_USAGE_CPU_READ_MASK = 0xFUL,
+    AHARDWAREBUFFER_USAGE_CPU_WRITE_NEVER = 0UL << 4,
+    AHARDWAREBUFFER_USAGE_CPU_WRITE_RARELY = 2UL << 4,
+    AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN = 3UL << 4,
+    AHARDWAREBUFFER_USAGE_CPU_WRITE_MASK = 0xFUL << 4,
+    AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE = 1UL << 8,
+    AHARDWAREBUFFER_USAGE_GPU_COLOR_OUTPUT = 1UL << 9,
+};
+
+int AHardwareBuffer_allocate(const AHardwareBuffer_Desc *desc,
+                             AHardwareBuffer **out_buffer);
+void AHardwareBuffer_acquire(AHardwareBuffer *buffer);
+void AHardwareBuffer_release(AHardwareBuffer *buffer);
+void AHardwareBuffer_describe(const AHardwareBuffer *buffer,
+                              AHardwareBuffer_Desc *out_desc);
+
+// The host ignores usage and fence, and maps the whole buffer.
+int AHardwareBuffer_lock(AHardwareBuffer *buffer, uint64_t usage,
+                         int32_t fence, const ARect *rect,
+                         void **out_virtual_address);
+int AHardwareBuffer_unlock(AHardwareBuffer *buffer, int32_t *fence);
+
+#ifdef __cplusplus
+}
+#endif
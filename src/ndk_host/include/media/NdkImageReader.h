@@ -0,0 +1,93 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Host stand-in for the NDK's <media/NdkImageReader.h>.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <android/hardware_buffer.h>
+#include <android/native_window.h>
+
+#include "NdkImage.h"
+#include "NdkMediaError.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AImageReader AImageReader;
+
+typedef void (*AImageReader_ImageCallback)(void *context, AImageReader *reader);
+
+typedef struct AImageReader_ImageListener {
+    void *context;
+    AImageReader_ImageCallback onImageAvailable;
+} AImageReader_ImageListener;
+
+typedef void (*AImageReader_BufferRemovedCallback)(void *context,
+                                                   AImageReader *reader,
+                                                   AHardwareBuffer *buffer);
+
+typedef struct AImageReader_BufferRemovedListener {
+    void *context;
+    AImageReader_BufferRemovedCallback onBufferRemoved;
+} AImageReader_BufferRemovedListener;
+
+media_status_t AImageReader_new(int32_t width, int32_t height, int32_t format,
+                                int32_t max_images, AImageReader **reader);
+media_status_t AImageReader_newWithUsage(int32_t width, int32_t height,
+                                         int32_t format, uint64_t usage,
+                                         int32_t max_images,
+                                         AImageReader **reader);
+
+// Invalidates the reader's window. Images still acquired remain valid.
+void AImageReader_delete(AImageReader *reader);
+
+media_status_t AImageReader_getWindow(AImageReader *reader,
+                                      ANativeWindow **window);
+media_status_t AImageReader_getWidth(const AImageReader *reader, int32_t *width);
+media_status_t AImageReader_getHeight(const AImageReader *reader, int32_t *height);
+media_status_t AImageReader_getFormat(const AImageReader *reader, int32_t *format);
+media_status_t AImageReader_getMaxImages(const AImageReader *reader,
+                                         int32_t *max_images);
+
+media_status_t AImageReader_acquireNextImage(AImageReader *reader, AImage **image);
+media_status_t AImageReader_acquireLatestImage(AImageReader *reader, AImage **image);
+
+media_status_t AImageReader_setImageListener(
+        AImageReader *reader, AImageReader_ImageListener *listener);
+
+// The host never removes a buffer while the reader lives, so the listener
+// never fires.
+media_status_t AImageReader_setBufferRemovedListener(
+        AImageReader *reader, AImageReader_BufferRemovedListener *listener);
+
+#ifdef __cplusplus
+}
+#endif
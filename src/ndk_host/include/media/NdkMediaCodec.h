@@ -0,0 +1,128 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Host stand-in for the NDK's <media/NdkMediaCodec.h>. The only codec is a
+// fake decoder, which runs on its own thread and fires the same async
+// callbacks as a real one. See ru_host_codec.c.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <android/native_window.h>
+
+#include "NdkMediaError.h"
+#include "NdkMediaFormat.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AMediaCodec AMediaCodec;
+typedef struct AMediaCrypto AMediaCrypto;
+
+typedef struct AMediaCodecBufferInfo {
+    int32_t offset;
+    int32_t size;
+    int64_t presentationTimeUs;
+    uint32_t flags;
+} AMediaCodecBufferInfo;
+
+enum {
+    AMEDIACODEC_BUFFER_FLAG_CODEC_CONFIG = 2,
+    AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM = 4,
+    AMEDIACODEC_BUFFER_FLAG_PARTIAL_FRAME = 8,
+
+    AMEDIACODEC_CONFIGURE_FLAG_ENCODE = 1,
+
+    AMEDIACODEC_INFO_OUTPUT_BUFFERS_CHANGED = -3,
+    AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED = -2,
+    AMEDIACODEC_INFO_TRY_AGAIN_LATER = -1,
+};
+
+typedef void (*AMediaCodecOnAsyncInputAvailable)(
+        AMediaCodec *codec, void *userdata, int32_t index);
+typedef void (*AMediaCodecOnAsyncOutputAvailable)(
+        AMediaCodec *codec, void *userdata, int32_t index,
+        AMediaCodecBufferInfo *buffer_info);
+typedef void (*AMediaCodecOnAsyncFormatChanged)(
+        AMediaCodec *codec, void *userdata, AMediaFormat *format);
+typedef void (*AMediaCodecOnAsyncError)(
+        AMediaCodec *codec, void *userdata, media_status_t error,
+        int32_t action_code, const char *detail);
+
+// Like the NDK's header, declare the struct without a typedef.
+struct AMediaCodecOnAsyncNotifyCallback {
+    AMediaCodecOnAsyncInputAvailable onAsyncInputAvailable;
+    AMediaCodecOnAsyncOutputAvailable onAsyncOutputAvailable;
+    AMediaCodecOnAsyncFormatChanged onAsyncFormatChanged;
+    AMediaCodecOnAsyncError onAsyncError;
+};
+
+AMediaCodec *AMediaCodec_createCodecByName(const char *name);
+AMediaCodec *AMediaCodec_createDecoderByType(const char *mime_type);
+media_status_t AMediaCodec_delete(AMediaCodec *codec);
+
+media_status_t AMediaCodec_configure(AMediaCodec *codec,
+                                     const AMediaFormat *format,
+                                     ANativeWindow *surface,
+                                     AMediaCrypto *crypto,
+                                     uint32_t flags);
+media_status_t AMediaCodec_setAsyncNotifyCallback(
+        AMediaCodec *codec,
+        struct AMediaCodecOnAsyncNotifyCallback callback,
+        void *userdata);
+media_status_t AMediaCodec_start(AMediaCodec *codec);
+media_status_t AMediaCodec_stop(AMediaCodec *codec);
+
+uint8_t *AMediaCodec_getInputBuffer(AMediaCodec *codec, size_t idx,
+                                    size_t *out_size);
+ssize_t AMediaCodec_dequeueInputBuffer(AMediaCodec *codec, int64_t timeout_us);
+media_status_t AMediaCodec_queueInputBuffer(AMediaCodec *codec, size_t idx,
+                                            off_t offset, size_t size,
+                                            uint64_t time, uint32_t flags);
+ssize_t AMediaCodec_dequeueOutputBuffer(AMediaCodec *codec,
+                                        AMediaCodecBufferInfo *info,
+                                        int64_t timeout_us);
+media_status_t AMediaCodec_releaseOutputBuffer(AMediaCodec *codec, size_t idx,
+                                               bool render);
+media_status_t AMediaCodec_setOutputSurface(AMediaCodec *codec,
+                                            ANativeWindow *surface);
+
+// The caller owns the returned format.
+AMediaFormat *AMediaCodec_getInputFormat(AMediaCodec *codec);
+AMediaFormat *AMediaCodec_getOutputFormat(AMediaCodec *codec);
+
+bool AMediaCodecActionCode_isRecoverable(int32_t action_code);
+bool AMediaCodecActionCode_isTransient(int32_t action_code);
+
+#ifdef __cplusplus
+}
+#endif
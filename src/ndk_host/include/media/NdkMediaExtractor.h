@@ -0,0 +1,81 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Host stand-in for the NDK's <media/NdkMediaExtractor.h>. It reads two
+// uncompressed-index formats: Y4M (raw I420 frames) and IVF (VP8, VP9, AV1).
+// Each file has one video track.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "NdkMediaError.h"
+#include "NdkMediaFormat.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AMediaExtractor AMediaExtractor;
+
+typedef enum {
+    AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC,
+    AMEDIAEXTRACTOR_SEEK_NEXT_SYNC,
+    AMEDIAEXTRACTOR_SEEK_CLOSEST_SYNC,
+} SeekMode;
+
+enum {
+    AMEDIAEXTRACTOR_SAMPLE_FLAG_SYNC = 1,
+    AMEDIAEXTRACTOR_SAMPLE_FLAG_ENCRYPTED = 2,
+};
+
+AMediaExtractor *AMediaExtractor_new(void);
+media_status_t AMediaExtractor_delete(AMediaExtractor *ex);
+
+// The extractor maps the file. The caller may close fd afterwards.
+media_status_t AMediaExtractor_setDataSourceFd(AMediaExtractor *ex, int fd,
+                                               off64_t offset, off64_t length);
+
+size_t AMediaExtractor_getTrackCount(AMediaExtractor *ex);
+AMediaFormat *AMediaExtractor_getTrackFormat(AMediaExtractor *ex, size_t idx);
+media_status_t AMediaExtractor_selectTrack(AMediaExtractor *ex, size_t idx);
+
+ssize_t AMediaExtractor_readSampleData(AMediaExtractor *ex, uint8_t *buffer,
+                                       size_t capacity);
+uint32_t AMediaExtractor_getSampleFlags(AMediaExtractor *ex);
+int AMediaExtractor_getSampleTrackIndex(AMediaExtractor *ex);
+int64_t AMediaExtractor_getSampleTime(AMediaExtractor *ex);
+bool AMediaExtractor_advance(AMediaExtractor *ex);
+media_status_t AMediaExtractor_seekTo(AMediaExtractor *ex, int64_t seek_pos_us,
+                                      SeekMode mode);
+
+#ifdef __cplusplus
+}
+#endif
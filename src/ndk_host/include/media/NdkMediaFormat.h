@@ -0,0 +1,82 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Host stand-in for the NDK's <media/NdkMediaFormat.h>.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "NdkMediaError.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AMediaFormat AMediaFormat;
+
+AMediaFormat *AMediaFormat_new(void);
+media_status_t AMediaFormat_delete(AMediaFormat *format);
+media_status_t AMediaFormat_copy(AMediaFormat *to, AMediaFormat *from);
+
+// The string is owned by the format, and valid until the next call.
+const char *AMediaFormat_toString(AMediaFormat *format);
+
+bool AMediaFormat_getInt32(AMediaFormat *format, const char *name, int32_t *out);
+bool AMediaFormat_getInt64(AMediaFormat *format, const char *name, int64_t *out);
+bool AMediaFormat_getFloat(AMediaFormat *format, const char *name, float *out);
+bool AMediaFormat_getString(AMediaFormat *format, const char *name, const char **out);
+bool AMediaFormat_getRect(AMediaFormat *format, const char *name,
+                          int32_t *left, int32_t *top,
+                          int32_t *right, int32_t *bottom);
+
+void AMediaFormat_setInt32(AMediaFormat *format, const char *name, int32_t value);
+void AMediaFormat_setInt64(AMediaFormat *format, const char *name, int64_t value);
+void AMediaFormat_setFloat(AMediaFormat *format, const char *name, float value);
+void AMediaFormat_setString(AMediaFormat *format, const char *name, const char *value);
+void AMediaFormat_setRect(AMediaFormat *format, const char *name,
+                          int32_t left, int32_t top,
+                          int32_t right, int32_t bottom);
+
+extern const char *AMEDIAFORMAT_KEY_COLOR_FORMAT;
+extern const char *AMEDIAFORMAT_KEY_DISPLAY_CROP;
+extern const char *AMEDIAFORMAT_KEY_DURATION;
+extern const char *AMEDIAFORMAT_KEY_FRAME_RATE;
+extern const char *AMEDIAFORMAT_KEY_HEIGHT;
+extern const char *AMEDIAFORMAT_KEY_MAX_INPUT_SIZE;
+extern const char *AMEDIAFORMAT_KEY_MIME;
+extern const char *AMEDIAFORMAT_KEY_OPERATING_RATE;
+extern const char *AMEDIAFORMAT_KEY_PRIORITY;
+extern const char *AMEDIAFORMAT_KEY_SLICE_HEIGHT;
+extern const char *AMEDIAFORMAT_KEY_STRIDE;
+extern const char *AMEDIAFORMAT_KEY_WIDTH;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,118 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+// stdlib
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Linux
+#include <pthread.h>
+
+// local
+#include <android/hardware_buffer.h>
+#include <android/native_window.h>
+#include <media/NdkImage.h>
+#include <media/NdkImageReader.h>
+
+#define LOG_PREFIX "host: "
+
+// Maximum number of buffers in an AImageReader's queue.
+#define RU_HOST_MAX_BUFFERS 64
+
+// Number of buffers that an AImageReader allocates beyond maxImages, so that a
+// producer can write one while the consumer holds maxImages.
+#define RU_HOST_EXTRA_BUFFERS 2
+
+// One lock guards all shim state shared between threads: the codecs' slots, and
+// the state of each AImageReader's buffers. Every state change broadcasts
+// ru_host_cond. No callback into the client is ever made with the lock held.
+extern pthread_mutex_t ru_host_mutex;
+extern pthread_cond_t ru_host_cond;
+
+typedef enum RuHostBufferState {
+    RU_HOST_BUFFER_STATE_FREE,
+    RU_HOST_BUFFER_STATE_DEQUEUED, // owned by a producer
+    RU_HOST_BUFFER_STATE_QUEUED, // waiting in the reader for acquisition
+    RU_HOST_BUFFER_STATE_ACQUIRED, // owned by an AImage
+} RuHostBufferState;
+
+struct AHardwareBuffer {
+    atomic_uint ref_count;
+
+    AHardwareBuffer_Desc desc;
+    int fd; // memfd
+    uint8_t *map;
+    size_t size;
+
+    // The remaining members belong to the AImageReader queue, and are
+    // guarded by ru_host_mutex.
+
+    // Null if the buffer does not belong to a reader, or if the reader was
+    // deleted.
+    AImageReader *reader;
+    RuHostBufferState state;
+    uint64_t queue_seq;
+    int64_t timestamp_ns;
+    AImageCropRect crop;
+};
+
+struct ANativeWindow {
+    AImageReader *reader;
+};
+
+// Offset of the interleaved CbCr plane in an AHARDWAREBUFFER_FORMAT_Y8Cb8Cr8_420
+// buffer.
+static inline size_t
+ru_host_ahb_cbcr_offset(const AHardwareBuffer *ahb) {
+    return (size_t) ahb->desc.stride * ahb->desc.height;
+}
+
+// Dequeue a free buffer from the reader, allocating it if needed. The caller
+// owns a reference to the buffer. Return null if every buffer is in use.
+//
+// Requires ru_host_mutex.
+AHardwareBuffer *ru_host_reader_dequeue_locked(AImageReader *reader);
+
+// Queue the dequeued buffer into its reader, and release the caller's
+// reference. Return the reader, and its listener through out_listener; the
+// caller calls the listener after dropping ru_host_mutex. If the buffer's
+// reader was deleted, then return null.
+//
+// Requires ru_host_mutex.
+AImageReader *ru_host_reader_queue_locked(AHardwareBuffer *ahb, int64_t timestamp_ns,
+                                 const AImageCropRect *crop,
+                                 AImageReader_ImageListener *out_listener);
+
+// Return the dequeued buffer to its reader unwritten, and release the caller's
+// reference.
+//
+// Requires ru_host_mutex.
+void ru_host_reader_cancel_locked(AHardwareBuffer *ahb);
@@ -0,0 +1,152 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// stdlib
+#include <stdatomic.h>
+#include <stdlib.h>
+
+// Linux
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// local
+#include "util/alloc.h"
+#include "util/check.h"
+#include "util/macros.h"
+
+#include "ru_host.h"
+
+pthread_mutex_t ru_host_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t ru_host_cond = PTHREAD_COND_INITIALIZER;
+
+static size_t
+ru_host_ahb_size(const AHardwareBuffer_Desc *desc) {
+    switch (desc->format) {
+        case AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM:
+        case AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM:
+            return (size_t) desc->stride * desc->height * desc->layers * 4;
+        case AHARDWAREBUFFER_FORMAT_R8G8B8_UNORM:
+            return (size_t) desc->stride * desc->height * desc->layers * 3;
+        case AHARDWAREBUFFER_FORMAT_BLOB:
+            return desc->width;
+        case AHARDWAREBUFFER_FORMAT_Y8Cb8Cr8_420:
+            // Pad the CbCr plane's height up so that odd heights fit.
+            return (size_t) desc->stride * (desc->height + (desc->height + 1) / 2)
+                   * desc->layers;
+        default:
+            return 0;
+    }
+}
+
+int
+AHardwareBuffer_allocate(const AHardwareBuffer_Desc *desc,
+                         AHardwareBuffer **out_buffer)
+{
+    *out_buffer = NULL;
+
+    if (desc->width == 0 || desc->height == 0 || desc->layers == 0)
+        return -EINVAL;
+
+    let ahb = new0(AHardwareBuffer);
+    atomic_init(&ahb->ref_count, 1);
+    ahb->desc = *desc;
+    ahb->desc.stride = desc->format == AHARDWAREBUFFER_FORMAT_BLOB
+                     ? desc->width
+                     : (desc->width + 1) & ~1u; // keep CbCr rows whole
+    ahb->desc.rfu0 = 0;
+    ahb->desc.rfu1 = 0;
+
+    ahb->size = ru_host_ahb_size(&ahb->desc);
+    if (ahb->size == 0) {
+        free(ahb);
+        return -EINVAL;
+    }
+
+    ahb->fd = memfd_create("ru-host-ahb", MFD_CLOEXEC);
+    if (ahb->fd < 0)
+        die(LOG_PREFIX "memfd_create failed: %s", strerror(errno));
+
+    if (ftruncate(ahb->fd, (off_t) ahb->size) < 0)
+        die(LOG_PREFIX "ftruncate(%zu) failed: %s", ahb->size, strerror(errno));
+
+    ahb->map = mmap(NULL, ahb->size, PROT_READ | PROT_WRITE, MAP_SHARED, ahb->fd, 0);
+    if (ahb->map == MAP_FAILED)
+        die(LOG_PREFIX "mmap(%zu) failed: %s", ahb->size, strerror(errno));
+
+    *out_buffer = ahb;
+    return 0;
+}
+
+void
+AHardwareBuffer_acquire(AHardwareBuffer *ahb) {
+    atomic_fetch_add_explicit(&ahb->ref_count, 1, memory_order_relaxed);
+}
+
+void
+AHardwareBuffer_release(AHardwareBuffer *ahb) {
+    if (atomic_fetch_sub_explicit(&ahb->ref_count, 1, memory_order_acq_rel) != 1)
+        return;
+
+    munmap(ahb->map, ahb->size);
+    close(ahb->fd);
+    free(ahb);
+}
+
+void
+AHardwareBuffer_describe(const AHardwareBuffer *ahb,
+                         AHardwareBuffer_Desc *out_desc)
+{
+    *out_desc = ahb->desc;
+}
+
+int
+AHardwareBuffer_lock(AHardwareBuffer *ahb, uint64_t usage, int32_t fence,
+                     const ARect *rect, void **out_virtual_address)
+{
+    (void) usage;
+    (void) rect;
+
+    // The host has no fences; producers finish writing before they queue.
+    if (fence >= 0)
+        close(fence);
+
+    *out_virtual_address = ahb->map;
+    return 0;
+}
+
+int
+AHardwareBuffer_unlock(AHardwareBuffer *ahb, int32_t *fence) {
+    (void) ahb;
+
+    if (fence)
+        *fence = -1;
+
+    return 0;
+}
@@ -0,0 +1,406 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// stdlib
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Linux
+#include <pthread.h>
+
+// local
+#include <media/NdkImage.h>
+#include <media/NdkImageReader.h>
+
+#include "util/alloc.h"
+#include "util/check.h"
+#include "util/log.h"
+#include "util/macros.h"
+#include "util/ru_thread.h"
+
+#include "ru_host.h"
+
+// A queue of AHardwareBuffers between a producer (the fake codec, which
+// dequeues and queues through the reader's window) and the consumer (which
+// acquires AImages). Every buffer is in exactly one RuHostBufferState.
+struct AImageReader {
+    int32_t width;
+    int32_t height;
+    int32_t format;
+    uint64_t usage;
+    int32_t max_images;
+
+    ANativeWindow window;
+
+    // The reader owns a reference to each buffer. Guarded by ru_host_mutex.
+    AHardwareBuffer *buffers[RU_HOST_MAX_BUFFERS];
+    uint32_t buffer_count;
+    uint32_t acquired_count;
+    uint64_t next_queue_seq;
+    AImageReader_ImageListener listener;
+};
+
+struct AImage {
+    // The image owns a reference to the buffer, so the image outlives a
+    // deleted reader.
+    AHardwareBuffer *ahb;
+    int32_t format;
+    int64_t timestamp_ns;
+    AImageCropRect crop;
+};
+
+media_status_t
+AImageReader_newWithUsage(int32_t width, int32_t height, int32_t format,
+                          uint64_t usage, int32_t max_images,
+                          AImageReader **out_reader) {
+    *out_reader = NULL;
+
+    if (width <= 0 || height <= 0 || max_images <= 0 ||
+        max_images + RU_HOST_EXTRA_BUFFERS > RU_HOST_MAX_BUFFERS) {
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+    }
+
+    // The fake codec produces only NV12.
+    if (format != AIMAGE_FORMAT_YUV_420_888 && format != AIMAGE_FORMAT_PRIVATE)
+        return AMEDIA_ERROR_UNSUPPORTED;
+
+    let r = new0(AImageReader);
+    r->width = width;
+    r->height = height;
+    r->format = format;
+    r->usage = usage;
+    r->max_images = max_images;
+    r->window.reader = r;
+
+    *out_reader = r;
+    return AMEDIA_OK;
+}
+
+media_status_t
+AImageReader_new(int32_t width, int32_t height, int32_t format,
+                 int32_t max_images, AImageReader **out_reader) {
+    return AImageReader_newWithUsage(width, height, format,
+                                     AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN,
+                                     max_images, out_reader);
+}
+
+void
+AImageReader_delete(AImageReader *r) {
+    if (!r)
+        return;
+
+    {
+        ru_mutex_lock_scoped(&ru_host_mutex);
+
+        // Detach the buffers. Any still dequeued by a producer or held by an
+        // AImage are freed when their last reference goes away.
+        for (uint32_t i = 0; i < r->buffer_count; ++i) {
+            r->buffers[i]->reader = NULL;
+            AHardwareBuffer_release(r->buffers[i]);
+        }
+
+        if (pthread_cond_broadcast(&ru_host_cond))
+            abort();
+    }
+
+    free(r);
+}
+
+media_status_t
+AImageReader_getWindow(AImageReader *r, ANativeWindow **window) {
+    *window = &r->window;
+    return AMEDIA_OK;
+}
+
+media_status_t
+AImageReader_getWidth(const AImageReader *r, int32_t *width) {
+    *width = r->width;
+    return AMEDIA_OK;
+}
+
+media_status_t
+AImageReader_getHeight(const AImageReader *r, int32_t *height) {
+    *height = r->height;
+    return AMEDIA_OK;
+}
+
+media_status_t
+AImageReader_getFormat(const AImageReader *r, int32_t *format) {
+    *format = r->format;
+    return AMEDIA_OK;
+}
+
+media_status_t
+AImageReader_getMaxImages(const AImageReader *r, int32_t *max_images) {
+    *max_images = r->max_images;
+    return AMEDIA_OK;
+}
+
+media_status_t
+AImageReader_setImageListener(AImageReader *r,
+                              AImageReader_ImageListener *listener) {
+    ru_mutex_lock_scoped(&ru_host_mutex);
+
+    if (listener) {
+        r->listener = *listener;
+    } else {
+        r->listener = (AImageReader_ImageListener) {0};
+    }
+
+    return AMEDIA_OK;
+}
+
+media_status_t
+AImageReader_setBufferRemovedListener(AImageReader *r,
+                                      AImageReader_BufferRemovedListener *listener) {
+    (void) r;
+    (void) listener;
+    return AMEDIA_OK;
+}
+
+// Requires ru_host_mutex.
+static media_status_t
+ru_host_reader_acquire_locked(AImageReader *r, bool latest, AImage **out_image) {
+    *out_image = NULL;
+
+    AHardwareBuffer *found = NULL;
+
+    for (uint32_t i = 0; i < r->buffer_count; ++i) {
+        let ahb = r->buffers[i];
+
+        if (ahb->state != RU_HOST_BUFFER_STATE_QUEUED)
+            continue;
+
+        if (!found ||
+            (latest ? ahb->queue_seq > found->queue_seq
+                    : ahb->queue_seq < found->queue_seq)) {
+            found = ahb;
+        }
+    }
+
+    if (!found)
+        return AMEDIA_IMGREADER_NO_BUFFER_AVAILABLE;
+
+    if (r->acquired_count >= (uint32_t) r->max_images)
+        return AMEDIA_IMGREADER_MAX_IMAGES_ACQUIRED;
+
+    // Like the NDK, acquireLatestImage() drops the older queued buffers.
+    if (latest) {
+        for (uint32_t i = 0; i < r->buffer_count; ++i) {
+            let ahb = r->buffers[i];
+
+            if (ahb != found && ahb->state == RU_HOST_BUFFER_STATE_QUEUED)
+                ahb->state = RU_HOST_BUFFER_STATE_FREE;
+        }
+    }
+
+    found->state = RU_HOST_BUFFER_STATE_ACQUIRED;
+    ++r->acquired_count;
+    AHardwareBuffer_acquire(found);
+
+    *out_image = new_init(AImage,
+        .ahb = found,
+        .format = r->format,
+        .timestamp_ns = found->timestamp_ns,
+        .crop = found->crop,
+    );
+
+    if (pthread_cond_broadcast(&ru_host_cond))
+        abort();
+
+    return AMEDIA_OK;
+}
+
+media_status_t
+AImageReader_acquireNextImage(AImageReader *r, AImage **image) {
+    ru_mutex_lock_scoped(&ru_host_mutex);
+    return ru_host_reader_acquire_locked(r, /*latest*/ false, image);
+}
+
+media_status_t
+AImageReader_acquireLatestImage(AImageReader *r, AImage **image) {
+    ru_mutex_lock_scoped(&ru_host_mutex);
+    return ru_host_reader_acquire_locked(r, /*latest*/ true, image);
+}
+
+AHardwareBuffer *
+ru_host_reader_dequeue_locked(AImageReader *r) {
+    for (uint32_t i = 0; i < r->buffer_count; ++i) {
+        let ahb = r->buffers[i];
+
+        if (ahb->state == RU_HOST_BUFFER_STATE_FREE) {
+            ahb->state = RU_HOST_BUFFER_STATE_DEQUEUED;
+            AHardwareBuffer_acquire(ahb);
+            return ahb;
+        }
+    }
+
+    if (r->buffer_count >= (uint32_t) r->max_images + RU_HOST_EXTRA_BUFFERS)
+        return NULL;
+
+    AHardwareBuffer *ahb;
+    int ret = AHardwareBuffer_allocate(
+        &(AHardwareBuffer_Desc) {
+            .width = (uint32_t) r->width,
+            .height = (uint32_t) r->height,
+            .layers = 1,
+            .format = AHARDWAREBUFFER_FORMAT_Y8Cb8Cr8_420,
+            .usage = r->usage,
+        },
+        &ahb);
+    if (ret)
+        die(LOG_PREFIX "failed to allocate %dx%d AHardwareBuffer", r->width, r->height);
+
+    ahb->reader = r;
+    ahb->state = RU_HOST_BUFFER_STATE_DEQUEUED;
+    r->buffers[r->buffer_count++] = ahb;
+
+    AHardwareBuffer_acquire(ahb);
+    return ahb;
+}
+
+AImageReader *
+ru_host_reader_queue_locked(AHardwareBuffer *ahb, int64_t timestamp_ns,
+                            const AImageCropRect *crop,
+                            AImageReader_ImageListener *out_listener) {
+    let r = ahb->reader;
+
+    *out_listener = (AImageReader_ImageListener) {0};
+
+    if (r) {
+        ahb->state = RU_HOST_BUFFER_STATE_QUEUED;
+        ahb->queue_seq = r->next_queue_seq++;
+        ahb->timestamp_ns = timestamp_ns;
+        ahb->crop = *crop;
+        *out_listener = r->listener;
+
+        if (pthread_cond_broadcast(&ru_host_cond))
+            abort();
+    }
+
+    AHardwareBuffer_release(ahb);
+    return r;
+}
+
+void
+ru_host_reader_cancel_locked(AHardwareBuffer *ahb) {
+    if (ahb->reader) {
+        ahb->state = RU_HOST_BUFFER_STATE_FREE;
+
+        if (pthread_cond_broadcast(&ru_host_cond))
+            abort();
+    }
+
+    AHardwareBuffer_release(ahb);
+}
+
+void
+ANativeWindow_acquire(ANativeWindow *window) {
+    // The reader owns the window.
+    (void) window;
+}
+
+void
+ANativeWindow_release(ANativeWindow *window) {
+    (void) window;
+}
+
+int32_t
+ANativeWindow_getWidth(ANativeWindow *window) {
+    return window->reader->width;
+}
+
+int32_t
+ANativeWindow_getHeight(ANativeWindow *window) {
+    return window->reader->height;
+}
+
+int32_t
+ANativeWindow_getFormat(ANativeWindow *window) {
+    return window->reader->format;
+}
+
+void
+AImage_delete(AImage *image) {
+    if (!image)
+        return;
+
+    {
+        ru_mutex_lock_scoped(&ru_host_mutex);
+
+        let ahb = image->ahb;
+
+        if (ahb->reader) {
+            ahb->state = RU_HOST_BUFFER_STATE_FREE;
+            --ahb->reader->acquired_count;
+
+            if (pthread_cond_broadcast(&ru_host_cond))
+                abort();
+        }
+
+        AHardwareBuffer_release(ahb);
+    }
+
+    free(image);
+}
+
+media_status_t
+AImage_getWidth(const AImage *image, int32_t *width) {
+    *width = (int32_t) image->ahb->desc.width;
+    return AMEDIA_OK;
+}
+
+media_status_t
+AImage_getHeight(const AImage *image, int32_t *height) {
+    *height = (int32_t) image->ahb->desc.height;
+    return AMEDIA_OK;
+}
+
+media_status_t
+AImage_getFormat(const AImage *image, int32_t *format) {
+    *format = image->format;
+    return AMEDIA_OK;
+}
+
+media_status_t
+AImage_getCropRect(const AImage *image, AImageCropRect *rect) {
+    *rect = image->crop;
+    return AMEDIA_OK;
+}
+
+media_status_t
+AImage_getTimestamp(const AImage *image, int64_t *timestamp_ns) {
+    *timestamp_ns = image->timestamp_ns;
+    return AMEDIA_OK;
+}
+
+media_status_t
+AImage_getHardwareBuffer(const AImage *image, AHardwareBuffer **buffer) {
+    *buffer = image->ahb;
+    return AMEDIA_OK;
+}
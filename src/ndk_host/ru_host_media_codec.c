@@ -0,0 +1,875 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// stdlib
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Linux
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+// local
+#include <media/NdkMediaCodec.h>
+
+#include "util/alloc.h"
+#include "util/check.h"
+#include "util/log.h"
+#include "util/macros.h"
+#include "util/ru_math.h"
+#include "util/ru_thread.h"
+
+#include "ru_host.h"
+
+// The name accepted by AMediaCodec_createCodecByName().
+#define RU_HOST_CODEC_NAME "ru.host.fake.decoder"
+
+#define RU_HOST_CODEC_INPUT_COUNT 4
+#define RU_HOST_CODEC_OUTPUT_COUNT 4
+
+// MediaCodecInfo.CodecCapabilities.COLOR_FormatYUV420SemiPlanar
+#define RU_HOST_COLOR_FORMAT_NV12 21
+
+// MediaCodec.CodecException action codes. Any other code is fatal.
+#define RU_HOST_ACTION_CODE_TRANSIENT 1
+#define RU_HOST_ACTION_CODE_RECOVERABLE 2
+
+// If set to "FRAMES:ACTION", each async codec session reports a codec error
+// with that action code once it has decoded FRAMES frames. Unless the error is
+// transient, the codec then goes silent, as a failed codec does, although
+// calls on the buffers that it already handed out still succeed. For testing
+// the client's error handling.
+#define RU_HOST_CODEC_ERROR_ENV "RU_HOST_CODEC_ERROR"
+
+// The fake decoder claims each of these. For "video/raw", which only the
+// host's Y4M extractor produces, it converts the I420 samples to NV12. For the
+// others, it ignores the bitstream and draws a test pattern, so that a
+// pipeline can run on real IVF files without a software decoder.
+static const char *const ru_host_codec_mimes[] = {
+    "video/raw",
+    "video/avc",
+    "video/hevc",
+    "video/x-vnd.on2.vp8",
+    "video/x-vnd.on2.vp9",
+    "video/av01",
+};
+
+typedef enum RuHostSlotState {
+    RU_HOST_SLOT_STATE_FREE, // owned by the codec, idle
+    RU_HOST_SLOT_STATE_CLIENT, // owned by the client
+    RU_HOST_SLOT_STATE_PENDING, // input awaiting decode, or output awaiting dequeue
+    RU_HOST_SLOT_STATE_BUSY, // owned by the codec thread, mid-decode
+} RuHostSlotState;
+
+typedef struct RuHostInputSlot {
+    RuHostSlotState state;
+    uint64_t seq;
+
+    uint8_t *data;
+    size_t capacity;
+
+    size_t size;
+    int64_t pts_us;
+    uint32_t flags;
+} RuHostInputSlot;
+
+typedef struct RuHostOutputSlot {
+    RuHostSlotState state;
+    uint64_t seq;
+
+    // Dequeued from the output surface's AImageReader. Null for empty outputs,
+    // such as end of stream, and when there is no surface.
+    AHardwareBuffer *ahb;
+
+    AMediaCodecBufferInfo info;
+} RuHostOutputSlot;
+
+// Everything below `mime` is guarded by ru_host_mutex once the codec starts.
+struct AMediaCodec {
+    char *mime;
+    bool is_raw;
+    int32_t width;
+    int32_t height;
+    AMediaFormat *input_format;
+    AMediaFormat *output_format;
+
+    bool is_async;
+    struct AMediaCodecOnAsyncNotifyCallback callback;
+    void *userdata;
+
+    pthread_t thread;
+    bool is_started;
+    bool is_stopping;
+
+    ANativeWindow *window;
+
+    RuHostInputSlot inputs[RU_HOST_CODEC_INPUT_COUNT];
+    RuHostOutputSlot outputs[RU_HOST_CODEC_OUTPUT_COUNT];
+    uint64_t next_input_seq;
+    uint64_t next_output_seq;
+
+    // The codec announces the output format before its first frame. In sync
+    // mode, the next dequeueOutputBuffer() returns
+    // AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED while is_output_format_pending.
+    bool is_output_format_sent;
+    bool is_output_format_pending;
+
+    uint32_t frame_count;
+
+    // See RU_HOST_CODEC_ERROR_ENV.
+    bool has_error;
+    bool is_error_sent;
+    bool is_failed;
+    uint32_t error_frame;
+    int32_t error_action;
+};
+
+static void
+ru_host_lock(void) {
+    if (pthread_mutex_lock(&ru_host_mutex))
+        abort();
+}
+
+static void
+ru_host_unlock(void) {
+    if (pthread_mutex_unlock(&ru_host_mutex))
+        abort();
+}
+
+static void
+ru_host_broadcast(void) {
+    if (pthread_cond_broadcast(&ru_host_cond))
+        abort();
+}
+
+// Wait on ru_host_cond until the deadline, on CLOCK_REALTIME. A null deadline
+// waits forever. Return false on timeout.
+static bool
+ru_host_wait_until(const struct timespec *deadline) {
+    if (!deadline) {
+        if (pthread_cond_wait(&ru_host_cond, &ru_host_mutex))
+            abort();
+        return true;
+    }
+
+    int err = pthread_cond_timedwait(&ru_host_cond, &ru_host_mutex, deadline);
+    if (err && err != ETIMEDOUT)
+        abort();
+
+    return err != ETIMEDOUT;
+}
+
+// Return null if timeout_us is negative, meaning wait forever.
+static struct timespec *
+ru_host_deadline_from_timeout(int64_t timeout_us, struct timespec *ts) {
+    if (timeout_us < 0)
+        return NULL;
+
+    if (clock_gettime(CLOCK_REALTIME, ts))
+        abort();
+
+    let ns = (int64_t) ts->tv_nsec + timeout_us * 1000;
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+    return ts;
+}
+
+static bool
+ru_host_codec_supports_mime(const char *mime) {
+    for (size_t i = 0; i < ARRAY_LEN(ru_host_codec_mimes); ++i) {
+        if (!strcmp(mime, ru_host_codec_mimes[i]))
+            return true;
+    }
+
+    return false;
+}
+
+AMediaCodec *
+AMediaCodec_createCodecByName(const char *name) {
+    if (strcmp(name, RU_HOST_CODEC_NAME) != 0) {
+        loge(LOG_PREFIX "codec: no codec named %s", name);
+        return NULL;
+    }
+
+    return new0(AMediaCodec);
+}
+
+AMediaCodec *
+AMediaCodec_createDecoderByType(const char *mime) {
+    if (!ru_host_codec_supports_mime(mime)) {
+        loge(LOG_PREFIX "codec: no decoder for %s", mime);
+        return NULL;
+    }
+
+    let c = new0(AMediaCodec);
+    c->mime = xstrdup(mime);
+    return c;
+}
+
+media_status_t
+AMediaCodec_configure(AMediaCodec *c, const AMediaFormat *_format,
+                      ANativeWindow *surface, AMediaCrypto *crypto,
+                      uint32_t flags) {
+    // The NDK takes a const format, yet its getters take non-const.
+    AMediaFormat *format = (AMediaFormat *) _format;
+    const char *mime;
+    int32_t width, height;
+
+    if (c->is_started || c->input_format)
+        return AMEDIA_ERROR_INVALID_OPERATION;
+
+    if (crypto || (flags & AMEDIACODEC_CONFIGURE_FLAG_ENCODE))
+        return AMEDIA_ERROR_UNSUPPORTED;
+
+    if (!AMediaFormat_getString(format, AMEDIAFORMAT_KEY_MIME, &mime) ||
+        !AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_WIDTH, &width) ||
+        !AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_HEIGHT, &height) ||
+        width <= 0 || height <= 0) {
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+    }
+
+    if (!ru_host_codec_supports_mime(mime) || (c->mime && strcmp(c->mime, mime)))
+        return AMEDIA_ERROR_UNSUPPORTED;
+
+    if (!c->mime)
+        c->mime = xstrdup(mime);
+
+    c->is_raw = !strcmp(mime, "video/raw");
+    c->width = width;
+    c->height = height;
+    c->window = surface;
+
+    c->input_format = AMediaFormat_new();
+    AMediaFormat_copy(c->input_format, format);
+
+    let f = c->output_format = AMediaFormat_new();
+    AMediaFormat_setString(f, AMEDIAFORMAT_KEY_MIME, "video/raw");
+    AMediaFormat_setInt32(f, AMEDIAFORMAT_KEY_WIDTH, width);
+    AMediaFormat_setInt32(f, AMEDIAFORMAT_KEY_HEIGHT, height);
+    AMediaFormat_setInt32(f, AMEDIAFORMAT_KEY_STRIDE, width);
+    AMediaFormat_setInt32(f, AMEDIAFORMAT_KEY_SLICE_HEIGHT, height);
+    AMediaFormat_setInt32(f, AMEDIAFORMAT_KEY_COLOR_FORMAT, RU_HOST_COLOR_FORMAT_NV12);
+    AMediaFormat_setRect(f, AMEDIAFORMAT_KEY_DISPLAY_CROP, 0, 0, width - 1, height - 1);
+
+    int32_t max_input_size;
+    if (!AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE, &max_input_size) ||
+        max_input_size <= 0) {
+        // Room for an uncompressed I420 frame.
+        max_input_size = width * height + 2 * ((width + 1) / 2) * ((height + 1) / 2);
+    }
+
+    for (int i = 0; i < RU_HOST_CODEC_INPUT_COUNT; ++i) {
+        c->inputs[i].capacity = (size_t) max_input_size;
+        c->inputs[i].data = xmalloc(c->inputs[i].capacity);
+    }
+
+    return AMEDIA_OK;
+}
+
+media_status_t
+AMediaCodec_setAsyncNotifyCallback(AMediaCodec *c,
+                                   struct AMediaCodecOnAsyncNotifyCallback callback,
+                                   void *userdata) {
+    if (c->is_started)
+        return AMEDIA_ERROR_INVALID_OPERATION;
+
+    c->is_async = true;
+    c->callback = callback;
+    c->userdata = userdata;
+    return AMEDIA_OK;
+}
+
+// Convert the input to NV12 in the output buffer. The codec thread calls this
+// without ru_host_mutex; it owns both slots while they are BUSY.
+static void
+ru_host_codec_render(const AMediaCodec *c, const RuHostInputSlot *in,
+                     uint32_t frame, AHardwareBuffer *ahb) {
+    let stride = (size_t) ahb->desc.stride;
+    let w = (size_t) ru_min((uint32_t) c->width, ahb->desc.width);
+    let h = (size_t) ru_min((uint32_t) c->height, ahb->desc.height);
+    let cw = (w + 1) / 2;
+    let ch = (h + 1) / 2;
+    uint8_t *y = ahb->map;
+    uint8_t *cbcr = ahb->map + ru_host_ahb_cbcr_offset(ahb);
+
+    let src_w = (size_t) c->width;
+    let src_cw = (src_w + 1) / 2;
+    let src_ch = ((size_t) c->height + 1) / 2;
+    let src_size = src_w * (size_t) c->height + 2 * src_cw * src_ch;
+
+    if (c->is_raw && in->size >= src_size) {
+        const uint8_t *src_y = in->data;
+        const uint8_t *src_u = src_y + src_w * (size_t) c->height;
+        const uint8_t *src_v = src_u + src_cw * src_ch;
+
+        for (size_t row = 0; row < h; ++row)
+            memcpy(y + row * stride, src_y + row * src_w, w);
+
+        for (size_t row = 0; row < ch; ++row) {
+            uint8_t *dst = cbcr + row * stride;
+
+            for (size_t col = 0; col < cw; ++col) {
+                dst[2 * col + 0] = src_u[row * src_cw + col];
+                dst[2 * col + 1] = src_v[row * src_cw + col];
+            }
+        }
+    } else {
+        // Grey bands that scroll one row per frame, so that a stall or a
+        // dropped frame is visible.
+        for (size_t row = 0; row < h; ++row)
+            memset(y + row * stride, (int) (((row + frame) / 8 % 2) ? 96 : 160), w);
+
+        for (size_t row = 0; row < ch; ++row)
+            memset(cbcr + row * stride, 128, 2 * cw);
+    }
+}
+
+// Offer each free input slot to the client. Return true if the lock was
+// dropped.
+//
+// Requires ru_host_mutex.
+static bool
+ru_host_codec_offer_input_locked(AMediaCodec *c) {
+    for (int32_t i = 0; i < RU_HOST_CODEC_INPUT_COUNT; ++i) {
+        if (c->inputs[i].state != RU_HOST_SLOT_STATE_FREE)
+            continue;
+
+        c->inputs[i].state = RU_HOST_SLOT_STATE_CLIENT;
+
+        let cb = c->callback;
+        ru_host_unlock();
+        cb.onAsyncInputAvailable(c, c->userdata, i);
+        ru_host_lock();
+        return true;
+    }
+
+    return false;
+}
+
+// Copy the image of src into dst, which may differ in size and stride.
+static void
+ru_host_copy_ahb(AHardwareBuffer *dst, const AHardwareBuffer *src) {
+    let w = (size_t) ru_min(dst->desc.width, src->desc.width);
+    let h = (size_t) ru_min(dst->desc.height, src->desc.height);
+    let dst_stride = (size_t) dst->desc.stride;
+    let src_stride = (size_t) src->desc.stride;
+    uint8_t *dst_cbcr = dst->map + ru_host_ahb_cbcr_offset(dst);
+    const uint8_t *src_cbcr = src->map + ru_host_ahb_cbcr_offset(src);
+
+    for (size_t row = 0; row < h; ++row)
+        memcpy(dst->map + row * dst_stride, src->map + row * src_stride, w);
+
+    // Each CbCr row interleaves (w + 1) / 2 pairs.
+    for (size_t row = 0; row < (h + 1) / 2; ++row)
+        memcpy(dst_cbcr + row * dst_stride, src_cbcr + row * src_stride, 2 * ((w + 1) / 2));
+}
+
+// Move a frame from a buffer of the old output surface to one of the current
+// surface, as a real codec attaches its dequeued buffers to a new surface.
+// Return the new buffer, or null if the surface has no free buffer and the
+// frame is dropped. Either way, the old buffer returns to its reader.
+//
+// Requires ru_host_mutex.
+static AHardwareBuffer *
+ru_host_codec_migrate_ahb_locked(AMediaCodec *c, AHardwareBuffer *old_ahb) {
+    let ahb = ru_host_reader_dequeue_locked(c->window->reader);
+    if (ahb) {
+        ru_host_copy_ahb(ahb, old_ahb);
+    } else {
+        logw(LOG_PREFIX "codec: new output surface is full; drop a frame");
+    }
+
+    ru_host_reader_cancel_locked(old_ahb);
+    return ahb;
+}
+
+// Move the frames that the client has not yet released to the current
+// surface, so that releasing them renders there.
+//
+// Requires ru_host_mutex.
+static void
+ru_host_codec_migrate_outputs_locked(AMediaCodec *c) {
+    for (int32_t i = 0; i < RU_HOST_CODEC_OUTPUT_COUNT; ++i) {
+        let slot = &c->outputs[i];
+
+        if (!slot->ahb || slot->ahb->reader == c->window->reader)
+            continue;
+
+        slot->ahb = ru_host_codec_migrate_ahb_locked(c, slot->ahb);
+        slot->info.size = slot->ahb ? (int32_t) slot->ahb->size : 0;
+    }
+}
+
+// Read RU_HOST_CODEC_ERROR_ENV into the codec.
+static void
+ru_host_codec_read_error_env(AMediaCodec *c) {
+    const char *s = getenv(RU_HOST_CODEC_ERROR_ENV);
+
+    c->has_error = false;
+    c->is_error_sent = false;
+    c->is_failed = false;
+
+    if (!s || !s[0] || !c->is_async)
+        return;
+
+    if (sscanf(s, "%u:%d", &c->error_frame, &c->error_action) != 2)
+        die(LOG_PREFIX "codec: bad value for %s: %s", RU_HOST_CODEC_ERROR_ENV, s);
+
+    c->has_error = true;
+}
+
+// Report the injected codec error, if it is due. Return true if the lock was
+// dropped.
+//
+// Requires ru_host_mutex.
+static bool
+ru_host_codec_fail_locked(AMediaCodec *c) {
+    if (!c->has_error || c->is_error_sent || c->frame_count < c->error_frame)
+        return false;
+
+    c->is_error_sent = true;
+    c->is_failed = !AMediaCodecActionCode_isTransient(c->error_action);
+
+    let cb = c->callback;
+    let action = c->error_action;
+    ru_host_unlock();
+    cb.onAsyncError(c, c->userdata, AMEDIA_ERROR_UNKNOWN, action,
+                    "injected by " RU_HOST_CODEC_ERROR_ENV);
+    ru_host_lock();
+    return true;
+}
+
+// Decode the oldest pending input, if an output slot and a buffer are free.
+// Return true on progress.
+//
+// Requires ru_host_mutex.
+static bool
+ru_host_codec_decode_locked(AMediaCodec *c) {
+    RuHostInputSlot *in = NULL;
+    RuHostOutputSlot *out = NULL;
+    int32_t out_index = -1;
+
+    for (int i = 0; i < RU_HOST_CODEC_INPUT_COUNT; ++i) {
+        let slot = &c->inputs[i];
+
+        if (slot->state == RU_HOST_SLOT_STATE_PENDING &&
+            (!in || slot->seq < in->seq)) {
+            in = slot;
+        }
+    }
+
+    for (int32_t i = 0; i < RU_HOST_CODEC_OUTPUT_COUNT; ++i) {
+        if (c->outputs[i].state == RU_HOST_SLOT_STATE_FREE) {
+            out = &c->outputs[i];
+            out_index = i;
+            break;
+        }
+    }
+
+    if (!in || !out)
+        return false;
+
+    let has_frame = in->size > 0 && !(in->flags & AMEDIACODEC_BUFFER_FLAG_CODEC_CONFIG);
+    AHardwareBuffer *ahb = NULL;
+
+    // Like a real decoder, stall until the consumer returns a buffer.
+    if (has_frame && c->window) {
+        ahb = ru_host_reader_dequeue_locked(c->window->reader);
+        if (!ahb)
+            return false;
+    }
+
+    in->state = RU_HOST_SLOT_STATE_BUSY;
+    out->state = RU_HOST_SLOT_STATE_BUSY;
+
+    if (has_frame && !c->is_output_format_sent) {
+        c->is_output_format_sent = true;
+
+        if (c->is_async) {
+            let cb = c->callback;
+            ru_host_unlock();
+            cb.onAsyncFormatChanged(c, c->userdata, c->output_format);
+            ru_host_lock();
+        } else {
+            c->is_output_format_pending = true;
+        }
+    }
+
+    let frame = c->frame_count;
+
+    if (ahb) {
+        ru_host_unlock();
+        ru_host_codec_render(c, in, frame, ahb);
+        ru_host_lock();
+
+        // The client may have changed the surface meanwhile.
+        if (ahb->reader != c->window->reader)
+            ahb = ru_host_codec_migrate_ahb_locked(c, ahb);
+    }
+
+    if (has_frame)
+        ++c->frame_count;
+
+    out->seq = c->next_output_seq++;
+    out->ahb = ahb;
+    out->info = (AMediaCodecBufferInfo) {
+        .offset = 0,
+        .size = ahb ? (int32_t) ahb->size : 0,
+        .presentationTimeUs = in->pts_us,
+        .flags = in->flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM,
+    };
+
+    in->state = RU_HOST_SLOT_STATE_FREE;
+    in->size = 0;
+
+    if (c->is_async) {
+        out->state = RU_HOST_SLOT_STATE_CLIENT;
+
+        let cb = c->callback;
+        let info = out->info;
+        ru_host_unlock();
+        cb.onAsyncOutputAvailable(c, c->userdata, out_index, &info);
+        ru_host_lock();
+    } else {
+        out->state = RU_HOST_SLOT_STATE_PENDING;
+    }
+
+    ru_host_broadcast();
+    return true;
+}
+
+static void *
+ru_host_codec_thread(void *_codec) {
+    AMediaCodec *c = _codec;
+
+    ru_host_lock();
+
+    while (!c->is_stopping) {
+        if (ru_host_codec_fail_locked(c))
+            continue;
+
+        // A failed codec neither offers nor decodes.
+        if (c->is_failed) {
+            ru_host_wait_until(NULL);
+            continue;
+        }
+
+        if (c->is_async && ru_host_codec_offer_input_locked(c))
+            continue;
+
+        if (ru_host_codec_decode_locked(c))
+            continue;
+
+        ru_host_wait_until(NULL);
+    }
+
+    ru_host_unlock();
+    return NULL;
+}
+
+media_status_t
+AMediaCodec_start(AMediaCodec *c) {
+    if (!c->input_format || c->is_started)
+        return AMEDIA_ERROR_INVALID_OPERATION;
+
+    c->is_started = true;
+    ru_host_codec_read_error_env(c);
+
+    if (pthread_create(&c->thread, NULL, ru_host_codec_thread, c))
+        die(LOG_PREFIX "codec: failed to create thread");
+
+    pthread_setname_np(c->thread, "ru-host-codec");
+
+    return AMEDIA_OK;
+}
+
+media_status_t
+AMediaCodec_stop(AMediaCodec *c) {
+    {
+        ru_mutex_lock_scoped(&ru_host_mutex);
+
+        if (!c->is_started)
+            return AMEDIA_OK;
+
+        c->is_stopping = true;
+        ru_host_broadcast();
+    }
+
+    // Once joined, no callback is in flight.
+    if (pthread_join(c->thread, NULL))
+        abort();
+
+    ru_mutex_lock_scoped(&ru_host_mutex);
+
+    for (int i = 0; i < RU_HOST_CODEC_OUTPUT_COUNT; ++i) {
+        let slot = &c->outputs[i];
+
+        if (slot->state != RU_HOST_SLOT_STATE_FREE && slot->ahb)
+            ru_host_reader_cancel_locked(slot->ahb);
+
+        *slot = (RuHostOutputSlot) {0};
+    }
+
+    // As on Android, the stopped codec is unconfigured, and may be configured
+    // again.
+    for (int i = 0; i < RU_HOST_CODEC_INPUT_COUNT; ++i) {
+        free(c->inputs[i].data);
+        c->inputs[i] = (RuHostInputSlot) {0};
+    }
+
+    AMediaFormat_delete(c->input_format);
+    AMediaFormat_delete(c->output_format);
+    c->input_format = NULL;
+    c->output_format = NULL;
+
+    c->is_started = false;
+    c->is_stopping = false;
+    c->is_output_format_sent = false;
+    c->is_output_format_pending = false;
+    c->frame_count = 0;
+
+    ru_host_broadcast();
+
+    return AMEDIA_OK;
+}
+
+media_status_t
+AMediaCodec_delete(AMediaCodec *c) {
+    if (!c)
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+
+    AMediaCodec_stop(c);
+
+    for (int i = 0; i < RU_HOST_CODEC_INPUT_COUNT; ++i)
+        free(c->inputs[i].data);
+
+    if (c->input_format)
+        AMediaFormat_delete(c->input_format);
+    if (c->output_format)
+        AMediaFormat_delete(c->output_format);
+
+    free(c->mime);
+    free(c);
+    return AMEDIA_OK;
+}
+
+uint8_t *
+AMediaCodec_getInputBuffer(AMediaCodec *c, size_t idx, size_t *out_size) {
+    ru_mutex_lock_scoped(&ru_host_mutex);
+
+    if (idx >= RU_HOST_CODEC_INPUT_COUNT ||
+        c->inputs[idx].state != RU_HOST_SLOT_STATE_CLIENT) {
+        *out_size = 0;
+        return NULL;
+    }
+
+    *out_size = c->inputs[idx].capacity;
+    return c->inputs[idx].data;
+}
+
+ssize_t
+AMediaCodec_dequeueInputBuffer(AMediaCodec *c, int64_t timeout_us) {
+    struct timespec ts;
+    let deadline = ru_host_deadline_from_timeout(timeout_us, &ts);
+
+    ru_mutex_lock_scoped(&ru_host_mutex);
+
+    if (c->is_async || !c->is_started)
+        return AMEDIA_ERROR_INVALID_OPERATION;
+
+    for (;;) {
+        for (ssize_t i = 0; i < RU_HOST_CODEC_INPUT_COUNT; ++i) {
+            if (c->inputs[i].state == RU_HOST_SLOT_STATE_FREE) {
+                c->inputs[i].state = RU_HOST_SLOT_STATE_CLIENT;
+                return i;
+            }
+        }
+
+        if (timeout_us == 0 || !ru_host_wait_until(deadline))
+            return AMEDIACODEC_INFO_TRY_AGAIN_LATER;
+    }
+}
+
+media_status_t
+AMediaCodec_queueInputBuffer(AMediaCodec *c, size_t idx, off_t offset,
+                             size_t size, uint64_t time, uint32_t flags) {
+    ru_mutex_lock_scoped(&ru_host_mutex);
+
+    if (idx >= RU_HOST_CODEC_INPUT_COUNT)
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+
+    let slot = &c->inputs[idx];
+
+    if (slot->state != RU_HOST_SLOT_STATE_CLIENT)
+        return AMEDIA_ERROR_INVALID_OPERATION;
+
+    if (offset < 0 || (size_t) offset > slot->capacity || size > slot->capacity - (size_t) offset)
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+
+    if (offset > 0)
+        memmove(slot->data, slot->data + offset, size);
+
+    slot->state = RU_HOST_SLOT_STATE_PENDING;
+    slot->seq = c->next_input_seq++;
+    slot->size = size;
+    slot->pts_us = (int64_t) time;
+    slot->flags = flags;
+
+    ru_host_broadcast();
+    return AMEDIA_OK;
+}
+
+ssize_t
+AMediaCodec_dequeueOutputBuffer(AMediaCodec *c, AMediaCodecBufferInfo *info,
+                                int64_t timeout_us) {
+    struct timespec ts;
+    let deadline = ru_host_deadline_from_timeout(timeout_us, &ts);
+
+    ru_mutex_lock_scoped(&ru_host_mutex);
+
+    if (c->is_async || !c->is_started)
+        return AMEDIA_ERROR_INVALID_OPERATION;
+
+    for (;;) {
+        if (c->is_output_format_pending) {
+            c->is_output_format_pending = false;
+            return AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED;
+        }
+
+        RuHostOutputSlot *found = NULL;
+        ssize_t found_index = -1;
+
+        for (ssize_t i = 0; i < RU_HOST_CODEC_OUTPUT_COUNT; ++i) {
+            let slot = &c->outputs[i];
+
+            if (slot->state == RU_HOST_SLOT_STATE_PENDING &&
+                (!found || slot->seq < found->seq)) {
+                found = slot;
+                found_index = i;
+            }
+        }
+
+        if (found) {
+            found->state = RU_HOST_SLOT_STATE_CLIENT;
+            *info = found->info;
+            return found_index;
+        }
+
+        if (timeout_us == 0 || !ru_host_wait_until(deadline))
+            return AMEDIACODEC_INFO_TRY_AGAIN_LATER;
+    }
+}
+
+media_status_t
+AMediaCodec_releaseOutputBuffer(AMediaCodec *c, size_t idx, bool render) {
+    AImageReader *reader = NULL;
+    AImageReader_ImageListener listener = {0};
+
+    {
+        ru_mutex_lock_scoped(&ru_host_mutex);
+
+        if (idx >= RU_HOST_CODEC_OUTPUT_COUNT)
+            return AMEDIA_ERROR_INVALID_PARAMETER;
+
+        let slot = &c->outputs[idx];
+
+        if (slot->state != RU_HOST_SLOT_STATE_CLIENT)
+            return AMEDIA_ERROR_INVALID_OPERATION;
+
+        if (slot->ahb) {
+            if (render) {
+                let crop = (AImageCropRect) {
+                    .left = 0,
+                    .top = 0,
+                    .right = ru_min(c->width, (int32_t) slot->ahb->desc.width),
+                    .bottom = ru_min(c->height, (int32_t) slot->ahb->desc.height),
+                };
+
+                reader = ru_host_reader_queue_locked(slot->ahb,
+                        slot->info.presentationTimeUs * 1000, &crop, &listener);
+            } else {
+                ru_host_reader_cancel_locked(slot->ahb);
+            }
+        }
+
+        *slot = (RuHostOutputSlot) {0};
+        ru_host_broadcast();
+    }
+
+    if (reader && listener.onImageAvailable)
+        listener.onImageAvailable(listener.context, reader);
+
+    return AMEDIA_OK;
+}
+
+media_status_t
+AMediaCodec_setOutputSurface(AMediaCodec *c, ANativeWindow *surface) {
+    if (!surface)
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+
+    ru_mutex_lock_scoped(&ru_host_mutex);
+
+    c->window = surface;
+    ru_host_codec_migrate_outputs_locked(c);
+    ru_host_broadcast();
+
+    return AMEDIA_OK;
+}
+
+AMediaFormat *
+AMediaCodec_getInputFormat(AMediaCodec *c) {
+    if (!c->input_format)
+        return NULL;
+
+    let f = AMediaFormat_new();
+    AMediaFormat_copy(f, c->input_format);
+    return f;
+}
+
+AMediaFormat *
+AMediaCodec_getOutputFormat(AMediaCodec *c) {
+    if (!c->output_format)
+        return NULL;
+
+    let f = AMediaFormat_new();
+    AMediaFormat_copy(f, c->output_format);
+    return f;
+}
+
+bool
+AMediaCodecActionCode_isRecoverable(int32_t action_code) {
+    return action_code == RU_HOST_ACTION_CODE_RECOVERABLE;
+}
+
+bool
+AMediaCodecActionCode_isTransient(int32_t action_code) {
+    return action_code == RU_HOST_ACTION_CODE_TRANSIENT;
+}
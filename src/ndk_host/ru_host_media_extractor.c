@@ -0,0 +1,462 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// stdlib
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Linux
+#include <sys/mman.h>
+#include <unistd.h>
+
+// local
+#include <media/NdkMediaExtractor.h>
+
+#include "util/alloc.h"
+#include "util/log.h"
+#include "util/macros.h"
+#include "util/ru_math.h"
+
+#include "ru_host.h"
+
+typedef struct RuHostSample {
+    size_t offset; // from the start of the data source
+    size_t size;
+    int64_t pts_us;
+    bool is_sync;
+} RuHostSample;
+
+struct AMediaExtractor {
+    // The mapping starts at a page boundary at or before the data source.
+    void *map;
+    size_t map_size;
+    const uint8_t *data;
+    size_t size;
+
+    AMediaFormat *format;
+    RuHostSample *samples;
+    size_t sample_count;
+    size_t sample_capacity;
+
+    bool is_track_selected;
+    size_t cursor;
+};
+
+AMediaExtractor *
+AMediaExtractor_new(void) {
+    return new0(AMediaExtractor);
+}
+
+static void
+ru_host_extractor_reset(AMediaExtractor *ex) {
+    if (ex->map)
+        munmap(ex->map, ex->map_size);
+
+    if (ex->format)
+        AMediaFormat_delete(ex->format);
+
+    free(ex->samples);
+
+    *ex = (AMediaExtractor) {0};
+}
+
+media_status_t
+AMediaExtractor_delete(AMediaExtractor *ex) {
+    if (!ex)
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+
+    ru_host_extractor_reset(ex);
+    free(ex);
+    return AMEDIA_OK;
+}
+
+static void
+ru_host_extractor_push_sample(AMediaExtractor *ex, size_t offset, size_t size,
+                              int64_t pts_us, bool is_sync) {
+    if (ex->sample_count == ex->sample_capacity) {
+        ex->sample_capacity = ex->sample_capacity ? 2 * ex->sample_capacity : 256;
+        ex->samples = xreallocn(ex->samples, ex->sample_capacity, sizeof(ex->samples[0]));
+    }
+
+    ex->samples[ex->sample_count++] = (RuHostSample) {
+        .offset = offset,
+        .size = size,
+        .pts_us = pts_us,
+        .is_sync = is_sync,
+    };
+}
+
+static uint16_t
+ru_host_read_le16(const uint8_t *p) {
+    return (uint16_t) (p[0] | p[1] << 8);
+}
+
+static uint32_t
+ru_host_read_le32(const uint8_t *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 |
+           (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t
+ru_host_read_le64(const uint8_t *p) {
+    return (uint64_t) ru_host_read_le32(p) |
+           (uint64_t) ru_host_read_le32(p + 4) << 32;
+}
+
+// Parse a YUV4MPEG2 stream. Each frame becomes one sample of mime
+// "video/raw", whose payload is a tightly packed I420 image.
+//
+// Refer to: https://wiki.multimedia.cx/index.php/YUV4MPEG2
+static media_status_t
+ru_host_extractor_parse_y4m(AMediaExtractor *ex) {
+    const char *p = (const char *) ex->data;
+    const char *end = p + ex->size;
+    const char *eol = memchr(p, '\n', ex->size);
+
+    if (!eol)
+        return AMEDIA_ERROR_MALFORMED;
+
+    int32_t width = 0;
+    int32_t height = 0;
+    int64_t rate_num = 30;
+    int64_t rate_den = 1;
+
+    // Skip the "YUV4MPEG2" signature, then parse the space-separated tags.
+    p += strlen("YUV4MPEG2");
+
+    while (p < eol) {
+        if (*p == ' ') {
+            ++p;
+            continue;
+        }
+
+        const char *tag_end = memchr(p, ' ', (size_t) (eol - p));
+        if (!tag_end)
+            tag_end = eol;
+
+        // The tags are not NUL-terminated, so copy each out.
+        _cleanup_free_ char *tag = xstrndup(p, (size_t) (tag_end - p));
+
+        switch (tag[0]) {
+            case 'W':
+                width = (int32_t) strtol(tag + 1, NULL, 10);
+                break;
+            case 'H':
+                height = (int32_t) strtol(tag + 1, NULL, 10);
+                break;
+            case 'F':
+                if (sscanf(tag + 1, "%"SCNd64":%"SCNd64, &rate_num, &rate_den) != 2 ||
+                    rate_num <= 0 || rate_den <= 0) {
+                    return AMEDIA_ERROR_MALFORMED;
+                }
+                break;
+            case 'C':
+                if (strncmp(tag + 1, "420", 3) != 0) {
+                    loge(LOG_PREFIX "y4m colorspace %s is unsupported", tag + 1);
+                    return AMEDIA_ERROR_UNSUPPORTED;
+                }
+                break;
+            default:
+                break;
+        }
+
+        p = tag_end;
+    }
+
+    if (width <= 0 || height <= 0)
+        return AMEDIA_ERROR_MALFORMED;
+
+    size_t cw = ((size_t) width + 1) / 2;
+    size_t ch = ((size_t) height + 1) / 2;
+    size_t frame_size = (size_t) width * height + 2 * cw * ch;
+
+    p = eol + 1;
+
+    while (p < end) {
+        if ((size_t) (end - p) < strlen("FRAME") || strncmp(p, "FRAME", 5) != 0)
+            return AMEDIA_ERROR_MALFORMED;
+
+        eol = memchr(p, '\n', (size_t) (end - p));
+        if (!eol)
+            return AMEDIA_ERROR_MALFORMED;
+
+        p = eol + 1;
+
+        // Drop a truncated final frame, like a real extractor would.
+        if ((size_t) (end - p) < frame_size)
+            break;
+
+        let pts_us = (int64_t) ex->sample_count * 1000000 * rate_den / rate_num;
+        ru_host_extractor_push_sample(ex, (size_t) (p - (const char *) ex->data),
+                                      frame_size, pts_us, /*is_sync*/ true);
+        p += frame_size;
+    }
+
+    let f = ex->format = AMediaFormat_new();
+    AMediaFormat_setString(f, AMEDIAFORMAT_KEY_MIME, "video/raw");
+    AMediaFormat_setInt32(f, AMEDIAFORMAT_KEY_WIDTH, width);
+    AMediaFormat_setInt32(f, AMEDIAFORMAT_KEY_HEIGHT, height);
+    AMediaFormat_setInt32(f, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE, (int32_t) frame_size);
+    AMediaFormat_setInt32(f, AMEDIAFORMAT_KEY_FRAME_RATE,
+                          (int32_t) ((rate_num + rate_den / 2) / rate_den));
+    AMediaFormat_setInt64(f, AMEDIAFORMAT_KEY_DURATION,
+                          (int64_t) ex->sample_count * 1000000 * rate_den / rate_num);
+
+    return AMEDIA_OK;
+}
+
+// Parse an IVF stream of VP8, VP9, or AV1 frames.
+//
+// Refer to: https://wiki.multimedia.cx/index.php/Duck_IVF
+static media_status_t
+ru_host_extractor_parse_ivf(AMediaExtractor *ex) {
+    const uint8_t *d = ex->data;
+
+    if (ex->size < 32)
+        return AMEDIA_ERROR_MALFORMED;
+
+    const char *mime;
+
+    if (memcmp(d + 8, "VP80", 4) == 0) {
+        mime = "video/x-vnd.on2.vp8";
+    } else if (memcmp(d + 8, "VP90", 4) == 0) {
+        mime = "video/x-vnd.on2.vp9";
+    } else if (memcmp(d + 8, "AV01", 4) == 0) {
+        mime = "video/av01";
+    } else {
+        loge(LOG_PREFIX "ivf fourcc %.4s is unsupported", (const char *) d + 8);
+        return AMEDIA_ERROR_UNSUPPORTED;
+    }
+
+    size_t header_size = ru_host_read_le16(d + 6);
+    int32_t width = ru_host_read_le16(d + 12);
+    int32_t height = ru_host_read_le16(d + 14);
+    int64_t rate_num = ru_host_read_le32(d + 16); // the timebase's denominator
+    int64_t rate_den = ru_host_read_le32(d + 20);
+
+    if (header_size < 32 || width == 0 || height == 0 || rate_num == 0 || rate_den == 0)
+        return AMEDIA_ERROR_MALFORMED;
+
+    size_t max_size = 0;
+    size_t p = header_size;
+
+    while (ex->size - p >= 12) {
+        size_t size = ru_host_read_le32(d + p);
+        int64_t pts = (int64_t) ru_host_read_le64(d + p + 4);
+
+        p += 12;
+        if (ex->size - p < size)
+            break;
+
+        // The fake decoder decodes any sample, so only the VP8 keyframe bit
+        // matters, and only to seekTo(). Treat other codecs' frames as sync.
+        bool is_sync = true;
+        if (mime[strlen(mime) - 1] == '8' && size > 0)
+            is_sync = (d[p] & 1) == 0;
+
+        ru_host_extractor_push_sample(ex, p, size, pts * 1000000 * rate_den / rate_num,
+                                      is_sync);
+        max_size = ru_max(max_size, size);
+        p += size;
+    }
+
+    let f = ex->format = AMediaFormat_new();
+    AMediaFormat_setString(f, AMEDIAFORMAT_KEY_MIME, mime);
+    AMediaFormat_setInt32(f, AMEDIAFORMAT_KEY_WIDTH, width);
+    AMediaFormat_setInt32(f, AMEDIAFORMAT_KEY_HEIGHT, height);
+    AMediaFormat_setInt32(f, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE, (int32_t) max_size);
+
+    if (ex->sample_count > 0) {
+        AMediaFormat_setInt64(f, AMEDIAFORMAT_KEY_DURATION,
+                              ex->samples[ex->sample_count - 1].pts_us);
+    }
+
+    return AMEDIA_OK;
+}
+
+media_status_t
+AMediaExtractor_setDataSourceFd(AMediaExtractor *ex, int fd, off64_t offset,
+                                off64_t length) {
+    media_status_t status;
+
+    ru_host_extractor_reset(ex);
+
+    if (offset < 0 || length <= 0)
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+
+    let page_size = (off64_t) sysconf(_SC_PAGESIZE);
+    let map_offset = offset - offset % page_size;
+
+    ex->map_size = (size_t) (length + (offset - map_offset));
+    ex->map = mmap(NULL, ex->map_size, PROT_READ, MAP_PRIVATE, fd, map_offset);
+    if (ex->map == MAP_FAILED) {
+        ex->map = NULL;
+        return AMEDIA_ERROR_IO;
+    }
+
+    ex->data = (const uint8_t *) ex->map + (offset - map_offset);
+    ex->size = (size_t) length;
+
+    if (ex->size >= 9 && memcmp(ex->data, "YUV4MPEG2", 9) == 0) {
+        status = ru_host_extractor_parse_y4m(ex);
+    } else if (ex->size >= 4 && memcmp(ex->data, "DKIF", 4) == 0) {
+        status = ru_host_extractor_parse_ivf(ex);
+    } else {
+        loge(LOG_PREFIX "extractor: container is not y4m or ivf");
+        status = AMEDIA_ERROR_UNSUPPORTED;
+    }
+
+    if (status != AMEDIA_OK) {
+        ru_host_extractor_reset(ex);
+        return status;
+    }
+
+    logd(LOG_PREFIX "extractor: %zu samples, format=%s", ex->sample_count,
+         AMediaFormat_toString(ex->format));
+
+    return AMEDIA_OK;
+}
+
+size_t
+AMediaExtractor_getTrackCount(AMediaExtractor *ex) {
+    return ex->format ? 1 : 0;
+}
+
+AMediaFormat *
+AMediaExtractor_getTrackFormat(AMediaExtractor *ex, size_t idx) {
+    if (!ex->format || idx != 0)
+        return NULL;
+
+    let f = AMediaFormat_new();
+    AMediaFormat_copy(f, ex->format);
+    return f;
+}
+
+media_status_t
+AMediaExtractor_selectTrack(AMediaExtractor *ex, size_t idx) {
+    if (!ex->format || idx != 0)
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+
+    ex->is_track_selected = true;
+    return AMEDIA_OK;
+}
+
+static const RuHostSample *
+ru_host_extractor_cur_sample(AMediaExtractor *ex) {
+    if (!ex->is_track_selected || ex->cursor >= ex->sample_count)
+        return NULL;
+
+    return &ex->samples[ex->cursor];
+}
+
+ssize_t
+AMediaExtractor_readSampleData(AMediaExtractor *ex, uint8_t *buffer,
+                               size_t capacity) {
+    let s = ru_host_extractor_cur_sample(ex);
+    if (!s || s->size > capacity)
+        return -1;
+
+    memcpy(buffer, ex->data + s->offset, s->size);
+    return (ssize_t) s->size;
+}
+
+uint32_t
+AMediaExtractor_getSampleFlags(AMediaExtractor *ex) {
+    let s = ru_host_extractor_cur_sample(ex);
+    return s && s->is_sync ? AMEDIAEXTRACTOR_SAMPLE_FLAG_SYNC : 0;
+}
+
+int
+AMediaExtractor_getSampleTrackIndex(AMediaExtractor *ex) {
+    return ru_host_extractor_cur_sample(ex) ? 0 : -1;
+}
+
+int64_t
+AMediaExtractor_getSampleTime(AMediaExtractor *ex) {
+    let s = ru_host_extractor_cur_sample(ex);
+    return s ? s->pts_us : -1;
+}
+
+bool
+AMediaExtractor_advance(AMediaExtractor *ex) {
+    if (!ru_host_extractor_cur_sample(ex))
+        return false;
+
+    ++ex->cursor;
+    return ex->cursor < ex->sample_count;
+}
+
+media_status_t
+AMediaExtractor_seekTo(AMediaExtractor *ex, int64_t seek_pos_us, SeekMode mode) {
+    if (!ex->is_track_selected)
+        return AMEDIA_ERROR_INVALID_OPERATION;
+
+    // Find the sync samples on either side of the position.
+    ssize_t prev = -1;
+    ssize_t next = -1;
+
+    for (size_t i = 0; i < ex->sample_count; ++i) {
+        let s = &ex->samples[i];
+        if (!s->is_sync)
+            continue;
+
+        if (s->pts_us <= seek_pos_us)
+            prev = (ssize_t) i;
+
+        if (s->pts_us >= seek_pos_us) {
+            next = (ssize_t) i;
+            break;
+        }
+    }
+
+    ssize_t target;
+
+    switch (mode) {
+        case AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC:
+            target = prev >= 0 ? prev : next;
+            break;
+        case AMEDIAEXTRACTOR_SEEK_NEXT_SYNC:
+            target = next >= 0 ? next : prev;
+            break;
+        case AMEDIAEXTRACTOR_SEEK_CLOSEST_SYNC:
+        default:
+            if (prev < 0 || next < 0) {
+                target = prev >= 0 ? prev : next;
+            } else {
+                let dprev = seek_pos_us - ex->samples[prev].pts_us;
+                let dnext = ex->samples[next].pts_us - seek_pos_us;
+                target = dprev <= dnext ? prev : next;
+            }
+            break;
+    }
+
+    ex->cursor = target >= 0 ? (size_t) target : ex->sample_count;
+    return AMEDIA_OK;
+}
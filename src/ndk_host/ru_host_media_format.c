@@ -0,0 +1,312 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// stdlib
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// local
+#include <media/NdkMediaFormat.h>
+
+#include "util/alloc.h"
+#include "util/macros.h"
+#include "util/ru_math.h"
+
+#include "ru_host.h"
+
+// The values match the NDK's, so that formats print the same on both.
+const char *AMEDIAFORMAT_KEY_COLOR_FORMAT = "color-format";
+const char *AMEDIAFORMAT_KEY_DISPLAY_CROP = "crop";
+const char *AMEDIAFORMAT_KEY_DURATION = "durationUs";
+const char *AMEDIAFORMAT_KEY_FRAME_RATE = "frame-rate";
+const char *AMEDIAFORMAT_KEY_HEIGHT = "height";
+const char *AMEDIAFORMAT_KEY_MAX_INPUT_SIZE = "max-input-size";
+const char *AMEDIAFORMAT_KEY_MIME = "mime";
+const char *AMEDIAFORMAT_KEY_OPERATING_RATE = "operating-rate";
+const char *AMEDIAFORMAT_KEY_PRIORITY = "priority";
+const char *AMEDIAFORMAT_KEY_SLICE_HEIGHT = "slice-height";
+const char *AMEDIAFORMAT_KEY_STRIDE = "stride";
+const char *AMEDIAFORMAT_KEY_WIDTH = "width";
+
+typedef enum RuHostFormatType {
+    RU_HOST_FORMAT_TYPE_INT32,
+    RU_HOST_FORMAT_TYPE_INT64,
+    RU_HOST_FORMAT_TYPE_FLOAT,
+    RU_HOST_FORMAT_TYPE_STRING,
+    RU_HOST_FORMAT_TYPE_RECT,
+} RuHostFormatType;
+
+typedef struct RuHostFormatEntry {
+    char *key;
+    RuHostFormatType type;
+
+    union {
+        int32_t i32;
+        int64_t i64;
+        float f;
+        char *str;
+        int32_t rect[4]; // left, top, right, bottom
+    };
+} RuHostFormatEntry;
+
+struct AMediaFormat {
+    RuHostFormatEntry *entries;
+    size_t entry_count;
+
+    // Returned by AMediaFormat_toString().
+    char *str;
+};
+
+AMediaFormat *
+AMediaFormat_new(void) {
+    return new0(AMediaFormat);
+}
+
+static void
+ru_host_format_entry_finish(RuHostFormatEntry *e) {
+    free(e->key);
+
+    if (e->type == RU_HOST_FORMAT_TYPE_STRING)
+        free(e->str);
+}
+
+static void
+ru_host_format_clear(AMediaFormat *f) {
+    for (size_t i = 0; i < f->entry_count; ++i)
+        ru_host_format_entry_finish(&f->entries[i]);
+
+    free(f->entries);
+    f->entries = NULL;
+    f->entry_count = 0;
+}
+
+media_status_t
+AMediaFormat_delete(AMediaFormat *f) {
+    if (!f)
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+
+    ru_host_format_clear(f);
+    free(f->str);
+    free(f);
+    return AMEDIA_OK;
+}
+
+media_status_t
+AMediaFormat_copy(AMediaFormat *to, AMediaFormat *from) {
+    if (!to || !from)
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+
+    if (to == from)
+        return AMEDIA_OK;
+
+    ru_host_format_clear(to);
+    to->entries = new_array(RuHostFormatEntry, ru_max(from->entry_count, (size_t) 1));
+    to->entry_count = from->entry_count;
+
+    for (size_t i = 0; i < from->entry_count; ++i) {
+        let e = &to->entries[i];
+        *e = from->entries[i];
+        e->key = xstrdup(e->key);
+
+        if (e->type == RU_HOST_FORMAT_TYPE_STRING)
+            e->str = xstrdup(e->str);
+    }
+
+    return AMEDIA_OK;
+}
+
+static RuHostFormatEntry *
+ru_host_format_find(AMediaFormat *f, const char *key) {
+    for (size_t i = 0; i < f->entry_count; ++i) {
+        if (strcmp(f->entries[i].key, key) == 0)
+            return &f->entries[i];
+    }
+
+    return NULL;
+}
+
+static RuHostFormatEntry *
+ru_host_format_find_type(AMediaFormat *f, const char *key,
+                         RuHostFormatType type) {
+    let e = ru_host_format_find(f, key);
+    return e && e->type == type ? e : NULL;
+}
+
+// Return a fresh entry for the key, replacing any old value.
+static RuHostFormatEntry *
+ru_host_format_put(AMediaFormat *f, const char *key, RuHostFormatType type) {
+    let e = ru_host_format_find(f, key);
+
+    if (e) {
+        ru_host_format_entry_finish(e);
+    } else {
+        f->entries = xreallocn(f->entries, f->entry_count + 1, sizeof(f->entries[0]));
+        e = &f->entries[f->entry_count++];
+    }
+
+    *e = (RuHostFormatEntry) {
+        .key = xstrdup(key),
+        .type = type,
+    };
+
+    return e;
+}
+
+const char *
+AMediaFormat_toString(AMediaFormat *f) {
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *s = open_memstream(&buf, &len);
+
+    if (!s)
+        oom();
+
+    fputc('{', s);
+
+    for (size_t i = 0; i < f->entry_count; ++i) {
+        let e = &f->entries[i];
+
+        fprintf(s, "%s%s: ", i ? ", " : "", e->key);
+
+        switch (e->type) {
+            case RU_HOST_FORMAT_TYPE_INT32:
+                fprintf(s, "int32(%"PRId32")", e->i32);
+                break;
+            case RU_HOST_FORMAT_TYPE_INT64:
+                fprintf(s, "int64(%"PRId64")", e->i64);
+                break;
+            case RU_HOST_FORMAT_TYPE_FLOAT:
+                fprintf(s, "float(%f)", e->f);
+                break;
+            case RU_HOST_FORMAT_TYPE_STRING:
+                fprintf(s, "string(%s)", e->str);
+                break;
+            case RU_HOST_FORMAT_TYPE_RECT:
+                fprintf(s, "Rect(%"PRId32", %"PRId32", %"PRId32", %"PRId32")",
+                        e->rect[0], e->rect[1], e->rect[2], e->rect[3]);
+                break;
+        }
+    }
+
+    fputc('}', s);
+    fclose(s);
+
+    free(f->str);
+    f->str = buf;
+    return f->str;
+}
+
+bool
+AMediaFormat_getInt32(AMediaFormat *f, const char *name, int32_t *out) {
+    let e = ru_host_format_find_type(f, name, RU_HOST_FORMAT_TYPE_INT32);
+    if (!e)
+        return false;
+
+    *out = e->i32;
+    return true;
+}
+
+bool
+AMediaFormat_getInt64(AMediaFormat *f, const char *name, int64_t *out) {
+    let e = ru_host_format_find_type(f, name, RU_HOST_FORMAT_TYPE_INT64);
+    if (!e)
+        return false;
+
+    *out = e->i64;
+    return true;
+}
+
+bool
+AMediaFormat_getFloat(AMediaFormat *f, const char *name, float *out) {
+    let e = ru_host_format_find_type(f, name, RU_HOST_FORMAT_TYPE_FLOAT);
+    if (!e)
+        return false;
+
+    *out = e->f;
+    return true;
+}
+
+bool
+AMediaFormat_getString(AMediaFormat *f, const char *name, const char **out) {
+    let e = ru_host_format_find_type(f, name, RU_HOST_FORMAT_TYPE_STRING);
+    if (!e)
+        return false;
+
+    *out = e->str;
+    return true;
+}
+
+bool
+AMediaFormat_getRect(AMediaFormat *f, const char *name,
+                     int32_t *left, int32_t *top,
+                     int32_t *right, int32_t *bottom) {
+    let e = ru_host_format_find_type(f, name, RU_HOST_FORMAT_TYPE_RECT);
+    if (!e)
+        return false;
+
+    *left = e->rect[0];
+    *top = e->rect[1];
+    *right = e->rect[2];
+    *bottom = e->rect[3];
+    return true;
+}
+
+void
+AMediaFormat_setInt32(AMediaFormat *f, const char *name, int32_t value) {
+    ru_host_format_put(f, name, RU_HOST_FORMAT_TYPE_INT32)->i32 = value;
+}
+
+void
+AMediaFormat_setInt64(AMediaFormat *f, const char *name, int64_t value) {
+    ru_host_format_put(f, name, RU_HOST_FORMAT_TYPE_INT64)->i64 = value;
+}
+
+void
+AMediaFormat_setFloat(AMediaFormat *f, const char *name, float value) {
+    ru_host_format_put(f, name, RU_HOST_FORMAT_TYPE_FLOAT)->f = value;
+}
+
+void
+AMediaFormat_setString(AMediaFormat *f, const char *name, const char *value) {
+    // Copy first, in case value points into the entry being replaced.
+    char *copy = xstrdup(value);
+    ru_host_format_put(f, name, RU_HOST_FORMAT_TYPE_STRING)->str = copy;
+}
+
+void
+AMediaFormat_setRect(AMediaFormat *f, const char *name,
+                     int32_t left, int32_t top,
+                     int32_t right, int32_t bottom) {
+    let e = ru_host_format_put(f, name, RU_HOST_FORMAT_TYPE_RECT);
+    e->rect[0] = left;
+    e->rect[1] = top;
+    e->rect[2] = right;
+    e->rect[3] = bottom;
+}
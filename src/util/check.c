@@ -38,19 +38,26 @@
 #include <android/log.h>
 #endif
 
+#ifdef HAVE_VULKAN
 #include <vulkan/vulkan.h>
+#endif
 
 #include "check.h"
+#include "ru_logring.h"
 
 noreturn void
 die(const char *format, ...) {
     va_list va;
 
+    // Log the deferred entries first, as they precede the failure.
+    ru_logring_flush_on_crash();
+
     va_start(va, format);
 #ifdef ANDROID
     __android_log_vprint(ANDROID_LOG_FATAL, LOG_TAG, format, va);
 #else
-#   error
+    vfprintf(stderr, format, va);
+    fputc('\n', stderr);
 #endif
     va_end(va);
 
@@ -59,9 +66,11 @@ die(const char *format, ...) {
     abort();
 }
 
+#ifdef HAVE_VULKAN
 VkResult
 check_vk_loc(const char *file, int line, VkResult r) {
     if (r != VK_SUCCESS)
         die("%s:%d: VkResult(%d)", file, line, r);
     return r;
 }
+#endif
@@ -0,0 +1,85 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "log.h"
+#include "macros.h"
+#include "ru_time.h"
+
+_Atomic int ru_log_level_ = RU_LOG_LEVEL_DEBUG;
+
+static const struct {
+    const char *name;
+    RuLogLevel level;
+} ru_log_level_names[] = {
+    { "verbose", RU_LOG_LEVEL_VERBOSE },
+    { "debug", RU_LOG_LEVEL_DEBUG },
+    { "info", RU_LOG_LEVEL_INFO },
+    { "warn", RU_LOG_LEVEL_WARN },
+    { "error", RU_LOG_LEVEL_ERROR },
+    { "fatal", RU_LOG_LEVEL_FATAL },
+};
+
+void
+ru_log_set_level(RuLogLevel level) {
+    atomic_store_explicit(&ru_log_level_, level, memory_order_relaxed);
+}
+
+bool
+ru_log_parse_level(const char *s, RuLogLevel *level) {
+    for (size_t i = 0; i < ARRAY_LEN(ru_log_level_names); ++i) {
+        if (!strcmp(s, ru_log_level_names[i].name)) {
+            *level = ru_log_level_names[i].level;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool
+ru_log_rate_limit(RuLogRateLimit *rl, int64_t interval_ns, uint32_t *suppressed) {
+    int64_t now_ns = ru_time_now_ns();
+    int64_t next_ns = atomic_load_explicit(&rl->next_ns, memory_order_relaxed);
+
+    // If threads race on the same call site, then only the winner logs.
+    if (now_ns < next_ns ||
+        !atomic_compare_exchange_strong_explicit(&rl->next_ns, &next_ns,
+                                                 now_ns + interval_ns,
+                                                 memory_order_relaxed,
+                                                 memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&rl->suppressed, 1, memory_order_relaxed);
+        return false;
+    }
+
+    *suppressed = atomic_exchange_explicit(&rl->suppressed, 0, memory_order_relaxed);
+    return true;
+}
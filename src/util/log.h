@@ -24,34 +24,116 @@
 
 #pragma once
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
 #ifdef ANDROID
 #include <android/log.h>
 #else
 #include <stdio.h>
 #endif
 
+#include "attribs.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// The values match android_LogPriority.
+typedef enum RuLogLevel {
+    RU_LOG_LEVEL_VERBOSE = 2,
+    RU_LOG_LEVEL_DEBUG = 3,
+    RU_LOG_LEVEL_INFO = 4,
+    RU_LOG_LEVEL_WARN = 5,
+    RU_LOG_LEVEL_ERROR = 6,
+    RU_LOG_LEVEL_FATAL = 7,
+} RuLogLevel;
+
+// Calls below RU_LOG_MIN_LEVEL compile to nothing, though their arguments are
+// still type-checked. Override it with the CMake cache variable of the same
+// name, such as -DRU_LOG_MIN_LEVEL=DEBUG.
+#ifndef RU_LOG_MIN_LEVEL
+#ifdef DEBUG
+#define RU_LOG_MIN_LEVEL RU_LOG_LEVEL_VERBOSE
+#else
+#define RU_LOG_MIN_LEVEL RU_LOG_LEVEL_INFO
+#endif
+#endif
+
+// Calls below the runtime level skip formatting. The default is
+// RU_LOG_LEVEL_DEBUG. Do not access directly; it is here for inlining.
+extern _Atomic int ru_log_level_;
+
+void ru_log_set_level(RuLogLevel level);
+
+// Accepts the lowercase level names, such as "debug". Returns false if the
+// string is not a level.
+bool ru_log_parse_level(const char *s, RuLogLevel *level) _must_use_result_;
+
+static inline bool _must_use_result_
+ru_log_is_enabled(RuLogLevel level) {
+    return level >= RU_LOG_MIN_LEVEL &&
+           level >= atomic_load_explicit(&ru_log_level_, memory_order_relaxed);
+}
+
+// Per-call-site state of a rate-limited log call.
+typedef struct RuLogRateLimit {
+    _Atomic int64_t next_ns;
+    _Atomic uint32_t suppressed;
+} RuLogRateLimit;
+
+// Returns true if the call site may log now. If so, *suppressed is the number
+// of calls dropped since it last logged.
+bool ru_log_rate_limit(RuLogRateLimit *rl, int64_t interval_ns,
+                       uint32_t *suppressed) _must_use_result_;
+
 #ifdef ANDROID
-#define logv(fmt, ...) __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, (fmt), ##__VA_ARGS__)
-#define logd(fmt, ...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, (fmt), ##__VA_ARGS__)
-#define logi(fmt, ...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, (fmt), ##__VA_ARGS__)
-#define logw(fmt, ...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, (fmt), ##__VA_ARGS__)
-#define loge(fmt, ...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, (fmt), ##__VA_ARGS__)
-#define logf(fmt, ...) __android_log_print(ANDROID_LOG_FATAL, LOG_TAG, (fmt), ##__VA_ARGS__)
+#define ru_log_print_(level, fmt, ...) __android_log_print((level), LOG_TAG, (fmt), ##__VA_ARGS__)
 #define log_assert(cond, fmt, ...) __android_log_assert((cond), LOG_TAG, (fmt), ##__VA_ARGS__)
 #define log_loc_assert(cond, fmt, ...) log_assert((cond), "%s:%d: %s: " fmt, __FILE__, __LINE__, __func__, ##__VA_ARGS__)
 #else
-#define logv(fmt, ...) printf((fmt), ##__VA_ARGS__)
-#define logd(fmt, ...) printf((fmt), ##__VA_ARGS__)
-#define logi(fmt, ...) printf((fmt), ##__VA_ARGS__)
-#define logw(fmt, ...) printf((fmt), ##__VA_ARGS__)
-#define loge(fmt, ...) printf((fmt), ##__VA_ARGS__)
-#define logf(fmt, ...) printf((fmt), ##__VA_ARGS__)
+#define ru_log_print_(level, fmt, ...) fprintf(stderr, fmt "\n", ##__VA_ARGS__)
 #endif
 
+#define ru_log(level, fmt, ...) \
+    do { \
+        if (ru_log_is_enabled(level)) \
+            ru_log_print_((level), fmt, ##__VA_ARGS__); \
+    } while (0)
+
+// Log at most once per interval_ms from this call site, and report how many
+// calls were dropped in between. Meant for messages that may fire on every
+// frame or every codec buffer.
+#define ru_log_ratelimit(level, interval_ms, fmt, ...) \
+    do { \
+        if (ru_log_is_enabled(level)) { \
+            static RuLogRateLimit ru_log_rl_; \
+            uint32_t ru_log_suppressed_; \
+            \
+            if (ru_log_rate_limit(&ru_log_rl_, (int64_t) (interval_ms) * 1000000, \
+                                  &ru_log_suppressed_)) { \
+                if (ru_log_suppressed_ > 0) { \
+                    ru_log_print_((level), fmt " (%u suppressed)", ##__VA_ARGS__, \
+                                  ru_log_suppressed_); \
+                } else { \
+                    ru_log_print_((level), fmt, ##__VA_ARGS__); \
+                } \
+            } \
+        } \
+    } while (0)
+
+#define logv(fmt, ...) ru_log(RU_LOG_LEVEL_VERBOSE, fmt, ##__VA_ARGS__)
+#define logd(fmt, ...) ru_log(RU_LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define logi(fmt, ...) ru_log(RU_LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define logw(fmt, ...) ru_log(RU_LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define loge(fmt, ...) ru_log(RU_LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define logf(fmt, ...) ru_log(RU_LOG_LEVEL_FATAL, fmt, ##__VA_ARGS__)
+
+#define logd_ratelimit(interval_ms, fmt, ...) ru_log_ratelimit(RU_LOG_LEVEL_DEBUG, (interval_ms), fmt, ##__VA_ARGS__)
+#define logi_ratelimit(interval_ms, fmt, ...) ru_log_ratelimit(RU_LOG_LEVEL_INFO, (interval_ms), fmt, ##__VA_ARGS__)
+#define logw_ratelimit(interval_ms, fmt, ...) ru_log_ratelimit(RU_LOG_LEVEL_WARN, (interval_ms), fmt, ##__VA_ARGS__)
+
 #define logv_loc(fmt, ...) logv("%s:%d: %s: " fmt, __FILE__, __LINE__, __func__, ##__VA_ARGS__)
 #define logd_loc(fmt, ...) logd("%s:%d: %s: " fmt, __FILE__, __LINE__, __func__, ##__VA_ARGS__)
 #define logi_loc(fmt, ...) logi("%s:%d: %s: " fmt, __FILE__, __LINE__, __func__, ##__VA_ARGS__)
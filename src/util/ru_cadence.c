@@ -0,0 +1,158 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "macros.h"
+#include "ru_cadence.h"
+#include "ru_math.h"
+#include "ru_time.h"
+
+// The rate is reported once this many consecutive intervals agree.
+#define RU_FRAME_RATE_STEADY_COUNT 16u
+
+// Longer intervals are gaps in the stream, not frames.
+#define RU_FRAME_RATE_MAX_PERIOD_NS (250 * RU_NSEC_PER_MSEC)
+
+static const struct {
+    double num;
+    double den;
+} ru_common_frame_rates[] = {
+    { 24000, 1001 },
+    { 24, 1 },
+    { 25, 1 },
+    { 30000, 1001 },
+    { 30, 1 },
+    { 48, 1 },
+    { 50, 1 },
+    { 60000, 1001 },
+    { 60, 1 },
+    { 90, 1 },
+    { 100, 1 },
+    { 120, 1 },
+};
+
+// Return the closest common rate within 0.5%, else hz itself.
+static double
+ru_frame_rate_snap(double hz) {
+    double best = hz;
+    double best_err = 0.005;
+
+    for (size_t i = 0; i < ARRAY_LEN(ru_common_frame_rates); ++i) {
+        double common = ru_common_frame_rates[i].num / ru_common_frame_rates[i].den;
+        double err = fabs(hz - common) / common;
+
+        if (err < best_err) {
+            best = common;
+            best_err = err;
+        }
+    }
+
+    return best;
+}
+
+void
+ru_frame_rate_reset(RuFrameRate *fr) {
+    *fr = (RuFrameRate) {
+        .prev_pts_ns = INT64_MIN,
+    };
+}
+
+bool
+ru_frame_rate_observe(RuFrameRate *fr, int64_t pts_ns) {
+    const int64_t prev_pts_ns = fr->prev_pts_ns;
+    fr->prev_pts_ns = pts_ns;
+
+    if (prev_pts_ns == INT64_MIN)
+        return false;
+
+    // A gap, such as a seek or a loop, may change the rate, so the intervals
+    // after it must hold steady again. The last reported rate stays.
+    const int64_t delta_ns = pts_ns - prev_pts_ns;
+    if (delta_ns <= 0 || delta_ns > RU_FRAME_RATE_MAX_PERIOD_NS) {
+        fr->period_ns = 0;
+        fr->steady_count = 0;
+        return false;
+    }
+
+    if (fr->period_ns == 0) {
+        fr->period_ns = delta_ns;
+        return false;
+    }
+
+    // Container timestamps are often rounded to the millisecond, so allow
+    // each interval 5% of jitter.
+    if (20 * llabs(delta_ns - fr->period_ns) <= fr->period_ns) {
+        fr->period_ns += (delta_ns - fr->period_ns) / 16;
+        fr->steady_count = ru_min(fr->steady_count + 1, RU_FRAME_RATE_STEADY_COUNT);
+    } else {
+        fr->period_ns = delta_ns;
+        fr->steady_count = 0;
+    }
+
+    if (fr->steady_count < RU_FRAME_RATE_STEADY_COUNT)
+        return false;
+
+    float hz = (float) ru_frame_rate_snap((double) RU_NSEC_PER_SEC / fr->period_ns);
+
+    // Ignore the drift of an unsnapped rate.
+    if (fabsf(hz - fr->hz) <= 0.001f * hz)
+        return false;
+
+    fr->hz = hz;
+    return true;
+}
+
+void
+ru_cadence_reset(RuCadence *c, int64_t frame_period_ns,
+                 int64_t vsync_period_ns) {
+    *c = (RuCadence) {
+        .frame_period_ns = frame_period_ns,
+        .vsync_period_ns = vsync_period_ns,
+
+        // Start a quarter of the way into a vsync. Frames of a whole or
+        // half-whole number of vsyncs, such as 24 Hz on 60 Hz, then end a
+        // quarter vsync from a boundary, where rounding error cannot move
+        // them. 24 Hz on 60 Hz runs 2, 3, 2, 3, ...
+        .phase_ns = vsync_period_ns / 4,
+    };
+}
+
+uint32_t
+ru_cadence_next(RuCadence *c) {
+    if (c->vsync_period_ns <= 0 || c->frame_period_ns <= c->vsync_period_ns)
+        return 1;
+
+    c->phase_ns += c->frame_period_ns;
+
+    int64_t n = c->phase_ns / c->vsync_period_ns;
+    c->phase_ns -= n * c->vsync_period_ns;
+
+    return (uint32_t) n;
+}
@@ -0,0 +1,83 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+// Estimates a stream's frame rate from its presentation timestamps, and
+// spreads the frames of one rate over the vsyncs of a faster display, such as
+// 24 Hz film over 60 Hz in the 3:2 pattern of telecine pulldown.
+//
+// Both are flat structs that neither allocate nor lock.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "attribs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct RuFrameRate {
+    int64_t prev_pts_ns; // INT64_MIN if none
+    int64_t period_ns; // smoothed interval between frames; 0 if unknown
+    uint32_t steady_count; // consecutive intervals close to period_ns
+
+    // The rate last reported by ru_frame_rate_observe(). Zero until the
+    // intervals hold steady.
+    float hz;
+} RuFrameRate;
+
+void ru_frame_rate_reset(RuFrameRate *fr);
+
+// Add the next frame in presentation order. Intervals that are not positive
+// or that exceed a few frames, such as at a seek or a loop, are gaps: they
+// are not counted, and restart the count of steady intervals. Return true if
+// the reported rate changed. Rates close to a common video rate, such as
+// 24000/1001 Hz, snap to it.
+bool ru_frame_rate_observe(RuFrameRate *fr, int64_t pts_ns) _must_use_result_;
+
+typedef struct RuCadence {
+    int64_t frame_period_ns;
+    int64_t vsync_period_ns;
+
+    // Time from the current frame's first vsync to its end, before the
+    // rounding to whole vsyncs. It carries the rounding into the next frame.
+    int64_t phase_ns;
+} RuCadence;
+
+void ru_cadence_reset(RuCadence *c, int64_t frame_period_ns,
+                      int64_t vsync_period_ns);
+
+// Return how many vsyncs the next frame stays on the display. The counts
+// alternate so that their average matches frame_period_ns / vsync_period_ns.
+// If the frames are no slower than the vsyncs, every count is 1.
+uint32_t ru_cadence_next(RuCadence *c) _must_use_result_;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,84 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdint.h>
+
+#include "ru_hist.h"
+
+// The greatest value that lands in the bucket.
+static uint64_t
+ru_hist_bucket_max(uint32_t index) {
+    if (index < RU_HIST_SUB_COUNT)
+        return index;
+
+    uint32_t shift = (index - RU_HIST_SUB_COUNT) / RU_HIST_SUB_COUNT;
+    uint64_t sub = (index - RU_HIST_SUB_COUNT) % RU_HIST_SUB_COUNT + RU_HIST_SUB_COUNT;
+
+    return ((sub + 1) << shift) - 1;
+}
+
+uint64_t
+ru_hist_percentile(const RuHist *h, double p) {
+    if (h->count == 0)
+        return 0;
+
+    if (p <= 0.0)
+        return h->min;
+
+    // Nearest rank.
+    uint64_t rank = (uint64_t) (p / 100.0 * h->count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank >= h->count)
+        return h->max;
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < RU_HIST_BUCKET_COUNT; ++i) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t v = ru_hist_bucket_max(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+void
+ru_hist_merge(RuHist *dst, const RuHist *src) {
+    if (src->count == 0)
+        return;
+
+    dst->count += src->count;
+    dst->sum += src->sum;
+    dst->min = src->min < dst->min ? src->min : dst->min;
+    dst->max = src->max > dst->max ? src->max : dst->max;
+
+    for (uint32_t i = 0; i < RU_HIST_BUCKET_COUNT; ++i) {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
@@ -0,0 +1,108 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+// A log-linear histogram of non-negative 64-bit values, in the style of
+// HdrHistogram. Values below 32 have exact buckets. Above that, each power of
+// 2 splits into 32 buckets, so a reported value is within 1/32 (about 3%) of
+// the true value. Values at or above 2^36, about 68 seconds in nanoseconds,
+// share the last bucket.
+//
+// A histogram is a flat struct of about 8 KiB. It neither allocates nor
+// locks. Recording is a few instructions.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "attribs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RU_HIST_SUB_BITS 5
+#define RU_HIST_SUB_COUNT (1 << RU_HIST_SUB_BITS)
+#define RU_HIST_MAX_BITS 36
+#define RU_HIST_BUCKET_COUNT \
+    (RU_HIST_SUB_COUNT + (RU_HIST_MAX_BITS - RU_HIST_SUB_BITS) * RU_HIST_SUB_COUNT)
+
+typedef struct RuHist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[RU_HIST_BUCKET_COUNT];
+} RuHist;
+
+static inline void
+ru_hist_reset(RuHist *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+static inline uint32_t _const_
+ru_hist_bucket_index(uint64_t v) {
+    if (v < RU_HIST_SUB_COUNT)
+        return v;
+
+    uint32_t msb = 63 - __builtin_clzll(v);
+    if (msb >= RU_HIST_MAX_BITS)
+        return RU_HIST_BUCKET_COUNT - 1;
+
+    uint32_t shift = msb - RU_HIST_SUB_BITS;
+    uint32_t sub = (v >> shift) - RU_HIST_SUB_COUNT;
+
+    return RU_HIST_SUB_COUNT + shift * RU_HIST_SUB_COUNT + sub;
+}
+
+static inline void
+ru_hist_record(RuHist *h, int64_t value) {
+    uint64_t v = value > 0 ? (uint64_t) value : 0;
+
+    h->count += 1;
+    h->sum += v;
+    h->min = v < h->min ? v : h->min;
+    h->max = v > h->max ? v : h->max;
+    h->buckets[ru_hist_bucket_index(v)] += 1;
+}
+
+// Return the value at percentile p, in [0, 100]. The result is the greatest
+// value of its bucket, clamped to the recorded max. Returns 0 if empty.
+uint64_t ru_hist_percentile(const RuHist *h, double p) _must_use_result_;
+
+static inline uint64_t _must_use_result_
+ru_hist_mean(const RuHist *h) {
+    return h->count ? h->sum / h->count : 0;
+}
+
+// Add src's values into dst.
+void ru_hist_merge(RuHist *dst, const RuHist *src);
+
+#ifdef __cplusplus
+}
+#endif
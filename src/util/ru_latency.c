@@ -0,0 +1,358 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "macros.h"
+#include "ru_hist.h"
+#include "ru_latency.h"
+#include "ru_thread.h"
+
+// Bounds the frames in the pipeline, across all streams. Frames that never
+// reach the display, such as those decoded just before a swapchain is
+// recreated, are evicted oldest first.
+#define RU_LATENCY_MAX_ENTRIES 256
+
+typedef struct RuLatencyEntry {
+    bool is_used;
+    int64_t created_ns; // for eviction
+    uint64_t rend_seq; // valid iff frame.stamps_ns[RU_LATENCY_STAGE_ACQUIRE]
+    RuLatencyFrame frame;
+} RuLatencyEntry;
+
+typedef struct RuLatencyHists {
+    RuHist stages[RU_LATENCY_STAGE_COUNT]; // stages[0] is unused
+    RuHist total;
+} RuLatencyHists;
+
+struct RuLatency {
+    RuLatencyListener listener;
+    int64_t window_ns;
+
+    pthread_mutex_t mutex;
+
+    RuLatencyEntry entries[RU_LATENCY_MAX_ENTRIES];
+
+    // windows[cur_window] collects the current window. The other holds the
+    // previous window.
+    RuLatencyHists windows[2];
+    uint32_t cur_window;
+    int64_t window_start_ns;
+
+    uint64_t dropped_count;
+};
+
+static void
+ru_latency_hists_reset(RuLatencyHists *hists) {
+    for (uint32_t i = 0; i < RU_LATENCY_STAGE_COUNT; ++i)
+        ru_hist_reset(&hists->stages[i]);
+
+    ru_hist_reset(&hists->total);
+}
+
+RuLatency *
+ru_latency_new_s(struct ru_latency_new_args args) {
+    let lat = new0(RuLatency);
+
+    lat->listener = args.listener;
+    lat->window_ns = args.window_ns > 0
+        ? args.window_ns
+        : RU_LATENCY_DEFAULT_WINDOW_NS;
+
+    if (pthread_mutex_init(&lat->mutex, NULL))
+        abort();
+
+    ru_latency_hists_reset(&lat->windows[0]);
+    ru_latency_hists_reset(&lat->windows[1]);
+
+    return lat;
+}
+
+void
+ru_latency_free(RuLatency *lat) {
+    if (!lat)
+        return;
+
+    if (pthread_mutex_destroy(&lat->mutex))
+        abort();
+
+    free(lat);
+}
+
+static RuLatencyEntry *
+ru_latency_find_locked(RuLatency *lat, uint32_t stream, int64_t pts_us) {
+    for (uint32_t i = 0; i < RU_LATENCY_MAX_ENTRIES; ++i) {
+        RuLatencyEntry *e = &lat->entries[i];
+
+        if (e->is_used && e->frame.stream == stream &&
+            e->frame.pts_us == pts_us) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+static RuLatencyEntry *
+ru_latency_alloc_locked(RuLatency *lat, uint32_t stream, int64_t pts_us,
+                        int64_t ns) {
+    RuLatencyEntry *e = NULL;
+
+    for (uint32_t i = 0; i < RU_LATENCY_MAX_ENTRIES; ++i) {
+        RuLatencyEntry *cand = &lat->entries[i];
+
+        if (!cand->is_used) {
+            e = cand;
+            break;
+        }
+
+        if (!e || cand->created_ns < e->created_ns)
+            e = cand;
+    }
+
+    *e = (RuLatencyEntry) {
+        .is_used = true,
+        .created_ns = ns,
+        .frame = {
+            .stream = stream,
+            .pts_us = pts_us,
+        },
+    };
+
+    return e;
+}
+
+static RuLatencyEntry *
+ru_latency_get_locked(RuLatency *lat, uint32_t stream, int64_t pts_us,
+                      int64_t ns) {
+    RuLatencyEntry *e = ru_latency_find_locked(lat, stream, pts_us);
+    if (!e)
+        e = ru_latency_alloc_locked(lat, stream, pts_us, ns);
+
+    return e;
+}
+
+void
+ru_latency_stamp(RuLatency *lat, uint32_t stream, int64_t pts_us,
+                 RuLatencyStage stage, int64_t ns) {
+    ru_mutex_lock_scoped(&lat->mutex);
+
+    RuLatencyEntry *e;
+
+    if (stage == RU_LATENCY_STAGE_QUEUE) {
+        // A stale entry of the same pts belongs to an earlier pass.
+        e = ru_latency_find_locked(lat, stream, pts_us);
+        if (e)
+            e->is_used = false;
+
+        e = ru_latency_alloc_locked(lat, stream, pts_us, ns);
+    } else {
+        e = ru_latency_get_locked(lat, stream, pts_us, ns);
+    }
+
+    e->frame.stamps_ns[stage] = ns;
+}
+
+void
+ru_latency_on_acquire(RuLatency *lat, uint32_t stream, int64_t pts_us,
+                      int64_t available_ns, int64_t acquire_ns,
+                      uint64_t rend_seq) {
+    ru_mutex_lock_scoped(&lat->mutex);
+
+    RuLatencyEntry *e = ru_latency_get_locked(lat, stream, pts_us, acquire_ns);
+    int64_t *stamps = e->frame.stamps_ns;
+
+    stamps[RU_LATENCY_STAGE_AVAILABLE] = available_ns;
+    stamps[RU_LATENCY_STAGE_ACQUIRE] = acquire_ns;
+    e->rend_seq = rend_seq;
+
+    const int64_t release_ns = stamps[RU_LATENCY_STAGE_RELEASE];
+    if (!release_ns)
+        return;
+
+    // AImageReader_acquireLatestImage skipped the stream's older frames.
+    for (uint32_t i = 0; i < RU_LATENCY_MAX_ENTRIES; ++i) {
+        RuLatencyEntry *old = &lat->entries[i];
+        const int64_t *old_stamps = old->frame.stamps_ns;
+
+        if (old->is_used && old != e && old->frame.stream == stream &&
+            !old_stamps[RU_LATENCY_STAGE_ACQUIRE] &&
+            old_stamps[RU_LATENCY_STAGE_RELEASE] &&
+            old_stamps[RU_LATENCY_STAGE_RELEASE] <= release_ns) {
+            old->is_used = false;
+            lat->dropped_count += 1;
+        }
+    }
+}
+
+void
+ru_latency_on_submit(RuLatency *lat, uint64_t rend_seq, int64_t ns) {
+    ru_mutex_lock_scoped(&lat->mutex);
+
+    for (uint32_t i = 0; i < RU_LATENCY_MAX_ENTRIES; ++i) {
+        RuLatencyEntry *e = &lat->entries[i];
+        int64_t *stamps = e->frame.stamps_ns;
+
+        if (e->is_used && stamps[RU_LATENCY_STAGE_ACQUIRE] &&
+            !stamps[RU_LATENCY_STAGE_SUBMIT] && e->rend_seq == rend_seq) {
+            stamps[RU_LATENCY_STAGE_SUBMIT] = ns;
+        }
+    }
+}
+
+static void
+ru_latency_record_locked(RuLatency *lat, const RuLatencyFrame *frame,
+                         int64_t ns) {
+    if (ns - lat->window_start_ns >= lat->window_ns) {
+        // Also forget the previous window if it, too, has expired.
+        if (ns - lat->window_start_ns >= 2 * lat->window_ns)
+            ru_latency_hists_reset(&lat->windows[lat->cur_window]);
+
+        lat->cur_window ^= 1;
+        lat->window_start_ns = ns;
+        ru_latency_hists_reset(&lat->windows[lat->cur_window]);
+    }
+
+    RuLatencyHists *hists = &lat->windows[lat->cur_window];
+    const int64_t *stamps = frame->stamps_ns;
+    int64_t first_ns = 0;
+
+    for (uint32_t i = 0; i < RU_LATENCY_STAGE_COUNT; ++i) {
+        if (!stamps[i])
+            continue;
+
+        if (!first_ns)
+            first_ns = stamps[i];
+
+        if (i > 0 && stamps[i - 1])
+            ru_hist_record(&hists->stages[i], stamps[i] - stamps[i - 1]);
+    }
+
+    ru_hist_record(&hists->total, stamps[RU_LATENCY_STAGE_PRESENT] - first_ns);
+}
+
+void
+ru_latency_on_present(RuLatency *lat, uint64_t rend_seq, int64_t ns) {
+    // Report each frame outside the lock, so that the listener may query the
+    // stats.
+    for (;;) {
+        RuLatencyFrame frame;
+        bool found = false;
+
+        {
+            ru_mutex_lock_scoped(&lat->mutex);
+
+            for (uint32_t i = 0; i < RU_LATENCY_MAX_ENTRIES; ++i) {
+                RuLatencyEntry *e = &lat->entries[i];
+
+                if (e->is_used && e->frame.stamps_ns[RU_LATENCY_STAGE_ACQUIRE] &&
+                    e->rend_seq == rend_seq) {
+                    e->frame.stamps_ns[RU_LATENCY_STAGE_PRESENT] = ns;
+                    e->is_used = false;
+                    frame = e->frame;
+                    found = true;
+
+                    ru_latency_record_locked(lat, &frame, ns);
+                    break;
+                }
+            }
+        }
+
+        if (!found)
+            return;
+
+        if (lat->listener.on_frame)
+            lat->listener.on_frame(lat->listener.context, &frame);
+    }
+}
+
+static void
+ru_latency_get_percentiles(const RuHist *h, RuLatencyPercentiles *p) {
+    *p = (RuLatencyPercentiles) {
+        .count = h->count,
+        .p50_ns = ru_hist_percentile(h, 50),
+        .p90_ns = ru_hist_percentile(h, 90),
+        .p99_ns = ru_hist_percentile(h, 99),
+        .max_ns = h->count ? h->max : 0,
+    };
+}
+
+void
+ru_latency_get_stats(RuLatency *lat, RuLatencyStats *stats) {
+    _cleanup_free_ RuLatencyHists *hists = new(RuLatencyHists);
+
+    {
+        ru_mutex_lock_scoped(&lat->mutex);
+
+        const RuLatencyHists *cur = &lat->windows[lat->cur_window];
+        const RuLatencyHists *prev = &lat->windows[lat->cur_window ^ 1];
+
+        *hists = *cur;
+
+        for (uint32_t i = 0; i < RU_LATENCY_STAGE_COUNT; ++i)
+            ru_hist_merge(&hists->stages[i], &prev->stages[i]);
+
+        ru_hist_merge(&hists->total, &prev->total);
+        stats->dropped_count = lat->dropped_count;
+    }
+
+    for (uint32_t i = 0; i < RU_LATENCY_STAGE_COUNT; ++i)
+        ru_latency_get_percentiles(&hists->stages[i], &stats->stages[i]);
+
+    ru_latency_get_percentiles(&hists->total, &stats->total);
+}
+
+void
+ru_latency_reset_stats(RuLatency *lat) {
+    ru_mutex_lock_scoped(&lat->mutex);
+
+    ru_latency_hists_reset(&lat->windows[0]);
+    ru_latency_hists_reset(&lat->windows[1]);
+    lat->window_start_ns = ru_time_now_ns();
+    lat->dropped_count = 0;
+}
+
+const char *
+ru_latency_stage_to_str(RuLatencyStage stage) {
+    switch (stage) {
+        case RU_LATENCY_STAGE_QUEUE: return "queue";
+        case RU_LATENCY_STAGE_DECODE: return "decode";
+        case RU_LATENCY_STAGE_RELEASE: return "release";
+        case RU_LATENCY_STAGE_AVAILABLE: return "available";
+        case RU_LATENCY_STAGE_ACQUIRE: return "acquire";
+        case RU_LATENCY_STAGE_SUBMIT: return "submit";
+        case RU_LATENCY_STAGE_PRESENT: return "present";
+        case RU_LATENCY_STAGE_COUNT: break;
+    }
+
+    return "unknown";
+}
@@ -0,0 +1,143 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+// Follows each decoded frame from the decoder's input to the display, and
+// breaks its latency into stages.
+//
+// The media thread and the render thread stamp each stage of a frame as it
+// passes. They identify the frame by its stream and its presentation
+// timestamp, which AMediaCodec copies from the input sample to the output
+// buffer, and which the AImage carries in nanoseconds. When the frame is
+// presented, RuLatency records the time between each pair of stages in a
+// histogram and reports the frame to its listener.
+//
+// Histograms roll over at the end of each window. ru_latency_get_stats()
+// reports the current window merged with the previous one, so that it always
+// covers at least one full window.
+
+#include <stdint.h>
+
+#include "attribs.h"
+#include "ru_time.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RU_LATENCY_DEFAULT_WINDOW_NS (5 * RU_NSEC_PER_SEC)
+
+typedef struct RuLatency RuLatency;
+
+// In the order that a frame passes them.
+typedef enum RuLatencyStage {
+    RU_LATENCY_STAGE_QUEUE, // AMediaCodec_queueInputBuffer
+    RU_LATENCY_STAGE_DECODE, // onAsyncOutputAvailable reached the media thread
+    RU_LATENCY_STAGE_RELEASE, // AMediaCodec_releaseOutputBuffer
+    RU_LATENCY_STAGE_AVAILABLE, // onImageAvailable
+    RU_LATENCY_STAGE_ACQUIRE, // AImageReader_acquireLatestImage
+    RU_LATENCY_STAGE_SUBMIT, // vkQueueSubmit of the first frame that draws it
+    RU_LATENCY_STAGE_PRESENT, // On the display, or the frame's fence if unknown
+    RU_LATENCY_STAGE_COUNT,
+} RuLatencyStage;
+
+typedef struct RuLatencyFrame {
+    uint32_t stream;
+    int64_t pts_us;
+
+    // On CLOCK_MONOTONIC, in nanoseconds. Zero if the stage was not stamped,
+    // such as when a frame skips the decoder's input because RuLatency
+    // evicted it.
+    int64_t stamps_ns[RU_LATENCY_STAGE_COUNT];
+} RuLatencyFrame;
+
+typedef struct RuLatencyListener {
+    void *context;
+
+    // Called on a render thread once each frame is presented. May be null.
+    void (*on_frame)(void *context, const RuLatencyFrame *frame);
+} RuLatencyListener;
+
+typedef struct RuLatencyPercentiles {
+    uint64_t count;
+    int64_t p50_ns;
+    int64_t p90_ns;
+    int64_t p99_ns;
+    int64_t max_ns;
+} RuLatencyPercentiles;
+
+typedef struct RuLatencyStats {
+    // stages[i] is the time from stage i - 1 to stage i. stages[0] is
+    // unused.
+    RuLatencyPercentiles stages[RU_LATENCY_STAGE_COUNT];
+
+    // From the first stamped stage to RU_LATENCY_STAGE_PRESENT.
+    RuLatencyPercentiles total;
+
+    // Frames released by the decoder but replaced by a newer frame before
+    // the renderer acquired them, since creation or the last reset.
+    uint64_t dropped_count;
+} RuLatencyStats;
+
+struct ru_latency_new_args {
+    int64_t window_ns; // default=RU_LATENCY_DEFAULT_WINDOW_NS
+    RuLatencyListener listener;
+};
+
+#define ru_latency_new(...) ru_latency_new_s((struct ru_latency_new_args) { 0, __VA_ARGS__ })
+RuLatency *ru_latency_new_s(struct ru_latency_new_args args) _malloc_ _must_use_result_;
+void ru_latency_free(RuLatency *lat);
+
+// Stamp one stage of the frame. A QUEUE stamp starts a new frame, replacing
+// any stale frame of the same stream and pts, such as from the previous pass
+// of a looping playlist.
+void ru_latency_stamp(RuLatency *lat, uint32_t stream, int64_t pts_us,
+                      RuLatencyStage stage, int64_t ns);
+
+// The renderer acquired the frame for its frame `rend_seq`. Frames of the
+// stream that were released before this one but never acquired count as
+// dropped.
+void ru_latency_on_acquire(RuLatency *lat, uint32_t stream, int64_t pts_us,
+                           int64_t available_ns, int64_t acquire_ns,
+                           uint64_t rend_seq);
+
+// Stamp every frame acquired for the renderer's frame `rend_seq`.
+void ru_latency_on_submit(RuLatency *lat, uint64_t rend_seq, int64_t ns);
+
+// Stamp every frame acquired for the renderer's frame `rend_seq`, record
+// them, and report them to the listener.
+void ru_latency_on_present(RuLatency *lat, uint64_t rend_seq, int64_t ns);
+
+void ru_latency_get_stats(RuLatency *lat, RuLatencyStats *stats);
+void ru_latency_reset_stats(RuLatency *lat);
+
+const char *ru_latency_stage_to_str(RuLatencyStage stage) _must_use_result_;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,466 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "log.h"
+#include "macros.h"
+#include "ru_logring.h"
+#include "ru_math.h"
+#include "ru_thread.h"
+#include "ru_time.h"
+
+// Entries per thread. Must be a power of 2.
+#define RU_LOGRING_CAPACITY 1024
+
+#define RU_LOGRING_FLUSH_PERIOD_NS (50 * RU_NSEC_PER_MSEC)
+#define RU_LOGRING_CRASH_WAIT_NS (100 * RU_NSEC_PER_MSEC)
+
+// Longest formatted message. Longer ones are truncated.
+#define RU_LOGRING_LINE_SIZE 512
+
+static_assert_q((RU_LOGRING_CAPACITY & (RU_LOGRING_CAPACITY - 1)) == 0);
+
+typedef struct RuLogRingEntry {
+    const char *format;
+    int64_t time_ns;
+    uint8_t level;
+    uint8_t arg_count;
+    uint64_t args[RU_LOGRING_MAX_ARGS];
+} RuLogRingEntry;
+
+// Single producer, the owning thread; single consumer, the flusher.
+typedef struct RuLogRing {
+    struct RuLogRing *next;
+    pid_t tid;
+
+    // The owner writes entries [tail, head). It publishes head with release
+    // order, and the flusher publishes tail likewise.
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+
+    _Atomic uint64_t dropped;
+    uint64_t reported_dropped; // flusher only
+
+    // Set when the thread exits. The flusher frees the ring once drained.
+    _Atomic bool is_orphan;
+
+    RuLogRingEntry entries[RU_LOGRING_CAPACITY];
+} RuLogRing;
+
+static pthread_once_t ru_logring_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ru_logring_key;
+
+// Protects the ring list. Held for the whole of each flush, which also
+// serializes the flushers.
+static pthread_mutex_t ru_logring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static RuLogRing *ru_logring_list;
+
+static _Thread_local RuLogRing *ru_logring_self;
+
+static void
+ru_logring_on_thread_exit(void *_ring) {
+    RuLogRing *ring = _ring;
+
+    // If a later destructor logs, then it gets a new ring.
+    ru_logring_self = NULL;
+    atomic_store_explicit(&ring->is_orphan, true, memory_order_release);
+}
+
+static void *
+ru_logring_flusher_main(void *arg) {
+    ru_thread_apply(RU_THREAD_CLASS_IO, "ru-logring");
+
+    for (;;) {
+        struct timespec ts = {
+            .tv_sec = 0,
+            .tv_nsec = RU_LOGRING_FLUSH_PERIOD_NS,
+        };
+
+        nanosleep(&ts, NULL);
+        ru_logring_flush();
+    }
+
+    return NULL;
+}
+
+static void
+ru_logring_init_once(void) {
+    if (pthread_key_create(&ru_logring_key, ru_logring_on_thread_exit))
+        abort();
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ru_logring_flusher_main, NULL))
+        abort();
+
+    if (pthread_detach(thread))
+        abort();
+
+    atexit(ru_logring_flush);
+}
+
+static RuLogRing *
+ru_logring_get_self(void) {
+    if (ru_logring_self)
+        return ru_logring_self;
+
+    if (pthread_once(&ru_logring_once, ru_logring_init_once))
+        abort();
+
+    RuLogRing *ring = new0(RuLogRing);
+    ring->tid = gettid();
+
+    {
+        ru_mutex_lock_scoped(&ru_logring_mutex);
+        ring->next = ru_logring_list;
+        ru_logring_list = ring;
+    }
+
+    if (pthread_setspecific(ru_logring_key, ring))
+        abort();
+
+    ru_logring_self = ring;
+    return ring;
+}
+
+void
+ru_logring_write(RuLogLevel level, const char *format,
+                 uint32_t arg_count, const uint64_t *args) {
+    assert(arg_count <= RU_LOGRING_MAX_ARGS);
+
+    RuLogRing *ring = ru_logring_get_self();
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail == RU_LOGRING_CAPACITY) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    RuLogRingEntry *e = &ring->entries[head % RU_LOGRING_CAPACITY];
+    e->format = format;
+    e->time_ns = ru_time_now_ns();
+    e->level = level;
+    e->arg_count = arg_count;
+    memcpy(e->args, args, arg_count * sizeof(args[0]));
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Append to buf[*len], truncating at size.
+static void _printf_(4, 5)
+ru_logring_append(char *buf, size_t size, size_t *len, const char *format, ...) {
+    if (*len + 1 >= size)
+        return;
+
+    va_list va;
+    va_start(va, format);
+    int n = vsnprintf(buf + *len, size - *len, format, va);
+    va_end(va);
+
+    if (n > 0)
+        *len = ru_min(*len + n, size - 1);
+}
+
+// A printf subset that takes its arguments from the entry. Integer
+// conversions are truncated to the width of their length modifier, then
+// printed with "ll". Unsupported conversions print as-is.
+static void
+ru_logring_format_entry(const RuLogRingEntry *e, char *buf, size_t size) {
+    const char *f = e->format;
+    uint32_t arg = 0;
+    size_t len = 0;
+
+    buf[0] = '\0';
+
+    while (*f && len + 1 < size) {
+        if (*f != '%') {
+            buf[len++] = *f++;
+            buf[len] = '\0';
+            continue;
+        }
+
+        const char *spec_begin = f++;
+
+        if (*f == '%') {
+            buf[len++] = *f++;
+            buf[len] = '\0';
+            continue;
+        }
+
+        // flags, width and precision, which may use '*'
+        char spec[32];
+        size_t spec_len = 0;
+        int stars[2];
+        uint32_t star_count = 0;
+
+        spec[spec_len++] = '%';
+
+        while (*f && strchr("-+ #0'", *f) && spec_len < 8)
+            spec[spec_len++] = *f++;
+
+        for (int pass = 0; pass < 2; ++pass) {
+            if (pass == 1) {
+                if (*f != '.')
+                    break;
+                spec[spec_len++] = *f++;
+            }
+
+            if (*f == '*') {
+                spec[spec_len++] = *f++;
+                stars[star_count++] = arg < e->arg_count ? (int) e->args[arg++] : 0;
+            } else {
+                while (*f >= '0' && *f <= '9' && spec_len < 20)
+                    spec[spec_len++] = *f++;
+            }
+        }
+
+        // length modifier
+        char len_mod[3] = {0};
+        while (*f && strchr("hljztL", *f) && strlen(len_mod) < 2)
+            len_mod[strlen(len_mod)] = *f++;
+
+        char conv = *f;
+        if (conv)
+            ++f;
+
+        if (!conv || !strchr("diouxXcsp" "eEfFgGaA", conv) ||
+            arg >= e->arg_count) {
+            // Print the spec verbatim, rather than guess.
+            ru_logring_append(buf, size, &len, "%.*s",
+                              (int) (f - spec_begin), spec_begin);
+            continue;
+        }
+
+        uint64_t v = e->args[arg++];
+
+        if (strchr("di", conv)) {
+            long long x;
+            if (!strcmp(len_mod, "hh"))
+                x = (signed char) v;
+            else if (!strcmp(len_mod, "h"))
+                x = (short) v;
+            else if (len_mod[0] == '\0')
+                x = (int) v;
+            else
+                x = (long long) v;
+
+            memcpy(spec + spec_len, "ll", 2);
+            spec[spec_len + 2] = conv;
+            spec[spec_len + 3] = '\0';
+
+            if (star_count == 2)
+                ru_logring_append(buf, size, &len, spec, stars[0], stars[1], x);
+            else if (star_count == 1)
+                ru_logring_append(buf, size, &len, spec, stars[0], x);
+            else
+                ru_logring_append(buf, size, &len, spec, x);
+        } else if (strchr("ouxXc", conv)) {
+            unsigned long long x;
+            if (!strcmp(len_mod, "hh"))
+                x = (unsigned char) v;
+            else if (!strcmp(len_mod, "h"))
+                x = (unsigned short) v;
+            else if (len_mod[0] == '\0')
+                x = (unsigned) v;
+            else
+                x = v;
+
+            if (conv == 'c') {
+                spec[spec_len] = 'c';
+                spec[spec_len + 1] = '\0';
+            } else {
+                memcpy(spec + spec_len, "ll", 2);
+                spec[spec_len + 2] = conv;
+                spec[spec_len + 3] = '\0';
+            }
+
+            if (conv == 'c') {
+                int c = (int) x;
+                if (star_count == 1)
+                    ru_logring_append(buf, size, &len, spec, stars[0], c);
+                else
+                    ru_logring_append(buf, size, &len, spec, c);
+            } else if (star_count == 2) {
+                ru_logring_append(buf, size, &len, spec, stars[0], stars[1], x);
+            } else if (star_count == 1) {
+                ru_logring_append(buf, size, &len, spec, stars[0], x);
+            } else {
+                ru_logring_append(buf, size, &len, spec, x);
+            }
+        } else if (conv == 's' || conv == 'p') {
+            const void *p = (const void *) (uintptr_t) v;
+
+            spec[spec_len] = conv;
+            spec[spec_len + 1] = '\0';
+
+            if (conv == 's' && !p)
+                p = "(null)";
+
+            if (star_count == 2)
+                ru_logring_append(buf, size, &len, spec, stars[0], stars[1], p);
+            else if (star_count == 1)
+                ru_logring_append(buf, size, &len, spec, stars[0], p);
+            else
+                ru_logring_append(buf, size, &len, spec, p);
+        } else {
+            double x;
+            memcpy(&x, &v, sizeof(x));
+
+            spec[spec_len] = conv;
+            spec[spec_len + 1] = '\0';
+
+            if (star_count == 2)
+                ru_logring_append(buf, size, &len, spec, stars[0], stars[1], x);
+            else if (star_count == 1)
+                ru_logring_append(buf, size, &len, spec, stars[0], x);
+            else
+                ru_logring_append(buf, size, &len, spec, x);
+        }
+    }
+}
+
+// Must hold ru_logring_mutex.
+static void
+ru_logring_flush_locked(void) {
+    // Drain each ring up to a snapshot of its head, and merge the rings by
+    // timestamp so that the output reads in order across threads.
+    uint32_t ring_count = 0;
+    for (RuLogRing *r = ru_logring_list; r; r = r->next)
+        ++ring_count;
+
+    if (ring_count == 0)
+        return;
+
+    RuLogRing *rings[ring_count];
+    uint64_t heads[ring_count];
+    uint64_t tails[ring_count];
+    bool orphans[ring_count];
+
+    uint32_t i = 0;
+    for (RuLogRing *r = ru_logring_list; r; r = r->next, ++i) {
+        rings[i] = r;
+
+        // Read is_orphan first. If it is set, then head is final.
+        orphans[i] = atomic_load_explicit(&r->is_orphan, memory_order_acquire);
+        heads[i] = atomic_load_explicit(&r->head, memory_order_acquire);
+        tails[i] = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+        uint64_t dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+        if (dropped != r->reported_dropped) {
+            logw("logring: thread %d dropped %" PRIu64 " entries",
+                 (int) r->tid, dropped - r->reported_dropped);
+            r->reported_dropped = dropped;
+        }
+    }
+
+    for (;;) {
+        int best = -1;
+
+        for (i = 0; i < ring_count; ++i) {
+            if (tails[i] == heads[i])
+                continue;
+
+            const RuLogRingEntry *e = &rings[i]->entries[tails[i] % RU_LOGRING_CAPACITY];
+            if (best < 0 ||
+                e->time_ns < rings[best]->entries[tails[best] % RU_LOGRING_CAPACITY].time_ns) {
+                best = i;
+            }
+        }
+
+        if (best < 0)
+            break;
+
+        RuLogRing *r = rings[best];
+        const RuLogRingEntry *e = &r->entries[tails[best] % RU_LOGRING_CAPACITY];
+
+        char line[RU_LOGRING_LINE_SIZE];
+        ru_logring_format_entry(e, line, sizeof(line));
+
+        // The entry's level already passed the filter when it was written.
+        ru_log_print_(e->level, "[%d %" PRIi64 ".%06" PRIi64 "] %s",
+                      (int) r->tid, e->time_ns / RU_NSEC_PER_SEC,
+                      (e->time_ns % RU_NSEC_PER_SEC) / RU_NSEC_PER_USEC, line);
+
+        ++tails[best];
+        atomic_store_explicit(&r->tail, tails[best], memory_order_release);
+    }
+
+    // Free the drained rings of exited threads.
+    RuLogRing **link = &ru_logring_list;
+    for (i = 0; i < ring_count; ++i) {
+        RuLogRing *r = rings[i];
+
+        assert(*link == r);
+
+        if (orphans[i]) {
+            *link = r->next;
+            free(r);
+        } else {
+            link = &r->next;
+        }
+    }
+}
+
+void
+ru_logring_flush(void) {
+    ru_mutex_lock_scoped(&ru_logring_mutex);
+    ru_logring_flush_locked();
+}
+
+void
+ru_logring_flush_on_crash(void) {
+    int64_t deadline_ns = ru_time_now_ns() + RU_LOGRING_CRASH_WAIT_NS;
+
+    while (pthread_mutex_trylock(&ru_logring_mutex)) {
+        if (ru_time_now_ns() >= deadline_ns)
+            return;
+
+        struct timespec ts = { .tv_nsec = RU_NSEC_PER_MSEC };
+        nanosleep(&ts, NULL);
+    }
+
+    ru_logring_flush_locked();
+
+    if (pthread_mutex_unlock(&ru_logring_mutex))
+        abort();
+}
@@ -0,0 +1,143 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+// A binary log for hot paths. Each thread owns a lock-free ring. A log call
+// stores the format pointer, a timestamp and the raw arguments, and returns.
+// A background thread formats the entries and hands them to the regular log,
+// and die() formats whatever remains before it aborts.
+//
+// Because formatting is deferred, the format must be a string literal and
+// each %s argument must outlive the process, such as a literal or __func__.
+// Arguments are integers, floating-point values and pointers. Cast other
+// pointers to void * for %p, as the regular log requires.
+//
+// If the flusher falls behind, then the ring drops new entries and the
+// flusher reports how many.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "attribs.h"
+#include "log.h"
+#include "macros.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RU_LOGRING_MAX_ARGS 8
+
+void ru_logring_write(RuLogLevel level, const char *format,
+                      uint32_t arg_count, const uint64_t *args);
+
+// Format and log every pending entry of every thread. Thread-safe.
+void ru_logring_flush(void);
+
+// Like ru_logring_flush(), but gives up after a short wait if another thread
+// is flushing. For crash paths.
+void ru_logring_flush_on_crash(void);
+
+static inline uint64_t
+ru_logring_arg_i_(int64_t x) {
+    return (uint64_t) x;
+}
+
+static inline uint64_t
+ru_logring_arg_u_(uint64_t x) {
+    return x;
+}
+
+static inline uint64_t
+ru_logring_arg_f_(double x) {
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    return u;
+}
+
+static inline uint64_t
+ru_logring_arg_p_(const void *x) {
+    return (uintptr_t) x;
+}
+
+static inline void _printf_(1, 2)
+ru_logring_check_format_(const char *format, ...) {}
+
+#define ru_logring_arg_(x) \
+    _Generic((x), \
+        float: ru_logring_arg_f_, \
+        double: ru_logring_arg_f_, \
+        unsigned long: ru_logring_arg_u_, \
+        unsigned long long: ru_logring_arg_u_, \
+        char *: ru_logring_arg_p_, \
+        const char *: ru_logring_arg_p_, \
+        void *: ru_logring_arg_p_, \
+        const void *: ru_logring_arg_p_, \
+        default: ru_logring_arg_i_ \
+    )(x)
+
+// Count the arguments. Expand it only where the arguments may be omitted
+// entirely, because in ISO C mode GCC keeps the comma before a variadic
+// argument that is present but empty.
+#define RU_LOGRING_NARGS_(_, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+
+#define RU_LOGRING_ARGS_0_(...)
+#define RU_LOGRING_ARGS_1_(x) , ru_logring_arg_(x)
+#define RU_LOGRING_ARGS_2_(x, ...) , ru_logring_arg_(x) RU_LOGRING_ARGS_1_(__VA_ARGS__)
+#define RU_LOGRING_ARGS_3_(x, ...) , ru_logring_arg_(x) RU_LOGRING_ARGS_2_(__VA_ARGS__)
+#define RU_LOGRING_ARGS_4_(x, ...) , ru_logring_arg_(x) RU_LOGRING_ARGS_3_(__VA_ARGS__)
+#define RU_LOGRING_ARGS_5_(x, ...) , ru_logring_arg_(x) RU_LOGRING_ARGS_4_(__VA_ARGS__)
+#define RU_LOGRING_ARGS_6_(x, ...) , ru_logring_arg_(x) RU_LOGRING_ARGS_5_(__VA_ARGS__)
+#define RU_LOGRING_ARGS_7_(x, ...) , ru_logring_arg_(x) RU_LOGRING_ARGS_6_(__VA_ARGS__)
+#define RU_LOGRING_ARGS_8_(x, ...) , ru_logring_arg_(x) RU_LOGRING_ARGS_7_(__VA_ARGS__)
+
+// The leading 0 keeps the initializer non-empty when there are no arguments.
+#define RU_LOGRING_ARGS_(n, ...) \
+    ((const uint64_t[]) { 0 CONCAT(RU_LOGRING_ARGS_, CONCAT(n, _))(__VA_ARGS__) } + 1)
+
+#define ru_log_deferred(level, format, ...) \
+    ru_log_deferred_((level), format, RU_LOGRING_NARGS_(_, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0), \
+                     ##__VA_ARGS__)
+
+#define ru_log_deferred_(level, format, n, ...) \
+    do { \
+        if (ru_log_is_enabled(level)) { \
+            if (0) \
+                ru_logring_check_format_(format, ##__VA_ARGS__); \
+            \
+            ru_logring_write((level), "" format, (n), RU_LOGRING_ARGS_(n, ##__VA_ARGS__)); \
+        } \
+    } while (0)
+
+#define logv_deferred(fmt, ...) ru_log_deferred(RU_LOG_LEVEL_VERBOSE, fmt, ##__VA_ARGS__)
+#define logd_deferred(fmt, ...) ru_log_deferred(RU_LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,11 +1,18 @@
 #include <stdlib.h>
-#include <android_native_app_glue.h>
+#include <string.h>
+#include <strings.h>
 #include <jni.h>
 
+#ifdef ANDROID
+#include <android_native_app_glue.h>
+#endif
+
 // local
 #include "alloc.h"
 #include "ru_ndk.h"
 
+#ifdef ANDROID
+
 char *
 ru_activity_get_package_name(ANativeActivity *activity) {
    JavaVM *vm = activity->vm;
@@ -100,3 +107,166 @@ ru_activity_get_string_extra(ANativeActivity *activity, const char *name) {
 
    return result;
 }
+
+// Before API 29, MediaCodecInfo has no isHardwareAccelerated(). Fall back to
+// the platform's naming convention for its software codecs.
+static bool
+ru_codec_name_is_software(const char *name) {
+   return !strncmp(name, "OMX.google.", 11) ||
+          !strncmp(name, "c2.android.", 11) ||
+          strstr(name, ".sw.") != NULL;
+}
+
+static bool
+ru_jstring_equals_ignore_case(JNIEnv *env, jstring s0, const char *s1) {
+   const char *s0_chars = (*env)->GetStringUTFChars(env, s0, NULL);
+   if (!s0_chars)
+      abort();
+
+   bool eq = !strcasecmp(s0_chars, s1);
+
+   (*env)->ReleaseStringUTFChars(env, s0, s0_chars);
+
+   return eq;
+}
+
+RuCodecInfo *
+ru_media_codec_list_get_decoders(JavaVM *vm, const char *mime, size_t *count) {
+   JNIEnv *env;
+   jint err;
+
+   // The media threads are not attached to the VM, but the activity's thread
+   // is. Detach only if we attach.
+   bool attached = false;
+   err = (*vm)->GetEnv(vm, (void **) &env, JNI_VERSION_1_6);
+   if (err == JNI_EDETACHED) {
+      err = (*vm)->AttachCurrentThread(vm, &env, NULL);
+      if (err)
+         abort();
+      attached = true;
+   } else if (err) {
+      abort();
+   }
+
+   if ((*env)->PushLocalFrame(env, 16))
+      abort();
+
+   jclass list_class = (*env)->FindClass(env, "android/media/MediaCodecList");
+   if (!list_class)
+      abort();
+
+   jclass info_class = (*env)->FindClass(env, "android/media/MediaCodecInfo");
+   if (!info_class)
+      abort();
+
+   jmethodID mid_list_init = (*env)->GetMethodID(env, list_class, "<init>", "(I)V");
+   jmethodID mid_get_codec_infos = (*env)->GetMethodID(env, list_class, "getCodecInfos", "()[Landroid/media/MediaCodecInfo;");
+   jmethodID mid_get_name = (*env)->GetMethodID(env, info_class, "getName", "()Ljava/lang/String;");
+   jmethodID mid_is_encoder = (*env)->GetMethodID(env, info_class, "isEncoder", "()Z");
+   jmethodID mid_get_supported_types = (*env)->GetMethodID(env, info_class, "getSupportedTypes", "()[Ljava/lang/String;");
+   if (!mid_list_init || !mid_get_codec_infos || !mid_get_name ||
+       !mid_is_encoder || !mid_get_supported_types) {
+      abort();
+   }
+
+   // Since API 29.
+   jmethodID mid_is_hardware = (*env)->GetMethodID(env, info_class, "isHardwareAccelerated", "()Z");
+   if (!mid_is_hardware)
+      (*env)->ExceptionClear(env);
+
+   // MediaCodecList.REGULAR_CODECS
+   jobject list = (*env)->NewObject(env, list_class, mid_list_init, (jint) 0);
+   if (!list)
+      abort();
+
+   jobjectArray infos = (jobjectArray) (*env)->CallObjectMethod(env, list, mid_get_codec_infos);
+   if (!infos)
+      abort();
+
+   jsize n_infos = (*env)->GetArrayLength(env, infos);
+   RuCodecInfo *result = NULL;
+   size_t n_result = 0;
+
+   for (jsize i = 0; i < n_infos; ++i) {
+      // Each iteration creates local references. Release them before the
+      // next, because the list may be long.
+      if ((*env)->PushLocalFrame(env, 8))
+         abort();
+
+      jobject info = (*env)->GetObjectArrayElement(env, infos, i);
+      if (!info)
+         abort();
+
+      if ((*env)->CallBooleanMethod(env, info, mid_is_encoder))
+         goto next_info;
+
+      jobjectArray types = (jobjectArray) (*env)->CallObjectMethod(env, info, mid_get_supported_types);
+      if (!types)
+         abort();
+
+      bool supports_mime = false;
+      jsize n_types = (*env)->GetArrayLength(env, types);
+      for (jsize j = 0; j < n_types && !supports_mime; ++j) {
+         jstring type = (jstring) (*env)->GetObjectArrayElement(env, types, j);
+         supports_mime = ru_jstring_equals_ignore_case(env, type, mime);
+         (*env)->DeleteLocalRef(env, type);
+      }
+
+      if (!supports_mime)
+         goto next_info;
+
+      jstring name0 = (jstring) (*env)->CallObjectMethod(env, info, mid_get_name);
+      if (!name0)
+         abort();
+
+      const char *name1 = (*env)->GetStringUTFChars(env, name0, NULL);
+      if (!name1)
+         abort();
+
+      result = xreallocn(result, n_result + 1, sizeof(result[0]));
+      result[n_result] = (RuCodecInfo) {
+         .name = xstrdup(name1),
+         .is_hardware = mid_is_hardware
+            ? (*env)->CallBooleanMethod(env, info, mid_is_hardware)
+            : !ru_codec_name_is_software(name1),
+      };
+      ++n_result;
+
+      (*env)->ReleaseStringUTFChars(env, name0, name1);
+
+    next_info:
+      (*env)->PopLocalFrame(env, NULL);
+   }
+
+   (*env)->PopLocalFrame(env, NULL);
+
+   if (attached)
+      (*vm)->DetachCurrentThread(vm);
+
+   *count = n_result;
+   return result;
+}
+
+#else // ANDROID
+
+RuCodecInfo *
+ru_media_codec_list_get_decoders(JavaVM *vm, const char *mime, size_t *count) {
+   // The host has no MediaCodecList. Callers fall back to
+   // AMediaCodec_createDecoderByType().
+   (void) vm;
+   (void) mime;
+
+   *count = 0;
+   return NULL;
+}
+
+#endif // ANDROID
+
+void
+ru_codec_infos_free(RuCodecInfo *infos, size_t count) {
+   for (size_t i = 0; i < count; ++i) {
+      free(infos[i].name);
+   }
+
+   free(infos);
+}
@@ -1,11 +1,30 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <jni.h>
+
 #include "attribs.h"
 
 typedef struct ANativeActivity ANativeActivity;
 
+typedef struct RuCodecInfo {
+    char *name; // for AMediaCodec_createCodecByName
+    bool is_hardware;
+} RuCodecInfo;
+
 char * _malloc_ _must_use_result_
 ru_activity_get_package_name(ANativeActivity *activity);
 
 char * _malloc_ _must_use_result_
 ru_activity_get_string_extra(ANativeActivity *activity, const char *name);
+
+// List the decoders for the MIME type, in MediaCodecList order. Returns null
+// and sets *count to 0 if there are none. Free the result with
+// ru_codec_infos_free().
+RuCodecInfo * _must_use_result_
+ru_media_codec_list_get_decoders(JavaVM *vm, const char *mime, size_t *count);
+
+void
+ru_codec_infos_free(RuCodecInfo *infos, size_t count);
@@ -0,0 +1,409 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "log.h"
+#include "macros.h"
+#include "ru_math.h"
+#include "ru_pool.h"
+#include "ru_queue.h"
+#include "ru_thread.h"
+#include "ru_time.h"
+#include "ru_trace.h"
+
+typedef struct RuPoolEntry {
+    RuPoolJob job;
+    RuFuture *future; // may be null
+} RuPoolEntry;
+
+struct RuFuture {
+    // The pool holds one reference until the job completes, and the
+    // submitter holds the other until ru_future_free().
+    _Atomic uint32_t ref_count;
+    _Atomic bool is_done;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+typedef struct RuPoolWorker {
+    RuPool *pool;
+    uint32_t index;
+    pthread_t thread;
+    char name[16];
+
+    pthread_mutex_t mutex;
+    RuQueue deque; // RuPoolEntry; guarded by mutex
+
+    _Atomic int64_t busy_ns;
+} RuPoolWorker;
+
+struct RuPool {
+    uint32_t worker_count;
+    RuThreadClass thread_class;
+    RuPoolWorker workers[RU_POOL_MAX_WORKERS];
+
+    // Where the next job submitted from outside the pool goes.
+    _Atomic uint32_t next_worker;
+
+    // Changed only with a worker's mutex held, together with its deque. A
+    // nonzero depth means that some deque holds a job.
+    _Atomic uint32_t queue_depth;
+    _Atomic uint32_t max_queue_depth;
+
+    _Atomic uint64_t submit_count;
+    _Atomic uint64_t complete_count;
+    _Atomic uint64_t steal_count;
+
+    // Idle workers sleep on cond. A submitter signals only if sleeper_count
+    // is nonzero.
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    _Atomic uint32_t sleeper_count;
+    bool is_stopping; // guarded by mutex
+};
+
+// The worker that runs on this thread, if any.
+static _Thread_local RuPoolWorker *ru_pool_self;
+
+static void
+ru_future_unref(RuFuture *f) {
+    if (atomic_fetch_sub(&f->ref_count, 1) != 1)
+        return;
+
+    if (pthread_cond_destroy(&f->cond))
+        abort();
+
+    if (pthread_mutex_destroy(&f->mutex))
+        abort();
+
+    free(f);
+}
+
+static void
+ru_future_complete(RuFuture *f) {
+    {
+        ru_mutex_lock_scoped(&f->mutex);
+        atomic_store_explicit(&f->is_done, true, memory_order_release);
+
+        if (pthread_cond_broadcast(&f->cond))
+            abort();
+    }
+
+    ru_future_unref(f);
+}
+
+bool
+ru_future_is_done(RuFuture *f) {
+    return atomic_load_explicit(&f->is_done, memory_order_acquire);
+}
+
+void
+ru_future_wait(RuFuture *f) {
+    assert(!ru_pool_self);
+
+    if (ru_future_is_done(f))
+        return;
+
+    ru_mutex_lock_scoped(&f->mutex);
+
+    while (!atomic_load_explicit(&f->is_done, memory_order_relaxed)) {
+        if (pthread_cond_wait(&f->cond, &f->mutex))
+            abort();
+    }
+}
+
+void
+ru_future_free(RuFuture *f) {
+    if (!f)
+        return;
+
+    ru_future_unref(f);
+}
+
+// Pop the worker's newest job, else steal another worker's oldest.
+static bool
+ru_pool_take(RuPool *p, RuPoolWorker *w, RuPoolEntry *e) {
+    for (uint32_t i = 0; i < p->worker_count; ++i) {
+        RuPoolWorker *victim = &p->workers[(w->index + i) % p->worker_count];
+        bool ok;
+
+        {
+            ru_mutex_lock_scoped(&victim->mutex);
+            ok = victim == w ? ru_queue_pop_tail(&victim->deque, e)
+                             : ru_queue_pop(&victim->deque, e);
+            if (ok)
+                atomic_fetch_sub(&p->queue_depth, 1);
+        }
+
+        if (ok) {
+            if (victim != w)
+                atomic_fetch_add_explicit(&p->steal_count, 1, memory_order_relaxed);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+ru_pool_run(RuPool *p, RuPoolWorker *w, RuPoolEntry *e) {
+    int64_t begin_ns = ru_time_now_ns();
+
+    {
+        ru_trace_scoped("pool job");
+        e->job.run(e->job.context);
+
+        if (e->job.on_done)
+            e->job.on_done(e->job.context);
+    }
+
+    atomic_fetch_add_explicit(&w->busy_ns, ru_time_now_ns() - begin_ns,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&p->complete_count, 1, memory_order_relaxed);
+
+    if (e->future)
+        ru_future_complete(e->future);
+}
+
+static void *
+ru_pool_worker_main(void *_worker) {
+    RuPoolWorker *w = _worker;
+    RuPool *p = w->pool;
+
+    ru_pool_self = w;
+    ru_thread_apply(p->thread_class, w->name);
+
+    for (;;) {
+        RuPoolEntry e;
+
+        if (ru_pool_take(p, w, &e)) {
+            ru_pool_run(p, w, &e);
+            continue;
+        }
+
+        ru_mutex_lock_scoped(&p->mutex);
+
+        // Pairs with the submitter's increment of queue_depth and load of
+        // sleeper_count. Either the submitter sees this sleeper and signals,
+        // or this sleeper sees the job.
+        atomic_fetch_add(&p->sleeper_count, 1);
+
+        while (atomic_load(&p->queue_depth) == 0 && !p->is_stopping) {
+            if (pthread_cond_wait(&p->cond, &p->mutex))
+                abort();
+        }
+
+        atomic_fetch_sub(&p->sleeper_count, 1);
+
+        // Finish every queued job before stopping, including jobs that
+        // other jobs submitted.
+        if (p->is_stopping && atomic_load(&p->queue_depth) == 0)
+            break;
+    }
+
+    return NULL;
+}
+
+RuPool *
+ru_pool_new_s(struct ru_pool_new_args args) {
+    uint32_t worker_count = args.worker_count;
+
+    if (!worker_count) {
+        long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = nproc > 1 ? (uint32_t) (nproc - 1) : 1;
+    }
+
+    worker_count = ru_min(worker_count, RU_POOL_MAX_WORKERS);
+
+    const char *thread_name = args.thread_name ? args.thread_name : "ru-pool";
+
+    let p = new0(RuPool);
+    p->worker_count = worker_count;
+    p->thread_class = args.thread_class;
+
+    if (pthread_mutex_init(&p->mutex, NULL))
+        abort();
+
+    if (pthread_cond_init(&p->cond, NULL))
+        abort();
+
+    for (uint32_t i = 0; i < worker_count; ++i) {
+        RuPoolWorker *w = &p->workers[i];
+        w->pool = p;
+        w->index = i;
+        snprintf(w->name, sizeof(w->name), "%s-%u", thread_name, i);
+
+        if (pthread_mutex_init(&w->mutex, NULL))
+            abort();
+
+        ru_queue_init(&w->deque, sizeof(RuPoolEntry), 8);
+    }
+
+    // Start the workers only once every deque exists, because each may
+    // steal from all.
+    for (uint32_t i = 0; i < worker_count; ++i) {
+        RuPoolWorker *w = &p->workers[i];
+
+        if (pthread_create(&w->thread, NULL, ru_pool_worker_main, w))
+            abort();
+    }
+
+    logd("pool %s: %u workers", thread_name, worker_count);
+
+    return p;
+}
+
+void
+ru_pool_free(RuPool *p) {
+    if (!p)
+        return;
+
+    assert(!ru_pool_self || ru_pool_self->pool != p);
+
+    {
+        ru_mutex_lock_scoped(&p->mutex);
+        p->is_stopping = true;
+
+        if (pthread_cond_broadcast(&p->cond))
+            abort();
+    }
+
+    for (uint32_t i = 0; i < p->worker_count; ++i) {
+        if (pthread_join(p->workers[i].thread, NULL))
+            abort();
+    }
+
+    // Only now, because a worker may steal from any deque until it exits.
+    for (uint32_t i = 0; i < p->worker_count; ++i) {
+        RuPoolWorker *w = &p->workers[i];
+
+        assert(ru_queue_is_empty(&w->deque));
+        ru_queue_finish(&w->deque);
+
+        if (pthread_mutex_destroy(&w->mutex))
+            abort();
+    }
+
+    if (pthread_cond_destroy(&p->cond))
+        abort();
+
+    if (pthread_mutex_destroy(&p->mutex))
+        abort();
+
+    free(p);
+}
+
+static void
+ru_pool_push(RuPool *p, RuPoolEntry *e) {
+    RuPoolWorker *w = ru_pool_self;
+
+    if (!w || w->pool != p) {
+        uint32_t i = atomic_fetch_add_explicit(&p->next_worker, 1,
+                                               memory_order_relaxed);
+        w = &p->workers[i % p->worker_count];
+    }
+
+    {
+        ru_mutex_lock_scoped(&w->mutex);
+        ru_queue_push(&w->deque, e);
+
+        uint32_t depth = atomic_fetch_add(&p->queue_depth, 1) + 1;
+        uint32_t max_depth = atomic_load_explicit(&p->max_queue_depth,
+                                                  memory_order_relaxed);
+
+        while (depth > max_depth &&
+               !atomic_compare_exchange_weak_explicit(&p->max_queue_depth,
+                                                      &max_depth, depth,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+            // max_depth was reloaded
+        }
+    }
+
+    atomic_fetch_add_explicit(&p->submit_count, 1, memory_order_relaxed);
+
+    if (atomic_load(&p->sleeper_count) > 0) {
+        ru_mutex_lock_scoped(&p->mutex);
+
+        if (pthread_cond_signal(&p->cond))
+            abort();
+    }
+}
+
+void
+ru_pool_submit(RuPool *p, RuPoolJob job) {
+    assert(job.run);
+
+    ru_pool_push(p, &(RuPoolEntry) { .job = job });
+}
+
+RuFuture *
+ru_pool_submit_future(RuPool *p, RuPoolJob job) {
+    assert(job.run);
+
+    let f = new0(RuFuture);
+    atomic_init(&f->ref_count, 2);
+    atomic_init(&f->is_done, false);
+
+    if (pthread_mutex_init(&f->mutex, NULL))
+        abort();
+
+    if (pthread_cond_init(&f->cond, NULL))
+        abort();
+
+    ru_pool_push(p, &(RuPoolEntry) { .job = job, .future = f });
+
+    return f;
+}
+
+void
+ru_pool_get_stats(RuPool *p, RuPoolStats *stats) {
+    *stats = (RuPoolStats) {
+        .worker_count = p->worker_count,
+        .queue_depth = atomic_load_explicit(&p->queue_depth, memory_order_relaxed),
+        .max_queue_depth = atomic_load_explicit(&p->max_queue_depth, memory_order_relaxed),
+        .submit_count = atomic_load_explicit(&p->submit_count, memory_order_relaxed),
+        .complete_count = atomic_load_explicit(&p->complete_count, memory_order_relaxed),
+        .steal_count = atomic_load_explicit(&p->steal_count, memory_order_relaxed),
+    };
+
+    for (uint32_t i = 0; i < p->worker_count; ++i) {
+        stats->busy_ns += atomic_load_explicit(&p->workers[i].busy_ns,
+                                               memory_order_relaxed);
+    }
+}
@@ -0,0 +1,104 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+// A fixed set of worker threads that run one-off jobs, so that a subsystem
+// can move heavy work off its own thread without creating a thread for it.
+//
+// Each worker owns a deque. A job submitted from a worker goes to that
+// worker's deque, and one submitted from elsewhere goes to the deques in
+// turn. A worker runs its newest job first, and once its deque is empty it
+// steals the oldest job from another worker's, before it sleeps.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "attribs.h"
+#include "ru_thread.h"
+
+#define RU_POOL_MAX_WORKERS 8
+
+typedef struct RuPool RuPool;
+typedef struct RuFuture RuFuture;
+
+typedef struct RuPoolJob {
+    void *context;
+
+    // Called on a worker.
+    void (*run)(void *context);
+
+    // Called on the same worker once run returns, before the job's future
+    // completes. May be null.
+    void (*on_done)(void *context);
+} RuPoolJob;
+
+typedef struct RuPoolStats {
+    uint32_t worker_count;
+    uint32_t queue_depth; // jobs queued and not yet started
+    uint32_t max_queue_depth;
+    uint64_t submit_count;
+    uint64_t complete_count;
+    uint64_t steal_count; // jobs that a worker took from another's deque
+
+    // Time the workers spent in jobs, summed over the workers.
+    int64_t busy_ns;
+} RuPoolStats;
+
+struct ru_pool_new_args {
+    // Default is the number of online CPUs less one, at least 1 and at most
+    // RU_POOL_MAX_WORKERS.
+    uint32_t worker_count;
+
+    const char *thread_name; // default="ru-pool"; workers append their index
+    RuThreadClass thread_class; // default=RU_THREAD_CLASS_RENDER
+};
+
+#define ru_pool_new(...) ru_pool_new_s((struct ru_pool_new_args) { 0, __VA_ARGS__ })
+RuPool *ru_pool_new_s(struct ru_pool_new_args args) _malloc_ _must_use_result_;
+
+// Runs the queued jobs, then joins the workers. Call from outside the pool.
+void ru_pool_free(RuPool *p);
+
+// Thread-safe, including from a job.
+void ru_pool_submit(RuPool *p, RuPoolJob job);
+
+// As ru_pool_submit(), but also return a future that completes after the
+// job's on_done. Free it with ru_future_free().
+RuFuture *ru_pool_submit_future(RuPool *p, RuPoolJob job) _must_use_result_;
+
+bool ru_future_is_done(RuFuture *f) _must_use_result_;
+
+// Blocks until the future completes. Do not call from a job: every worker
+// could end up waiting on a job that no worker is left to run.
+void ru_future_wait(RuFuture *f);
+
+// The job may still be running; it then completes unobserved.
+void ru_future_free(RuFuture *f);
+
+// Thread-safe.
+void ru_pool_get_stats(RuPool *p, RuPoolStats *stats);
@@ -46,8 +46,11 @@ ru_queue_grow(RuQueue *q, size_t elem_count) {
 
     let old_mod = q->mod;
 
+    // If the elements wrap, then the ones in [0, tail) move to just past the
+    // old end. The new space must hold them, and the new tail must stay
+    // below the new modulus.
     if (q->tail < q->head)
-        elem_count = ru_max(elem_count, q->tail);
+        elem_count = ru_max(elem_count, q->tail + 1);
 
     if (__builtin_add_overflow(q->mod, elem_count, &q->mod))
         oom();
@@ -102,6 +105,24 @@ ru_queue_pop(RuQueue *q, void *elem) {
     return true;
 }
 
+// Pop the newest element instead of the oldest. Return false if queue is
+// empty.
+bool
+ru_queue_pop_tail(RuQueue *q, void *elem) {
+    ru_queue_check(q);
+
+    if (ru_queue_is_empty(q))
+        return false;
+
+    q->tail = (q->tail + q->mod - 1) % q->mod;
+
+    if (elem) {
+        memcpy(elem, q->elems + q->tail * q->elem_size, q->elem_size);
+    }
+
+    return true;
+}
+
 // Return false if queue is empty.
 bool
 ru_queue_peek(RuQueue *q, void *elem) {
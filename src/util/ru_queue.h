@@ -16,6 +16,7 @@ void ru_queue_finish(RuQueue *q);
 void ru_queue_grow(RuQueue *q, size_t elem_count);
 void ru_queue_push(RuQueue *q, void *elem);
 bool ru_queue_pop(RuQueue *q, void *elem) _must_use_result_;
+bool ru_queue_pop_tail(RuQueue *q, void *elem) _must_use_result_;
 bool ru_queue_peek(RuQueue *q, void *elem) _must_use_result_;
 
 static inline size_t _must_use_result_
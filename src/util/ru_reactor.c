@@ -0,0 +1,392 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "check.h"
+#include "log.h"
+#include "macros.h"
+#include "ru_math.h"
+#include "ru_reactor.h"
+#include "ru_thread.h"
+#include "ru_time.h"
+
+// epoll_event::data of the reactor's own fds. Sources use their index.
+#define RU_REACTOR_TAG_STOP UINT32_MAX
+#define RU_REACTOR_TAG_TIMER (UINT32_MAX - 1)
+
+struct RuReactorSource {
+    RuReactor *reactor;
+    RuReactorHandler handler;
+    int event_fd; // -1 if the slot is free
+
+    // Set by the first wake after a dispatch begins, so that later wakes
+    // need not write event_fd.
+    _Atomic bool is_woken;
+
+    int64_t deadline_ns; // Zero if none. Only the reactor thread touches it.
+
+    // Guarded by RuReactor::mutex.
+    bool is_active;
+    bool is_dispatching;
+};
+
+struct RuReactor {
+    int epoll_fd;
+    int stop_fd; // eventfd
+    int timer_fd;
+    pthread_t thread;
+    RuThreadClass thread_class;
+    char thread_name[16];
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // signaled when a dispatch returns
+    RuReactorSource sources[RU_REACTOR_MAX_SOURCES];
+
+    _Atomic uint64_t dispatch_count;
+    _Atomic uint64_t wake_count;
+    _Atomic uint64_t wake_write_count;
+};
+
+static void
+ru_reactor_epoll_add(RuReactor *r, int fd, uint32_t tag) {
+    struct epoll_event ev = {
+        .events = EPOLLIN,
+        .data.u32 = tag,
+    };
+
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+        die("epoll_ctl(EPOLL_CTL_ADD) failed: errno=%d", errno);
+}
+
+static void
+ru_reactor_drain_fd(int fd) {
+    uint64_t count;
+
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        die("reactor: read failed: errno=%d", errno);
+}
+
+// Arm the timer for the earliest deadline, or disarm it.
+static void
+ru_reactor_arm_timer(RuReactor *r) {
+    int64_t deadline_ns = 0;
+
+    {
+        ru_mutex_lock_scoped(&r->mutex);
+
+        for (uint32_t i = 0; i < RU_REACTOR_MAX_SOURCES; ++i) {
+            const RuReactorSource *src = &r->sources[i];
+
+            if (src->is_active && src->deadline_ns &&
+                (!deadline_ns || src->deadline_ns < deadline_ns)) {
+                deadline_ns = src->deadline_ns;
+            }
+        }
+    }
+
+    // A zero it_value disarms the timer.
+    struct itimerspec spec = {
+        .it_value = {
+            .tv_sec = deadline_ns / RU_NSEC_PER_SEC,
+            .tv_nsec = deadline_ns % RU_NSEC_PER_SEC,
+        },
+    };
+
+    if (timerfd_settime(r->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL))
+        die("timerfd_settime failed: errno=%d", errno);
+}
+
+static void *
+ru_reactor_thread(void *_reactor) {
+    RuReactor *r = _reactor;
+
+    ru_thread_apply(r->thread_class, r->thread_name);
+    logd("reactor: start thread tid=%d", gettid());
+
+    for (;;) {
+        ru_reactor_arm_timer(r);
+
+        struct epoll_event evs[RU_REACTOR_MAX_SOURCES + 2];
+        int n = epoll_wait(r->epoll_fd, evs, ARRAY_LEN(evs), /*timeout*/ -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            die("epoll_wait failed: errno=%d", errno);
+        }
+
+        bool is_woken[RU_REACTOR_MAX_SOURCES] = { false };
+
+        for (int i = 0; i < n; ++i) {
+            const uint32_t tag = evs[i].data.u32;
+
+            switch (tag) {
+                case RU_REACTOR_TAG_STOP:
+                    return NULL;
+                case RU_REACTOR_TAG_TIMER:
+                    ru_reactor_drain_fd(r->timer_fd);
+                    break;
+                default:
+                    assert(tag < RU_REACTOR_MAX_SOURCES);
+                    is_woken[tag] = true;
+                    break;
+            }
+        }
+
+        const int64_t now_ns = ru_time_now_ns();
+
+        for (uint32_t i = 0; i < RU_REACTOR_MAX_SOURCES; ++i) {
+            RuReactorSource *src = &r->sources[i];
+
+            {
+                ru_mutex_lock_scoped(&r->mutex);
+
+                if (!src->is_active)
+                    continue;
+
+                bool is_due = src->deadline_ns && src->deadline_ns <= now_ns;
+                if (!is_woken[i] && !is_due)
+                    continue;
+
+                src->is_dispatching = true;
+            }
+
+            if (is_woken[i]) {
+                ru_reactor_drain_fd(src->event_fd);
+
+                // The exchange pairs with the one in ru_reactor_source_wake().
+                // A wake that saw is_woken set happened before this, so the
+                // handler sees the work it queued.
+                (void) atomic_exchange(&src->is_woken, false);
+            }
+
+            src->deadline_ns = 0;
+            atomic_fetch_add_explicit(&r->dispatch_count, 1, memory_order_relaxed);
+            src->handler.dispatch(src->handler.context);
+
+            {
+                ru_mutex_lock_scoped(&r->mutex);
+                src->is_dispatching = false;
+
+                if (pthread_cond_broadcast(&r->cond))
+                    abort();
+            }
+        }
+    }
+}
+
+RuReactor *
+ru_reactor_new(const char *thread_name, RuThreadClass thread_class) {
+    let r = new0(RuReactor);
+
+    r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epoll_fd < 0)
+        die("epoll_create1 failed: errno=%d", errno);
+
+    r->stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (r->stop_fd < 0)
+        die("eventfd failed: errno=%d", errno);
+
+    r->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (r->timer_fd < 0)
+        die("timerfd_create failed: errno=%d", errno);
+
+    ru_reactor_epoll_add(r, r->stop_fd, RU_REACTOR_TAG_STOP);
+    ru_reactor_epoll_add(r, r->timer_fd, RU_REACTOR_TAG_TIMER);
+
+    if (pthread_mutex_init(&r->mutex, NULL))
+        abort();
+
+    if (pthread_cond_init(&r->cond, NULL))
+        abort();
+
+    for (uint32_t i = 0; i < RU_REACTOR_MAX_SOURCES; ++i)
+        r->sources[i].event_fd = -1;
+
+    r->thread_class = thread_class;
+    snprintf(r->thread_name, sizeof(r->thread_name), "%s", thread_name);
+
+    if (pthread_create(&r->thread, NULL, ru_reactor_thread, r))
+        abort();
+
+    return r;
+}
+
+void
+ru_reactor_free(RuReactor *r) {
+    if (!r)
+        return;
+
+    uint64_t one = 1;
+    if (write(r->stop_fd, &one, sizeof(one)) != sizeof(one))
+        die("reactor: write failed: errno=%d", errno);
+
+    if (pthread_join(r->thread, NULL))
+        abort();
+
+    for (uint32_t i = 0; i < RU_REACTOR_MAX_SOURCES; ++i)
+        assert(r->sources[i].event_fd < 0);
+
+    close(r->timer_fd);
+    close(r->stop_fd);
+    close(r->epoll_fd);
+
+    if (pthread_cond_destroy(&r->cond))
+        abort();
+
+    if (pthread_mutex_destroy(&r->mutex))
+        abort();
+
+    free(r);
+}
+
+RuReactorSource *
+ru_reactor_add(RuReactor *r, RuReactorHandler handler) {
+    ru_mutex_lock_scoped(&r->mutex);
+
+    for (uint32_t i = 0; i < RU_REACTOR_MAX_SOURCES; ++i) {
+        RuReactorSource *src = &r->sources[i];
+
+        if (src->event_fd >= 0)
+            continue;
+
+        src->reactor = r;
+        src->handler = handler;
+        src->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (src->event_fd < 0)
+            die("eventfd failed: errno=%d", errno);
+
+        atomic_init(&src->is_woken, false);
+        src->deadline_ns = 0;
+        src->is_active = true;
+        src->is_dispatching = false;
+
+        ru_reactor_epoll_add(r, src->event_fd, i);
+        return src;
+    }
+
+    die("reactor: too many sources");
+}
+
+void
+ru_reactor_remove(RuReactor *r, RuReactorSource *src) {
+    ru_mutex_lock_scoped(&r->mutex);
+
+    assert(src->is_active);
+    src->is_active = false;
+
+    while (src->is_dispatching) {
+        if (pthread_cond_wait(&r->cond, &r->mutex))
+            abort();
+    }
+
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, src->event_fd, NULL))
+        die("epoll_ctl(EPOLL_CTL_DEL) failed: errno=%d", errno);
+
+    close(src->event_fd);
+    src->event_fd = -1;
+}
+
+void
+ru_reactor_source_wake(RuReactorSource *src) {
+    RuReactor *r = src->reactor;
+
+    atomic_fetch_add_explicit(&r->wake_count, 1, memory_order_relaxed);
+
+    if (atomic_exchange(&src->is_woken, true))
+        return;
+
+    atomic_fetch_add_explicit(&r->wake_write_count, 1, memory_order_relaxed);
+
+    uint64_t one = 1;
+    if (write(src->event_fd, &one, sizeof(one)) != sizeof(one))
+        die("reactor: write failed: errno=%d", errno);
+}
+
+void
+ru_reactor_source_schedule(RuReactorSource *src, int64_t ns) {
+    // Zero means no deadline.
+    src->deadline_ns = ru_max(ns, INT64_C(1));
+}
+
+void
+ru_reactor_get_stats(RuReactor *r, RuReactorStats *stats) {
+    *stats = (RuReactorStats) {
+        .dispatch_count = atomic_load(&r->dispatch_count),
+        .wake_count = atomic_load(&r->wake_count),
+        .wake_write_count = atomic_load(&r->wake_write_count),
+    };
+}
+
+void
+ru_reactor_link_init(RuReactorLink *link) {
+    atomic_init(&link->source, NULL);
+    atomic_init(&link->waker_count, 0);
+}
+
+void
+ru_reactor_link_set(RuReactorLink *link, RuReactorSource *src) {
+    atomic_store(&link->source, src);
+}
+
+void
+ru_reactor_link_wake(RuReactorLink *link) {
+    // Count the wake before loading the source. Both are sequentially
+    // consistent, as are the clear's store and load in the other order, so
+    // either the clear sees the count or the wake sees null.
+    atomic_fetch_add(&link->waker_count, 1);
+
+    RuReactorSource *src = atomic_load(&link->source);
+    if (src)
+        ru_reactor_source_wake(src);
+
+    atomic_fetch_sub(&link->waker_count, 1);
+}
+
+RuReactorSource *
+ru_reactor_link_clear(RuReactorLink *link) {
+    RuReactorSource *src = atomic_exchange(&link->source, NULL);
+
+    // A wake in flight holds the count for one eventfd write at most.
+    while (atomic_load(&link->waker_count) > 0)
+        sched_yield();
+
+    return src;
+}
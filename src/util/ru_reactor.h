@@ -0,0 +1,109 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+// Runs the handlers of several event sources on one thread, which sleeps in
+// epoll_wait() while no source has work.
+//
+// Each source owns an eventfd. Other threads wake the source after they queue
+// work for it, and the reactor then dispatches the source's handler. Wakes
+// coalesce: while a source is already woken and not yet dispatched, further
+// wakes cost no syscall. A handler may also ask to be dispatched again at a
+// deadline, which the reactor waits for with a timerfd.
+//
+// The sources share the thread, so a handler should do what work it can
+// without blocking and return.
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "attribs.h"
+#include "ru_thread.h"
+
+#define RU_REACTOR_MAX_SOURCES 8
+
+typedef struct RuReactor RuReactor;
+typedef struct RuReactorSource RuReactorSource;
+
+typedef struct RuReactorHandler {
+    void *context;
+
+    // Called on the reactor thread after ru_reactor_source_wake(), or once
+    // the deadline of ru_reactor_source_schedule() passes.
+    void (*dispatch)(void *context);
+} RuReactorHandler;
+
+typedef struct RuReactorStats {
+    uint64_t dispatch_count;
+    uint64_t wake_count; // calls to ru_reactor_source_wake()
+    uint64_t wake_write_count; // wakes that wrote the eventfd
+} RuReactorStats;
+
+// Starts the reactor thread, named thread_name, under the policy of
+// thread_class.
+RuReactor *ru_reactor_new(const char *thread_name, RuThreadClass thread_class)
+    _malloc_ _must_use_result_;
+
+// Stops and joins the reactor thread. Remove all sources first.
+void ru_reactor_free(RuReactor *r);
+
+// Thread-safe.
+RuReactorSource *ru_reactor_add(RuReactor *r, RuReactorHandler handler) _must_use_result_;
+
+// When this returns, the handler is not running and will not run again.
+// Thread-safe, but must not be called from the source's own handler.
+void ru_reactor_remove(RuReactor *r, RuReactorSource *src);
+
+// Dispatch the source's handler soon. Thread-safe.
+void ru_reactor_source_wake(RuReactorSource *src);
+
+// Dispatch the source's handler once ru_time_now_ns() reaches ns, unless a
+// wake dispatches it first. Each dispatch clears the deadline. Call only from
+// the source's handler.
+void ru_reactor_source_schedule(RuReactorSource *src, int64_t ns);
+
+void ru_reactor_get_stats(RuReactor *r, RuReactorStats *stats);
+
+// Lets other threads wake a source that its owner may remove while they run.
+// The owner clears the link before ru_reactor_remove(), and the clear waits
+// for every wake in flight, so no wake writes an eventfd that the remove
+// closed.
+typedef struct RuReactorLink {
+    _Atomic(RuReactorSource *) source; // null until set, and once cleared
+    _Atomic uint32_t waker_count; // wakes in flight
+} RuReactorLink;
+
+void ru_reactor_link_init(RuReactorLink *link);
+void ru_reactor_link_set(RuReactorLink *link, RuReactorSource *src);
+
+// Wake the linked source, if any. Thread-safe.
+void ru_reactor_link_wake(RuReactorLink *link);
+
+// Unlink the source and return it, once no ru_reactor_link_wake() can touch
+// it. Thread-safe, but must not be called from a wake.
+RuReactorSource *ru_reactor_link_clear(RuReactorLink *link) _must_use_result_;
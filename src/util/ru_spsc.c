@@ -0,0 +1,163 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <string.h>
+
+#include "alloc.h"
+#include "ru_spsc.h"
+#include "ru_thread.h"
+
+void
+ru_spsc_init(RuSpsc *q, size_t elem_size, size_t capacity) {
+    if (capacity == 0)
+        abort();
+
+    q->elems = new_array(char, elem_size * capacity);
+    q->elem_size = elem_size;
+    q->capacity = capacity;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->waiters, 0);
+
+    if (pthread_mutex_init(&q->mutex, NULL))
+        abort();
+
+    if (pthread_cond_init(&q->cond, NULL))
+        abort();
+}
+
+void
+ru_spsc_finish(RuSpsc *q) {
+    if (pthread_mutex_destroy(&q->mutex))
+        abort();
+
+    if (pthread_cond_destroy(&q->cond))
+        abort();
+
+    free(q->elems);
+}
+
+// Wake the other side if it sleeps. The fence orders the caller's update of
+// its index before the load of waiters; ru_spsc_wait() orders the
+// increment of waiters before its recheck of the index. So either the
+// sleeper sees the update, or we see the sleeper.
+static void
+ru_spsc_wake(RuSpsc *q) {
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(&q->waiters, memory_order_relaxed) == 0)
+        return;
+
+    ru_mutex_lock_scoped(&q->mutex);
+
+    if (pthread_cond_broadcast(&q->cond))
+        abort();
+}
+
+static bool _must_use_result_
+ru_spsc_is_full(RuSpsc *q) {
+    return atomic_load_explicit(&q->tail, memory_order_relaxed) -
+           atomic_load_explicit(&q->head, memory_order_acquire) == q->capacity;
+}
+
+static bool _must_use_result_
+ru_spsc_is_empty(RuSpsc *q) {
+    return atomic_load_explicit(&q->tail, memory_order_acquire) ==
+           atomic_load_explicit(&q->head, memory_order_relaxed);
+}
+
+// Sleep until is_ready() holds.
+static void
+ru_spsc_wait(RuSpsc *q, bool (*is_ready)(RuSpsc *q)) {
+    ru_mutex_lock_scoped(&q->mutex);
+
+    atomic_fetch_add_explicit(&q->waiters, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    while (!is_ready(q)) {
+        if (pthread_cond_wait(&q->cond, &q->mutex))
+            abort();
+    }
+
+    atomic_fetch_sub_explicit(&q->waiters, 1, memory_order_relaxed);
+}
+
+static bool _must_use_result_
+ru_spsc_is_not_full(RuSpsc *q) {
+    return !ru_spsc_is_full(q);
+}
+
+static bool _must_use_result_
+ru_spsc_is_not_empty(RuSpsc *q) {
+    return !ru_spsc_is_empty(q);
+}
+
+bool
+ru_spsc_try_push(RuSpsc *q, const void *elem) {
+    if (ru_spsc_is_full(q))
+        return false;
+
+    const size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    memcpy((char *) q->elems + (tail % q->capacity) * q->elem_size, elem,
+           q->elem_size);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+
+    ru_spsc_wake(q);
+    return true;
+}
+
+// Blocks until the queue has room.
+void
+ru_spsc_push_wait(RuSpsc *q, const void *elem) {
+    while (!ru_spsc_try_push(q, elem))
+        ru_spsc_wait(q, ru_spsc_is_not_full);
+}
+
+bool
+ru_spsc_try_pop(RuSpsc *q, void *elem) {
+    if (ru_spsc_is_empty(q))
+        return false;
+
+    const size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    if (elem) {
+        memcpy(elem, (char *) q->elems + (head % q->capacity) * q->elem_size,
+               q->elem_size);
+    }
+
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+    ru_spsc_wake(q);
+    return true;
+}
+
+// Blocks until the queue is non-empty.
+void
+ru_spsc_pop_wait(RuSpsc *q, void *elem) {
+    while (!ru_spsc_try_pop(q, elem))
+        ru_spsc_wait(q, ru_spsc_is_not_empty);
+}
@@ -0,0 +1,75 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "attribs.h"
+
+#define RU_SPSC_CACHE_LINE_SIZE 64
+
+// A bounded queue between exactly one producer thread and one consumer
+// thread. Unlike RuChan, the non-blocking calls take no lock: each side owns
+// one index and only reads the other's. The blocking calls sleep on a
+// condition variable, which the other side signals only if someone sleeps.
+//
+// The indices sit on separate cache lines, padded by hand because the struct
+// may live in memory from malloc().
+typedef struct RuSpsc {
+    void *elems; // array of elements; size is `elem_size * capacity`.
+    size_t elem_size;
+    size_t capacity;
+
+    // Count the elements popped and pushed since init. Only the consumer
+    // writes head, and only the producer writes tail.
+    char pad0[RU_SPSC_CACHE_LINE_SIZE];
+    _Atomic size_t head;
+    char pad1[RU_SPSC_CACHE_LINE_SIZE - sizeof(size_t)];
+    _Atomic size_t tail;
+    char pad2[RU_SPSC_CACHE_LINE_SIZE - sizeof(size_t)];
+
+    // Threads blocked in ru_spsc_push_wait() or ru_spsc_pop_wait().
+    _Atomic uint32_t waiters;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} RuSpsc;
+
+void ru_spsc_init(RuSpsc *q, size_t elem_size, size_t capacity);
+void ru_spsc_finish(RuSpsc *q);
+
+// Call only on the producer thread.
+bool ru_spsc_try_push(RuSpsc *q, const void *elem) _must_use_result_;
+void ru_spsc_push_wait(RuSpsc *q, const void *elem);
+
+// Call only on the consumer thread.
+bool ru_spsc_try_pop(RuSpsc *q, void *elem) _must_use_result_;
+void ru_spsc_pop_wait(RuSpsc *q, void *elem);
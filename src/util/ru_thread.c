@@ -0,0 +1,320 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "log.h"
+#include "macros.h"
+#include "ru_thread.h"
+
+#define RU_THREAD_SYSFS_CPU_DIR "/sys/devices/system/cpu"
+
+// Android's THREAD_PRIORITY_URGENT_DISPLAY and THREAD_PRIORITY_DISPLAY.
+static RuThreadPolicy policies[RU_THREAD_CLASS_COUNT] = {
+    [RU_THREAD_CLASS_RENDER] = { .cores = RU_THREAD_CORES_BIG, .nice = -8 },
+    [RU_THREAD_CLASS_MEDIA] = { .cores = RU_THREAD_CORES_LITTLE, .nice = -4 },
+    [RU_THREAD_CLASS_IO] = { .cores = RU_THREAD_CORES_LITTLE, .nice = 0 },
+};
+
+static pthread_mutex_t policies_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static RuCpuTopology topology;
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+static const char *
+ru_thread_cores_to_str(RuThreadCores cores) {
+    switch (cores) {
+        case RU_THREAD_CORES_ANY: return "any";
+        case RU_THREAD_CORES_BIG: return "big";
+        case RU_THREAD_CORES_LITTLE: return "little";
+    }
+
+    return "?";
+}
+
+const char *
+ru_thread_class_to_str(RuThreadClass c) {
+    switch (c) {
+        case RU_THREAD_CLASS_RENDER: return "render";
+        case RU_THREAD_CLASS_MEDIA: return "media";
+        case RU_THREAD_CLASS_IO: return "io";
+        case RU_THREAD_CLASS_COUNT: break;
+    }
+
+    return "?";
+}
+
+bool
+ru_cpu_topology_read(const char *sysfs_cpu_dir, RuCpuTopology *t) {
+    *t = (RuCpuTopology) { 0 };
+
+    // Offline CPUs keep their directories, so try every index rather than
+    // stop at the first gap.
+    for (uint32_t cpu = 0; cpu < RU_THREAD_MAX_CPUS; ++cpu) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/cpu%u/cpu_capacity", sysfs_cpu_dir, cpu);
+
+        FILE *f = fopen(path, "r");
+        if (!f)
+            continue;
+
+        unsigned capacity;
+        if (fscanf(f, "%u", &capacity) == 1 && capacity > 0) {
+            t->capacities[cpu] = capacity;
+
+            if (t->min_capacity == 0 || capacity < t->min_capacity)
+                t->min_capacity = capacity;
+            if (capacity > t->max_capacity)
+                t->max_capacity = capacity;
+        }
+
+        fclose(f);
+    }
+
+    return t->min_capacity > 0;
+}
+
+bool
+ru_cpu_topology_get_cpus(const RuCpuTopology *t, RuThreadCores cores,
+                         cpu_set_t *set) {
+    CPU_ZERO(set);
+
+    uint32_t known_count = 0;
+    uint32_t count = 0;
+
+    for (uint32_t cpu = 0; cpu < RU_THREAD_MAX_CPUS; ++cpu) {
+        uint32_t capacity = t->capacities[cpu];
+        if (capacity == 0)
+            continue;
+
+        known_count += 1;
+
+        bool is_match;
+        switch (cores) {
+            case RU_THREAD_CORES_BIG:
+                is_match = capacity > t->min_capacity;
+                break;
+            case RU_THREAD_CORES_LITTLE:
+                is_match = capacity == t->min_capacity;
+                break;
+            case RU_THREAD_CORES_ANY:
+            default:
+                is_match = true;
+                break;
+        }
+
+        if (is_match) {
+            CPU_SET(cpu, set);
+            count += 1;
+        }
+    }
+
+    if (count == 0 || count == known_count) {
+        CPU_ZERO(set);
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+ru_thread_parse_cores(const char *s, RuThreadCores *cores) {
+    if (!strcmp(s, "any")) {
+        *cores = RU_THREAD_CORES_ANY;
+    } else if (!strcmp(s, "big")) {
+        *cores = RU_THREAD_CORES_BIG;
+    } else if (!strcmp(s, "little")) {
+        *cores = RU_THREAD_CORES_LITTLE;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+ru_thread_parse_priority(const char *s, RuThreadPolicy *p) {
+    char *end;
+
+    p->keep_priority = false;
+    p->nice = 0;
+    p->rt_priority = 0;
+
+    if (!strcmp(s, "keep")) {
+        p->keep_priority = true;
+        return true;
+    }
+
+    if (!strncmp(s, "rt", 2)) {
+        long prio = strtol(s + 2, &end, 10);
+        if (end == s + 2 || *end || prio < 1 || prio > 99)
+            return false;
+
+        p->rt_priority = prio;
+        return true;
+    }
+
+    long nice = strtol(s, &end, 10);
+    if (end == s || *end || nice < -20 || nice > 19)
+        return false;
+
+    p->nice = nice;
+    return true;
+}
+
+bool
+ru_thread_set_policies(const char *spec) {
+    RuThreadPolicy new_policies[RU_THREAD_CLASS_COUNT];
+
+    if (!strcmp(spec, "none")) {
+        for (uint32_t c = 0; c < RU_THREAD_CLASS_COUNT; ++c) {
+            new_policies[c] = (RuThreadPolicy) {
+                .cores = RU_THREAD_CORES_ANY,
+                .keep_priority = true,
+            };
+        }
+    } else {
+        {
+            ru_mutex_lock_scoped(&policies_mutex);
+            memcpy(new_policies, policies, sizeof(policies));
+        }
+
+        _cleanup_free_ char *copy = strdup(spec);
+        if (!copy)
+            abort();
+
+        char *save = NULL;
+        for (char *item = strtok_r(copy, ",", &save); item;
+             item = strtok_r(NULL, ",", &save)) {
+            char *cores_s = strchr(item, '=');
+            if (!cores_s)
+                return false;
+            *cores_s++ = '\0';
+
+            char *prio_s = strchr(cores_s, ':');
+            if (!prio_s)
+                return false;
+            *prio_s++ = '\0';
+
+            uint32_t c;
+            for (c = 0; c < RU_THREAD_CLASS_COUNT; ++c) {
+                if (!strcmp(item, ru_thread_class_to_str(c)))
+                    break;
+            }
+
+            if (c == RU_THREAD_CLASS_COUNT)
+                return false;
+
+            RuThreadPolicy *p = &new_policies[c];
+            if (!ru_thread_parse_cores(cores_s, &p->cores) ||
+                !ru_thread_parse_priority(prio_s, p)) {
+                return false;
+            }
+        }
+    }
+
+    ru_mutex_lock_scoped(&policies_mutex);
+    memcpy(policies, new_policies, sizeof(policies));
+
+    return true;
+}
+
+void
+ru_thread_get_policy(RuThreadClass c, RuThreadPolicy *p) {
+    assert(c < RU_THREAD_CLASS_COUNT);
+
+    ru_mutex_lock_scoped(&policies_mutex);
+    *p = policies[c];
+}
+
+static void
+ru_thread_read_topology(void) {
+    if (!ru_cpu_topology_read(RU_THREAD_SYSFS_CPU_DIR, &topology)) {
+        logd("thread: no cpu_capacity; big and little mean any core");
+        return;
+    }
+
+    logd("thread: cpu_capacity min=%u max=%u",
+         topology.min_capacity, topology.max_capacity);
+}
+
+void
+ru_thread_apply_policy(const RuThreadPolicy *p, const RuCpuTopology *t,
+                       const char *name) {
+    if (name)
+        pthread_setname_np(pthread_self(), name);
+    else
+        name = "?";
+
+    if (p->keep_priority) {
+        // as inherited
+    } else if (p->rt_priority > 0) {
+        struct sched_param param = { .sched_priority = p->rt_priority };
+        if (sched_setscheduler(0, SCHED_FIFO, &param))
+            logw("thread %s: failed to set SCHED_FIFO priority %d: errno=%d",
+                 name, p->rt_priority, errno);
+    } else {
+        // On Linux, nice is per thread.
+        if (setpriority(PRIO_PROCESS, gettid(), p->nice))
+            logw("thread %s: failed to set nice %d: errno=%d",
+                 name, p->nice, errno);
+    }
+
+    cpu_set_t set;
+    if (ru_cpu_topology_get_cpus(t, p->cores, &set)) {
+        if (sched_setaffinity(0, sizeof(set), &set))
+            logw("thread %s: failed to set affinity to %s cores: errno=%d",
+                 name, ru_thread_cores_to_str(p->cores), errno);
+    }
+
+    logd("thread %s: tid=%d cores=%s(%d) nice=%d rt=%d%s",
+         name, gettid(), ru_thread_cores_to_str(p->cores),
+         CPU_COUNT(&set), p->nice, p->rt_priority,
+         p->keep_priority ? " (kept)" : "");
+}
+
+void
+ru_thread_apply(RuThreadClass c, const char *name) {
+    if (pthread_once(&topology_once, ru_thread_read_topology))
+        abort();
+
+    RuThreadPolicy p;
+    ru_thread_get_policy(c, &p);
+    ru_thread_apply_policy(&p, &topology, name);
+}
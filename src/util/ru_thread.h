@@ -1,10 +1,86 @@
 #pragma once
 
 #include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 #include "attribs.h"
 #include "macros.h"
 
+#define RU_THREAD_MAX_CPUS 64
+
+// Each thread of ours belongs to a class, and each class has a policy that
+// the thread applies to itself when it starts, with ru_thread_apply().
+typedef enum RuThreadClass {
+    RU_THREAD_CLASS_RENDER, // Renders, submits and presents; paced to vsync.
+    RU_THREAD_CLASS_MEDIA, // Demuxes and feeds the decoders.
+    RU_THREAD_CLASS_IO, // Prepares clips and flushes logs; not time-critical.
+    RU_THREAD_CLASS_COUNT,
+} RuThreadClass;
+
+typedef enum RuThreadCores {
+    RU_THREAD_CORES_ANY = 0,
+
+    // On a heterogeneous CPU, the cores whose cpu_capacity exceeds the
+    // smallest, or those of exactly the smallest capacity. On a homogeneous
+    // CPU, or without cpu_capacity, both mean any core.
+    RU_THREAD_CORES_BIG,
+    RU_THREAD_CORES_LITTLE,
+} RuThreadCores;
+
+typedef struct RuThreadPolicy {
+    RuThreadCores cores;
+
+    // Leave the scheduling policy and nice value as the thread inherited
+    // them, and ignore nice and rt_priority.
+    bool keep_priority;
+
+    // If rt_priority is positive, the thread runs as SCHED_FIFO at that
+    // priority, and else as SCHED_OTHER at this nice value. Android's
+    // THREAD_PRIORITY_URGENT_DISPLAY is nice -8.
+    int nice;
+    int rt_priority;
+} RuThreadPolicy;
+
+// The cpu_capacity of each CPU, as the scheduler sees it. The biggest core
+// is usually 1024. Zero for a CPU without the file.
+typedef struct RuCpuTopology {
+    uint32_t capacities[RU_THREAD_MAX_CPUS];
+    uint32_t min_capacity; // zero if no CPU has a capacity
+    uint32_t max_capacity;
+} RuCpuTopology;
+
+// Reads <sysfs_cpu_dir>/cpu<N>/cpu_capacity, such as with
+// sysfs_cpu_dir="/sys/devices/system/cpu". Returns false if no CPU has one.
+bool ru_cpu_topology_read(const char *sysfs_cpu_dir, RuCpuTopology *t);
+
+// Returns false, and leaves set empty, if the cores are all CPUs or no CPU.
+// The thread then keeps its affinity.
+bool ru_cpu_topology_get_cpus(const RuCpuTopology *t, RuThreadCores cores,
+                              cpu_set_t *set);
+
+// Replace the policy of each class from a spec such as
+// "render=big:-8,media=little:rt1,io=any:keep", where each value is the
+// cores followed by a nice value, rt<priority> or keep. Classes missing from
+// the spec keep their policy. The spec "none" makes every class leave its
+// threads as created. Returns false, and changes nothing, if the spec is
+// malformed.
+// Call before creating the threads.
+bool ru_thread_set_policies(const char *spec) _must_use_result_;
+void ru_thread_get_policy(RuThreadClass c, RuThreadPolicy *p);
+
+// Name the calling thread, and apply its class's policy against the CPU
+// topology of /sys/devices/system/cpu. If the kernel refuses a priority or
+// affinity, log a warning and keep going.
+void ru_thread_apply(RuThreadClass c, const char *name);
+
+// As ru_thread_apply(), but with an explicit policy and topology.
+void ru_thread_apply_policy(const RuThreadPolicy *p, const RuCpuTopology *t,
+                            const char *name);
+
+const char *ru_thread_class_to_str(RuThreadClass c) _must_use_result_;
+
 static inline void
 ru_mutex_unlock_p(pthread_mutex_t **m) {
     if (pthread_mutex_unlock(*m))
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "attribs.h"
+
+#define RU_NSEC_PER_USEC INT64_C(1000)
+#define RU_NSEC_PER_MSEC INT64_C(1000000)
+#define RU_NSEC_PER_SEC INT64_C(1000000000)
+
+// Nanoseconds on CLOCK_MONOTONIC, the same clock as System.nanoTime().
+static inline int64_t _must_use_result_
+ru_time_now_ns(void) {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts))
+        abort();
+
+    return (int64_t) ts.tv_sec * RU_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+// Sleep until ru_time_now_ns() reaches ns.
+static inline void
+ru_time_sleep_until_ns(int64_t ns) {
+    struct timespec ts = {
+        .tv_sec = ns / RU_NSEC_PER_SEC,
+        .tv_nsec = ns % RU_NSEC_PER_SEC,
+    };
+
+    int ret;
+    while ((ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))) {
+        if (ret != EINTR)
+            abort();
+    }
+}
+
+static inline double _const_ _must_use_result_
+ru_time_ns_to_ms(int64_t ns) {
+    return (double) ns / RU_NSEC_PER_MSEC;
+}
@@ -0,0 +1,256 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef ANDROID
+#include <dlfcn.h>
+#endif
+
+#include "log.h"
+#include "macros.h"
+#include "ru_thread.h"
+#include "ru_time.h"
+#include "ru_trace.h"
+
+#ifdef ANDROID
+
+// ATrace's async sections and counters need API 29, above our minSdkVersion,
+// so look up all of ATrace at runtime.
+static struct {
+    bool (*isEnabled)(void);
+    void (*beginSection)(const char *name);
+    void (*endSection)(void);
+    void (*beginAsyncSection)(const char *name, int32_t cookie);
+    void (*endAsyncSection)(const char *name, int32_t cookie);
+    void (*setCounter)(const char *name, int64_t value);
+} ru_atrace;
+
+static pthread_once_t ru_atrace_once = PTHREAD_ONCE_INIT;
+
+static void
+ru_atrace_init_once(void) {
+    void *lib = dlopen("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+    if (!lib) {
+        logw("trace: dlopen(libandroid.so) failed");
+        return;
+    }
+
+    ru_atrace.isEnabled = dlsym(lib, "ATrace_isEnabled");
+    ru_atrace.beginSection = dlsym(lib, "ATrace_beginSection");
+    ru_atrace.endSection = dlsym(lib, "ATrace_endSection");
+    ru_atrace.beginAsyncSection = dlsym(lib, "ATrace_beginAsyncSection");
+    ru_atrace.endAsyncSection = dlsym(lib, "ATrace_endAsyncSection");
+    ru_atrace.setCounter = dlsym(lib, "ATrace_setCounter");
+
+    if (!ru_atrace.isEnabled || !ru_atrace.beginSection || !ru_atrace.endSection)
+        ru_atrace.isEnabled = NULL;
+}
+
+bool
+ru_trace_is_enabled(void) {
+    if (pthread_once(&ru_atrace_once, ru_atrace_init_once))
+        abort();
+
+    return ru_atrace.isEnabled && ru_atrace.isEnabled();
+}
+
+bool
+ru_trace_begin(const char *name) {
+    if (!ru_trace_is_enabled())
+        return false;
+
+    ru_atrace.beginSection(name);
+    return true;
+}
+
+void
+ru_trace_end(void) {
+    if (ru_trace_is_enabled())
+        ru_atrace.endSection();
+}
+
+void
+ru_trace_counter(const char *name, int64_t value) {
+    if (ru_trace_is_enabled() && ru_atrace.setCounter)
+        ru_atrace.setCounter(name, value);
+}
+
+void
+ru_trace_async_begin(const char *name, int32_t cookie) {
+    if (ru_trace_is_enabled() && ru_atrace.beginAsyncSection)
+        ru_atrace.beginAsyncSection(name, cookie);
+}
+
+void
+ru_trace_async_end(const char *name, int32_t cookie) {
+    if (ru_trace_is_enabled() && ru_atrace.endAsyncSection)
+        ru_atrace.endAsyncSection(name, cookie);
+}
+
+bool
+ru_trace_start_file(const char *path) {
+    logw("trace: ignore trace file %s; use Perfetto or systrace", path);
+    return true;
+}
+
+void
+ru_trace_stop_file(void) {}
+
+#else // !ANDROID
+
+// Protects the file. stdio would serialize the writes anyway, but the lock
+// also keeps each event's fields together and orders start and stop.
+static pthread_mutex_t ru_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *ru_trace_file;
+static _Atomic bool ru_trace_enabled;
+
+// The file that this thread has announced its name to.
+static _Thread_local FILE *ru_trace_named_file;
+
+bool
+ru_trace_is_enabled(void) {
+    return atomic_load_explicit(&ru_trace_enabled, memory_order_relaxed);
+}
+
+// Must hold ru_trace_mutex.
+static void
+ru_trace_write_thread_name_locked(void) {
+    if (ru_trace_named_file == ru_trace_file)
+        return;
+
+    char name[16] = "";
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+
+    fprintf(ru_trace_file,
+            ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s\"}}",
+            (int) getpid(), (int) gettid(), name);
+
+    ru_trace_named_file = ru_trace_file;
+}
+
+// Write an event with the given phase. `extra` holds any further fields,
+// each with a leading comma.
+#define ru_trace_write(ph, name, extra_fmt, ...) \
+    do { \
+        int64_t ts_ns = ru_time_now_ns(); \
+        ru_mutex_lock_scoped(&ru_trace_mutex); \
+        \
+        if (!ru_trace_file) \
+            break; \
+        \
+        ru_trace_write_thread_name_locked(); \
+        fprintf(ru_trace_file, \
+                ",\n{\"ph\":\"%s\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d," \
+                "\"ts\":%" PRIi64 ".%03" PRIi64 extra_fmt "}", \
+                (ph), (name), (int) getpid(), (int) gettid(), \
+                ts_ns / RU_NSEC_PER_USEC, ts_ns % RU_NSEC_PER_USEC, \
+                ##__VA_ARGS__); \
+    } while (0)
+
+bool
+ru_trace_begin(const char *name) {
+    if (!ru_trace_is_enabled())
+        return false;
+
+    ru_trace_write("B", name, "");
+    return true;
+}
+
+void
+ru_trace_end(void) {
+    if (ru_trace_is_enabled())
+        ru_trace_write("E", "", "");
+}
+
+void
+ru_trace_counter(const char *name, int64_t value) {
+    if (ru_trace_is_enabled())
+        ru_trace_write("C", name, ",\"args\":{\"value\":%" PRIi64 "}", value);
+}
+
+void
+ru_trace_async_begin(const char *name, int32_t cookie) {
+    if (ru_trace_is_enabled())
+        ru_trace_write("b", name, ",\"cat\":\"ru\",\"id\":%d", (int) cookie);
+}
+
+void
+ru_trace_async_end(const char *name, int32_t cookie) {
+    if (ru_trace_is_enabled())
+        ru_trace_write("e", name, ",\"cat\":\"ru\",\"id\":%d", (int) cookie);
+}
+
+bool
+ru_trace_start_file(const char *path) {
+    ru_mutex_lock_scoped(&ru_trace_mutex);
+
+    if (ru_trace_file) {
+        logw("trace: already tracing");
+        return false;
+    }
+
+    ru_trace_file = fopen(path, "w");
+    if (!ru_trace_file) {
+        loge("trace: failed to open %s", path);
+        return false;
+    }
+
+    // Each event begins with a comma, so open with a metadata event.
+    fprintf(ru_trace_file,
+            "[{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,"
+            "\"args\":{\"name\":\"%s\"}}",
+            (int) getpid(), LOG_TAG);
+
+    atomic_store_explicit(&ru_trace_enabled, true, memory_order_relaxed);
+    return true;
+}
+
+void
+ru_trace_stop_file(void) {
+    ru_mutex_lock_scoped(&ru_trace_mutex);
+
+    if (!ru_trace_file)
+        return;
+
+    atomic_store_explicit(&ru_trace_enabled, false, memory_order_relaxed);
+
+    fprintf(ru_trace_file, "\n]\n");
+    fclose(ru_trace_file);
+    ru_trace_file = NULL;
+}
+
+#endif // ANDROID
@@ -0,0 +1,85 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+// Trace sections, counters and async sections.
+//
+// On Android they go to ATrace, so systrace and Perfetto record them whenever
+// they trace the app. On other hosts they go to a Chrome trace-event JSON file,
+// which ui.perfetto.dev and chrome://tracing open, between
+// ru_trace_start_file() and ru_trace_stop_file().
+//
+// Names must be string literals, or otherwise outlive the trace.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "attribs.h"
+#include "macros.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool ru_trace_is_enabled(void) _must_use_result_;
+
+// Returns true if the section began, in which case ru_trace_end() must end
+// it on the same thread. Sections nest.
+bool ru_trace_begin(const char *name);
+void ru_trace_end(void);
+
+void ru_trace_counter(const char *name, int64_t value);
+
+// An async section may begin and end on different threads. The name and
+// cookie identify it, and concurrent sections of the same name need distinct
+// cookies.
+void ru_trace_async_begin(const char *name, int32_t cookie);
+void ru_trace_async_end(const char *name, int32_t cookie);
+
+// Host only. Returns false if the file cannot be opened. On Android, the
+// tracing service decides what to record, so these do nothing.
+bool ru_trace_start_file(const char *path) _must_use_result_;
+void ru_trace_stop_file(void);
+
+static inline void
+ru_trace_end_p(bool *began) {
+    if (*began)
+        ru_trace_end();
+}
+
+// Trace a section until the end of the current scope.
+#define ru_trace_scoped(name) \
+    __ru_trace_scoped(UNIQ(_trace), (name))
+
+#define __ru_trace_scoped(uniq_trace, name) \
+    _cleanup_(ru_trace_end_p) bool uniq_trace = ru_trace_begin(name); \
+    ru_require_semicolon()
+
+#ifdef __cplusplus
+}
+#endif
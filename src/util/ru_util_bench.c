@@ -0,0 +1,1192 @@
+// Copyright 2019 Google Inc
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of Google Inc. nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without
+//    specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ru-util-bench stresses and times RuQueue, RuChan, RuSpsc and RuPool, checks
+// the thread policies of ru_thread.h, then prints a JSON report to stdout. It
+// dies on the first broken invariant, so a clean exit also means that the
+// stress checks passed.
+//
+//     usage: ru-util-bench [-n ITEMS] [-i ITERATIONS]
+//
+//     -n  Items per throughput run. Default is 1048576.
+//     -i  Wake-ups per wake latency run. Default is 1000.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdnoreturn.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "check.h"
+#include "macros.h"
+#include "ru_cadence.h"
+#include "ru_chan.h"
+#include "ru_hist.h"
+#include "ru_latency.h"
+#include "ru_math.h"
+#include "ru_pool.h"
+#include "ru_queue.h"
+#include "ru_spsc.h"
+#include "ru_thread.h"
+#include "ru_time.h"
+
+#define RU_BENCH_WAKE_SLEEP_NS (200 * RU_NSEC_PER_USEC)
+#define RU_BENCH_STOP UINT64_MAX
+
+static const uint32_t thread_counts[] = { 1, 2, 4, 8 };
+static const size_t spsc_capacities[] = { 1, 4, 64 };
+static const uint32_t pool_worker_counts[] = { 1, 2, 4 };
+
+#define RU_BENCH_POOL_FANOUT 3
+#define RU_BENCH_POOL_SPIN 2000
+
+static size_t item_count = 1 << 20;
+static uint32_t wake_iterations = 1000;
+
+static double
+ns_to_us(uint64_t ns) {
+    return (double) ns / RU_NSEC_PER_USEC;
+}
+
+static void
+sleep_ns(int64_t ns) {
+    struct timespec ts = {
+        .tv_sec = ns / RU_NSEC_PER_SEC,
+        .tv_nsec = ns % RU_NSEC_PER_SEC,
+    };
+
+    while (nanosleep(&ts, &ts)) {
+        // interrupted; sleep the remainder
+    }
+}
+
+static double
+mops(size_t ops, int64_t ns) {
+    return ns > 0 ? (double) ops * 1e3 / ns : 0.0;
+}
+
+// Pop every element and check that they are `first, first + 1, ...`.
+static void
+check_queue_seq(RuQueue *q, uint64_t first, size_t len) {
+    if (q->head >= q->mod || q->tail >= q->mod)
+        die("queue: head=%zu tail=%zu escaped mod=%zu", q->head, q->tail, q->mod);
+
+    if (ru_queue_len(q) != len)
+        die("queue: len=%zu, expected %zu", ru_queue_len(q), len);
+
+    for (size_t i = 0; i < len; ++i) {
+        uint64_t v;
+        if (!ru_queue_pop(q, &v))
+            die("queue: empty after %zu of %zu pops", i, len);
+
+        if (v != first + i)
+            die("queue: popped %" PRIu64 ", expected %" PRIu64, v, first + i);
+    }
+
+    if (!ru_queue_is_empty(q))
+        die("queue: not empty after %zu pops", len);
+}
+
+// Exhaustively grow small queues from every head position and fill level,
+// so that the wrapped tail lands at each offset relative to the new space.
+// Returns the number of cases.
+static size_t
+stress_queue_grow(void) {
+    size_t cases = 0;
+
+    for (size_t cap = 1; cap <= 9; ++cap) {
+        for (size_t head = 0; head <= cap; ++head) {
+            for (size_t len = 0; len <= cap; ++len) {
+                for (size_t grow = 0; grow <= cap + 2; ++grow) {
+                    RuQueue q;
+                    ru_queue_init(&q, sizeof(uint64_t), cap);
+
+                    // Move head and tail to `head` without growing.
+                    for (size_t i = 0; i < head; ++i) {
+                        uint64_t v = 0;
+                        ru_queue_push(&q, &v);
+                        if (!ru_queue_pop(&q, &v))
+                            die("queue: empty after push");
+                    }
+
+                    for (uint64_t i = 0; i < len; ++i) {
+                        ru_queue_push(&q, &i);
+                    }
+
+                    size_t old_mod = q.mod;
+                    ru_queue_grow(&q, grow);
+
+                    if (q.mod < old_mod + grow)
+                        die("queue: grow(%zu) took mod from %zu to %zu", grow, old_mod, q.mod);
+
+                    // Refill past the new capacity to cross the wrap point
+                    // and the push path's own grow.
+                    uint64_t extra = q.mod + 1;
+                    for (uint64_t i = 0; i < extra; ++i) {
+                        uint64_t v = len + i;
+                        ru_queue_push(&q, &v);
+                    }
+
+                    check_queue_seq(&q, 0, len + extra);
+                    ru_queue_finish(&q);
+                    ++cases;
+                }
+            }
+        }
+    }
+
+    return cases;
+}
+
+static void
+bench_queue(FILE *f) {
+    RuQueue q;
+    int64_t t0, t1;
+
+    // Push all, then pop all. The queue starts small and grows on push.
+    ru_queue_init(&q, sizeof(uint64_t), 1);
+    t0 = ru_time_now_ns();
+    for (uint64_t i = 0; i < item_count; ++i) {
+        ru_queue_push(&q, &i);
+    }
+    t1 = ru_time_now_ns();
+    int64_t push_grow_ns = t1 - t0;
+    check_queue_seq(&q, 0, item_count);
+    ru_queue_finish(&q);
+
+    // The same, but grown up front.
+    ru_queue_init(&q, sizeof(uint64_t), 1);
+    ru_queue_grow(&q, item_count);
+    t0 = ru_time_now_ns();
+    for (uint64_t i = 0; i < item_count; ++i) {
+        ru_queue_push(&q, &i);
+    }
+    t1 = ru_time_now_ns();
+    int64_t push_ns = t1 - t0;
+
+    t0 = ru_time_now_ns();
+    for (size_t i = 0; i < item_count; ++i) {
+        uint64_t v;
+        if (!ru_queue_pop(&q, &v) || v != i)
+            die("queue: bad pop at %zu", i);
+    }
+    t1 = ru_time_now_ns();
+    int64_t pop_ns = t1 - t0;
+    ru_queue_finish(&q);
+
+    // Alternate push and pop, as a steady-state channel does.
+    ru_queue_init(&q, sizeof(uint64_t), 8);
+    t0 = ru_time_now_ns();
+    for (uint64_t i = 0; i < item_count; ++i) {
+        uint64_t v;
+        ru_queue_push(&q, &i);
+        if (!ru_queue_pop(&q, &v) || v != i)
+            die("queue: bad pop at %" PRIu64, i);
+    }
+    t1 = ru_time_now_ns();
+    int64_t pingpong_ns = t1 - t0;
+    ru_queue_finish(&q);
+
+    fprintf(f, "  \"queue\": {\n");
+    fprintf(f, "    \"items\": %zu,\n", item_count);
+    fprintf(f, "    \"push_with_grow_mops\": %.3f,\n", mops(item_count, push_grow_ns));
+    fprintf(f, "    \"push_mops\": %.3f,\n", mops(item_count, push_ns));
+    fprintf(f, "    \"pop_mops\": %.3f,\n", mops(item_count, pop_ns));
+    fprintf(f, "    \"push_pop_mops\": %.3f\n", mops(item_count, pingpong_ns));
+    fprintf(f, "  },\n");
+}
+
+// Time one ru_queue_grow() of a full queue whose contents wrap at the
+// midpoint, which is the most the grow path ever moves.
+static void
+bench_queue_grow(FILE *f) {
+    fprintf(f, "  \"queue_grow\": [");
+
+    bool first = true;
+    for (size_t cap = 1 << 10; cap <= item_count; cap <<= 2) {
+        RuQueue q;
+        ru_queue_init(&q, sizeof(uint64_t), cap);
+
+        uint64_t v = 0;
+        for (size_t i = 0; i < cap / 2; ++i) {
+            ru_queue_push(&q, &v);
+            if (!ru_queue_pop(&q, &v))
+                die("queue: empty after push");
+        }
+
+        for (uint64_t i = 0; i < cap; ++i) {
+            ru_queue_push(&q, &i);
+        }
+
+        int64_t t0 = ru_time_now_ns();
+        ru_queue_grow(&q, cap);
+        int64_t t1 = ru_time_now_ns();
+
+        check_queue_seq(&q, 0, cap);
+        ru_queue_finish(&q);
+
+        fprintf(f, "%s\n    {\"capacity\": %zu, \"moved\": %zu, \"us\": %.3f}",
+                first ? "" : ",", cap, cap - cap / 2,
+                (double) (t1 - t0) / RU_NSEC_PER_USEC);
+        first = false;
+    }
+
+    fprintf(f, "\n  ],\n");
+}
+
+typedef struct ProducerArgs {
+    RuChan *chan;
+    uint64_t id;
+    size_t count;
+} ProducerArgs;
+
+// Each item carries the producer id in the high bits and a sequence number
+// in the low bits, so the consumer can check per-producer order.
+static void *
+producer_main(void *_args) {
+    ProducerArgs *args = _args;
+
+    for (uint64_t i = 0; i < args->count; ++i) {
+        uint64_t v = (args->id << 48) | i;
+        ru_chan_push(args->chan, &v);
+    }
+
+    return NULL;
+}
+
+static void
+bench_chan_throughput(FILE *f) {
+    fprintf(f, "  \"chan_throughput\": [");
+
+    for (size_t t = 0; t < ARRAY_LEN(thread_counts); ++t) {
+        uint32_t n = thread_counts[t];
+        size_t per_producer = item_count / n;
+
+        RuChan chan;
+        ru_chan_init(&chan, sizeof(uint64_t), 8);
+
+        pthread_t threads[n];
+        ProducerArgs args[n];
+        uint64_t next_seq[n];
+
+        int64_t t0 = ru_time_now_ns();
+
+        for (uint32_t i = 0; i < n; ++i) {
+            args[i] = (ProducerArgs) {
+                .chan = &chan,
+                .id = i,
+                .count = per_producer,
+            };
+
+            next_seq[i] = 0;
+
+            if (pthread_create(&threads[i], NULL, producer_main, &args[i]))
+                abort();
+        }
+
+        for (size_t i = 0; i < per_producer * n; ++i) {
+            uint64_t v;
+            ru_chan_pop_wait(&chan, &v);
+
+            uint64_t id = v >> 48;
+            uint64_t seq = v & ((UINT64_C(1) << 48) - 1);
+
+            if (id >= n || seq != next_seq[id])
+                die("chan: producer %" PRIu64 " sent %" PRIu64 " out of order", id, seq);
+
+            ++next_seq[id];
+        }
+
+        int64_t t1 = ru_time_now_ns();
+
+        for (uint32_t i = 0; i < n; ++i) {
+            if (pthread_join(threads[i], NULL))
+                abort();
+        }
+
+        if (!ru_queue_is_empty(&chan.queue))
+            die("chan: not empty after the last pop");
+
+        ru_chan_finish(&chan);
+
+        fprintf(f, "%s\n    {\"producers\": %u, \"items\": %zu, \"mops\": %.3f}",
+                t == 0 ? "" : ",", n, per_producer * n,
+                mops(per_producer * n, t1 - t0));
+    }
+
+    fprintf(f, "\n  ],\n");
+}
+
+typedef struct SpscProducerArgs {
+    RuSpsc *spsc;
+    size_t count;
+} SpscProducerArgs;
+
+static void *
+spsc_producer_main(void *_args) {
+    SpscProducerArgs *args = _args;
+
+    for (uint64_t i = 0; i < args->count; ++i)
+        ru_spsc_push_wait(args->spsc, &i);
+
+    return NULL;
+}
+
+// One producer, one consumer. Small capacities keep both sides blocking in
+// turn, which stresses the wake-up handshake; a lost wake-up hangs the run.
+static void
+bench_spsc_throughput(FILE *f) {
+    fprintf(f, "  \"spsc_throughput\": [");
+
+    for (size_t c = 0; c < ARRAY_LEN(spsc_capacities); ++c) {
+        size_t capacity = spsc_capacities[c];
+
+        RuSpsc spsc;
+        ru_spsc_init(&spsc, sizeof(uint64_t), capacity);
+
+        SpscProducerArgs args = {
+            .spsc = &spsc,
+            .count = item_count,
+        };
+
+        int64_t t0 = ru_time_now_ns();
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, spsc_producer_main, &args))
+            abort();
+
+        for (uint64_t i = 0; i < item_count; ++i) {
+            uint64_t v;
+            ru_spsc_pop_wait(&spsc, &v);
+
+            if (v != i)
+                die("spsc: popped %" PRIu64 ", expected %" PRIu64, v, i);
+        }
+
+        int64_t t1 = ru_time_now_ns();
+
+        if (pthread_join(thread, NULL))
+            abort();
+
+        if (ru_spsc_try_pop(&spsc, NULL))
+            die("spsc: not empty after the last pop");
+
+        ru_spsc_finish(&spsc);
+
+        fprintf(f, "%s\n    {\"capacity\": %zu, \"items\": %zu, \"mops\": %.3f}",
+                c == 0 ? "" : ",", capacity, item_count,
+                mops(item_count, t1 - t0));
+    }
+
+    fprintf(f, "\n  ],\n");
+}
+
+typedef struct PoolContext {
+    RuPool *pool;
+    _Atomic uint64_t run_count;
+    _Atomic uint64_t done_count;
+    _Atomic uint64_t sink;
+} PoolContext;
+
+static void
+pool_spin(PoolContext *ctx) {
+    uint64_t x = atomic_load_explicit(&ctx->sink, memory_order_relaxed) | 1;
+
+    for (uint32_t i = 0; i < RU_BENCH_POOL_SPIN; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+
+    atomic_fetch_add_explicit(&ctx->sink, x, memory_order_relaxed);
+    atomic_fetch_add_explicit(&ctx->run_count, 1, memory_order_relaxed);
+}
+
+static void
+pool_on_done(void *_ctx) {
+    PoolContext *ctx = _ctx;
+    atomic_fetch_add_explicit(&ctx->done_count, 1, memory_order_relaxed);
+}
+
+static void
+pool_leaf_run(void *_ctx) {
+    pool_spin(_ctx);
+}
+
+// Each root job spawns leaves from its worker, which the other workers must
+// steal to stay busy.
+static void
+pool_root_run(void *_ctx) {
+    PoolContext *ctx = _ctx;
+
+    for (uint32_t i = 0; i < RU_BENCH_POOL_FANOUT; ++i) {
+        ru_pool_submit(ctx->pool, (RuPoolJob) {
+            .context = ctx,
+            .run = pool_leaf_run,
+            .on_done = pool_on_done,
+        });
+    }
+
+    pool_spin(ctx);
+}
+
+static void
+check_queue_pop_tail(void) {
+    RuQueue q;
+    ru_queue_init(&q, sizeof(uint64_t), 1);
+
+    // Wrap the tail past the end of the array.
+    for (uint64_t i = 0; i < 3; ++i) {
+        ru_queue_push(&q, &i);
+        if (!ru_queue_pop(&q, NULL))
+            die("queue: empty after push");
+    }
+
+    for (uint64_t i = 0; i < 5; ++i)
+        ru_queue_push(&q, &i);
+
+    for (uint64_t i = 5; i-- > 0;) {
+        uint64_t v;
+        if (!ru_queue_pop_tail(&q, &v))
+            die("queue: empty before pop_tail %" PRIu64, i);
+
+        if (v != i)
+            die("queue: pop_tail got %" PRIu64 ", expected %" PRIu64, v, i);
+    }
+
+    if (ru_queue_pop_tail(&q, NULL))
+        die("queue: pop_tail on empty queue");
+
+    ru_queue_finish(&q);
+}
+
+// The main thread submits root jobs with futures and waits for them all.
+// Freeing the pool then runs the leaves that are still queued.
+static void
+bench_pool(FILE *f) {
+    check_queue_pop_tail();
+
+    fprintf(f, "  \"pool\": [");
+
+    size_t root_count = ru_max(item_count / 256, (size_t) 1);
+    RuFuture **futures = new_array(RuFuture *, root_count);
+
+    for (size_t c = 0; c < ARRAY_LEN(pool_worker_counts); ++c) {
+        uint32_t worker_count = pool_worker_counts[c];
+
+        PoolContext ctx = {
+            .pool = ru_pool_new(.worker_count = worker_count,
+                                .thread_name = "ru-bench-pool"),
+        };
+
+        int64_t t0 = ru_time_now_ns();
+
+        for (size_t i = 0; i < root_count; ++i) {
+            futures[i] = ru_pool_submit_future(ctx.pool, (RuPoolJob) {
+                .context = &ctx,
+                .run = pool_root_run,
+                .on_done = pool_on_done,
+            });
+        }
+
+        for (size_t i = 0; i < root_count; ++i) {
+            ru_future_wait(futures[i]);
+
+            if (!ru_future_is_done(futures[i]))
+                die("pool: future %zu not done after wait", i);
+
+            ru_future_free(futures[i]);
+        }
+
+        RuPoolStats stats;
+        ru_pool_get_stats(ctx.pool, &stats);
+        ru_pool_free(ctx.pool);
+
+        int64_t t1 = ru_time_now_ns();
+
+        uint64_t job_count = root_count * (1 + RU_BENCH_POOL_FANOUT);
+        uint64_t run_count = atomic_load(&ctx.run_count);
+        uint64_t done_count = atomic_load(&ctx.done_count);
+
+        if (run_count != job_count || done_count != job_count)
+            die("pool: ran %" PRIu64 " and finished %" PRIu64 " of %" PRIu64 " jobs",
+                run_count, done_count, job_count);
+
+        if (stats.submit_count != job_count || stats.worker_count != worker_count)
+            die("pool: submit_count=%" PRIu64 " worker_count=%u",
+                stats.submit_count, stats.worker_count);
+
+        fprintf(f, "%s\n    {\"workers\": %u, \"jobs\": %" PRIu64 ", \"mops\": %.3f, "
+                "\"steals\": %" PRIu64 ", \"max_queue_depth\": %u, \"busy_ms\": %.3f}",
+                c == 0 ? "" : ",", worker_count, job_count,
+                mops(job_count, t1 - t0), stats.steal_count,
+                stats.max_queue_depth, ru_time_ns_to_ms(stats.busy_ns));
+    }
+
+    free(futures);
+
+    fprintf(f, "\n  ],\n");
+}
+
+typedef struct WakeContext {
+    RuChan wake; // pushed times, or RU_BENCH_STOP
+    RuChan done; // popped latencies
+} WakeContext;
+
+static void *
+waiter_main(void *_ctx) {
+    WakeContext *ctx = _ctx;
+
+    for (;;) {
+        uint64_t push_ns;
+        ru_chan_pop_wait(&ctx->wake, &push_ns);
+
+        if (push_ns == RU_BENCH_STOP)
+            break;
+
+        int64_t latency_ns = ru_time_now_ns() - (int64_t) push_ns;
+        ru_chan_push(&ctx->done, &latency_ns);
+    }
+
+    return NULL;
+}
+
+// Every waiter blocks in ru_chan_pop_wait() on one channel. The main thread
+// pushes one item at a time, after a sleep that lets the waiters block
+// again, and times the hand-off to whichever waiter wins it.
+static void
+bench_chan_wake(FILE *f) {
+    fprintf(f, "  \"chan_wake_latency_us\": [");
+
+    for (size_t t = 0; t < ARRAY_LEN(thread_counts); ++t) {
+        uint32_t n = thread_counts[t];
+
+        RuHist hist;
+        ru_hist_reset(&hist);
+
+        WakeContext ctx;
+        ru_chan_init(&ctx.wake, sizeof(uint64_t), n);
+        ru_chan_init(&ctx.done, sizeof(int64_t), 1);
+
+        pthread_t threads[n];
+        for (uint32_t i = 0; i < n; ++i) {
+            if (pthread_create(&threads[i], NULL, waiter_main, &ctx))
+                abort();
+        }
+
+        for (uint32_t i = 0; i < wake_iterations; ++i) {
+            sleep_ns(RU_BENCH_WAKE_SLEEP_NS);
+
+            uint64_t push_ns = ru_time_now_ns();
+            ru_chan_push(&ctx.wake, &push_ns);
+
+            int64_t latency_ns;
+            ru_chan_pop_wait(&ctx.done, &latency_ns);
+            ru_hist_record(&hist, latency_ns);
+        }
+
+        for (uint32_t i = 0; i < n; ++i) {
+            uint64_t stop = RU_BENCH_STOP;
+            ru_chan_push(&ctx.wake, &stop);
+        }
+
+        for (uint32_t i = 0; i < n; ++i) {
+            if (pthread_join(threads[i], NULL))
+                abort();
+        }
+
+        ru_chan_finish(&ctx.wake);
+        ru_chan_finish(&ctx.done);
+
+        fprintf(f, "%s\n    {\"waiters\": %u, \"wakes\": %u, \"p50\": %.3f, "
+                "\"p99\": %.3f, \"p99.9\": %.3f, \"max\": %.3f}",
+                t == 0 ? "" : ",", n, wake_iterations,
+                ns_to_us(ru_hist_percentile(&hist, 50.0)),
+                ns_to_us(ru_hist_percentile(&hist, 99.0)),
+                ns_to_us(ru_hist_percentile(&hist, 99.9)),
+                ns_to_us(hist.max));
+    }
+
+    fprintf(f, "\n  ],\n");
+}
+
+static void
+write_cpu_capacity(const char *dir, uint32_t cpu, uint32_t capacity) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/cpu%u", dir, cpu);
+    if (mkdir(path, 0700) && errno != EEXIST)
+        die("mkdir(\"%s\") failed: errno=%d", path, errno);
+
+    snprintf(path, sizeof(path), "%s/cpu%u/cpu_capacity", dir, cpu);
+    FILE *file = fopen(path, "w");
+    if (!file)
+        die("fopen(\"%s\") failed: errno=%d", path, errno);
+
+    fprintf(file, "%u\n", capacity);
+    fclose(file);
+}
+
+static void
+remove_cpu_capacity(const char *dir, uint32_t cpu) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/cpu%u/cpu_capacity", dir, cpu);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/cpu%u", dir, cpu);
+    rmdir(path);
+}
+
+// Read a fake sysfs with three clusters, cpu0-3, cpu4-6 and cpu7, and a gap
+// at cpu8, then make the CPU homogeneous.
+static void
+check_cpu_topology(void) {
+    static const uint32_t capacities[] = { 160, 160, 160, 160, 512, 512, 512, 1024, 0, 160 };
+
+    char dir[] = "/tmp/ru-util-bench-XXXXXX";
+    if (!mkdtemp(dir))
+        die("mkdtemp failed: errno=%d", errno);
+
+    for (uint32_t cpu = 0; cpu < ARRAY_LEN(capacities); ++cpu) {
+        if (capacities[cpu])
+            write_cpu_capacity(dir, cpu, capacities[cpu]);
+    }
+
+    RuCpuTopology t;
+    if (!ru_cpu_topology_read(dir, &t))
+        die("thread: found no cpu_capacity");
+
+    if (t.min_capacity != 160 || t.max_capacity != 1024)
+        die("thread: min_capacity=%u max_capacity=%u", t.min_capacity, t.max_capacity);
+
+    cpu_set_t big, little, any;
+    if (!ru_cpu_topology_get_cpus(&t, RU_THREAD_CORES_BIG, &big) ||
+        !ru_cpu_topology_get_cpus(&t, RU_THREAD_CORES_LITTLE, &little)) {
+        die("thread: heterogeneous CPU has no big or little cores");
+    }
+
+    if (ru_cpu_topology_get_cpus(&t, RU_THREAD_CORES_ANY, &any))
+        die("thread: any core restricted the affinity");
+
+    for (uint32_t cpu = 0; cpu < ARRAY_LEN(capacities); ++cpu) {
+        bool is_big = capacities[cpu] > 160;
+        bool is_little = capacities[cpu] == 160;
+
+        if (!!CPU_ISSET(cpu, &big) != is_big || !!CPU_ISSET(cpu, &little) != is_little)
+            die("thread: cpu%u misplaced", cpu);
+    }
+
+    for (uint32_t cpu = 0; cpu < ARRAY_LEN(capacities); ++cpu) {
+        if (capacities[cpu])
+            write_cpu_capacity(dir, cpu, 1024);
+    }
+
+    if (!ru_cpu_topology_read(dir, &t))
+        die("thread: found no cpu_capacity");
+
+    if (ru_cpu_topology_get_cpus(&t, RU_THREAD_CORES_BIG, &big) ||
+        ru_cpu_topology_get_cpus(&t, RU_THREAD_CORES_LITTLE, &little)) {
+        die("thread: homogeneous CPU restricted the affinity");
+    }
+
+    for (uint32_t cpu = 0; cpu < ARRAY_LEN(capacities); ++cpu)
+        remove_cpu_capacity(dir, cpu);
+
+    if (rmdir(dir))
+        die("rmdir(\"%s\") failed: errno=%d", dir, errno);
+}
+
+static void
+check_thread_policy_spec(void) {
+    static const char *const bad_specs[] = {
+        "render", "render=big", "render=huge:0", "render=big:-21",
+        "render=big:rt0", "render=big:rt", "gpu=big:0", "render=big:1x",
+    };
+
+    for (size_t i = 0; i < ARRAY_LEN(bad_specs); ++i) {
+        if (ru_thread_set_policies(bad_specs[i]))
+            die("thread: accepted bad spec \"%s\"", bad_specs[i]);
+    }
+
+    if (!ru_thread_set_policies("media=big:rt3,io=any:keep"))
+        die("thread: rejected good spec");
+
+    RuThreadPolicy render, media, io;
+    ru_thread_get_policy(RU_THREAD_CLASS_RENDER, &render);
+    ru_thread_get_policy(RU_THREAD_CLASS_MEDIA, &media);
+    ru_thread_get_policy(RU_THREAD_CLASS_IO, &io);
+
+    if (render.cores != RU_THREAD_CORES_BIG || render.nice != -8 ||
+        media.cores != RU_THREAD_CORES_BIG || media.rt_priority != 3 ||
+        io.cores != RU_THREAD_CORES_ANY || !io.keep_priority) {
+        die("thread: spec parsed wrong");
+    }
+
+    if (!ru_thread_set_policies("none"))
+        die("thread: rejected \"none\"");
+
+    ru_thread_get_policy(RU_THREAD_CLASS_RENDER, &render);
+    if (render.cores != RU_THREAD_CORES_ANY || !render.keep_priority)
+        die("thread: \"none\" kept the render policy");
+
+    if (!ru_thread_set_policies("render=big:-8,media=little:-4,io=little:0"))
+        die("thread: rejected the default spec");
+}
+
+typedef struct PolicyThreadArgs {
+    RuCpuTopology topology;
+    uint32_t cpu_count;
+} PolicyThreadArgs;
+
+// Raising nice needs no privilege, so the check runs anywhere.
+static void *
+policy_thread_main(void *_args) {
+    PolicyThreadArgs *args = _args;
+
+    RuThreadPolicy p = {
+        .cores = RU_THREAD_CORES_LITTLE,
+        .nice = 5,
+    };
+    ru_thread_apply_policy(&p, &args->topology, "ru-policy-test");
+
+    char name[16];
+    if (pthread_getname_np(pthread_self(), name, sizeof(name)) ||
+        strcmp(name, "ru-policy-test")) {
+        die("thread: name not set");
+    }
+
+    errno = 0;
+    int nice = getpriority(PRIO_PROCESS, gettid());
+    if (nice != 5 || errno)
+        die("thread: nice=%d, expected 5", nice);
+
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set))
+        die("sched_getaffinity failed: errno=%d", errno);
+
+    // cpu0 is the only little core.
+    if (args->cpu_count >= 2 && (CPU_COUNT(&set) != 1 || !CPU_ISSET(0, &set)))
+        die("thread: affinity has %d CPUs, expected cpu0", CPU_COUNT(&set));
+
+    return NULL;
+}
+
+static void
+check_thread_policy(FILE *f) {
+    check_cpu_topology();
+    check_thread_policy_spec();
+
+    PolicyThreadArgs args = { 0 };
+
+    long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    args.cpu_count = ru_min(nproc > 0 ? (uint32_t) nproc : 1, RU_THREAD_MAX_CPUS);
+
+    for (uint32_t cpu = 0; cpu < args.cpu_count; ++cpu)
+        args.topology.capacities[cpu] = cpu == 0 ? 100 : 1024;
+
+    args.topology.min_capacity = 100;
+    args.topology.max_capacity = args.cpu_count >= 2 ? 1024 : 100;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, policy_thread_main, &args))
+        abort();
+
+    if (pthread_join(thread, NULL))
+        abort();
+
+    // Report this machine's topology, for comparison with a device's.
+    RuCpuTopology t;
+    ru_cpu_topology_read("/sys/devices/system/cpu", &t);
+
+    cpu_set_t big, little;
+    ru_cpu_topology_get_cpus(&t, RU_THREAD_CORES_BIG, &big);
+    ru_cpu_topology_get_cpus(&t, RU_THREAD_CORES_LITTLE, &little);
+
+    fprintf(f, "  \"cpu_topology\": {\"min_capacity\": %u, \"max_capacity\": %u, "
+            "\"big_cpus\": %d, \"little_cpus\": %d},\n",
+            t.min_capacity, t.max_capacity, CPU_COUNT(&big), CPU_COUNT(&little));
+}
+
+// Record v and a larger value, so that the clamp to the max leaves v's bucket
+// bound visible, and return the median.
+static uint64_t
+hist_bucket_max(uint64_t v) {
+    RuHist h;
+    ru_hist_reset(&h);
+    ru_hist_record(&h, v);
+    ru_hist_record(&h, v);
+    ru_hist_record(&h, INT64_MAX);
+
+    return ru_hist_percentile(&h, 50);
+}
+
+static void
+check_hist(void) {
+    RuHist h;
+    ru_hist_reset(&h);
+
+    if (ru_hist_percentile(&h, 50) || ru_hist_mean(&h))
+        die("hist: empty histogram reported a value");
+
+    for (uint64_t v = 0; v < RU_HIST_SUB_COUNT; ++v) {
+        if (ru_hist_bucket_index(v) != v || hist_bucket_max(v) != v)
+            die("hist: %" PRIu64 " has no exact bucket", v);
+    }
+
+    for (uint32_t k = RU_HIST_SUB_BITS; k < RU_HIST_MAX_BITS; ++k) {
+        const uint64_t pow = UINT64_C(1) << k;
+
+        if (ru_hist_bucket_index(pow) != ru_hist_bucket_index(pow - 1) + 1)
+            die("hist: 2^%u does not start a bucket", k);
+
+        const uint64_t values[] = { pow - 1, pow, pow + 1, pow + pow / 2, 2 * pow - 1 };
+        for (size_t i = 0; i < ARRAY_LEN(values); ++i) {
+            const uint64_t v = values[i];
+            const uint64_t r = hist_bucket_max(v);
+
+            if (r < v || r - v > v / RU_HIST_SUB_COUNT)
+                die("hist: %" PRIu64 " reported as %" PRIu64, v, r);
+        }
+    }
+
+    const uint64_t last = RU_HIST_BUCKET_COUNT - 1;
+    if (ru_hist_bucket_index(UINT64_C(1) << RU_HIST_MAX_BITS) != last ||
+        ru_hist_bucket_index(UINT64_MAX) != last ||
+        ru_hist_bucket_index(UINT64_C(1) << (RU_HIST_MAX_BITS - 1)) == last) {
+        die("hist: values past 2^%u missed the last bucket", RU_HIST_MAX_BITS);
+    }
+
+    // Nearest rank of 1..100.
+    for (int64_t v = 100; v > 0; --v)
+        ru_hist_record(&h, v);
+
+    if (ru_hist_percentile(&h, 0) != 1 || ru_hist_percentile(&h, 100) != 100)
+        die("hist: p0=%" PRIu64 " p100=%" PRIu64 ", expected 1 and 100",
+            ru_hist_percentile(&h, 0), ru_hist_percentile(&h, 100));
+
+    const uint64_t p50 = ru_hist_percentile(&h, 50);
+    if (p50 < 50 || p50 > 50 + 50 / RU_HIST_SUB_COUNT)
+        die("hist: p50=%" PRIu64 ", expected 50", p50);
+
+    if (ru_hist_mean(&h) != 50)
+        die("hist: mean=%" PRIu64 ", expected 50", ru_hist_mean(&h));
+
+    // Merging halves must match recording everything into one.
+    RuHist lo, hi, empty;
+    ru_hist_reset(&lo);
+    ru_hist_reset(&hi);
+    ru_hist_reset(&empty);
+
+    for (int64_t v = 1; v <= 100; ++v)
+        ru_hist_record(v <= 50 ? &lo : &hi, v);
+
+    ru_hist_merge(&lo, &empty);
+    ru_hist_merge(&empty, &hi);
+    ru_hist_merge(&empty, &lo);
+
+    if (memcmp(&empty, &h, sizeof(h)))
+        die("hist: merge differs from recording");
+}
+
+// The timestamp of frame i at num/den Hz, rounded to the microsecond as in a
+// container.
+static int64_t
+frame_pts_us(int64_t i, int64_t num, int64_t den) {
+    return (i * 1000000 * den + num / 2) / num;
+}
+
+// Observe `count` frames at num/den Hz from *pts_us, and advance it to the
+// next frame. Return the index of the frame that reported a new rate, or -1.
+static int
+observe_frames(RuFrameRate *fr, int64_t *pts_us, int64_t num, int64_t den,
+               uint32_t count) {
+    const int64_t start_us = *pts_us;
+    int reported = -1;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        *pts_us = start_us + frame_pts_us(i, num, den);
+
+        if (ru_frame_rate_observe(fr, *pts_us * RU_NSEC_PER_USEC)) {
+            if (reported >= 0)
+                die("cadence: frame %u reported again", i);
+
+            reported = i;
+        }
+    }
+
+    *pts_us = start_us + frame_pts_us(count, num, den);
+    return reported;
+}
+
+static void
+check_cadence_pattern(int64_t frame_period_ns, int64_t vsync_period_ns,
+                      const uint32_t *pattern, size_t pattern_len) {
+    RuCadence c;
+    ru_cadence_reset(&c, frame_period_ns, vsync_period_ns);
+
+    for (size_t i = 0; i < 1000; ++i) {
+        uint32_t n = ru_cadence_next(&c);
+        if (n != pattern[i % pattern_len])
+            die("cadence: frame %zu of %" PRId64 " ns on %" PRId64 " ns vsyncs "
+                "took %u vsyncs", i, frame_period_ns, vsync_period_ns, n);
+    }
+}
+
+static void
+check_cadence(void) {
+    static const struct {
+        int64_t num;
+        int64_t den;
+    } rates[] = {
+        { 24000, 1001 },
+        { 30000, 1001 },
+    };
+
+    RuFrameRate fr;
+    int64_t pts_us;
+
+    // The first interval sets the period, and the next 16 must agree.
+    for (size_t i = 0; i < ARRAY_LEN(rates); ++i) {
+        ru_frame_rate_reset(&fr);
+        pts_us = 0;
+
+        int reported = observe_frames(&fr, &pts_us, rates[i].num, rates[i].den, 64);
+        if (reported != 17 || fr.hz != (float) ((double) rates[i].num / rates[i].den))
+            die("cadence: frame %d reported %.4f Hz", reported, fr.hz);
+    }
+
+    // After a gap forwards or backwards, the intervals start over.
+    static const int64_t gaps_us[] = { INT64_C(1000000), -INT64_C(1000000) };
+
+    for (size_t i = 0; i < ARRAY_LEN(gaps_us); ++i) {
+        ru_frame_rate_reset(&fr);
+        pts_us = 10 * INT64_C(1000000);
+
+        if (observe_frames(&fr, &pts_us, 30000, 1001, 10) >= 0)
+            die("cadence: reported after 10 frames");
+
+        pts_us += gaps_us[i];
+        if (ru_frame_rate_observe(&fr, pts_us * RU_NSEC_PER_USEC) ||
+            fr.period_ns || fr.steady_count) {
+            die("cadence: gap of %" PRId64 " us counted as a frame", gaps_us[i]);
+        }
+
+        pts_us += frame_pts_us(1, 30000, 1001);
+        int reported = observe_frames(&fr, &pts_us, 30000, 1001, 64);
+        if (reported != 16)
+            die("cadence: frame %d after a gap reported %.4f Hz", reported, fr.hz);
+    }
+
+    static const uint32_t pulldown[] = { 2, 3 };
+    static const uint32_t twice[] = { 2 };
+    static const uint32_t once[] = { 1 };
+
+    check_cadence_pattern(RU_NSEC_PER_SEC / 24, RU_NSEC_PER_SEC / 60, pulldown, 2);
+    check_cadence_pattern(RU_NSEC_PER_SEC * 1001 / 24000,
+                          RU_NSEC_PER_SEC * 1001 / 60000, pulldown, 2);
+    check_cadence_pattern(RU_NSEC_PER_SEC / 30, RU_NSEC_PER_SEC / 60, twice, 1);
+    check_cadence_pattern(RU_NSEC_PER_SEC / 60, RU_NSEC_PER_SEC / 60, once, 1);
+    check_cadence_pattern(RU_NSEC_PER_SEC / 60, RU_NSEC_PER_SEC / 120, twice, 1);
+}
+
+typedef struct LatencyContext {
+    uint32_t frame_count;
+    RuLatencyFrame last;
+} LatencyContext;
+
+static void
+latency_on_frame(void *_ctx, const RuLatencyFrame *frame) {
+    LatencyContext *ctx = _ctx;
+    ctx->frame_count += 1;
+    ctx->last = *frame;
+}
+
+// Pass a frame through every stage, each stage `step_ns` after the previous,
+// from `ns`, and present it on the renderer's frame `rend_seq`.
+static void
+latency_run_frame(RuLatency *lat, uint32_t stream, int64_t pts_us, int64_t ns,
+                  int64_t step_ns, uint64_t rend_seq) {
+    ru_latency_stamp(lat, stream, pts_us, RU_LATENCY_STAGE_QUEUE, ns);
+    ru_latency_stamp(lat, stream, pts_us, RU_LATENCY_STAGE_DECODE, ns + step_ns);
+    ru_latency_stamp(lat, stream, pts_us, RU_LATENCY_STAGE_RELEASE, ns + 2 * step_ns);
+    ru_latency_on_acquire(lat, stream, pts_us, ns + 3 * step_ns, ns + 4 * step_ns,
+                          rend_seq);
+    ru_latency_on_submit(lat, rend_seq, ns + 5 * step_ns);
+    ru_latency_on_present(lat, rend_seq, ns + 6 * step_ns);
+}
+
+static void
+check_latency(void) {
+    const int64_t window_ns = RU_NSEC_PER_SEC;
+    LatencyContext ctx = { 0 };
+    RuLatencyStats stats;
+
+    RuLatency *lat = ru_latency_new(
+        .window_ns = window_ns,
+        .listener = {
+            .context = &ctx,
+            .on_frame = latency_on_frame,
+        },
+    );
+
+    // Each stage is matched to the one before it.
+    latency_run_frame(lat, 0, 1000, window_ns / 2, 10, 1);
+
+    if (ctx.frame_count != 1 || ctx.last.stream != 0 || ctx.last.pts_us != 1000)
+        die("latency: %u frames reported, expected 1", ctx.frame_count);
+
+    for (uint32_t i = 0; i < RU_LATENCY_STAGE_COUNT; ++i) {
+        if (ctx.last.stamps_ns[i] != window_ns / 2 + 10 * i)
+            die("latency: %s stamped wrong", ru_latency_stage_to_str(i));
+    }
+
+    ru_latency_get_stats(lat, &stats);
+
+    for (uint32_t i = 1; i < RU_LATENCY_STAGE_COUNT; ++i) {
+        if (stats.stages[i].count != 1 || stats.stages[i].p50_ns != 10)
+            die("latency: %s took %" PRId64 " ns, expected 10",
+                ru_latency_stage_to_str(i), stats.stages[i].p50_ns);
+    }
+
+    if (stats.total.count != 1 || stats.total.max_ns != 60 || stats.dropped_count)
+        die("latency: total of %" PRId64 " ns, expected 60", stats.total.max_ns);
+
+    // A frame that is never presented is not reported.
+    ru_latency_on_present(lat, 1, window_ns / 2 + 100);
+    if (ctx.frame_count != 1)
+        die("latency: frame reported twice");
+
+    // The renderer acquires the newest of three released frames. The older
+    // two count as dropped; the other stream's frame does not.
+    const int64_t ns = window_ns / 2 + 1000;
+
+    for (int64_t pts_us = 2000; pts_us <= 4000; pts_us += 1000) {
+        ru_latency_stamp(lat, 0, pts_us, RU_LATENCY_STAGE_QUEUE, ns + pts_us);
+        ru_latency_stamp(lat, 0, pts_us, RU_LATENCY_STAGE_RELEASE, ns + pts_us + 10);
+    }
+
+    ru_latency_stamp(lat, 1, 2000, RU_LATENCY_STAGE_QUEUE, ns);
+    ru_latency_stamp(lat, 1, 2000, RU_LATENCY_STAGE_RELEASE, ns + 10);
+
+    ru_latency_on_acquire(lat, 0, 4000, ns + 5000, ns + 5010, 2);
+    ru_latency_on_submit(lat, 2, ns + 5020);
+    ru_latency_on_present(lat, 2, ns + 5030);
+
+    ru_latency_get_stats(lat, &stats);
+    if (ctx.frame_count != 2 || ctx.last.pts_us != 4000 || stats.dropped_count != 2)
+        die("latency: %" PRIu64 " frames dropped, expected 2", stats.dropped_count);
+
+    // A QUEUE stamp of the same pts, such as on the next pass of a loop,
+    // replaces the stale frame rather than reporting it.
+    latency_run_frame(lat, 1, 2000, ns + 6000, 10, 3);
+    if (ctx.frame_count != 3 || ctx.last.stamps_ns[RU_LATENCY_STAGE_QUEUE] != ns + 6000)
+        die("latency: stale frame reported");
+
+    // The stats cover the current window and the previous one, and forget
+    // a window once two have passed.
+    latency_run_frame(lat, 0, 5000, window_ns + window_ns / 2, 10, 4);
+    ru_latency_get_stats(lat, &stats);
+    if (stats.total.count != 4)
+        die("latency: %" PRIu64 " frames after one rollover, expected 4",
+            stats.total.count);
+
+    latency_run_frame(lat, 0, 6000, 2 * window_ns + window_ns / 2 + 100, 10, 5);
+    ru_latency_get_stats(lat, &stats);
+    if (stats.total.count != 2)
+        die("latency: %" PRIu64 " frames after two rollovers, expected 2",
+            stats.total.count);
+
+    latency_run_frame(lat, 0, 7000, 6 * window_ns, 10, 6);
+    ru_latency_get_stats(lat, &stats);
+    if (stats.total.count != 1)
+        die("latency: %" PRIu64 " frames after a long pause, expected 1",
+            stats.total.count);
+
+    ru_latency_reset_stats(lat);
+    ru_latency_get_stats(lat, &stats);
+    if (stats.total.count || stats.dropped_count)
+        die("latency: reset kept %" PRIu64 " frames", stats.total.count);
+
+    ru_latency_free(lat);
+}
+
+static noreturn void
+usage(void) {
+    fprintf(stderr, "usage: ru-util-bench [-n ITEMS] [-i ITERATIONS]\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:")) != -1) {
+        switch (opt) {
+            case 'n':
+                item_count = strtoull(optarg, NULL, 0);
+                if (item_count == 0 || item_count >= (UINT64_C(1) << 48))
+                    usage();
+                break;
+            case 'i':
+                wake_iterations = strtoul(optarg, NULL, 0);
+                if (wake_iterations == 0)
+                    usage();
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (optind != argc)
+        usage();
+
+    FILE *f = stdout;
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"queue_grow_cases\": %zu,\n", stress_queue_grow());
+    bench_queue(f);
+    bench_queue_grow(f);
+    bench_chan_throughput(f);
+    bench_spsc_throughput(f);
+    bench_chan_wake(f);
+    bench_pool(f);
+    check_thread_policy(f);
+    check_hist();
+    check_cadence();
+    check_latency();
+    fprintf(f, "  \"ok\": true\n");
+    fprintf(f, "}\n");
+
+    return 0;
+}